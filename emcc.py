@@ -413,7 +413,7 @@ def apply_settings(changes):
       exit_with_error('%s is an internal setting and cannot be set from command line', key)
 
     # In those settings fields that represent amount of memory, translate suffixes to multiples of 1024.
-    if key in ('TOTAL_STACK', 'TOTAL_MEMORY', 'MEMORY_GROWTH_STEP', 'GL_MAX_TEMP_BUFFER_SIZE',
+    if key in ('TOTAL_STACK', 'TOTAL_MEMORY', 'MEMORY_GROWTH_STEP', 'MEMORY_GROWTH_GEOMETRIC_CAP', 'GL_MAX_TEMP_BUFFER_SIZE',
                'WASM_MEM_MAX', 'DEFAULT_PTHREAD_STACK_SIZE'):
       value = str(shared.expand_byte_size_suffixes(value))
 
@@ -1503,6 +1503,10 @@ There is NO warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR P
       exit_with_error('WASM_MEM_MAX must be a multiple of 64KB, was ' + str(shared.Settings.WASM_MEM_MAX))
     if shared.Settings.MEMORY_GROWTH_STEP != -1 and shared.Settings.MEMORY_GROWTH_STEP % 65536 != 0:
       exit_with_error('MEMORY_GROWTH_STEP must be a multiple of 64KB, was ' + str(shared.Settings.MEMORY_GROWTH_STEP))
+    if shared.Settings.MEMORY_GROWTH_GEOMETRIC_PERCENT <= 0:
+      exit_with_error('MEMORY_GROWTH_GEOMETRIC_PERCENT must be positive, was ' + str(shared.Settings.MEMORY_GROWTH_GEOMETRIC_PERCENT))
+    if shared.Settings.MEMORY_GROWTH_GEOMETRIC_CAP % 65536 != 0:
+      exit_with_error('MEMORY_GROWTH_GEOMETRIC_CAP must be a multiple of 64KB, was ' + str(shared.Settings.MEMORY_GROWTH_GEOMETRIC_CAP))
     if shared.Settings.USE_PTHREADS and shared.Settings.WASM and shared.Settings.ALLOW_MEMORY_GROWTH and shared.Settings.WASM_MEM_MAX == -1:
       exit_with_error('If pthreads and memory growth are enabled, WASM_MEM_MAX must be set')
 
@@ -1864,6 +1868,8 @@ There is NO warranty; not even for MERCHANTABILITY or FITNESS FOR A PARTICULAR P
     if shared.Settings.WASM_BACKEND:
       if shared.Settings.SIMD:
         newargs.append('-msimd128')
+      if shared.Settings.BULK_MEMORY:
+        newargs.append('-mbulk-memory')
       if shared.Settings.USE_PTHREADS:
         newargs.append('-pthread')
     else:
@@ -2862,6 +2868,11 @@ def parse_args(newargs):
       settings_changes.append('SIMD=1')
     elif newargs[i] == '-mno-simd128':
       settings_changes.append('SIMD=0')
+    # Record BULK_MEMORY setting because it selects the system library variants
+    elif newargs[i] == '-mbulk-memory':
+      settings_changes.append('BULK_MEMORY=1')
+    elif newargs[i] == '-mno-bulk-memory':
+      settings_changes.append('BULK_MEMORY=0')
     # Record USE_PTHREADS setting because it controls whether --shared-memory is passed to lld
     elif newargs[i] == '-pthread':
       settings_changes.append('USE_PTHREADS=1')
@@ -6,6 +6,10 @@
 var Fetch = {
   xhrs: [],
 
+  // The functions that resume the streaming fetches that are paused on a full streamBuffer, by fetch id, so that
+  // emscripten_fetch_read() can resume them as soon as it has made room.
+  pausedStreams: {},
+
   // The web worker that runs proxied file I/O requests. (this field is populated on demand, start as undefined to save code size)
   // worker: undefined,
 
@@ -13,11 +17,51 @@ var Fetch = {
   // as a preload step before the Emscripten application starts. (this field is populated on demand, start as undefined to save code size)
   // dbInstance: undefined,
 
+  // Specifies a cache backend that is used for EMSCRIPTEN_FETCH_PERSIST_FILE instead of IndexedDB, either one given in
+  // Module['fetchCacheBackend'], or Fetch.nodeDiskCache when running in node.js with -s FETCH_DISK_CACHE=1. A backend
+  // is an object with the functions load(fetch, onsuccess, onerror), store(fetch, data, onsuccess, onerror, xhr) and
+  // delete(fetch, onsuccess, onerror), which behave like the IndexedDB functions __emscripten_fetch_load_cached_data(),
+  // __emscripten_fetch_cache_data() and __emscripten_fetch_delete_cached_data() below, and optionally
+  // validators(fetch), which returns the HTTP request headers to revalidate a cached response with, or null to use the
+  // cached response as is. (this field is populated on demand, start as undefined to save code size)
+  // cacheBackend: undefined,
+
   setu64: function(addr, val) {
     HEAPU32[addr >> 2] = val;
     HEAPU32[addr + 4 >> 2] = (val / 4294967296)|0;
   },
 
+  // Calls the fetch() API, which the functions below can not do directly since their emscripten_fetch_t parameters are
+  // called 'fetch'.
+  request: function(url, init) {
+    return fetch(url, init);
+  },
+
+  // Copies as much of the given chunk of bytes from the position pos on as fits in the streamBuffer of the given fetch,
+  // and returns the number of bytes copied.
+  writeStream: function(fetch, chunk, pos) {
+    var fetch_attr = fetch + {{{ C_STRUCTS.emscripten_fetch_t.__attributes }}};
+    var ring = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.streamBuffer }}} >> 2];
+    var ringSize = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.streamBufferSize }}} >> 2];
+    var writePos = HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.__streamWritePos }}} >> 2];
+    var readPos = Atomics.load(HEAPU32, fetch + {{{ C_STRUCTS.emscripten_fetch_t.__streamReadPos }}} >> 2);
+    var n = Math.min(ringSize - ((writePos - readPos) >>> 0), chunk.length - pos);
+    var offset = writePos & (ringSize - 1);
+    var first = Math.min(n, ringSize - offset);
+    HEAPU8.set(chunk.subarray(pos, pos + first), ring + offset);
+    HEAPU8.set(chunk.subarray(pos + first, pos + n), ring);
+    Atomics.store(HEAPU32, fetch + {{{ C_STRUCTS.emscripten_fetch_t.__streamWritePos }}} >> 2, (writePos + n) >>> 0);
+    return n;
+  },
+
+  // Wakes up a thread that waits for the given fetch in emscripten_fetch_read().
+  signalStream: function(fetch) {
+    Atomics.add(HEAPU32, fetch + {{{ C_STRUCTS.emscripten_fetch_t.__streamSignal }}} >> 2, 1);
+#if USE_PTHREADS
+    Atomics.notify(HEAP32, fetch + {{{ C_STRUCTS.emscripten_fetch_t.__streamSignal }}} >> 2);
+#endif
+  },
+
 #if FETCH_SUPPORT_INDEXEDDB
   openDatabase: function(dbname, dbversion, onsuccess, onerror) {
     try {
@@ -42,6 +86,231 @@ var Fetch = {
   },
 #endif
 
+#if FETCH_SUPPORT_INDEXEDDB && FETCH_DISK_CACHE
+  // Caches responses in node.js on disk, in the directory Module['fetchDiskCacheDir'] (by default a directory under
+  // emscripten_fetch_cache/ in the temp directory that is named after the path of the application, so that different
+  // applications do not see each other's entries). The response bodies are stored in files named by the SHA-256 of
+  // their contents under blobs/, so that the same asset fetched from several URLs is only stored once, and each cached
+  // URL and destination path pair has a small JSON file under entries/, named by the SHA-256 of the pair, that points
+  // to its blob and records the ETag and Last-Modified headers of the response. Cached responses that have either of
+  // these are revalidated with a conditional request, so the body is only downloaded again if it changed, and the
+  // cached response is used as is if the server can not be reached. When the blobs take more than
+  // Module['fetchDiskCacheMaxBytes'] (by default FETCH_DISK_CACHE_MAX_BYTES), the least recently used entries are
+  // evicted. Files are written under a temporary name and then renamed, so several processes can share the cache.
+  nodeDiskCache: {
+    dir: null,
+
+    init: function() {
+      if (!nodeFS) nodeFS = require('fs');
+      if (!nodePath) nodePath = require('path');
+      var dir = Module['fetchDiskCacheDir'];
+      if (!dir) {
+        var app = nodePath['resolve'](typeof __filename !== 'undefined' ? __filename : thisProgram);
+        dir = nodePath['join'](require('os')['tmpdir'](), 'emscripten_fetch_cache', Fetch.nodeDiskCache.hash(app).substr(0, 16));
+      }
+      try {
+        nodeFS['mkdirSync'](dir, { recursive: true });
+        nodeFS['mkdirSync'](nodePath['join'](dir, 'blobs'), { recursive: true });
+        nodeFS['mkdirSync'](nodePath['join'](dir, 'entries'), { recursive: true });
+      } catch(e) {
+#if FETCH_DEBUG
+        console.error('fetch: Failed to create disk cache directory ' + dir + '! Got exception ' + e);
+#endif
+        return false;
+      }
+      Fetch.nodeDiskCache.dir = dir;
+      return true;
+    },
+
+    hash: function(data) {
+      return require('crypto')['createHash']('sha256')['update'](data)['digest']('hex');
+    },
+
+    // Returns the key that the response of the given fetch is cached under: its URL and destination path, since the
+    // same path can be downloaded from different URLs, and the same URL to different paths.
+    keyOf: function(fetch) {
+      var fetch_attr = fetch + {{{ C_STRUCTS.emscripten_fetch_t.__attributes }}};
+      var url = HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.url }}} >> 2];
+      var path = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.destinationPath }}} >> 2];
+      return (url ? UTF8ToString(url) : '') + '\n' + (path ? UTF8ToString(path) : '');
+    },
+
+    entryFile: function(key) {
+      return nodePath['join'](Fetch.nodeDiskCache.dir, 'entries', Fetch.nodeDiskCache.hash(key) + '.json');
+    },
+
+    blobFile: function(blob) {
+      return nodePath['join'](Fetch.nodeDiskCache.dir, 'blobs', blob);
+    },
+
+    writeAtomically: function(file, data) {
+      var temp = file + '.' + process['pid'] + '.tmp';
+      nodeFS['writeFileSync'](temp, data);
+      nodeFS['renameSync'](temp, file);
+    },
+
+    readEntry: function(key) {
+      try {
+        var entry = JSON.parse(nodeFS['readFileSync'](Fetch.nodeDiskCache.entryFile(key), 'utf8'));
+        return entry['key'] === key ? entry : null;
+      } catch(e) {
+        return null;
+      }
+    },
+
+    validators: function(fetch) {
+      var entry = Fetch.nodeDiskCache.readEntry(Fetch.nodeDiskCache.keyOf(fetch));
+      if (!entry || !(entry['etag'] || entry['lastModified'])) return null;
+      var headers = {};
+      if (entry['etag']) headers['If-None-Match'] = entry['etag'];
+      if (entry['lastModified']) headers['If-Modified-Since'] = entry['lastModified'];
+      return headers;
+    },
+
+    load: function(fetch, onsuccess, onerror) {
+      var key = Fetch.nodeDiskCache.keyOf(fetch);
+      var entry = Fetch.nodeDiskCache.readEntry(key);
+      try {
+        var value = entry && nodeFS['readFileSync'](Fetch.nodeDiskCache.blobFile(entry['blob']));
+      } catch(e) {
+        value = null; // the blob was evicted by another process
+      }
+      if (!value) {
+#if FETCH_DEBUG
+        console.error('fetch: File ' + JSON.stringify(key) + ' not found in disk cache');
+#endif
+        HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = 4; // Mimic XHR readyState 4 === 'DONE: The operation is complete'
+        HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1] = 404; // Mimic XHR HTTP status code 404 "Not Found"
+        stringToUTF8("Not Found", fetch + {{{ C_STRUCTS.emscripten_fetch_t.statusText }}}, 64);
+        onerror(fetch, 0, 'no data');
+        return;
+      }
+      // Touch the entry, so that the eviction of least recently used entries sees that it is in use.
+      try {
+        var now = new Date();
+        nodeFS['utimesSync'](Fetch.nodeDiskCache.entryFile(key), now, now);
+      } catch(e) {}
+      var len = value.length;
+#if FETCH_DEBUG
+      console.log('fetch: Loaded file ' + JSON.stringify(key) + ' from disk cache, length: ' + len);
+#endif
+      // The data pointer malloc()ed here has the same lifetime as the emscripten_fetch_t structure itself has, and is
+      // freed when emscripten_fetch_close() is called.
+      var ptr = _malloc(len);
+      HEAPU8.set(value, ptr);
+      HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.data }}} >> 2] = ptr;
+      Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.numBytes }}}, len);
+      Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.dataOffset }}}, 0);
+      Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.totalBytes }}}, len);
+      HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = 4; // Mimic XHR readyState 4 === 'DONE: The operation is complete'
+      HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1] = 200; // Mimic XHR HTTP status code 200 "OK"
+      stringToUTF8("OK", fetch + {{{ C_STRUCTS.emscripten_fetch_t.statusText }}}, 64);
+      onsuccess(fetch, 0, value);
+    },
+
+    store: function(fetch, data, onsuccess, onerror, xhr) {
+      var key = Fetch.nodeDiskCache.keyOf(fetch);
+      try {
+        var bytes = new Uint8Array(data.buffer || data, data.byteOffset || 0, data.byteLength);
+        var blob = Fetch.nodeDiskCache.hash(bytes);
+        var blobFile = Fetch.nodeDiskCache.blobFile(blob);
+        if (!nodeFS['existsSync'](blobFile)) Fetch.nodeDiskCache.writeAtomically(blobFile, bytes);
+        var entry = { 'key': key, 'blob': blob, 'size': bytes.length };
+        if (xhr) {
+          var etag = xhr.getResponseHeader('ETag');
+          var lastModified = xhr.getResponseHeader('Last-Modified');
+          if (etag) entry['etag'] = etag;
+          if (lastModified) entry['lastModified'] = lastModified;
+        }
+        Fetch.nodeDiskCache.writeAtomically(Fetch.nodeDiskCache.entryFile(key), JSON.stringify(entry));
+        Fetch.nodeDiskCache.evict(blob);
+      } catch(e) {
+#if FETCH_DEBUG
+        console.error('fetch: Failed to store file ' + JSON.stringify(key) + ' to disk cache! Exception: ' + e);
+#endif
+        HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = 4; // Mimic XHR readyState 4 === 'DONE: The operation is complete'
+        HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1] = 413; // Mimic XHR HTTP status code 413 "Payload Too Large"
+        stringToUTF8("Payload Too Large", fetch + {{{ C_STRUCTS.emscripten_fetch_t.statusText }}}, 64);
+        onerror(fetch, 0, e);
+        return;
+      }
+#if FETCH_DEBUG
+      console.log('fetch: Stored file ' + JSON.stringify(key) + ' to disk cache.');
+#endif
+      HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = 4; // Mimic XHR readyState 4 === 'DONE: The operation is complete'
+      HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1] = 200; // Mimic XHR HTTP status code 200 "OK"
+      stringToUTF8("OK", fetch + {{{ C_STRUCTS.emscripten_fetch_t.statusText }}}, 64);
+      onsuccess(fetch, 0, key);
+    },
+
+    'delete': function(fetch, onsuccess, onerror) {
+      var key = Fetch.nodeDiskCache.keyOf(fetch);
+      try {
+        nodeFS['unlinkSync'](Fetch.nodeDiskCache.entryFile(key));
+      } catch(e) {
+#if FETCH_DEBUG
+        console.error('fetch: Failed to delete file ' + JSON.stringify(key) + ' from disk cache! error: ' + e);
+#endif
+        HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = 4; // Mimic XHR readyState 4 === 'DONE: The operation is complete'
+        HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1] = 404; // Mimic XHR HTTP status code 404 "Not Found"
+        stringToUTF8("Not Found", fetch + {{{ C_STRUCTS.emscripten_fetch_t.statusText }}}, 64);
+        onerror(fetch, 0, e);
+        return;
+      }
+      // The blob may still be referenced by other entries, so it is left for the next eviction to remove.
+#if FETCH_DEBUG
+      console.log('fetch: Deleted file ' + JSON.stringify(key) + ' from disk cache');
+#endif
+      HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.data }}} >> 2] = 0;
+      Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.numBytes }}}, 0);
+      Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.dataOffset }}}, 0);
+      Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.totalBytes }}}, 0);
+      HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = 4; // Mimic XHR readyState 4 === 'DONE: The operation is complete'
+      HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1] = 200; // Mimic XHR HTTP status code 200 "OK"
+      stringToUTF8("OK", fetch + {{{ C_STRUCTS.emscripten_fetch_t.statusText }}}, 64);
+      onsuccess(fetch, 0, key);
+    },
+
+    // Removes the least recently used entries until the blobs they refer to fit in the size limit, and then removes
+    // the blobs that no entry refers to anymore. The blob that was just stored is kept even if it alone is larger than
+    // the limit.
+    evict: function(keepBlob) {
+      var maxBytes = Module['fetchDiskCacheMaxBytes'] || {{{ FETCH_DISK_CACHE_MAX_BYTES }}};
+      var entriesDir = nodePath['join'](Fetch.nodeDiskCache.dir, 'entries');
+      var entries = [];
+      nodeFS['readdirSync'](entriesDir).forEach(function(name) {
+        if (!/\.json$/.test(name)) return;
+        var file = nodePath['join'](entriesDir, name);
+        try {
+          var entry = JSON.parse(nodeFS['readFileSync'](file, 'utf8'));
+          entry.file = file;
+          entry.atime = nodeFS['statSync'](file)['mtimeMs'];
+          entries.push(entry);
+        } catch(e) {} // removed or being replaced by another process
+      });
+      // Newest first: the blobs that are kept are the ones that the most recently used entries refer to.
+      entries.sort(function(a, b) { return b.atime - a.atime; });
+      var referenced = {};
+      var totalBytes = 0;
+      entries.forEach(function(entry) {
+        var blob = entry['blob'];
+        if (!referenced[blob] && blob !== keepBlob && totalBytes + entry['size'] > maxBytes) {
+          try { nodeFS['unlinkSync'](entry.file); } catch(e) {}
+          return;
+        }
+        if (!referenced[blob]) totalBytes += entry['size'];
+        referenced[blob] = true;
+      });
+      var blobsDir = nodePath['join'](Fetch.nodeDiskCache.dir, 'blobs');
+      nodeFS['readdirSync'](blobsDir).forEach(function(name) {
+        if (!referenced[name] && name !== keepBlob && !/\.tmp$/.test(name)) {
+          try { nodeFS['unlinkSync'](nodePath['join'](blobsDir, name)); } catch(e) {}
+        }
+      });
+    },
+  },
+#endif
+
 #if USE_FETCH_WORKER
   initFetchWorker: function() {
     var stackSize = 128*1024;
@@ -58,6 +327,16 @@ var Fetch = {
 #endif
 
 #if FETCH_SUPPORT_INDEXEDDB
+    // The fetch worker has no Module object, and always runs in a browser.
+    if (typeof Module !== 'undefined' && Module['fetchCacheBackend']) {
+      Fetch.cacheBackend = Module['fetchCacheBackend'];
+    }
+#if FETCH_DISK_CACHE
+    else if (typeof ENVIRONMENT_IS_NODE !== 'undefined' && ENVIRONMENT_IS_NODE && Fetch.nodeDiskCache.init()) {
+      Fetch.cacheBackend = Fetch.nodeDiskCache;
+    }
+#endif
+
     var onsuccess = function(db) {
 #if FETCH_DEBUG
       console.log('fetch: IndexedDB successfully opened.');
@@ -84,7 +363,10 @@ var Fetch = {
         removeRunDependency('library_fetch_init');
       }
     };
-    Fetch.openDatabase('emscripten_filesystem', 1, onsuccess, onerror);
+    // With another cache backend, IndexedDB is not used. Finish asynchronously all the same, since the run dependency
+    // is only added below.
+    if (Fetch.cacheBackend) setTimeout(function() { onsuccess(false); }, 0);
+    else Fetch.openDatabase('emscripten_filesystem', 1, onsuccess, onerror);
 #endif // ~FETCH_SUPPORT_INDEXEDDB
 
 #if USE_FETCH_WORKER
@@ -115,6 +397,10 @@ var Fetch = {
 
 #if FETCH_SUPPORT_INDEXEDDB
 function __emscripten_fetch_delete_cached_data(db, fetch, onsuccess, onerror) {
+  if (Fetch.cacheBackend) {
+    Fetch.cacheBackend['delete'](fetch, onsuccess, onerror);
+    return;
+  }
   if (!db) {
 #if FETCH_DEBUG
     console.error('fetch: IndexedDB not available!');
@@ -164,6 +450,10 @@ function __emscripten_fetch_delete_cached_data(db, fetch, onsuccess, onerror) {
 }
 
 function __emscripten_fetch_load_cached_data(db, fetch, onsuccess, onerror) {
+  if (Fetch.cacheBackend) {
+    Fetch.cacheBackend['load'](fetch, onsuccess, onerror);
+    return;
+  }
   if (!db) {
 #if FETCH_DEBUG
     console.error('fetch: IndexedDB not available!');
@@ -228,7 +518,11 @@ function __emscripten_fetch_load_cached_data(db, fetch, onsuccess, onerror) {
   }
 }
 
-function __emscripten_fetch_cache_data(db, fetch, data, onsuccess, onerror) {
+function __emscripten_fetch_cache_data(db, fetch, data, onsuccess, onerror, xhr) {
+  if (Fetch.cacheBackend) {
+    Fetch.cacheBackend['store'](fetch, data, onsuccess, onerror, xhr);
+    return;
+  }
   if (!db) {
 #if FETCH_DEBUG
     console.error('fetch: IndexedDB not available!');
@@ -276,7 +570,9 @@ function __emscripten_fetch_cache_data(db, fetch, data, onsuccess, onerror) {
 }
 #endif // ~FETCH_SUPPORT_INDEXEDDB
 
-function __emscripten_fetch_xhr(fetch, onsuccess, onerror, onprogress, onreadystatechange) {
+// If given, extraHeaders is an object of request headers to send in addition to the ones specified in the fetch
+// attributes.
+function __emscripten_fetch_xhr(fetch, onsuccess, onerror, onprogress, onreadystatechange, extraHeaders) {
   var url = HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.url }}} >> 2];
   if (!url) {
 #if FETCH_DEBUG
@@ -349,6 +645,14 @@ function __emscripten_fetch_xhr(fetch, onsuccess, onerror, onprogress, onreadyst
       xhr.setRequestHeader(keyStr, valueStr);
     }
   }
+  if (extraHeaders) {
+    for (var key in extraHeaders) {
+#if FETCH_DEBUG
+      console.log('fetch: xhr.setRequestHeader("' + key + '", "' + extraHeaders[key] + '");');
+#endif
+      xhr.setRequestHeader(key, extraHeaders[key]);
+    }
+  }
   Fetch.xhrs.push(xhr);
   var id = Fetch.xhrs.length;
   HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.id }}} >> 2] = id;
@@ -459,6 +763,206 @@ function __emscripten_fetch_xhr(fetch, onsuccess, onerror, onprogress, onreadyst
   }
 }
 
+// Performs a fetch with EMSCRIPTEN_FETCH_STREAM_DATA, using the streams of the fetch() API to get at the bytes of the
+// response body as they arrive. The bytes are either written to the streamBuffer, pausing the download while it is
+// full, or passed to onprogress one chunk at a time in a heap buffer that is reused for all the chunks, instead of
+// being copied to a new allocation for each chunk.
+function __emscripten_fetch_stream(fetch, onsuccess, onerror, onprogress, onreadystatechange) {
+  var url = HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.url }}} >> 2];
+  if (!url) {
+#if FETCH_DEBUG
+    console.error('fetch: stream failed, no URL specified!');
+#endif
+    onerror(fetch, 0, 'no url specified!');
+    return;
+  }
+  var url_ = UTF8ToString(url);
+
+  var fetch_attr = fetch + {{{ C_STRUCTS.emscripten_fetch_t.__attributes }}};
+  var requestMethod = UTF8ToString(fetch_attr);
+  if (!requestMethod) requestMethod = 'GET';
+  var timeoutMsecs = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.timeoutMSecs }}} >> 2];
+  var withCredentials = !!HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.withCredentials }}} >> 2];
+  var userName = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.userName }}} >> 2];
+  var password = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.password }}} >> 2];
+  var requestHeaders = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.requestHeaders }}} >> 2];
+  var dataPtr = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.requestData }}} >> 2];
+  var dataLength = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.requestDataSize }}} >> 2];
+  var streamBuffer = HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.streamBuffer }}} >> 2];
+
+  var headers = {};
+  if (userName) headers['Authorization'] = 'Basic ' + btoa(UTF8ToString(userName) + ':' + (password ? UTF8ToString(password) : ''));
+  if (requestHeaders) {
+    for(;;) {
+      var key = HEAPU32[requestHeaders >> 2];
+      if (!key) break;
+      var value = HEAPU32[requestHeaders + 4 >> 2];
+      if (!value) break;
+      requestHeaders += 8;
+      headers[UTF8ToString(key)] = UTF8ToString(value);
+    }
+  }
+  var init = {
+    'method': requestMethod,
+    'headers': headers,
+    'credentials': withCredentials ? 'include' : 'same-origin',
+    'body': (dataPtr && dataLength) ? HEAPU8.slice(dataPtr, dataPtr + dataLength) : null
+  };
+  var abortController = (typeof AbortController !== 'undefined') ? new AbortController() : null;
+  if (abortController) init['signal'] = abortController.signal;
+
+  // Stands in for the XHR in Fetch.xhrs, for emscripten_fetch_get_response_headers(). emscripten_fetch_close() removes
+  // it from there, which is how a closed fetch is noticed, and the download cancelled.
+  var responseHeaders = '';
+  var request = { getAllResponseHeaders: function() { return responseHeaders; } };
+  Fetch.xhrs.push(request);
+  var id = Fetch.xhrs.length;
+  HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.id }}} >> 2] = id;
+  var closed = function() { return Fetch.xhrs[id-1] !== request; };
+
+  var reader = null;
+  var cancel = function() {
+    if (reader) reader.cancel().catch(function() {});
+    reader = null;
+  };
+  var chunkPtr = 0, chunkPtrLen = 0; // The heap buffer for passing chunks to onprogress, when not using a streamBuffer.
+  var loaded = 0;
+  var timeout = 0;
+  var pauseTimer = 0, pauseMsecs = 1;
+  var finished = false;
+  var finish = function(status, statusText, succeeded, e) {
+    if (finished) return;
+    finished = true;
+    if (timeout) clearTimeout(timeout);
+    if (pauseTimer) clearTimeout(pauseTimer);
+    if (Fetch.pausedStreams[id] === resume) delete Fetch.pausedStreams[id];
+    if (chunkPtr) _free(chunkPtr);
+    if (closed()) return;
+    // The data was streamed, no bytes are available here.
+    HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.data }}} >> 2] = 0;
+    Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.numBytes }}}, 0);
+    Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.dataOffset }}}, loaded);
+    if (succeeded) Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.totalBytes }}}, loaded);
+    HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1] = status;
+    if (statusText) stringToUTF8(statusText, fetch + {{{ C_STRUCTS.emscripten_fetch_t.statusText }}}, 64);
+    Atomics.store(HEAPU16, fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1, 4); // DONE, after the last bytes
+    if (streamBuffer) Fetch.signalStream(fetch);
+    if (succeeded) onsuccess(fetch, request, e);
+    else onerror(fetch, request, e);
+  };
+  var fail = function(e) {
+#if FETCH_DEBUG
+    console.error('fetch: stream of URL "' + url_ + '" failed: ' + e);
+#endif
+    cancel();
+    var status = HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1];
+    finish((status >= 200 && status < 300) ? 0 : status, null, false, e); // A failure while downloading the body
+  };
+  if (timeoutMsecs) {
+    timeout = setTimeout(function() {
+      timeout = 0;
+      if (abortController) abortController.abort();
+      fail('timed out');
+    }, timeoutMsecs);
+  }
+
+  // Continues a download that was paused on a full streamBuffer, either when emscripten_fetch_read() has made room in
+  // this thread, or when the timer that polls for a reader in another thread fires.
+  var resume = function() {
+    if (!pauseTimer) return; // Already resumed.
+    clearTimeout(pauseTimer);
+    pauseTimer = 0;
+    if (Fetch.pausedStreams[id] === resume) delete Fetch.pausedStreams[id];
+    pump();
+  };
+
+  // Moves the bytes of the current chunk on, and reads the next chunk when they have all been taken.
+  var chunk = null, chunkPos = 0;
+  var pump = function() {
+    if (finished) return;
+    if (closed()) {
+      cancel();
+      finish(0, null, false, null); // Only frees the chunk buffer.
+      return;
+    }
+    if (chunk) {
+      if (streamBuffer) {
+        var n = Fetch.writeStream(fetch, chunk, chunkPos);
+        if (n) {
+          pauseMsecs = 1;
+          chunkPos += n;
+          loaded += n;
+          Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.dataOffset }}}, loaded);
+          Fetch.signalStream(fetch);
+          onprogress(fetch, request, null);
+          if (closed()) return pump();
+        }
+        if (chunkPos < chunk.length) {
+          // The buffer is full: the download stays paused until the reader makes room for more. A reader in this
+          // thread resumes it through Fetch.pausedStreams. One in another thread can't, so poll for it too, backing
+          // off while the buffer stays full.
+          pauseTimer = setTimeout(resume, pauseMsecs);
+          pauseMsecs = Math.min(pauseMsecs * 2, 64);
+          Fetch.pausedStreams[id] = resume;
+          return;
+        }
+      } else {
+        if (chunk.length > chunkPtrLen) {
+          _free(chunkPtr);
+          chunkPtrLen = chunk.length;
+          chunkPtr = _malloc(chunkPtrLen);
+        }
+        HEAPU8.set(chunk, chunkPtr);
+        HEAPU32[fetch + {{{ C_STRUCTS.emscripten_fetch_t.data }}} >> 2] = chunkPtr;
+        Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.numBytes }}}, chunk.length);
+        Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.dataOffset }}}, loaded);
+        loaded += chunk.length;
+        onprogress(fetch, request, null);
+        if (closed()) return pump();
+      }
+      chunk = null;
+    }
+    reader.read().then(function(result) {
+      if (result.done) {
+        finish(HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1], null, true, null);
+        return;
+      }
+      chunk = result.value;
+      chunkPos = 0;
+      pump();
+    }, fail);
+  };
+
+  HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = 1; // OPENED
+#if FETCH_DEBUG
+  console.log('fetch: fetch(url="' + url_ + '", method="' + requestMethod + '"), streaming ' + (streamBuffer ? 'to a ring buffer' : 'to onprogress'));
+#endif
+  Fetch.request(url_, init).then(function(response) {
+    if (closed()) {
+      if (response.body) response.body.cancel().catch(function() {});
+      return;
+    }
+    response.headers.forEach(function(value, key) { responseHeaders += key + ': ' + value + '\r\n'; });
+    var length = response.headers.get('Content-Length');
+    if (length) Fetch.setu64(fetch + {{{ C_STRUCTS.emscripten_fetch_t.totalBytes }}}, +length);
+    HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.status }}} >> 1] = response.status;
+    stringToUTF8(response.statusText, fetch + {{{ C_STRUCTS.emscripten_fetch_t.statusText }}}, 64);
+    HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = 2; // HEADERS_RECEIVED
+    onreadystatechange(fetch, request, null);
+    if (closed()) return;
+    if (!response.ok || !response.body) {
+      if (response.body) response.body.cancel().catch(function() {});
+      finish(response.status, response.statusText, response.ok, 'status ' + response.status);
+      return;
+    }
+    HEAPU16[fetch + {{{ C_STRUCTS.emscripten_fetch_t.readyState }}} >> 1] = 3; // LOADING
+    onreadystatechange(fetch, request, null);
+    if (closed()) return;
+    reader = response.body.getReader();
+    pump();
+  }, fail);
+}
+
 function emscripten_start_fetch(fetch, successcb, errorcb, progresscb, readystatechangecb) {
   if (typeof noExitRuntime !== 'undefined') noExitRuntime = true; // If we are the main Emscripten runtime, we should not be closing down.
 
@@ -474,6 +978,7 @@ function emscripten_start_fetch(fetch, successcb, errorcb, progresscb, readystat
 #if FETCH_SUPPORT_INDEXEDDB
   var fetchAttrPersistFile = !!(fetchAttributes & {{{ cDefine('EMSCRIPTEN_FETCH_PERSIST_FILE') }}});
   var fetchAttrNoDownload = !!(fetchAttributes & {{{ cDefine('EMSCRIPTEN_FETCH_NO_DOWNLOAD') }}});
+  var validators;
 #endif
   var fetchAttrAppend = !!(fetchAttributes & {{{ cDefine('EMSCRIPTEN_FETCH_APPEND') }}});
   var fetchAttrReplace = !!(fetchAttributes & {{{ cDefine('EMSCRIPTEN_FETCH_REPLACE') }}});
@@ -507,6 +1012,11 @@ function emscripten_start_fetch(fetch, successcb, errorcb, progresscb, readystat
     else if (readystatechangecb) readystatechangecb(fetch);
   };
 
+  if (fetchAttrStreamData) {
+    __emscripten_fetch_stream(fetch, reportSuccess, reportError, reportProgress, reportReadyStateChange);
+    return fetch;
+  }
+
   var performUncachedXhr = function(fetch, xhr, e) {
 #if FETCH_DEBUG
     console.error('fetch: starting (uncached) XHR: ' + e);
@@ -533,7 +1043,7 @@ function emscripten_start_fetch(fetch, successcb, errorcb, progresscb, readystat
       if (onsuccess) {{{ makeDynCall('vi') }}}(onsuccess, fetch);
       else if (successcb) successcb(fetch);
     };
-    __emscripten_fetch_cache_data(Fetch.dbInstance, fetch, xhr.response, storeSuccess, storeError);
+    __emscripten_fetch_cache_data(Fetch.dbInstance, fetch, xhr.response, storeSuccess, storeError, xhr);
   };
 
   var performCachedXhr = function(fetch, xhr, e) {
@@ -549,6 +1059,15 @@ function emscripten_start_fetch(fetch, successcb, errorcb, progresscb, readystat
     __emscripten_fetch_cache_data(Fetch.dbInstance, fetch, HEAPU8.slice(ptr, ptr + HEAPU32[fetch_attr + {{{ C_STRUCTS.emscripten_fetch_attr_t.requestDataSize }}} >> 2]), reportSuccess, reportError);
   } else if (requestMethod === 'EM_IDB_DELETE') {
     __emscripten_fetch_delete_cached_data(Fetch.dbInstance, fetch, reportSuccess, reportError);
+  } else if (!fetchAttrReplace && !fetchAttrNoDownload && Fetch.cacheBackend && Fetch.cacheBackend['validators'] && (validators = Fetch.cacheBackend['validators'](fetch))) {
+    // The cached response can be stale, so ask the server whether it changed, and only download the body again if it
+    // did. A 304 "Not Modified" comes in as an error, since it is not a 2xx status. If the server can not be reached
+    // at all (status 0), the cached response is the best there is, so use it as well.
+    var loadCachedIfNotModified = function(fetch, xhr, e) {
+      if (xhr && (xhr.status === 304 || xhr.status === 0)) __emscripten_fetch_load_cached_data(Fetch.dbInstance, fetch, reportSuccess, reportError);
+      else reportError(fetch, xhr, e);
+    };
+    __emscripten_fetch_xhr(fetch, fetchAttrPersistFile ? cacheResultAndReportSuccess : reportSuccess, loadCachedIfNotModified, reportProgress, reportReadyStateChange, validators);
   } else if (!fetchAttrReplace) {
     __emscripten_fetch_load_cached_data(Fetch.dbInstance, fetch, reportSuccess, fetchAttrNoDownload ? reportError : (fetchAttrPersistFile ? performCachedXhr : performUncachedXhr));
   } else if (!fetchAttrNoDownload) {
@@ -577,6 +1096,13 @@ function _fetch_get_response_headers(id, dst, dstSizeBytes) {
     return Math.min(lengthBytes, dstSizeBytes);
 }
 
+// Called by emscripten_fetch_read() when it has made room in a streamBuffer that was full, which the download of the
+// fetch may be paused on. The download resumes after emscripten_fetch_read() has returned, not inside it.
+function _fetch_stream_resume(id) {
+  var resume = Fetch.pausedStreams[id];
+  if (resume) Promise.resolve().then(resume);
+}
+
 //Delete the xhr JS object, allowing it to be garbage collected.
 function _fetch_free(id) {
   //Note: should just be [id], but indexes off by 1 (see: #8803)
@@ -4,23 +4,29 @@
 // found in the LICENSE file.
 
 /*global Module:true, Runtime*/
-/*global HEAP32*/
+/*global HEAP32, HEAPU8*/
 /*global new_*/
 /*global createNamedFunction*/
-/*global readLatin1String, stringToUTF8*/
+/*global readLatin1String, stringToUTF8, lengthBytesUTF8, _embind_repr*/
 /*global requireRegisteredType, throwBindingError, runDestructors*/
 /*jslint sub:true*/ /* The symbols 'fromWireType' and 'toWireType' must be accessed via array notation to be closure-safe since craftInvokerFunction crafts functions as strings that can't be closured. */
 
 // -- jshint doesn't understand library syntax, so we need to mark the symbols exposed here
-/*global getStringOrSymbol, emval_handle_array, __emval_register, __emval_unregister, requireHandle, count_emval_handles, emval_symbols, emval_free_list, get_first_emval, __emval_decref, emval_newers*/
+/*global getStringOrSymbol, emval_values, emval_refcounts, emval_free_head, emval_handle_count, __emval_register, __emval_unregister, requireHandle, count_emval_handles, emval_symbols, get_first_emval, __emval_decref, emval_newers*/
 /*global craftEmvalAllocator, __emval_addMethodCaller, emval_methodCallers, LibraryManager, mergeInto, __emval_allocateDestructors, global, __emval_lookupTypes, makeLegalFunctionName*/
 /*global emval_get_global*/
 
 var LibraryEmVal = {
-  $emval_handle_array: [{},
-    {value: undefined},{value: null},
-    {value: true},{value: false}], // reserve zero and special values
-  $emval_free_list: [],
+  // The handle table is kept as two parallel arrays indexed by handle: the
+  // values, and their reference counts in a typed array, so that refcounting
+  // does not touch a heap object per handle. Handle 0 is never used, and 1 to
+  // 4 are the constants undefined, null, true and false, which are not
+  // refcounted. The refcount of a free handle is minus the next free handle,
+  // or 0 at the end of the free list.
+  $emval_values: [undefined, undefined, null, true, false],
+  $emval_refcounts: '=new Int32Array(64)',
+  $emval_free_head: 0,
+  $emval_handle_count: 0, // live handles, not counting the constants
   $emval_symbols: {}, // address -> string
 
   $init_emval__deps: ['$count_emval_handles', '$get_first_emval'],
@@ -30,22 +36,16 @@ var LibraryEmVal = {
     Module['get_first_emval'] = get_first_emval;
   },
 
-  $count_emval_handles__deps: ['$emval_handle_array'],
+  $count_emval_handles__deps: ['$emval_handle_count'],
   $count_emval_handles: function() {
-    var count = 0;
-    for (var i = 5; i < emval_handle_array.length; ++i) {
-        if (emval_handle_array[i] !== undefined) {
-            ++count;
-        }
-    }
-    return count;
+    return emval_handle_count;
   },
 
-  $get_first_emval__deps: ['$emval_handle_array'],
+  $get_first_emval__deps: ['$emval_values', '$emval_refcounts'],
   $get_first_emval: function() {
-    for (var i = 5; i < emval_handle_array.length; ++i) {
-        if (emval_handle_array[i] !== undefined) {
-            return emval_handle_array[i];
+    for (var i = 5; i < emval_values.length; ++i) {
+        if (emval_refcounts[i] > 0) {
+            return {refcount: emval_refcounts[i], value: emval_values[i]};
         }
     }
     return null;
@@ -66,15 +66,15 @@ var LibraryEmVal = {
     }
   },
 
-  $requireHandle__deps: ['$emval_handle_array', '$throwBindingError'],
+  $requireHandle__deps: ['$emval_values', '$throwBindingError'],
   $requireHandle: function(handle) {
     if (!handle) {
         throwBindingError('Cannot use deleted val. handle = ' + handle);
     }
-    return emval_handle_array[handle].value;
+    return emval_values[handle];
   },
 
-  _emval_register__deps: ['$emval_free_list', '$emval_handle_array', '$init_emval'],
+  _emval_register__deps: ['$emval_values', '$emval_refcounts', '$emval_free_head', '$emval_handle_count', '$init_emval'],
   _emval_register: function(value) {
 
     switch(value){
@@ -83,34 +83,50 @@ var LibraryEmVal = {
       case true :{ return 3; }
       case false :{ return 4; }
       default:{
-        var handle = emval_free_list.length ?
-            emval_free_list.pop() :
-            emval_handle_array.length;
-
-        emval_handle_array[handle] = {refcount: 1, value: value};
+        var handle = emval_free_head;
+        if (handle) {
+            emval_free_head = -emval_refcounts[handle];
+        } else {
+            handle = emval_values.length;
+            if (handle === emval_refcounts.length) {
+                var refcounts = new Int32Array(handle * 2);
+                refcounts.set(emval_refcounts);
+                emval_refcounts = refcounts;
+            }
+        }
+        emval_values[handle] = value;
+        emval_refcounts[handle] = 1;
+        ++emval_handle_count;
         return handle;
         }
       }
   },
 
-  _emval_incref__deps: ['$emval_handle_array'],
+  _emval_incref__deps: ['$emval_refcounts'],
   _emval_incref: function(handle) {
     if (handle > 4) {
-        emval_handle_array[handle].refcount += 1;
+        emval_refcounts[handle] += 1;
     }
   },
 
-  _emval_decref__deps: ['$emval_free_list', '$emval_handle_array'],
+  _emval_decref__deps: ['$emval_values', '$emval_refcounts', '$emval_free_head', '$emval_handle_count'],
   _emval_decref: function(handle) {
-    if (handle > 4 && 0 === --emval_handle_array[handle].refcount) {
-        emval_handle_array[handle] = undefined;
-        emval_free_list.push(handle);
+    if (handle > 4) {
+#if ASSERTIONS
+        assert(emval_refcounts[handle] > 0, 'emval handle ' + handle + ' released too many times');
+#endif
+        if (0 === --emval_refcounts[handle]) {
+            emval_values[handle] = undefined;
+            emval_refcounts[handle] = -emval_free_head;
+            emval_free_head = handle;
+            --emval_handle_count;
+        }
     }
   },
 
-  _emval_run_destructors__deps: ['_emval_decref', '$emval_handle_array', '$runDestructors'],
+  _emval_run_destructors__deps: ['_emval_decref', '$emval_values', '$runDestructors'],
   _emval_run_destructors: function(handle) {
-    var destructors = emval_handle_array[handle].value;
+    var destructors = emval_values[handle];
     runDestructors(destructors);
     __emval_decref(handle);
   },
@@ -467,6 +483,62 @@ var LibraryEmVal = {
     return typeof handle === 'string';
   },
 
+  // Typed fast paths for val(double), val::as<double>() and
+  // val::as<std::string>(), which the generic _emval_take_value and _emval_as
+  // would otherwise route through the type registry, an argument pack or a
+  // destructors array registered as a handle of its own, and a malloc'd copy
+  // of the string.
+  _emval_new_double__deps: ['_emval_register'],
+  _emval_new_double: function(value) {
+    return __emval_register(value);
+  },
+
+  // typeName is the C++ type the value is converted to, for the error.
+  _emval_as_double__deps: ['$requireHandle', 'embind_repr', '$readLatin1String'],
+  _emval_as_double: function(handle, typeName) {
+    var value = requireHandle(handle);
+    if (typeof value !== 'number' && typeof value !== 'boolean') {
+        throw new TypeError('Cannot convert "' + _embind_repr(value) + '" to ' + readLatin1String(typeName));
+    }
+    return +value;
+  },
+
+  // Returns the length in bytes of the std::string the value converts to, or
+  // -1 if it is not a JS string, in which case the caller falls back to
+  // _emval_as().
+  _emval_get_string_length__deps: ['$requireHandle', '$throwBindingError'],
+  _emval_get_string_length: function(handle) {
+    var value = requireHandle(handle);
+    if (typeof value !== 'string') {
+        return -1;
+    }
+#if EMBIND_STD_STRING_IS_UTF8
+    return lengthBytesUTF8(value);
+#else
+    for (var i = 0; i < value.length; ++i) {
+        if (value.charCodeAt(i) > 255) {
+            throwBindingError('String has UTF-16 code units that do not fit in 8 bits');
+        }
+    }
+    return value.length;
+#endif
+  },
+
+  // Writes the string to buffer, which has room for the length returned by
+  // _emval_get_string_length() plus a null terminator.
+  _emval_copy_string__deps: ['$requireHandle'],
+  _emval_copy_string: function(handle, buffer, length) {
+    var value = requireHandle(handle);
+#if EMBIND_STD_STRING_IS_UTF8
+    stringToUTF8(value, buffer, length + 1);
+#else
+    for (var i = 0; i < length; ++i) {
+        HEAPU8[buffer + i] = value.charCodeAt(i);
+    }
+    HEAPU8[buffer + length] = 0;
+#endif
+  },
+
   _emval_in__deps: ['$requireHandle'],
   _emval_in: function(item, object) {
     item = requireHandle(item);
@@ -579,7 +579,12 @@ LibraryManager.library = {
       newSize = Math.min(alignUp(newSize + {{{ MEMORY_GROWTH_STEP }}}, PAGE_MULTIPLE), LIMIT);
 #else
       if (newSize <= 536870912) {
-        newSize = alignUp(2 * newSize, PAGE_MULTIPLE); // Simple heuristic: double until 1GB...
+        // Grow by a fraction of the current size (by default, double) until 1GB...
+        var step = newSize * {{{ MEMORY_GROWTH_GEOMETRIC_PERCENT / 100 }}};
+#if MEMORY_GROWTH_GEOMETRIC_CAP
+        step = Math.min(step, {{{ MEMORY_GROWTH_GEOMETRIC_CAP }}});
+#endif
+        newSize = alignUp(newSize + step, PAGE_MULTIPLE);
       } else {
         // ..., but after that, add smaller increments towards 2GB, which we cannot reach
         newSize = Math.min(alignUp((3 * newSize + 2147483648) / 4, PAGE_MULTIPLE), LIMIT);
@@ -624,6 +629,11 @@ LibraryManager.library = {
 #endif
 
     var replacement = emscripten_realloc_buffer(newSize);
+    if (!replacement && newSize > requestedSize) {
+      // There may still be room for what was actually asked for.
+      newSize = alignUp(requestedSize, PAGE_MULTIPLE);
+      replacement = emscripten_realloc_buffer(newSize);
+    }
     if (!replacement) {
 #if ASSERTIONS
       err('Failed to grow the heap from ' + oldSize + ' bytes to ' + newSize + ' bytes, not enough memory!');
@@ -20,6 +20,8 @@ var LibraryFetch = {
   _emscripten_fetch_get_response_headers_length: _fetch_get_response_headers_length,
   _emscripten_fetch_get_response_headers: _fetch_get_response_headers,
   _emscripten_fetch_free: _fetch_free,
+  _emscripten_fetch_stream_resume: _fetch_stream_resume,
+  _emscripten_fetch_stream_resume__deps: ['$Fetch'],
 
 #if FETCH_SUPPORT_INDEXEDDB
   $__emscripten_fetch_delete_cached_data: __emscripten_fetch_delete_cached_data,
@@ -27,9 +29,10 @@ var LibraryFetch = {
   $__emscripten_fetch_cache_data: __emscripten_fetch_cache_data,
 #endif
   $__emscripten_fetch_xhr: __emscripten_fetch_xhr,
+  $__emscripten_fetch_stream: __emscripten_fetch_stream,
 
   emscripten_start_fetch: emscripten_start_fetch,
-  emscripten_start_fetch__deps: ['$Fetch', '$__emscripten_fetch_xhr',
+  emscripten_start_fetch__deps: ['$Fetch', '$__emscripten_fetch_xhr', '$__emscripten_fetch_stream',
 #if FETCH_SUPPORT_INDEXEDDB
   '$__emscripten_fetch_cache_data', '$__emscripten_fetch_load_cached_data', '$__emscripten_fetch_delete_cached_data',
 #endif
@@ -160,8 +160,12 @@ var LibraryPThread = {
         PThread.exitHandlers = null;
       }
 
-      // Call into the musl function that runs destructors of all thread-specific data.
-      if (ENVIRONMENT_IS_PTHREAD && threadInfoStruct) ___pthread_tsd_run_dtors();
+      if (ENVIRONMENT_IS_PTHREAD && threadInfoStruct) {
+        // Call into the musl function that runs destructors of all thread-specific data.
+        ___pthread_tsd_run_dtors();
+        // Cancel the calls still queued to this thread, and any queued to it from now on.
+        ___emscripten_close_call_queue(threadInfoStruct);
+      }
     },
 
     // Called when we are performing a pthread_exit(), either explicitly called by programmer,
@@ -250,6 +254,7 @@ var LibraryPThread = {
         var tlsMemory = {{{ makeGetValue('pthread.threadInfoStruct', C_STRUCTS.pthread.tsd, 'i32') }}};
         {{{ makeSetValue('pthread.threadInfoStruct', C_STRUCTS.pthread.tsd, 0, 'i32') }}};
         _free(tlsMemory);
+        ___emscripten_close_call_queue(pthread.threadInfoStruct);
         _free(pthread.threadInfoStruct);
       }
       pthread.threadInfoStruct = 0;
@@ -758,6 +763,7 @@ var LibraryPThread = {
     var threadInfoStruct = _malloc({{{ C_STRUCTS.pthread.__size__ }}});
     for (var i = 0; i < {{{ C_STRUCTS.pthread.__size__ }}} >> 2; ++i) HEAPU32[(threadInfoStruct>>2) + i] = 0; // zero-initialize thread structure.
     {{{ makeSetValue('pthread_ptr', 0, 'threadInfoStruct', 'i32') }}};
+    ___emscripten_open_call_queue(threadInfoStruct);
 
     // The pthread struct has a field that points to itself - this is used as a magic ID to detect whether the pthread_t
     // structure is 'alive'.
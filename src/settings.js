@@ -114,14 +114,34 @@ var TOTAL_MEMORY = 16777216;
 //  * emmalloc - a simple and compact malloc designed for emscripten
 //  * none     - no malloc() implementation is provided, but you must implement
 //               malloc() and free() yourself.
-// dlmalloc is necessary for multithreading, split memory, and other special
-// modes, and will be used automatically in those cases.
+// dlmalloc is necessary for split memory and other special modes, and will be
+// used automatically in those cases.
 // In general, if you don't need one of those special modes, and if you don't
 // allocate very many small objects, you should use emmalloc since it's
 // smaller. Otherwise, if you do allocate many small objects, dlmalloc
 // is usually worth the extra size.
+// With pthreads, emmalloc keeps per-thread caches of small free regions, so
+// that most allocations do not contend on a global lock as they do in
+// dlmalloc (thread caches require the wasm backend).
 var MALLOC = "dlmalloc";
 
+// If 1, and MALLOC is emmalloc, allocations of up to 256 bytes are served
+// from slabs of objects of the same size class, which have no per-object
+// metadata. This saves a lot of memory in programs that allocate many small
+// objects (like std::strings), at the cost of some code size, a 16KB table
+// of which memory pages are slabs, and memory being reserved in 16KB slabs
+// for each size class that is used.
+var EMMALLOC_SLABS = 0;
+
+// If 1, and MALLOC is dlmalloc, then in pthreads builds each thread allocates
+// from an mspace of its own, instead of all threads sharing one behind a global
+// lock. A chunk that is freed by another thread than the one that allocated it
+// is handed back to its mspace through a lock-free list. This lets allocation
+// scale with the number of threads, at the cost of more memory, as free memory
+// in the mspace of one thread is not available to the others, and of 4 bytes
+// more overhead per allocation. (Requires the wasm backend.)
+var DLMALLOC_MSPACES = 0;
+
 // If 1, then when malloc would fail we abort(). This is nonstandard behavior,
 // but makes sense for the web since we have a fixed amount of memory that
 // must all be allocated up front, and so (a) failing mallocs are much more
@@ -155,11 +175,22 @@ var FAST_UNROLLED_MEMCPY_AND_MEMSET = 1;
 // memory from the system as necessary.
 var ALLOW_MEMORY_GROWTH = 0;
 
-// If ALLOW_MEMORY_GROWTH is true and MEMORY_GROWTH_STEP == -1, memory roughly
-// doubles in size each time is grows. Set MEMORY_GROWTH_STEP to a multiple of
-// WASM page size (64KB), eg. 16MB to enable a slower growth rate.
+// If ALLOW_MEMORY_GROWTH is true and MEMORY_GROWTH_STEP == -1, memory grows
+// geometrically, see MEMORY_GROWTH_GEOMETRIC_PERCENT. Set MEMORY_GROWTH_STEP to
+// a multiple of WASM page size (64KB), eg. 16MB to enable a slower growth rate.
 var MEMORY_GROWTH_STEP = -1;
 
+// With geometric memory growth, by how many percent of its current size the
+// heap grows each time (up to 1GB; after that it grows in smaller steps towards
+// the 2GB limit). The default of 100 doubles it. Use
+// emscripten_reserve_heap() (see emscripten/heap.h) to grow it to a known size
+// in one go.
+var MEMORY_GROWTH_GEOMETRIC_PERCENT = 100;
+
+// If nonzero, geometric memory growth adds at most this many bytes to the heap
+// at a time, which must be a multiple of the WASM page size (64KB).
+var MEMORY_GROWTH_GEOMETRIC_CAP = 0;
+
 // If true, allows more functions to be added to the table at runtime. This is
 // necessary for dynamic linking, and set automatically in that mode.
 var ALLOW_TABLE_GROWTH = 0;
@@ -226,6 +257,12 @@ var PRECISE_F32 = 0;
 // fast.
 var SIMD = 0;
 
+// Whether to use the WebAssembly bulk memory operations (memory.copy and
+// memory.fill). When set, the system libraries implement large memcpy, memmove
+// and memset calls with them. Passing -mbulk-memory sets this as well.
+// Only supported by the upstream wasm backend.
+var BULK_MEMORY = 0;
+
 // Whether closure compiling is being run on this output
 var USE_CLOSURE_COMPILER = 0;
 
@@ -1486,6 +1523,17 @@ var OFFSCREEN_FRAMEBUFFER = 0;
 // IndexedDB support is not interesting for target application, to save a few kBytes.
 var FETCH_SUPPORT_INDEXEDDB = 1;
 
+// If nonzero, when running in node.js, where IndexedDB is not available, downloads that are made with the
+// EMSCRIPTEN_FETCH_PERSIST_FILE attribute are cached on disk instead, in Module['fetchDiskCacheDir'] (by default a
+// directory per application under emscripten_fetch_cache/ in the temp directory of the system). Cached responses that
+// have an ETag or a Last-Modified header are revalidated with the server before they are used, and used as is if the
+// server can not be reached. Requires FETCH_SUPPORT_INDEXEDDB.
+var FETCH_DISK_CACHE = 0;
+
+// The size in bytes that the FETCH_DISK_CACHE is allowed to grow to before the least recently used responses are
+// evicted from it. Can be changed at runtime with Module['fetchDiskCacheMaxBytes'].
+var FETCH_DISK_CACHE_MAX_BYTES = 512*1024*1024;
+
 // If nonzero, prints out debugging information in library_fetch.js
 var FETCH_DEBUG = 0;
 
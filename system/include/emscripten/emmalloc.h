@@ -0,0 +1,35 @@
+/*
+ * Copyright 2020 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Functions specific to emmalloc (-s MALLOC=emmalloc).
+
+// Gives back free memory at the end of the heap by lowering the sbrk() break,
+// keeping at most 'pad' bytes of it for future allocations. Large free regions
+// in the middle of the heap are zeroed out, so that tools that snapshot or
+// serialize the heap find them cheap to handle; regions that are still zeroed
+// from an earlier call are skipped. With pthreads, this also
+// frees the calling thread's cache of small allocations and the shared cache.
+// Returns 1 if any memory was released or zeroed, 0 otherwise.
+// malloc_trim() does the same.
+int emmalloc_trim(size_t pad);
+
+// Sets up automatic trimming: whenever a free() leaves a free region of at least
+// 'threshold' bytes at the end of the heap, it is given back using sbrk(). A
+// threshold of 0 (the default) disables automatic trimming.
+void emmalloc_set_trim_threshold(size_t threshold);
+
+#ifdef __cplusplus
+}
+#endif
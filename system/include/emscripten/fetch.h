@@ -20,9 +20,10 @@ extern "C" {
 // If passed, the body of the request will be present in full in the onsuccess() handler.
 #define EMSCRIPTEN_FETCH_LOAD_TO_MEMORY  1
 
-// If passed, the intermediate streamed bytes will be passed in to the onprogress() handler. If not specified, the
-// onprogress() handler will still be called, but without data bytes.
-// Note: Firefox only as it depends on 'moz-chunked-arraybuffer'.
+// If passed, the response body is delivered as it arrives, instead of only after the download finishes, using the
+// streams of the fetch() API. If a streamBuffer is given in the fetch attributes, the bytes are written to it, and
+// are read out with emscripten_fetch_read(). Otherwise each chunk of bytes is passed in to the onprogress() handler, in
+// a buffer that is only valid until the handler returns. Streamed fetches do not read from or write to IndexedDB.
 #define EMSCRIPTEN_FETCH_STREAM_DATA 2
 
 // If passed, the final download will be stored in IndexedDB. If not specified, the file will only reside in browser memory.
@@ -113,6 +114,16 @@ typedef struct emscripten_fetch_attr_t
 
 	// Specifies the length of the buffer pointed by 'requestData'. Leave as 0 if no request body needs to be sent.
 	size_t requestDataSize;
+
+	// If non-zero, and EMSCRIPTEN_FETCH_STREAM_DATA is passed, specifies a ring buffer that the response body is
+	// written to as it arrives, to be read out with emscripten_fetch_read(). When the buffer is full, the download is
+	// paused until the bytes are read, so a response of any size can be processed in a fixed amount of memory.
+	// The memory pointed to by this field is provided by the user, and needs to be valid until the fetch is closed.
+	char *streamBuffer;
+
+	// Specifies the length of the buffer pointed by 'streamBuffer'. Only the largest power of two that fits in it is
+	// used.
+	size_t streamBufferSize;
 } emscripten_fetch_attr_t;
 
 typedef struct emscripten_fetch_t
@@ -130,8 +141,8 @@ typedef struct emscripten_fetch_t
 	//   - If the EMSCRIPTEN_FETCH_LOAD_TO_MEMORY attribute was specified for the transfer, this points to the
 	//     body of the downloaded data. Otherwise this will be null.
 	// In onprogress() handler:
-	//   - If the EMSCRIPTEN_FETCH_STREAM_DATA attribute was specified for the transfer, this points to a partial
-	//     chunk of bytes related to the transfer. Otherwise this will be null.
+	//   - If the EMSCRIPTEN_FETCH_STREAM_DATA attribute was specified for the transfer without a streamBuffer, this
+	//     points to a partial chunk of bytes related to the transfer. Otherwise this will be null.
 	// The data buffer provided here has identical lifetime with the emscripten_fetch_t object itself, and is freed by
 	// calling emscripten_fetch_close() on the emscripten_fetch_t pointer.
 	const char *data;
@@ -165,6 +176,12 @@ typedef struct emscripten_fetch_t
 
 	uint32_t __proxyState;
 
+	// The total numbers of bytes written to and read from the streamBuffer (wrapping around at 2^32), and a counter
+	// that is incremented whenever the fetch writes to it or finishes, to wait on in emscripten_fetch_read().
+	uint32_t __streamWritePos;
+	uint32_t __streamReadPos;
+	uint32_t __streamSignal;
+
 	// For internal use only.
 	emscripten_fetch_attr_t __attributes;
 } emscripten_fetch_t;
@@ -182,6 +199,17 @@ emscripten_fetch_t *emscripten_fetch(emscripten_fetch_attr_t *fetch_attr, const
 // this function returns.
 EMSCRIPTEN_RESULT emscripten_fetch_wait(emscripten_fetch_t *fetch, double timeoutMSecs);
 
+// Reads up to dstSizeBytes bytes of the response body of a fetch that was started with EMSCRIPTEN_FETCH_STREAM_DATA
+// and a streamBuffer, and stores the number of bytes read to *numBytesRead. Returns EMSCRIPTEN_RESULT_SUCCESS if some
+// bytes were read, EMSCRIPTEN_RESULT_NO_DATA if the whole body has been read, EMSCRIPTEN_RESULT_FAILED if the fetch
+// failed, and EMSCRIPTEN_RESULT_TIMED_OUT if no bytes arrived within timeoutMSecs. Pass timeoutMSecs=0 to poll
+// without blocking. Blocking is only possible when the fetch runs on another thread (i.e. it was passed
+// EMSCRIPTEN_FETCH_WAITABLE), and not on the main browser thread. Otherwise read the bytes in the onprogress()
+// handler, which is called whenever new bytes have been written to the streamBuffer.
+// This can be called on a different thread than the one that started the fetch, but only one thread may read from
+// a fetch at a time.
+EMSCRIPTEN_RESULT emscripten_fetch_read(emscripten_fetch_t *fetch, char *dst, size_t dstSizeBytes, size_t *numBytesRead, double timeoutMSecs);
+
 // Closes a finished or an executing fetch operation and frees up all memory. If the fetch operation was still executing, the
 // onerror() handler will be called in the calling thread before this function returns.
 EMSCRIPTEN_RESULT emscripten_fetch_close(emscripten_fetch_t *fetch);
@@ -245,6 +273,23 @@ void emscripten_asmfs_unload_data(const char *pathname);
 // synchronous access by looking at IndexedDB only.
 EMSCRIPTEN_RESULT emscripten_asmfs_preload_file(const char *url, const char *pathname, int mode, emscripten_fetch_attr_t *options);
 
+// Adds a file to the ASMFS filesystem at destination path 'pathname' whose contents are downloaded from the given URL
+// lazily, one block at a time with HTTP Range requests, as the file is read, instead of as a whole. This allows reading
+// parts of very large files without downloading or keeping all of them in memory. If the server does not support
+// Range requests, the whole file is downloaded. Lazily loaded files are read-only.
+// This function must be called on a worker thread, since it waits for the first block to download to learn the size
+// of the file. Reads of blocks that are not in memory also block, and fail with EAGAIN on the main browser thread.
+// Files of 2GB or more can't be addressed by ASMFS, and are rejected with EMSCRIPTEN_RESULT_NOT_SUPPORTED.
+EMSCRIPTEN_RESULT emscripten_asmfs_add_lazy_file(const char *url, const char *pathname, int mode);
+
+// Configures lazy loading. These settings are global, not per file: blockSize is the number of bytes requested at a
+// time (default 1MB), and applies to files added after this call, since it fixes how a file is split into blocks.
+// readAheadBlocks is the number of further blocks requested along with a block when a file is read sequentially
+// (default 4), and maxResidentBytes is the budget of downloaded blocks of all lazy files together kept in memory,
+// after which the least recently used blocks are evicted (default 64MB). These two apply to all lazy files from the
+// next download on.
+void emscripten_asmfs_set_lazy_loading(uint32_t blockSize, uint32_t readAheadBlocks, uint64_t maxResidentBytes);
+
 // Computes the total amount of bytes in memory utilized by the filesystem at the moment.
 // Note: This function can be slow since it walks through the whole filesystem.
 uint64_t emscripten_asmfs_compute_memory_usage();
@@ -0,0 +1,31 @@
+/*
+ * Copyright 2020 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Grows the heap now, in one step, so that the next 'bytes' bytes that sbrk()
+// (and so malloc()) hands out do not need to grow it again. This is useful
+// before a phase that allocates a lot incrementally, like startup, since each
+// growth of the heap replaces the JS views of it. As with sbrk(), if memory
+// cannot grow and ABORTING_MALLOC is set, this aborts. Returns 1 on success,
+// 0 otherwise.
+int emscripten_reserve_heap(size_t bytes);
+
+// How many times sbrk() and emscripten_reserve_heap() have grown the heap,
+// and by how many bytes in total.
+size_t emscripten_get_heap_growth_count(void);
+size_t emscripten_get_heap_growth_bytes(void);
+
+#ifdef __cplusplus
+}
+#endif
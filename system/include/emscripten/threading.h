@@ -123,6 +123,9 @@ typedef struct em_queued_call
   // this em_queued_call object after it has been executed. If
   // false, the caller is in control of the memory.
   int calleeDelete;
+
+  // Links this call in the call queue of the thread it was proxied to. Owned by the queue.
+  struct em_queued_call *next;
 } em_queued_call;
 
 void emscripten_sync_run_in_main_thread(em_queued_call *call);
@@ -132,6 +135,19 @@ void *emscripten_sync_run_in_main_thread_2(int function, void *arg1, void *arg2)
 void *emscripten_sync_run_in_main_thread_3(int function, void *arg1, void *arg2, void *arg3);
 void *emscripten_sync_run_in_main_thread_7(int function, void *arg1, void *arg2, void *arg3, void *arg4, void *arg5, void *arg6, void *arg7);
 
+// Proxies a batch of calls to the main runtime thread as a single unit: the main thread is woken up
+// at most once for the whole batch, and performs the calls back to back in the order they appear in
+// the array, with no calls from other threads in between. The calls are owned by the caller
+// (calleeDelete must be 0), and must stay alive until the batch has completed.
+// The sync variant waits for the whole batch to complete. With the async variant, wait for the last
+// call of the batch with emscripten_wait_for_call_v(), after which all the calls have completed.
+void emscripten_sync_run_batch_in_main_thread(em_queued_call **calls, int numCalls);
+void emscripten_async_run_batch_in_main_thread(em_queued_call **calls, int numCalls);
+
+// Reports how many of the em_queued_call objects allocated for proxied calls were reused from the
+// pool of free objects (hits), and how many had to be allocated with malloc() (misses).
+void emscripten_get_queued_call_pool_stats(uint32_t *hits, uint32_t *misses);
+
 typedef void (*em_func_v)(void);
 typedef void (*em_func_vi)(int);
 typedef void (*em_func_vf)(float);
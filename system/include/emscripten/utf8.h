@@ -0,0 +1,34 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns the length of the longest prefix of str that is valid UTF-8, which is
+// len if all of it is.
+size_t emscripten_utf8_validate(const char *str, size_t len);
+
+// Converts len bytes of UTF-8 to UTF-16, like UTF8ToString() does. Invalid
+// input is replaced by U+FFFD, as TextDecoder does. out must have room for len
+// code units. Returns the number of code units written; no null terminator is
+// added.
+size_t emscripten_utf8_to_utf16(const char *str, size_t len, uint16_t *out);
+
+// Converts len UTF-16 code units to UTF-8, like stringToUTF8() does. Unpaired
+// surrogates are replaced by U+FFFD, as TextEncoder does. out must have room for
+// 3*len bytes. Returns the number of bytes written; no null terminator is added.
+size_t emscripten_utf16_to_utf8(const uint16_t *str, size_t len, char *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -53,6 +53,7 @@ namespace emscripten {
             EM_VAL _emval_new_cstring(const char*);
 
             EM_VAL _emval_take_value(TYPEID type, EM_VAR_ARGS argv);
+            EM_VAL _emval_new_double(double value);
 
             EM_VAL _emval_new(
                 EM_VAL value,
@@ -65,6 +66,9 @@ namespace emscripten {
             EM_VAL _emval_get_property(EM_VAL object, EM_VAL key);
             void _emval_set_property(EM_VAL object, EM_VAL key, EM_VAL value);
             EM_GENERIC_WIRE_TYPE _emval_as(EM_VAL value, TYPEID returnType, EM_DESTRUCTORS* destructors);
+            double _emval_as_double(EM_VAL value, const char* typeName);
+            int _emval_get_string_length(EM_VAL value);
+            void _emval_copy_string(EM_VAL value, char* buffer, unsigned length);
 
             bool _emval_equals(EM_VAL first, EM_VAL second);
             bool _emval_strictly_equals(EM_VAL first, EM_VAL second);
@@ -354,6 +358,10 @@ namespace emscripten {
             : handle(internal::_emval_new_cstring(v))
         {}
 
+        explicit val(double v)
+            : handle(internal::_emval_new_double(v))
+        {}
+
         val(val&& v)
             : handle(v.handle)
         {
@@ -486,18 +494,7 @@ namespace emscripten {
 
         template<typename T, typename ...Policies>
         T as(Policies...) const {
-            using namespace internal;
-
-            typedef BindingType<T> BT;
-            typename WithPolicies<Policies...>::template ArgTypeList<T> targetType;
-
-            EM_DESTRUCTORS destructors;
-            EM_GENERIC_WIRE_TYPE result = _emval_as(
-                handle,
-                targetType.getTypes()[0],
-                &destructors);
-            DestructorsRunner dr(destructors);
-            return fromGenericWireType<T>(result);
+            return genericAs<T, Policies...>();
         }
 
 // If code is not being compiled with GNU extensions enabled, typeof() is not a reserved keyword, so support that as a member function.
@@ -542,6 +539,23 @@ namespace emscripten {
             return handle;
         }
 
+        // as() through the type registry, for any type.
+        template<typename T, typename ...Policies>
+        T genericAs() const {
+            using namespace internal;
+
+            typedef BindingType<T> BT;
+            typename WithPolicies<Policies...>::template ArgTypeList<T> targetType;
+
+            EM_DESTRUCTORS destructors;
+            EM_GENERIC_WIRE_TYPE result = _emval_as(
+                handle,
+                targetType.getTypes()[0],
+                &destructors);
+            DestructorsRunner dr(destructors);
+            return fromGenericWireType<T>(result);
+        }
+
         template<typename Implementation, typename... Args>
         val internalCall(Implementation impl, Args&&... args) const {
             using namespace internal;
@@ -575,6 +589,31 @@ namespace emscripten {
         };
     }
 
+    // Numbers and strings are converted without going through the type
+    // registry or allocating a handle for destructors.
+    template<>
+    inline double val::as<double>() const {
+        return internal::_emval_as_double(handle, "double");
+    }
+
+    template<>
+    inline float val::as<float>() const {
+        return internal::_emval_as_double(handle, "float");
+    }
+
+    template<>
+    inline std::string val::as<std::string>() const {
+        int length = internal::_emval_get_string_length(handle);
+        if (length < 0) {
+            // Not a JS string, but perhaps an ArrayBuffer or a typed array.
+            return genericAs<std::string>();
+        }
+        std::string rv(length + 1, '\0');
+        internal::_emval_copy_string(handle, &rv[0], length);
+        rv.resize(length);
+        return rv;
+    }
+
     template<typename T>
     std::vector<T> vecFromJSArray(val v) {
         auto l = v["length"].as<unsigned>();
@@ -24,6 +24,21 @@
 #if __EMSCRIPTEN_PTHREADS__
 #define USE_LOCKS 1
 #define USE_SPIN_LOCKS 0 // Ensure we use pthread_mutex_t.
+/* With DLMALLOC_MSPACES, each thread allocates from an mspace of its own
+   instead of taking the lock of the global one, see "Per-thread arenas" at the
+   end of this file. This needs thread-local storage, which only the wasm
+   backend has. Footers tell free() which arena a chunk belongs to. Arenas grow
+   by separate sbrk() calls, so grow them in bigger steps than a page. */
+#if defined(DLMALLOC_MSPACES) && defined(__wasm__)
+#define DLMALLOC_THREAD_ARENAS 1
+#define ONLY_MSPACES 1
+#define HAVE_MORECORE 1
+#define FOOTERS 1
+#define DEFAULT_GRANULARITY ((size_t)64U * (size_t)1024U)
+#endif
+#endif
+#ifndef DLMALLOC_THREAD_ARENAS
+#define DLMALLOC_THREAD_ARENAS 0
 #endif
 
 #endif
@@ -851,7 +866,7 @@ extern "C" {
 #define FORCEINLINE
 #endif
     
-#if !ONLY_MSPACES
+#if !ONLY_MSPACES || DLMALLOC_THREAD_ARENAS
     
     /* ------------------- Declarations of public routines ------------------- */
     
@@ -6066,12 +6081,407 @@ int mspace_mallopt(int param_number, int value) {
 
 #endif /* MSPACES */
 
+/* -------------------------- Per-thread arenas -------------------------- */
+
+#if DLMALLOC_THREAD_ARENAS
+
+/*
+ XXX Emscripten: with DLMALLOC_MSPACES, the global routines are built on
+ mspaces. Each thread allocates from an arena (an mspace) of its own, so
+ threads do not contend for a lock in malloc, or when freeing their own
+ chunks. Arenas are still locked, but their locks are only contended by
+ the routines that visit all arenas, like mallinfo.
+
+ A chunk that is freed by another thread than the owner of its arena
+ (which is found from the footer of the chunk) is pushed on a lock-free
+ list in the arena. The owner takes the whole list with one atomic
+ exchange, so there is no ABA problem, and frees the chunks in it on its
+ next allocation. When a thread exits, its arena is abandoned, and other
+ threads free chunks in it directly until a new thread adopts it.
+ */
+
+#include <emscripten/threading.h>
+
+struct thread_arena {
+    mstate ms;
+    void* volatile remote_frees;  /* linked through the first word of each chunk */
+    volatile uint32_t abandoned;
+    struct thread_arena* next;    /* in all_arenas */
+    struct thread_arena* next_abandoned;
+};
+
+#define ARENA_HEADER_SIZE \
+((sizeof(struct thread_arena) + CHUNK_ALIGN_MASK) & ~CHUNK_ALIGN_MASK)
+
+/*
+ Both lists are modified under the malloc global lock. Arenas are never
+ destroyed and are only ever added to the front of all_arenas, so it can
+ be walked without the lock.
+ */
+static struct thread_arena* all_arenas;
+static struct thread_arena* abandoned_arenas;
+
+/* The footprint limit for each arena, also applied to new ones. */
+static size_t arena_footprint_limit;
+
+static __thread struct thread_arena* current_arena;
+static pthread_key_t arena_key;
+static pthread_once_t arena_key_once = PTHREAD_ONCE_INIT;
+
+static struct thread_arena* first_arena(void) {
+    return (struct thread_arena*)emscripten_atomic_load_u32((void*)&all_arenas);
+}
+
+static void drain_remote_frees(struct thread_arena* a) {
+    void* mem = (void*)emscripten_atomic_exchange_u32((void*)&a->remote_frees, 0);
+    while (mem != 0) {
+        void* next = *(void**)mem;
+        mspace_free(a->ms, mem);
+        mem = next;
+    }
+}
+
+static void free_remote(struct thread_arena* a, void* mem) {
+    if (emscripten_atomic_load_u32((void*)&a->abandoned)) {
+        mspace_free(a->ms, mem);
+        return;
+    }
+    for (;;) {
+        void* head = a->remote_frees;
+        *(void**)mem = head;
+        if (emscripten_atomic_cas_u32((void*)&a->remote_frees, (uint32_t)head,
+                                      (uint32_t)mem) == (uint32_t)head)
+            return;
+    }
+}
+
+/* Runs when a thread that has an arena exits. */
+static void abandon_thread_arena(void* arg) {
+    struct thread_arena* a = (struct thread_arena*)arg;
+    current_arena = 0;
+    emscripten_atomic_store_u32((void*)&a->abandoned, 1);
+    /* A chunk that was pushed just after this is left for the next owner. */
+    drain_remote_frees(a);
+    ACQUIRE_MALLOC_GLOBAL_LOCK();
+    a->next_abandoned = abandoned_arenas;
+    abandoned_arenas = a;
+    RELEASE_MALLOC_GLOBAL_LOCK();
+}
+
+static void create_arena_key(void) {
+    pthread_key_create(&arena_key, abandon_thread_arena);
+}
+
+static struct thread_arena* attach_thread_arena(void) {
+    struct thread_arena* a;
+    ensure_initialization();
+    pthread_once(&arena_key_once, create_arena_key);
+    ACQUIRE_MALLOC_GLOBAL_LOCK();
+    a = abandoned_arenas;
+    if (a != 0) {
+        abandoned_arenas = a->next_abandoned;
+    }
+    else {
+        size_t size = mparams.granularity;
+        char* base = (char*)CALL_MORECORE(size);
+        if (base != CMFAIL) {
+            size_t pad = align_offset(base) + ARENA_HEADER_SIZE;
+            a = (struct thread_arena*)(base + align_offset(base));
+            a->ms = (mstate)create_mspace_with_base(base + pad, size - pad, 1);
+            a->ms->extp = a;
+            a->ms->footprint_limit = arena_footprint_limit;
+            a->remote_frees = 0;
+            a->abandoned = 0;
+            a->next_abandoned = 0;
+            a->next = all_arenas;
+            emscripten_atomic_store_u32((void*)&all_arenas, (uint32_t)a);
+        }
+    }
+    RELEASE_MALLOC_GLOBAL_LOCK();
+    if (a == 0)
+        return 0;
+    if (a->abandoned) {
+        emscripten_atomic_store_u32((void*)&a->abandoned, 0);
+        drain_remote_frees(a);
+    }
+    current_arena = a;
+    pthread_setspecific(arena_key, a);
+    return a;
+}
+
+/* The calling thread's arena, after freeing what other threads returned to it. */
+static FORCEINLINE struct thread_arena* thread_arena(void) {
+    struct thread_arena* a = current_arena;
+    if (a == 0)
+        return attach_thread_arena();
+    if (a->remote_frees != 0)
+        drain_remote_frees(a);
+    return a;
+}
+
+void* dlmalloc(size_t bytes) {
+    void* mem = 0;
+    struct thread_arena* a = thread_arena();
+    if (a != 0)
+        mem = mspace_malloc(a->ms, bytes);
+    else {
+        MALLOC_FAILURE_ACTION;
+    }
+    /* XXX Emscripten Tracing API. */
+    emscripten_trace_record_allocation(mem, bytes);
+    return mem;
+}
+
+void dlfree(void* mem) {
+    if (mem != 0) {
+        mchunkptr p = mem2chunk(mem);
+        mstate fm = get_mstate_for(p);
+        struct thread_arena* a;
+        /* XXX Emscripten Tracing API. */
+        emscripten_trace_record_free(mem);
+        if (!ok_magic(fm)) {
+            USAGE_ERROR_ACTION(fm, p);
+            return;
+        }
+        a = (struct thread_arena*)fm->extp;
+        if (a == current_arena)
+            mspace_free(fm, mem);
+        else
+            free_remote(a, mem);
+    }
+}
+
+void* dlcalloc(size_t n_elements, size_t elem_size) {
+    void* mem;
+    size_t req = 0;
+    if (n_elements != 0) {
+        req = n_elements * elem_size;
+        if (((n_elements | elem_size) & ~(size_t)0xffff) &&
+            (req / n_elements != elem_size))
+            req = MAX_SIZE_T; /* force downstream failure on overflow */
+    }
+    mem = dlmalloc(req);
+    if (mem != 0 && calloc_must_clear(mem2chunk(mem)))
+        memset(mem, 0, req);
+    return mem;
+}
+
+void* dlrealloc(void* oldmem, size_t bytes) {
+    void* mem = 0;
+    if (oldmem == 0) {
+        mem = dlmalloc(bytes);
+    }
+    else if (bytes >= MAX_REQUEST) {
+        MALLOC_FAILURE_ACTION;
+    }
+#ifdef REALLOC_ZERO_BYTES_FREES
+    else if (bytes == 0) {
+        dlfree(oldmem);
+    }
+#endif /* REALLOC_ZERO_BYTES_FREES */
+    else {
+        mstate m = get_mstate_for(mem2chunk(oldmem));
+        if (!ok_magic(m)) {
+            USAGE_ERROR_ACTION(m, oldmem);
+            return 0;
+        }
+        if (m->extp == current_arena) {
+            mem = mspace_realloc(m, oldmem, bytes);
+            /* XXX Emscripten Tracing API. */
+            if (mem != 0)
+                emscripten_trace_record_reallocation(oldmem, mem, bytes);
+        }
+        else {
+            /* Move chunks of other threads to this thread's arena. */
+            mem = dlmalloc(bytes);
+            if (mem != 0) {
+                size_t oc = mspace_usable_size(oldmem);
+                memcpy(mem, oldmem, (oc < bytes)? oc : bytes);
+                dlfree(oldmem);
+            }
+        }
+    }
+    return mem;
+}
+
+void* dlrealloc_in_place(void* oldmem, size_t bytes) {
+    /* With footers this works on the arena of the chunk, under its lock. */
+    void* mem = mspace_realloc_in_place(0, oldmem, bytes);
+    /* XXX Emscripten Tracing API. */
+    emscripten_trace_record_reallocation(oldmem, mem, bytes);
+    return mem;
+}
+
+void* dlmemalign(size_t alignment, size_t bytes) {
+    void* mem = 0;
+    struct thread_arena* a = thread_arena();
+    if (a != 0)
+        mem = mspace_memalign(a->ms, alignment, bytes);
+    else {
+        MALLOC_FAILURE_ACTION;
+    }
+    /* XXX Emscripten Tracing API. */
+    emscripten_trace_record_allocation(mem, bytes);
+    return mem;
+}
+
+int dlposix_memalign(void** pp, size_t alignment, size_t bytes) {
+    void* mem = 0;
+    if (alignment == MALLOC_ALIGNMENT)
+        mem = dlmalloc(bytes);
+    else {
+        size_t d = alignment / sizeof(void*);
+        size_t r = alignment % sizeof(void*);
+        if (r != 0 || d == 0 || (d & (d-SIZE_T_ONE)) != 0)
+            return EINVAL;
+        else if (bytes <= MAX_REQUEST - alignment)
+            mem = dlmemalign(alignment, bytes);
+    }
+    if (mem == 0)
+        return ENOMEM;
+    else {
+        *pp = mem;
+        return 0;
+    }
+}
+
+void* dlvalloc(size_t bytes) {
+    size_t pagesz;
+    ensure_initialization();
+    pagesz = mparams.page_size;
+    return dlmemalign(pagesz, bytes);
+}
+
+void* dlpvalloc(size_t bytes) {
+    size_t pagesz;
+    ensure_initialization();
+    pagesz = mparams.page_size;
+    return dlmemalign(pagesz, (bytes + pagesz - SIZE_T_ONE) & ~(pagesz - SIZE_T_ONE));
+}
+
+void** dlindependent_calloc(size_t n_elements, size_t elem_size,
+                            void* chunks[]) {
+    struct thread_arena* a = thread_arena();
+    return (a != 0)? mspace_independent_calloc(a->ms, n_elements, elem_size, chunks) : 0;
+}
+
+void** dlindependent_comalloc(size_t n_elements, size_t sizes[],
+                              void* chunks[]) {
+    struct thread_arena* a = thread_arena();
+    return (a != 0)? mspace_independent_comalloc(a->ms, n_elements, sizes, chunks) : 0;
+}
+
+size_t dlbulk_free(void* array[], size_t nelem) {
+    size_t i;
+    for (i = 0; i < nelem; ++i) {
+        if (array[i] != 0) {
+            dlfree(array[i]);
+            array[i] = 0;
+        }
+    }
+    return 0;
+}
+
+#if MALLOC_INSPECT_ALL
+void dlmalloc_inspect_all(void(*handler)(void *start,
+                                         void *end,
+                                         size_t used_bytes,
+                                         void* callback_arg),
+                          void* arg) {
+    struct thread_arena* a;
+    for (a = first_arena(); a != 0; a = a->next)
+        mspace_inspect_all(a->ms, handler, arg);
+}
+#endif /* MALLOC_INSPECT_ALL */
+
+int dlmalloc_trim(size_t pad) {
+    int result = 0;
+    struct thread_arena* a;
+    for (a = first_arena(); a != 0; a = a->next)
+        result |= mspace_trim(a->ms, pad);
+    return result;
+}
+
+size_t dlmalloc_footprint(void) {
+    size_t result = 0;
+    struct thread_arena* a;
+    for (a = first_arena(); a != 0; a = a->next)
+        result += a->ms->footprint;
+    return result;
+}
+
+size_t dlmalloc_max_footprint(void) {
+    size_t result = 0;
+    struct thread_arena* a;
+    for (a = first_arena(); a != 0; a = a->next)
+        result += a->ms->max_footprint;
+    return result;
+}
+
+size_t dlmalloc_footprint_limit(void) {
+    size_t maf = arena_footprint_limit;
+    return maf == 0 ? MAX_SIZE_T : maf;
+}
+
+size_t dlmalloc_set_footprint_limit(size_t bytes) {
+    size_t result;  /* invert sense of 0 */
+    struct thread_arena* a;
+    if (bytes == 0)
+        result = granularity_align(1); /* Use minimal size */
+    if (bytes == MAX_SIZE_T)
+        result = 0;                    /* disable */
+    else
+        result = granularity_align(bytes);
+    ACQUIRE_MALLOC_GLOBAL_LOCK();
+    arena_footprint_limit = result;
+    for (a = all_arenas; a != 0; a = a->next)
+        a->ms->footprint_limit = result;
+    RELEASE_MALLOC_GLOBAL_LOCK();
+    return result;
+}
+
+#if !NO_MALLINFO
+struct mallinfo dlmallinfo(void) {
+    struct mallinfo nm = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+    struct thread_arena* a;
+    for (a = first_arena(); a != 0; a = a->next) {
+        struct mallinfo m = mspace_mallinfo(a->ms);
+        nm.arena    += m.arena;
+        nm.ordblks  += m.ordblks;
+        nm.hblkhd   += m.hblkhd;
+        nm.usmblks  += m.usmblks;
+        nm.uordblks += m.uordblks;
+        nm.fordblks += m.fordblks;
+        nm.keepcost += m.keepcost;
+    }
+    return nm;
+}
+#endif /* NO_MALLINFO */
+
+#if !NO_MALLOC_STATS
+void dlmalloc_stats() {
+    struct thread_arena* a;
+    for (a = first_arena(); a != 0; a = a->next)
+        mspace_malloc_stats(a->ms);
+}
+#endif /* NO_MALLOC_STATS */
+
+int dlmallopt(int param_number, int value) {
+    return change_mparam(param_number, value);
+}
+
+size_t dlmalloc_usable_size(void* mem) {
+    return mspace_usable_size(mem);
+}
+
+#endif /* DLMALLOC_THREAD_ARENAS */
+
 // Export malloc and free as duplicate names emscripten_builtin_malloc and
 // emscripten_builtin_free so that applications can replace malloc and free
 // in their code, and make those replacements refer to the original dlmalloc
 // and dlfree from this file.
 // This allows an easy mechanism for hooking into memory allocation.
-#if defined(__EMSCRIPTEN__) && !ONLY_MSPACES
+#if defined(__EMSCRIPTEN__) && (!ONLY_MSPACES || DLMALLOC_THREAD_ARENAS)
 #ifdef __asmjs__
 // XXX This is to support the fastcomp hack above where we remove the dl prefix.
 // TODO: Remove this branch when fastcomp is removed.
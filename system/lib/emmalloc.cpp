@@ -9,7 +9,7 @@
  * Assumptions:
  *
  *  - Pointers are 32-bit.
- *  - Single-threaded.
+ *  - Single-threaded, unless built with pthreads (see "Threading" below).
  *  - sbrk() is used, and nothing else.
  *  - sbrk() will not be accessed by anyone else.
  *  - sbrk() is very fast in most cases (internal wasm call).
@@ -37,10 +37,33 @@
  *  - Debugging and logging uses EM_ASM, not printf etc., to minimize any
  *    risk of debugging or logging depending on malloc.
  *
- * TODO
+ * Threading:
  *
- *  - Optimizations for small allocations that are not multiples of 8, like
- *    12 and 20 (which take 24 and 32 bytes respectively)
+ *  - With pthreads, all the region and freelist state is protected by a
+ *    single spinlock, which is taken by the public API functions.
+ *  - To avoid taking that lock in the common case, each thread keeps a small
+ *    cache of recently freed small regions, which it can hand out again
+ *    without any synchronization. Regions in a thread cache are still marked
+ *    as used as far as the rest of the allocator is concerned.
+ *  - When a thread cache fills up, regions overflow into a shared cache, which
+ *    is a set of lock-free stacks that other threads can grab from (atomically
+ *    taking the whole stack, which avoids the ABA problem). Only when that is
+ *    full too do we take the lock and really free the region.
+ *  - When a thread exits, a pthread key destructor really frees what is left
+ *    in its cache.
+ *
+ * Trimming:
+ *
+ *  - emmalloc_trim() (or malloc_trim()) gives back a free region at the end of
+ *    the heap using sbrk(), and zeroes out large free regions elsewhere.
+ *    emmalloc_set_trim_threshold() sets up doing the former automatically.
+ *
+ * Slabs:
+ *
+ *  - If EMMALLOC_SLABS is defined, allocations of up to 256 bytes are served
+ *    from size-class slabs instead of regions. Objects in slabs have no
+ *    metadata, and so e.g. 12 and 20 byte allocations only take 16 and 24
+ *    bytes, instead of 24 and 32 bytes as regions (see "Slabs" below).
  *
  */
 
@@ -51,6 +74,13 @@
 #include <string.h> // for memcpy, memset
 #include <unistd.h> // for sbrk()
 
+#include <emscripten/emmalloc.h>
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include <emscripten/threading.h> // for emscripten_atomic_*
+#include <pthread.h> // for freeing thread caches on thread exit
+#endif
+
 #define EMMALLOC_EXPORT __attribute__((__weak__, __visibility__("default")))
 
 // Assumptions
@@ -154,15 +184,16 @@ struct Region {
   // Whether this region is in use or not.
   size_t _used : 1;
 
+  // Whether this region is free and its payload after the freelist info is
+  // known to be all zeros, so that emmalloc_trim() need not zero it again.
+  // Using the region, or growing it, clears this.
+  size_t _zeroed : 1;
+
   // The total size of the section of memory this is associated
-  // with and contained in.
+  // with and contained in, shifted right by 1, as it is always even.
   // That includes the metadata itself and the payload memory after,
   // which includes the used and unused portions of it.
-  // FIXME: Shift by 1, as our size is even anyhow?
-  //        Or, disallow allocation of half the total space or above.
-  //        Browsers barely allow allocating 2^31 anyhow, so inside that
-  //        space we can just allocate something smaller than it.
-  size_t _totalSize : 31;
+  size_t _halfTotalSize : 30;
 
   // Each memory area knows its previous neighbor, as we hope to merge them.
   // To compute the next neighbor we can use the total size, and to know
@@ -176,13 +207,31 @@ struct Region {
     char _payload[];
   };
 
-  size_t getTotalSize() { return _totalSize; }
-  void setTotalSize(size_t x) { _totalSize = x; }
-  void incTotalSize(size_t x) { _totalSize += x; }
-  void decTotalSize(size_t x) { _totalSize -= x; }
+  size_t getTotalSize() { return size_t(_halfTotalSize) << 1; }
+  void setTotalSize(size_t x) {
+    assert(x % 2 == 0);
+    _halfTotalSize = x >> 1;
+    _zeroed = 0;
+  }
+  void incTotalSize(size_t x) {
+    assert(x % 2 == 0);
+    _halfTotalSize += x >> 1;
+    _zeroed = 0;
+  }
+  // Shrinking leaves the rest of the payload as it was.
+  void decTotalSize(size_t x) {
+    assert(x % 2 == 0);
+    _halfTotalSize -= x >> 1;
+  }
 
   size_t getUsed() { return _used; }
-  void setUsed(size_t x) { _used = x; }
+  void setUsed(size_t x) {
+    _used = x;
+    _zeroed = 0;
+  }
+
+  size_t getZeroed() { return _zeroed; }
+  void setZeroed() { _zeroed = 1; }
 
   Region*& prev() { return _prev; }
   // The next region is not, as we compute it on the fly
@@ -495,11 +544,497 @@ static Region* useFreeInfo(FreeInfo* freeInfo, size_t size) {
   return region;
 }
 
+// Trimming
+
+// If nonzero, whenever a free leaves a free region at the end of memory
+// with at least this much payload, we give it back using sbrk().
+static size_t trimThreshold = 0;
+
+// emmalloc_trim() zeroes out the payload of free regions at least this big.
+// Memory can't be given back to the system in wasm, but zeroed memory is
+// cheap for tools that snapshot or serialize the heap.
+static const size_t ZERO_FREE_REGION_SIZE = 65536;
+
+// Shrinks the last region, if it is free, to at most pad bytes of payload,
+// and gives back the rest with sbrk(). Returns 1 if memory was released.
+static int trimLastRegion(size_t pad) {
+#ifdef EMMALLOC_DEBUG_LOG
+  EM_ASM({out("  emmalloc.trimLastRegion " + $0)}, pad);
+#endif
+  if (!lastRegion || lastRegion->getUsed()) {
+    return 0;
+  }
+  size_t keep = alignUp(pad < ALLOC_UNIT ? ALLOC_UNIT : pad);
+  size_t payload = getMaxPayload(lastRegion);
+  if (payload <= keep) {
+    return 0;
+  }
+  // We can only shrink if no one else has used sbrk() after us.
+  if (getAfter(lastRegion) != sbrk(0)) {
+    return 0;
+  }
+  size_t release = payload - keep;
+  if (sbrk(-intptr_t(release)) == (void*)-1) {
+    return 0;
+  }
+  // The size determines the freelist we are in.
+  removeFromFreeList(lastRegion);
+  lastRegion->decTotalSize(release);
+  addToFreeList(lastRegion);
+  return 1;
+}
+
+static void maybeTrimAutomatically() {
+  if (trimThreshold && lastRegion && !lastRegion->getUsed() &&
+      getMaxPayload(lastRegion) >= trimThreshold) {
+    trimLastRegion(0);
+  }
+}
+
+// Zeroes out large free regions that were not already zeroed by a previous
+// call. Returns 1 if anything was zeroed.
+static int zeroFreeRegions() {
+  int zeroed = 0;
+  // All the regions in these freelists are big enough.
+  for (size_t i = lowerBoundPowerOf2(ZERO_FREE_REGION_SIZE); i < MAX_FREELIST_INDEX; i++) {
+    for (FreeInfo* freeInfo = freeLists[i]; freeInfo; freeInfo = freeInfo->next()) {
+      Region* region = fromFreeInfo(freeInfo);
+      if (region->getZeroed()) {
+        continue;
+      }
+      // Don't clobber the freelist info itself.
+      memset((char*)freeInfo + sizeof(FreeInfo), 0, getMaxPayload(region) - sizeof(FreeInfo));
+      region->setZeroed();
+      zeroed = 1;
+    }
+  }
+  return zeroed;
+}
+
+// Slabs
+
+#ifdef EMMALLOC_SLABS
+
+// Small allocations are served from slabs: regions of SLAB_SIZE bytes,
+// aligned to SLAB_SIZE, that contain objects of a single size class. The
+// objects have no metadata of their own, so e.g. 12 and 20 byte allocations
+// only take 16 and 24 bytes. A bitmap in the slab header tracks which
+// objects are free, and a global bitmap of all SLAB_SIZE pages tells us
+// whether a pointer is in a slab or a normal region.
+
+static const size_t SLAB_SIZE = 16384;
+
+// Allocations up to this size go in slabs. There is a size class for each
+// multiple of ALLOC_UNIT.
+static const size_t SLAB_MAX_PAYLOAD = 256;
+
+static const size_t NUM_SLAB_CLASSES = SLAB_MAX_PAYLOAD / ALLOC_UNIT;
+
+static const size_t SLAB_BITMAP_WORDS = SLAB_SIZE / ALLOC_UNIT / SIZE_T_BIT;
+
+// Forward declaration for convenience.
+static void* alignedAllocation(size_t size, size_t alignment);
+
+struct Slab {
+  // Slabs with free objects are in a doubly-linked list for their class.
+  Slab* _prev;
+  Slab* _next;
+
+  size_t objectSize;
+  size_t numObjects;
+  size_t numFree;
+
+  // The first word in the bitmap that may have a free bit.
+  size_t hint;
+
+  // A set bit means the object is free.
+  size_t freeBits[SLAB_BITMAP_WORDS];
+
+  Slab*& prev() { return _prev; }
+  Slab*& next() { return _next; }
+
+  // The objects start right after the header.
+  char* objects() { return (char*)this + alignUp(sizeof(Slab)); }
+};
+
+// We allocate the slab with a size that takes into account the metadata
+// of the region it is in, so that the next slab after it (if allocated
+// immediately) is already aligned.
+static const size_t SLAB_PAYLOAD = SLAB_SIZE - METADATA_SIZE;
+
+static Slab* partialSlabs[NUM_SLAB_CLASSES];
+
+// One bit for each SLAB_SIZE page in the address space, which is at most
+// 2GB (see sbrk()).
+static size_t slabPages[(size_t(1) << 31) / SLAB_SIZE / SIZE_T_BIT];
+
+static size_t getSlabClass(size_t size) {
+  assert(size > 0 && size <= SLAB_MAX_PAYLOAD);
+  return alignUp(size) / ALLOC_UNIT - 1;
+}
+
+static Slab* fromSlabObject(void* ptr) { return (Slab*)(size_t(ptr) & -SLAB_SIZE); }
+
+static bool isSlabObject(void* ptr) {
+  size_t page = size_t(ptr) / SLAB_SIZE;
+  return slabPages[page / SIZE_T_BIT] & (size_t(1) << (page % SIZE_T_BIT));
+}
+
+static void setSlabPage(Slab* slab, bool value) {
+  size_t page = size_t(slab) / SLAB_SIZE;
+  size_t bit = size_t(1) << (page % SIZE_T_BIT);
+  if (value) {
+    slabPages[page / SIZE_T_BIT] |= bit;
+  } else {
+    slabPages[page / SIZE_T_BIT] &= ~bit;
+  }
+}
+
+static void addToPartialSlabs(Slab* slab, size_t index) {
+  Slab* last = partialSlabs[index];
+  partialSlabs[index] = slab;
+  slab->prev() = nullptr;
+  slab->next() = last;
+  if (last) {
+    last->prev() = slab;
+  }
+}
+
+static void removeFromPartialSlabs(Slab* slab, size_t index) {
+  if (partialSlabs[index] == slab) {
+    partialSlabs[index] = slab->next();
+  }
+  if (slab->prev()) {
+    slab->prev()->next() = slab->next();
+  }
+  if (slab->next()) {
+    slab->next()->prev() = slab->prev();
+  }
+}
+
+static Slab* newSlab(size_t index) {
+#ifdef EMMALLOC_DEBUG_LOG
+  EM_ASM({out("  emmalloc.newSlab " + $0)}, index);
+#endif
+  Slab* slab = (Slab*)alignedAllocation(SLAB_PAYLOAD, SLAB_SIZE);
+  if (!slab) {
+    return nullptr;
+  }
+  assert(size_t(slab) % SLAB_SIZE == 0);
+  size_t objectSize = (index + 1) * ALLOC_UNIT;
+  size_t numObjects = (SLAB_PAYLOAD - alignUp(sizeof(Slab))) / objectSize;
+  assert(numObjects <= SLAB_BITMAP_WORDS * SIZE_T_BIT);
+  slab->objectSize = objectSize;
+  slab->numObjects = numObjects;
+  slab->numFree = numObjects;
+  slab->hint = 0;
+  for (size_t i = 0; i < SLAB_BITMAP_WORDS; i++) {
+    if (numObjects >= SIZE_T_BIT) {
+      slab->freeBits[i] = size_t(-1);
+      numObjects -= SIZE_T_BIT;
+    } else {
+      slab->freeBits[i] = (size_t(1) << numObjects) - 1;
+      numObjects = 0;
+    }
+  }
+  setSlabPage(slab, true);
+  addToPartialSlabs(slab, index);
+  return slab;
+}
+
+static void* slabMalloc(size_t size) {
+  size_t index = getSlabClass(size);
+  Slab* slab = partialSlabs[index];
+  if (!slab) {
+    slab = newSlab(index);
+    if (!slab) {
+      return nullptr;
+    }
+  }
+  assert(slab->numFree > 0);
+  // The hint is the first word that may have free bits, and since this
+  // slab is not full, we must find some.
+  size_t i = slab->hint;
+  while (!slab->freeBits[i]) {
+    i++;
+    assert(i < SLAB_BITMAP_WORDS);
+  }
+  size_t bit = __builtin_ctz(slab->freeBits[i]);
+  slab->freeBits[i] &= ~(size_t(1) << bit);
+  slab->hint = i;
+  if (--slab->numFree == 0) {
+    removeFromPartialSlabs(slab, index);
+  }
+  return slab->objects() + (i * SIZE_T_BIT + bit) * slab->objectSize;
+}
+
+static void slabFree(void* ptr) {
+  Slab* slab = fromSlabObject(ptr);
+  size_t offset = (char*)ptr - slab->objects();
+  assert(offset % slab->objectSize == 0);
+  size_t object = offset / slab->objectSize;
+  assert(object < slab->numObjects);
+  size_t i = object / SIZE_T_BIT;
+  size_t bit = size_t(1) << (object % SIZE_T_BIT);
+  assert(!(slab->freeBits[i] & bit));
+  slab->freeBits[i] |= bit;
+  if (i < slab->hint) {
+    slab->hint = i;
+  }
+  size_t index = getSlabClass(slab->objectSize);
+  slab->numFree++;
+  if (slab->numFree == 1) {
+    // It was full, and now it can be used again.
+    addToPartialSlabs(slab, index);
+  } else if (slab->numFree == slab->numObjects && (slab->prev() || slab->next())) {
+    // It is completely free, and there is another slab for this class
+    // that we can use, so give the memory back. (Keeping one around avoids
+    // thrashing when a single object is repeatedly allocated and freed.)
+#ifdef EMMALLOC_DEBUG_LOG
+    EM_ASM({out("  emmalloc.slabFree releasing slab " + $0)}, slab);
+#endif
+    removeFromPartialSlabs(slab, index);
+    setSlabPage(slab, false);
+    stopUsing(fromPayload(slab));
+  }
+}
+
+static void clearSlabs() {
+  for (size_t i = 0; i < NUM_SLAB_CLASSES; i++) {
+    partialSlabs[i] = nullptr;
+  }
+  memset(slabPages, 0, sizeof(slabPages));
+}
+
+#endif // EMMALLOC_SLABS
+
+// Returns how many bytes can be used in an allocation.
+static size_t getUsableSize(void* ptr) {
+#ifdef EMMALLOC_SLABS
+  if (isSlabObject(ptr)) {
+    return fromSlabObject(ptr)->objectSize;
+  }
+#endif
+  return getMaxPayload(fromPayload(ptr));
+}
+
+// Threading
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+
+// The lock around all the global state. This should only rarely be
+// contended, as small allocations go through the caches below, so a
+// simple spinlock is good enough (and it works on the main browser
+// thread, where we cannot block on a futex).
+static volatile uint32_t globalLock = 0;
+
+struct ScopedLock {
+  ScopedLock() {
+    while (emscripten_atomic_cas_u32((void*)&globalLock, 0, 1) != 0) {
+    }
+  }
+  ~ScopedLock() { emscripten_atomic_store_u32((void*)&globalLock, 0); }
+};
+
+#define EMMALLOC_LOCK() ScopedLock emmallocScopedLock
+
+// Thread-local storage is only available in the wasm backend; without it
+// we just use the lock for everything.
+#ifdef __wasm__
+#define EMMALLOC_THREAD_CACHE
+#endif
+
+#else // __EMSCRIPTEN_PTHREADS__
+
+#define EMMALLOC_LOCK()
+
+#endif // __EMSCRIPTEN_PTHREADS__
+
+#ifdef EMMALLOC_THREAD_CACHE
+
+// Allocations with a usable size up to this are cached. There is a cache
+// bucket for each multiple of ALLOC_UNIT, and an allocation (a region, or
+// an object in a slab) is placed in the bucket of its exact usable size, so
+// anything in a bucket is big enough for any allocation that rounds up to
+// that size.
+static const size_t THREAD_CACHE_MAX_PAYLOAD = 256;
+
+static const size_t NUM_THREAD_CACHE_BUCKETS = THREAD_CACHE_MAX_PAYLOAD / ALLOC_UNIT;
+
+// How many regions a thread keeps in each bucket before it overflows into
+// the shared cache.
+static const size_t THREAD_CACHE_BUCKET_SIZE = 32;
+
+// How many regions the shared cache may hold in each bucket before we
+// really free them, which bounds how much memory can be kept in caches
+// and not available to larger allocations.
+static const size_t SHARED_CACHE_BUCKET_SIZE = 256;
+
+// The caches are singly-linked lists, using FreeInfo::next().
+static __thread FreeInfo* threadCache[NUM_THREAD_CACHE_BUCKETS];
+static __thread uint32_t threadCacheCounts[NUM_THREAD_CACHE_BUCKETS];
+
+static FreeInfo* volatile sharedCache[NUM_THREAD_CACHE_BUCKETS];
+static volatile uint32_t sharedCacheCounts[NUM_THREAD_CACHE_BUCKETS];
+
+// Whether the calling thread has set up freeing its cache when it exits.
+static __thread int threadCacheRegistered;
+
+// A pthread key, whose destructor frees the cache of an exiting thread, as
+// nothing else could ever use the regions in it.
+static pthread_key_t threadCacheKey;
+static pthread_once_t threadCacheKeyOnce = PTHREAD_ONCE_INIT;
+
+static void releaseThreadCache(void*);
+
+static void createThreadCacheKey() { pthread_key_create(&threadCacheKey, releaseThreadCache); }
+
+static void registerThreadCache() {
+  pthread_once(&threadCacheKeyOnce, createThreadCacheKey);
+  // Destructors only run for keys with a non-null value.
+  pthread_setspecific(threadCacheKey, (void*)1);
+  threadCacheRegistered = 1;
+}
+
+static size_t getThreadCacheBucket(size_t payload) {
+  assert(payload > 0 && payload % ALLOC_UNIT == 0);
+  return payload / ALLOC_UNIT - 1;
+}
+
+// Grab the entire shared stack for a bucket. Taking everything with a
+// single exchange (and never popping individual items) avoids the ABA
+// problem.
+static void refillThreadCache(size_t bucket) {
+  FreeInfo* list = (FreeInfo*)emscripten_atomic_exchange_u32((void*)&sharedCache[bucket], 0);
+  if (!list) {
+    return;
+  }
+  uint32_t count = 0;
+  FreeInfo* last = list;
+  while (1) {
+    count++;
+    if (!last->next()) {
+      break;
+    }
+    last = last->next();
+  }
+  emscripten_atomic_sub_u32((void*)&sharedCacheCounts[bucket], count);
+  last->next() = threadCache[bucket];
+  threadCache[bucket] = list;
+  threadCacheCounts[bucket] += count;
+}
+
+static void* tryFromThreadCache(size_t size) {
+  if (size == 0)
+    size = 1;
+  size = alignUp(size);
+  if (size > THREAD_CACHE_MAX_PAYLOAD) {
+    return nullptr;
+  }
+  size_t bucket = getThreadCacheBucket(size);
+  if (!threadCache[bucket]) {
+    refillThreadCache(bucket);
+    if (!threadCache[bucket]) {
+      return nullptr;
+    }
+  }
+  FreeInfo* freeInfo = threadCache[bucket];
+  threadCache[bucket] = freeInfo->next();
+  threadCacheCounts[bucket]--;
+  return (void*)freeInfo;
+}
+
+// Returns 1 if the region was cached, and 0 if the caller must free it
+// normally.
+static int tryToThreadCache(void* ptr) {
+  size_t payload = getUsableSize(ptr);
+  if (payload > THREAD_CACHE_MAX_PAYLOAD) {
+    return 0;
+  }
+  size_t bucket = getThreadCacheBucket(payload);
+  FreeInfo* freeInfo = (FreeInfo*)ptr;
+  if (threadCacheCounts[bucket] < THREAD_CACHE_BUCKET_SIZE) {
+    if (!threadCacheRegistered) {
+      registerThreadCache();
+    }
+    freeInfo->next() = threadCache[bucket];
+    threadCache[bucket] = freeInfo;
+    threadCacheCounts[bucket]++;
+    return 1;
+  }
+  // The count is only approximate, as it is updated separately from the
+  // stack, but that is fine for a bound.
+  if (emscripten_atomic_load_u32((void*)&sharedCacheCounts[bucket]) >= SHARED_CACHE_BUCKET_SIZE) {
+    return 0;
+  }
+  emscripten_atomic_add_u32((void*)&sharedCacheCounts[bucket], 1);
+  while (1) {
+    FreeInfo* head = sharedCache[bucket];
+    freeInfo->next() = head;
+    if (emscripten_atomic_cas_u32((void*)&sharedCache[bucket], (uint32_t)head,
+          (uint32_t)freeInfo) == (uint32_t)head) {
+      return 1;
+    }
+  }
+}
+
+// Forward declaration for convenience.
+static void emmalloc_free(void* ptr);
+
+// Really frees everything in the calling thread's cache. The lock must be
+// held.
+static void freeThreadCache() {
+  for (size_t i = 0; i < NUM_THREAD_CACHE_BUCKETS; i++) {
+    FreeInfo* freeInfo = threadCache[i];
+    while (freeInfo) {
+      FreeInfo* next = freeInfo->next();
+      emmalloc_free(freeInfo);
+      freeInfo = next;
+    }
+    threadCache[i] = nullptr;
+    threadCacheCounts[i] = 0;
+  }
+}
+
+// Really frees everything in the calling thread's cache and in the shared
+// cache. The lock must be held.
+static void flushThreadCaches() {
+  for (size_t i = 0; i < NUM_THREAD_CACHE_BUCKETS; i++) {
+    refillThreadCache(i);
+  }
+  freeThreadCache();
+}
+
+static void releaseThreadCache(void*) {
+  EMMALLOC_LOCK();
+  freeThreadCache();
+  // A destructor that runs after this one may free more, and register again.
+  threadCacheRegistered = 0;
+}
+
+static void clearThreadCaches() {
+  for (size_t i = 0; i < NUM_THREAD_CACHE_BUCKETS; i++) {
+    threadCache[i] = nullptr;
+    threadCacheCounts[i] = 0;
+    sharedCache[i] = nullptr;
+    sharedCacheCounts[i] = 0;
+  }
+}
+
+#endif // EMMALLOC_THREAD_CACHE
+
 // Debugging
 
 // Mostly for testing purposes, wipes everything.
 EMMALLOC_EXPORT
 void emmalloc_blank_slate_from_orbit() {
+  EMMALLOC_LOCK();
+#ifdef EMMALLOC_THREAD_CACHE
+  clearThreadCaches();
+#endif
+#ifdef EMMALLOC_SLABS
+  clearSlabs();
+#endif
   for (int i = 0; i < MAX_FREELIST_INDEX; i++) {
     freeLists[i] = nullptr;
   }
@@ -580,6 +1115,28 @@ static void emmalloc_validate_all() {
       curr = curr->next();
     }
   }
+#ifdef EMMALLOC_SLABS
+  // Validate slabs.
+  for (size_t i = 0; i < NUM_SLAB_CLASSES; i++) {
+    Slab* prev = nullptr;
+    for (Slab* slab = partialSlabs[i]; slab; slab = slab->next()) {
+      assert(slab->prev() == prev);
+      assert(isSlabObject(slab));
+      assert(fromPayload(slab)->getUsed());
+      assert(getSlabClass(slab->objectSize) == i);
+      assert(slab->numFree > 0 && slab->numFree <= slab->numObjects);
+      size_t numFree = 0;
+      for (size_t j = 0; j < SLAB_BITMAP_WORDS; j++) {
+        numFree += __builtin_popcount(slab->freeBits[j]);
+        if (j < slab->hint) {
+          assert(!slab->freeBits[j]);
+        }
+      }
+      assert(numFree == slab->numFree);
+      prev = slab;
+    }
+  }
+#endif
   // Validate lastRegion.
   if (lastRegion) {
     assert(lastRegion->next() == nullptr);
@@ -806,6 +1363,11 @@ static void* emmalloc_malloc(size_t size) {
   // though returning nullptr is permitted by the standard.
   if (size == 0)
     size = 1;
+#ifdef EMMALLOC_SLABS
+  if (size <= SLAB_MAX_PAYLOAD) {
+    return slabMalloc(size);
+  }
+#endif
   // Look in the freelist first.
   Region* region = tryFromFreeList(size);
   if (!region) {
@@ -823,7 +1385,16 @@ static void* emmalloc_malloc(size_t size) {
 static void emmalloc_free(void* ptr) {
   if (ptr == nullptr)
     return;
+#ifdef EMMALLOC_SLABS
+  if (isSlabObject(ptr)) {
+    // This may release the whole slab.
+    slabFree(ptr);
+    maybeTrimAutomatically();
+    return;
+  }
+#endif
   stopUsing(fromPayload(ptr));
+  maybeTrimAutomatically();
 }
 
 static void* emmalloc_calloc(size_t nmemb, size_t size) {
@@ -843,6 +1414,20 @@ static void* emmalloc_realloc(void* ptr, size_t size) {
     emmalloc_free(ptr);
     return nullptr;
   }
+#ifdef EMMALLOC_SLABS
+  if (isSlabObject(ptr)) {
+    size_t objectSize = fromSlabObject(ptr)->objectSize;
+    if (size <= objectSize) {
+      return ptr;
+    }
+    void* newPtr = emmalloc_malloc(size);
+    if (!newPtr)
+      return nullptr;
+    memcpy(newPtr, ptr, objectSize);
+    slabFree(ptr);
+    return newPtr;
+  }
+#endif
   Region* region = fromPayload(ptr);
   assert(region->getUsed());
   // Grow it. First, maybe we can do simple growth in the current region.
@@ -922,7 +1507,7 @@ static struct mallinfo emmalloc_mallinfo() {
   info.usmblks = 0;
   info.fsmblks = 0;
   info.uordblks = 0;
-  info.ordblks = 0;
+  info.fordblks = 0;
   info.keepcost = 0;
   if (firstRegion) {
     info.arena = (char*)sbrk(0) - (char*)firstRegion;
@@ -937,9 +1522,32 @@ static struct mallinfo emmalloc_mallinfo() {
       region = region->next();
     }
   }
+#ifdef EMMALLOC_SLABS
+  // Slabs are used regions, but free objects in them are available for
+  // small allocations.
+  for (size_t i = 0; i < NUM_SLAB_CLASSES; i++) {
+    for (Slab* slab = partialSlabs[i]; slab; slab = slab->next()) {
+      info.smblks += slab->numFree;
+      info.fsmblks += slab->numFree * slab->objectSize;
+      info.uordblks -= slab->numFree * slab->objectSize;
+    }
+  }
+#endif
   return info;
 }
 
+static int trimHeap(size_t pad) {
+  int released = 0;
+#ifdef EMMALLOC_THREAD_CACHE
+  // Cached allocations are not free as far as regions are concerned, so
+  // we must free them first to be able to give back their memory.
+  flushThreadCaches();
+#endif
+  released |= trimLastRegion(pad);
+  released |= zeroFreeRegions();
+  return released;
+}
+
 // An aligned allocation. This is a rarer allocation path, and is
 // much less optimized - the assumption is that it is used for few
 // large allocations.
@@ -955,7 +1563,9 @@ static void* alignedAllocation(size_t size, size_t alignment) {
   //       using multiple tries?
   Region* fromFreeList = tryFromFreeList(size + alignment);
   if (fromFreeList && size_t(getPayload(fromFreeList)) % alignment == 0) {
-    // Luck has favored us.
+    // Luck has favored us. We don't need the extra space we asked for
+    // in order to be able to align.
+    possiblySplitRemainder(fromFreeList, size);
     return getPayload(fromFreeList);
   } else if (fromFreeList) {
     stopUsing(fromFreeList);
@@ -968,7 +1578,9 @@ static void* alignedAllocation(size_t size, size_t alignment) {
   // Ensure a region before us, which we may enlarge as necessary.
   if (!lastRegion) {
     // This allocation is not freeable, but there is one at most.
-    void* prev = emmalloc_malloc(MIN_REGION_SIZE);
+    // Note that we can't use emmalloc_malloc() here, as that may try
+    // to allocate a slab, which is itself an aligned allocation.
+    Region* prev = newAllocation(MIN_REGION_SIZE);
     if (!prev)
       return nullptr;
   }
@@ -1037,6 +1649,12 @@ extern "C" {
 
 EMMALLOC_EXPORT
 void* malloc(size_t size) {
+#ifdef EMMALLOC_THREAD_CACHE
+  if (void* ptr = tryFromThreadCache(size)) {
+    return ptr;
+  }
+#endif
+  EMMALLOC_LOCK();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.malloc " + $0)}, size);
@@ -1061,6 +1679,12 @@ void* malloc(size_t size) {
 
 EMMALLOC_EXPORT
 void free(void* ptr) {
+#ifdef EMMALLOC_THREAD_CACHE
+  if (ptr && tryToThreadCache(ptr)) {
+    return;
+  }
+#endif
+  EMMALLOC_LOCK();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.free " + $0)}, ptr);
@@ -1081,6 +1705,7 @@ void free(void* ptr) {
 
 EMMALLOC_EXPORT
 void* calloc(size_t nmemb, size_t size) {
+  EMMALLOC_LOCK();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.calloc " + $0)}, size);
@@ -1105,6 +1730,7 @@ void* calloc(size_t nmemb, size_t size) {
 
 EMMALLOC_EXPORT
 void* realloc(void* ptr, size_t size) {
+  EMMALLOC_LOCK();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.realloc " + [ $0, $1 ])}, ptr, size);
@@ -1129,6 +1755,7 @@ void* realloc(void* ptr, size_t size) {
 
 EMMALLOC_EXPORT
 int posix_memalign(void** memptr, size_t alignment, size_t size) {
+  EMMALLOC_LOCK();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.posix_memalign " + [ $0, $1, $2 ])}, memptr, alignment, size);
@@ -1153,6 +1780,7 @@ int posix_memalign(void** memptr, size_t alignment, size_t size) {
 
 EMMALLOC_EXPORT
 void* memalign(size_t alignment, size_t size) {
+  EMMALLOC_LOCK();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.memalign " + [ $0, $1 ])}, alignment, size);
@@ -1177,6 +1805,7 @@ void* memalign(size_t alignment, size_t size) {
 
 EMMALLOC_EXPORT
 struct mallinfo mallinfo() {
+  EMMALLOC_LOCK();
 #ifdef EMMALLOC_DEBUG
 #ifdef EMMALLOC_DEBUG_LOG
   EM_ASM({out("emmalloc.mallinfo")});
@@ -1189,6 +1818,47 @@ struct mallinfo mallinfo() {
   return emmalloc_mallinfo();
 }
 
+EMMALLOC_EXPORT
+int emmalloc_trim(size_t pad) {
+  EMMALLOC_LOCK();
+#ifdef EMMALLOC_DEBUG
+#ifdef EMMALLOC_DEBUG_LOG
+  EM_ASM({out("emmalloc.emmalloc_trim " + $0)}, pad);
+#endif
+  emmalloc_validate_all();
+#ifdef EMMALLOC_DEBUG_LOG
+  emmalloc_dump_all();
+#endif
+#endif
+  int result = trimHeap(pad);
+#ifdef EMMALLOC_DEBUG
+#ifdef EMMALLOC_DEBUG_LOG
+  EM_ASM({out("emmalloc.emmalloc_trim ==> " + $0)}, result);
+#endif
+#ifdef EMMALLOC_DEBUG_LOG
+  emmalloc_dump_all();
+#endif
+  emmalloc_validate_all();
+#endif
+  return result;
+}
+
+EMMALLOC_EXPORT
+int malloc_trim(size_t pad) { return emmalloc_trim(pad); }
+
+EMMALLOC_EXPORT
+void emmalloc_set_trim_threshold(size_t threshold) {
+  EMMALLOC_LOCK();
+  trimThreshold = threshold;
+}
+
+EMMALLOC_EXPORT
+size_t malloc_usable_size(void* ptr) {
+  if (!ptr)
+    return 0;
+  return getUsableSize(ptr);
+}
+
 // Export malloc and free as duplicate names emscripten_builtin_malloc and
 // emscripten_builtin_free so that applications can replace malloc and free
 // in their code, and make those replacements refer to the original malloc
@@ -7,6 +7,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #define __NEED_struct_iovec
@@ -18,6 +19,7 @@
 #include <libc/fcntl.h>
 #include <math.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
 #include <time.h>
 #include <wasi/api.h>
@@ -34,29 +36,44 @@ extern "C" {
 #define INODE_FILE 1
 #define INODE_DIR 2
 
+// Fields that nearly all inodes leave at their defaults. These are stored out of line, and only
+// allocated for the inodes that need them.
+struct inode_cold {
+  uint32_t uid; // User ID of the owner
+  uint32_t gid; // Group ID of the owning group
+  time_t ctime; // Time when the inode was last modified
+  time_t atime; // Time when the content was last accessed
+
+  // Specifies a remote server address where this inode can be located.
+  char* remoteurl;
+
+  // If the file is loaded lazily with HTTP Range requests, its downloaded blocks, or 0.
+  struct lazy_file* lazy;
+};
+
 struct inode {
-  char name[NAME_MAX + 1]; // NAME_MAX actual bytes + one byte for null termination.
-  inode* parent;           // ID of the parent node
+  const char* name; // Interned name of the inode, see intern_name().
+  inode* parent;    // ID of the parent node
   inode* sibling; // ID of a sibling node (these form a singular linked list that specifies the
                   // content under a directory)
   inode* child;   // ID of the first child node in a chain of children (the root of a linked list of
                   // inodes)
-  uint32_t uid;   // User ID of the owner
-  uint32_t gid;   // Group ID of the owning group
   uint32_t mode;  // r/w/x modes
-  time_t ctime;   // Time when the inode was last modified
   time_t mtime;   // Time when the content was last modified
-  time_t atime;   // Time when the content was last accessed
   size_t size;    // Size of the file in bytes
-  size_t capacity; // Amount of bytes allocated to pointer data
-  uint8_t* data;   // The actual file contents.
+  size_t capacity; // Amount of bytes allocated to the first chunk of the file
+  uint8_t** chunks;    // The actual file contents, see FILE_CHUNK_SIZE.
+  uint32_t num_chunks; // Number of entries in the chunks table
 
   INODE_TYPE type;
 
   emscripten_fetch_t* fetch;
 
-  // Specifies a remote server address where this inode can be located.
-  char* remoteurl;
+  inode_cold* cold; // Rarely used fields, or 0 if they all have their default values.
+
+  uint32_t num_children;   // Number of children linked under this directory
+  struct dir_index* index; // Hash table of the children of a large directory, or 0
+  inode* hash_next;        // Next inode in the same bucket of the parent directory's index
 };
 
 #define EM_FILEDESCRIPTOR_MAGIC 0x64666d65U // 'emfd'
@@ -69,15 +86,622 @@ struct FileDescriptor {
   inode* node;
 };
 
+// Directories that get more children than this are given a hash table index of their children, so
+// that finding a name in them does not need to walk the whole sibling list.
+#define DIR_INDEX_MIN_CHILDREN 16
+
+struct dir_index {
+  uint32_t num_buckets; // Always a power of two.
+  uint32_t num_entries;
+  inode* buckets[1];
+};
+
+// Guards the directory indices, the dentry cache, the name table and the inode slabs. These are
+// only held for short periods of time, so a spinlock is enough.
+static volatile int fs_index_lock = 0;
+
+static void lock_fs_index() {
+  while (__atomic_exchange_n(&fs_index_lock, 1, __ATOMIC_ACQUIRE))
+    ;
+}
+
+static void unlock_fs_index() { __atomic_store_n(&fs_index_lock, 0, __ATOMIC_RELEASE); }
+
+// FNV-1a hash of an inode name, which ends either at a null terminator or at a forward slash, so
+// that a name can be hashed in place inside a longer path.
+static uint32_t hash_inodename(const char* name) {
+  uint32_t hash = 2166136261u;
+  while (*name && *name != '/')
+    hash = (hash ^ (uint8_t)*name++) * 16777619u;
+  return hash;
+}
+
+static dir_index* alloc_dir_index(uint32_t num_buckets) {
+  dir_index* index =
+    (dir_index*)calloc(1, sizeof(dir_index) + (num_buckets - 1) * sizeof(inode*));
+  if (index)
+    index->num_buckets = num_buckets;
+  return index;
+}
+
+static void dir_index_insert(dir_index* index, inode* node) {
+  inode** bucket = &index->buckets[hash_inodename(node->name) & (index->num_buckets - 1)];
+  node->hash_next = *bucket;
+  *bucket = node;
+  ++index->num_entries;
+}
+
+// Adds node to the index of directory dir, creating or growing the index if needed. If memory runs
+// out, the directory is left without an index, or with longer hash chains. Call with fs_index_lock
+// held.
+static void dir_index_add(inode* dir, inode* node) {
+  if (!dir->index) {
+    if (dir->num_children < DIR_INDEX_MIN_CHILDREN)
+      return;
+    dir->index = alloc_dir_index(DIR_INDEX_MIN_CHILDREN * 2);
+    if (!dir->index)
+      return;
+    for (inode* child = dir->child; child; child = child->sibling)
+      dir_index_insert(dir->index, child);
+  } else if (dir->index->num_entries >= dir->index->num_buckets) {
+    dir_index* index = alloc_dir_index(dir->index->num_buckets * 2);
+    if (index) {
+      for (uint32_t i = 0; i < dir->index->num_buckets; ++i) {
+        inode* child = dir->index->buckets[i];
+        while (child) {
+          inode* next = child->hash_next;
+          dir_index_insert(index, child);
+          child = next;
+        }
+      }
+      free(dir->index);
+      dir->index = index;
+    }
+  }
+  dir_index_insert(dir->index, node);
+}
+
+// Call with fs_index_lock held.
+static void dir_index_remove(inode* dir, inode* node) {
+  if (!dir->index)
+    return;
+  inode** link = &dir->index->buckets[hash_inodename(node->name) & (dir->index->num_buckets - 1)];
+  while (*link && *link != node)
+    link = &(*link)->hash_next;
+  if (*link) {
+    *link = node->hash_next;
+    --dir->index->num_entries;
+  }
+  node->hash_next = 0;
+}
+
+// Cache of recently resolved paths (a "dentry cache"), so that accessing the same files over and
+// over again does not walk the directory tree each time. Entries are keyed by the directory the
+// path was resolved relative to, and by the path itself. Adding inodes to the tree does not change
+// the result of any successful lookup, but whenever an inode is unlinked or deleted, the generation
+// counter is bumped, which invalidates all cached entries at once.
+#define DENTRY_CACHE_SIZE 256 // Must be a power of two.
+
+struct dentry_cache_entry {
+  inode* root;
+  char* path;
+  inode* node;
+  uint32_t generation;
+};
+
+static dentry_cache_entry dentry_cache[DENTRY_CACHE_SIZE];
+static uint32_t dentry_cache_generation = 1; // Entries with generation 0 are unused.
+
+static void invalidate_dentry_cache() {
+  lock_fs_index();
+  ++dentry_cache_generation;
+  unlock_fs_index();
+}
+
+static dentry_cache_entry* dentry_cache_slot(inode* root, const char* path) {
+  uint32_t hash = 2166136261u ^ (uint32_t)(uintptr_t)root;
+  while (*path)
+    hash = (hash ^ (uint8_t)*path++) * 16777619u;
+  return &dentry_cache[hash & (DENTRY_CACHE_SIZE - 1)];
+}
+
+static inode* dentry_cache_lookup(inode* root, const char* path) {
+  inode* node = 0;
+  lock_fs_index();
+  dentry_cache_entry* e = dentry_cache_slot(root, path);
+  if (e->generation == dentry_cache_generation && e->root == root && !strcmp(e->path, path))
+    node = e->node;
+  unlock_fs_index();
+  return node;
+}
+
+// 'generation' is the value of dentry_cache_generation from before the path was resolved, so that
+// if the tree was changed while resolving, the entry is already stale when inserted.
+static void dentry_cache_insert(inode* root, const char* path, inode* node, uint32_t generation) {
+  char* pathCopy = strdup(path);
+  if (!pathCopy)
+    return;
+  lock_fs_index();
+  dentry_cache_entry* e = dentry_cache_slot(root, path);
+  char* oldPath = e->path;
+  e->root = root;
+  e->path = pathCopy;
+  e->node = node;
+  e->generation = generation;
+  unlock_fs_index();
+  free(oldPath);
+}
+
+// Inode names are interned: each distinct name is stored once, and shared by reference count
+// between all the inodes that have it, since large asset trees repeat the same names (index.html,
+// textures, etc.) across many directories.
+struct interned_name {
+  interned_name* next; // Next name in the same bucket of the name table
+  uint32_t hash;
+  uint32_t refcount;
+  char str[1];
+};
+
+static interned_name** name_table = 0;
+static uint32_t name_table_size = 0; // Number of buckets, always a power of two.
+static uint32_t num_interned_names = 0;
+static const char empty_name[1] = ""; // The name of the root, not kept in the table.
+
+static interned_name* interned_name_of(const char* name) {
+  return (interned_name*)(name - offsetof(interned_name, str));
+}
+
+// Returns the interned copy of the given name, which ends at a null terminator or at a forward
+// slash. The name may be at most NAME_MAX bytes long, see has_too_long_name(). Call with
+// fs_index_lock held.
+static const char* intern_name(const char* name) {
+  int len = 0;
+  uint32_t hash = 2166136261u;
+  while (name[len] && name[len] != '/')
+    hash = (hash ^ (uint8_t)name[len++]) * 16777619u;
+  assert(len <= NAME_MAX);
+  if (!len)
+    return empty_name;
+
+  if (name_table) {
+    for (interned_name* n = name_table[hash & (name_table_size - 1)]; n; n = n->next) {
+      if (n->hash == hash && !strncmp(n->str, name, len) && n->str[len] == '\0') {
+        ++n->refcount;
+        return n->str;
+      }
+    }
+  }
+
+  if (num_interned_names >= name_table_size) {
+    uint32_t size = name_table_size ? name_table_size * 2 : 256;
+    interned_name** table = (interned_name**)calloc(size, sizeof(interned_name*));
+    if (table) {
+      for (uint32_t i = 0; i < name_table_size; ++i) {
+        interned_name* n = name_table[i];
+        while (n) {
+          interned_name* next = n->next;
+          n->next = table[n->hash & (size - 1)];
+          table[n->hash & (size - 1)] = n;
+          n = next;
+        }
+      }
+      free(name_table);
+      name_table = table;
+      name_table_size = size;
+    }
+    assert(name_table);
+  }
+
+  interned_name* n = (interned_name*)malloc(offsetof(interned_name, str) + len + 1);
+  assert(n);
+  memcpy(n->str, name, len);
+  n->str[len] = '\0';
+  n->hash = hash;
+  n->refcount = 1;
+  interned_name** bucket = &name_table[hash & (name_table_size - 1)];
+  n->next = *bucket;
+  *bucket = n;
+  ++num_interned_names;
+  return n->str;
+}
+
+// Call with fs_index_lock held.
+static void release_name(const char* name) {
+  if (!name || name == empty_name)
+    return;
+  interned_name* n = interned_name_of(name);
+  if (--n->refcount > 0)
+    return;
+  interned_name** link = &name_table[n->hash & (name_table_size - 1)];
+  while (*link != n)
+    link = &(*link)->next;
+  *link = n->next;
+  --num_interned_names;
+  free(n);
+}
+
+// Sets the name of an inode that is not linked to the filesystem tree yet.
+static void set_inode_name(inode* node, const char* name) {
+  assert(!node->parent);
+  lock_fs_index();
+  const char* oldName = node->name;
+  node->name = intern_name(name);
+  release_name(oldName);
+  unlock_fs_index();
+}
+
+// Inodes are allocated from slabs of this many, and deleted inodes are kept in a free list for
+// reuse, rather than allocating each inode separately.
+#define INODE_SLAB_SIZE 64
+
+static inode* free_inodes = 0; // Linked through their parent field.
+
 static inode* create_inode(INODE_TYPE type, int mode) {
-  inode* i = (inode*)malloc(sizeof(inode));
+  lock_fs_index();
+  if (!free_inodes) {
+    inode* slab = (inode*)malloc(sizeof(inode) * INODE_SLAB_SIZE);
+    assert(slab); // Not a programming error, but use assert() in debug builds to catch OOM.
+    for (int i = 0; slab && i < INODE_SLAB_SIZE; ++i) {
+      slab[i].parent = free_inodes;
+      free_inodes = &slab[i];
+    }
+  }
+  inode* i = free_inodes;
+  if (i)
+    free_inodes = i->parent;
+  unlock_fs_index();
+  if (!i)
+    return 0;
+
   memset(i, 0, sizeof(inode));
-  i->ctime = i->mtime = i->atime = time(0);
+  i->name = empty_name;
+  i->mtime = time(0);
   i->type = type;
   i->mode = mode;
   return i;
 }
 
+// Returns the out of line fields of an inode, allocating them if necessary.
+static inode_cold* get_inode_cold(inode* node) {
+  if (!node->cold) {
+    inode_cold* cold = (inode_cold*)calloc(1, sizeof(inode_cold));
+    assert(cold);
+    cold->ctime = cold->atime = node->mtime;
+    inode_cold* expected = 0;
+    if (!__atomic_compare_exchange_n(
+          &node->cold, &expected, cold, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      free(cold); // Another thread allocated them first.
+  }
+  return node->cold;
+}
+
+static const char* inode_remoteurl(inode* node) {
+  return node->cold ? node->cold->remoteurl : 0;
+}
+
+// File contents are stored in chunks of this many bytes, so that growing a file never reallocates
+// and copies what was already written to it. Chunks that were never written to are holes, which
+// read as zeros. The first chunk starts out small and grows up to a full chunk, so that small files
+// don't take up a whole chunk each.
+#define FILE_CHUNK_SHIFT 16
+#define FILE_CHUNK_SIZE (1 << FILE_CHUNK_SHIFT)
+
+// Returns true if the file has contents stored in memory, rather than only in its fetch.
+static bool has_file_chunks(inode* node) { return node->chunks != 0; }
+
+// Returns chunk i of the file, allocating it if necessary so that it holds at least 'bytes' bytes,
+// or 0 if out of memory.
+static uint8_t* get_writable_chunk(inode* node, uint32_t i, size_t bytes) {
+  if (i >= node->num_chunks) {
+    uint32_t numChunks = node->num_chunks ? node->num_chunks : 4;
+    while (numChunks <= i)
+      numChunks *= 2;
+    uint8_t** chunks = (uint8_t**)realloc(node->chunks, numChunks * sizeof(uint8_t*));
+    if (!chunks)
+      return 0;
+    memset(chunks + node->num_chunks, 0, (numChunks - node->num_chunks) * sizeof(uint8_t*));
+    node->chunks = chunks;
+    node->num_chunks = numChunks;
+  }
+  if (i > 0) {
+    if (!node->chunks[i])
+      node->chunks[i] = (uint8_t*)calloc(1, FILE_CHUNK_SIZE);
+    return node->chunks[i];
+  }
+  if (node->capacity < bytes) {
+    size_t capacity = node->capacity ? node->capacity : 64;
+    while (capacity < bytes)
+      capacity *= 2;
+    if (capacity > FILE_CHUNK_SIZE)
+      capacity = FILE_CHUNK_SIZE;
+    uint8_t* chunk = (uint8_t*)realloc(node->chunks[0], capacity);
+    if (!chunk)
+      return 0;
+    memset(chunk + node->capacity, 0, capacity - node->capacity);
+    node->chunks[0] = chunk;
+    node->capacity = capacity;
+  }
+  return node->chunks[0];
+}
+
+// Writes len bytes to the file at the given offset. Returns false if out of memory.
+static bool write_file_chunks(inode* node, size_t offset, const uint8_t* src, size_t len) {
+  while (len > 0) {
+    uint32_t i = offset >> FILE_CHUNK_SHIFT;
+    size_t chunkOffset = offset & (FILE_CHUNK_SIZE - 1);
+    size_t n = FILE_CHUNK_SIZE - chunkOffset < len ? FILE_CHUNK_SIZE - chunkOffset : len;
+    uint8_t* chunk = get_writable_chunk(node, i, chunkOffset + n);
+    if (!chunk)
+      return false;
+    memcpy(chunk + chunkOffset, src, n);
+    offset += n;
+    src += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Reads len bytes from the file at the given offset. The caller checks against the file size.
+static void read_file_chunks(inode* node, size_t offset, uint8_t* dst, size_t len) {
+  while (len > 0) {
+    uint32_t i = offset >> FILE_CHUNK_SHIFT;
+    size_t chunkOffset = offset & (FILE_CHUNK_SIZE - 1);
+    size_t n = FILE_CHUNK_SIZE - chunkOffset < len ? FILE_CHUNK_SIZE - chunkOffset : len;
+    uint8_t* chunk = i < node->num_chunks ? node->chunks[i] : 0;
+    size_t chunkSize = !chunk ? 0 : (i == 0 ? node->capacity : FILE_CHUNK_SIZE);
+    size_t available = chunkOffset < chunkSize ? chunkSize - chunkOffset : 0;
+    if (available > n)
+      available = n;
+    if (available)
+      memcpy(dst, chunk + chunkOffset, available);
+    memset(dst + available, 0, n - available);
+    offset += n;
+    dst += n;
+    len -= n;
+  }
+}
+
+// Frees the contents of the file. If keepTable is true, the file still has (empty) contents in
+// memory afterwards, i.e. it is truncated rather than unloaded.
+static void free_file_chunks(inode* node, bool keepTable) {
+  for (uint32_t i = 0; i < node->num_chunks; ++i) {
+    free(node->chunks[i]);
+    node->chunks[i] = 0;
+  }
+  node->capacity = 0;
+  if (!keepTable) {
+    free(node->chunks);
+    node->chunks = 0;
+    node->num_chunks = 0;
+  }
+}
+
+// Returns the number of bytes of memory taken up by the file contents.
+static size_t file_chunks_memory_usage(inode* node) {
+  size_t sz = node->num_chunks * sizeof(uint8_t*) + node->capacity;
+  for (uint32_t i = 1; i < node->num_chunks; ++i)
+    if (node->chunks[i])
+      sz += FILE_CHUNK_SIZE;
+  return sz;
+}
+
+// File offsets are 32-bit signed, see llseek.
+#define ASMFS_MAX_FILE_OFFSET 0x7FFFFFFFLL
+
+// Files added with emscripten_asmfs_add_lazy_file() are downloaded on demand, a block at a time,
+// with HTTP Range requests, rather than as a whole when opened. The downloaded blocks of all lazy
+// files share a memory budget, and when it is exceeded, the least recently used blocks are evicted,
+// to be downloaded again if they are needed later.
+static uint32_t lazy_block_size = 1024 * 1024;
+static uint32_t lazy_read_ahead_blocks = 4;
+static uint64_t lazy_max_resident_bytes = 64 * 1024 * 1024;
+
+struct lazy_block {
+  struct lazy_file* file;
+  uint32_t index;
+  uint32_t size;        // Number of bytes in data. Only the last block of a file can be short.
+  lazy_block* lru_prev; // Toward the most recently used block
+  lazy_block* lru_next; // Toward the least recently used block
+  uint8_t data[1];
+};
+
+struct lazy_file {
+  char* url;
+  uint32_t block_size;
+  uint32_t num_blocks;
+  uint32_t next_sequential_block; // The block that a sequential reader would read next.
+  uint64_t resident_bytes;
+  lazy_block** blocks; // Downloaded blocks, 0 for blocks that are not in memory.
+};
+
+// Guards the blocks of lazy files and the LRU list. Readers hold this while copying out of a block,
+// so that it can't be evicted underneath them, but never while downloading.
+static volatile int lazy_lock = 0;
+
+static void lock_lazy_blocks() {
+  while (__atomic_exchange_n(&lazy_lock, 1, __ATOMIC_ACQUIRE))
+    ;
+}
+
+static void unlock_lazy_blocks() { __atomic_store_n(&lazy_lock, 0, __ATOMIC_RELEASE); }
+
+static lazy_block* lru_head = 0; // The most recently used block
+static lazy_block* lru_tail = 0; // The least recently used block
+static uint64_t lazy_resident_bytes = 0;
+
+// The following functions are called with lazy_lock held.
+static void lru_unlink(lazy_block* block) {
+  if (block->lru_prev)
+    block->lru_prev->lru_next = block->lru_next;
+  else
+    lru_head = block->lru_next;
+  if (block->lru_next)
+    block->lru_next->lru_prev = block->lru_prev;
+  else
+    lru_tail = block->lru_prev;
+  block->lru_prev = block->lru_next = 0;
+}
+
+static void lru_push_front(lazy_block* block) {
+  block->lru_prev = 0;
+  block->lru_next = lru_head;
+  if (lru_head)
+    lru_head->lru_prev = block;
+  else
+    lru_tail = block;
+  lru_head = block;
+}
+
+static void evict_lazy_block(lazy_block* block) {
+  lru_unlink(block);
+  block->file->blocks[block->index] = 0;
+  block->file->resident_bytes -= block->size;
+  lazy_resident_bytes -= block->size;
+  free(block);
+}
+
+// Adds a downloaded block, unless another thread already did, and evicts blocks to stay within the
+// budget, although the most recently used block is always kept.
+static void add_lazy_block(lazy_file* file, uint32_t index, const uint8_t* data, uint32_t size) {
+  if (file->blocks[index]) {
+    lru_unlink(file->blocks[index]);
+    lru_push_front(file->blocks[index]);
+    return;
+  }
+  lazy_block* block = (lazy_block*)malloc(offsetof(lazy_block, data) + size);
+  if (!block)
+    return;
+  block->file = file;
+  block->index = index;
+  block->size = size;
+  memcpy(block->data, data, size);
+  file->blocks[index] = block;
+  file->resident_bytes += size;
+  lazy_resident_bytes += size;
+  lru_push_front(block);
+  while (lazy_resident_bytes > lazy_max_resident_bytes && lru_tail != lru_head)
+    evict_lazy_block(lru_tail);
+}
+
+static void free_lazy_file(lazy_file* file) {
+  if (!file)
+    return;
+  lock_lazy_blocks();
+  for (uint32_t i = 0; i < file->num_blocks; ++i)
+    if (file->blocks[i])
+      evict_lazy_block(file->blocks[i]);
+  unlock_lazy_blocks();
+  free(file->blocks);
+  free(file->url);
+  free(file);
+}
+
+static lazy_file* inode_lazy(inode* node) { return node->cold ? node->cold->lazy : 0; }
+
+// Synchronously downloads the bytes [begin, end) of the given URL. Returns 0 on failure. A server
+// answers a range that starts at 0 with 416 Range Not Satisfiable if the file is empty, so that
+// response is returned as well, for the caller to check.
+static emscripten_fetch_t* fetch_range(const char* url, uint64_t begin, uint64_t end) {
+  if (end <= begin)
+    return 0;
+  char range[64];
+  sprintf(range, "bytes=%llu-%llu", (unsigned long long)begin, (unsigned long long)end - 1);
+  const char* headers[] = {"Range", range, 0};
+  emscripten_fetch_attr_t attr;
+  emscripten_fetch_attr_init(&attr);
+  strcpy(attr.requestMethod, "GET");
+  attr.attributes = EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_WAITABLE;
+  attr.requestHeaders = headers;
+  emscripten_fetch_t* fetch = emscripten_fetch(&attr, url);
+  if (!fetch)
+    return 0;
+  emscripten_fetch_wait(fetch, INFINITY);
+  if (fetch->status != 200 && fetch->status != 206 && (fetch->status != 416 || begin != 0)) {
+    emscripten_fetch_close(fetch);
+    return 0;
+  }
+  return fetch;
+}
+
+// Returns a pointer to byte 'offset' of the file in a completed fetch_range() download, which
+// holds the requested range, or the whole file if the server did not honor the Range header.
+static const uint8_t* fetched_range_data(emscripten_fetch_t* fetch, uint64_t begin, uint64_t offset) {
+  return (const uint8_t*)fetch->data + (fetch->status == 206 ? offset - begin : offset);
+}
+
+// Downloads block 'index' of the file, and if the file is being read sequentially, the blocks
+// after it that are not in memory either, in the same request. Returns false on failure.
+static bool download_lazy_blocks(inode* node, lazy_file* file, uint32_t index) {
+  uint32_t end = index + 1;
+  if (index == file->next_sequential_block) {
+    lock_lazy_blocks();
+    while (end < file->num_blocks && end - index <= lazy_read_ahead_blocks && !file->blocks[end])
+      ++end;
+    unlock_lazy_blocks();
+  }
+  uint64_t begin = (uint64_t)index * file->block_size;
+  uint64_t endByte = (uint64_t)end * file->block_size;
+  if (endByte > node->size)
+    endByte = node->size;
+
+  emscripten_fetch_t* fetch = fetch_range(file->url, begin, endByte);
+  if (!fetch)
+    return false;
+  uint64_t available = fetch->status == 206 ? begin + fetch->numBytes : fetch->numBytes;
+  if (available < endByte) {
+    emscripten_fetch_close(fetch);
+    return false;
+  }
+  lock_lazy_blocks();
+  // Add the requested block last, so that it is the most recently used.
+  for (uint32_t i = end; i-- > index;) {
+    uint64_t blockBegin = (uint64_t)i * file->block_size;
+    uint64_t blockEnd = blockBegin + file->block_size < endByte ? blockBegin + file->block_size : endByte;
+    add_lazy_block(file, i, fetched_range_data(fetch, begin, blockBegin), blockEnd - blockBegin);
+  }
+  unlock_lazy_blocks();
+  emscripten_fetch_close(fetch);
+  return true;
+}
+
+// Reads len bytes from the given offset of a lazily loaded file, downloading blocks as needed. The
+// caller checks against the file size. Returns 0 on success, or an errno value.
+static int read_lazy_file(inode* node, size_t offset, uint8_t* dst, size_t len) {
+  lazy_file* file = inode_lazy(node);
+  while (len > 0) {
+    uint32_t index = offset / file->block_size;
+    size_t blockOffset = offset - (size_t)index * file->block_size;
+    size_t n = file->block_size - blockOffset < len ? file->block_size - blockOffset : len;
+    for (int attempt = 0;; ++attempt) {
+      lock_lazy_blocks();
+      lazy_block* block = file->blocks[index];
+      if (block) {
+        if (blockOffset + n > block->size) {
+          unlock_lazy_blocks();
+          return EIO;
+        }
+        memcpy(dst, block->data + blockOffset, n);
+        lru_unlink(block);
+        lru_push_front(block);
+        file->next_sequential_block = index + 1;
+        unlock_lazy_blocks();
+        break;
+      }
+      unlock_lazy_blocks();
+      // Downloading can't be waited for on the main browser thread. If the block was downloaded,
+      // but evicted again before we got to read it, the budget is too small to be useful.
+      if (emscripten_is_main_browser_thread())
+        return EAGAIN;
+      if (attempt > 1 || !download_lazy_blocks(node, file, index))
+        return EIO;
+    }
+    offset += n;
+    dst += n;
+    len -= n;
+  }
+  return 0;
+}
+
 // The current working directory of the application process.
 static inode* cwd_inode = 0;
 
@@ -135,10 +759,21 @@ static void delete_inode(inode* node) {
 #ifdef ASMFS_DEBUG
   EM_ASM(err('delete_inode: ' + UTF8ToString($0)), node->name);
 #endif
+  invalidate_dentry_cache();
   if (node->fetch)
     emscripten_fetch_close(node->fetch);
-  free(node->remoteurl);
-  free(node);
+  free_file_chunks(node, false);
+  if (node->cold) {
+    free(node->cold->remoteurl);
+    free_lazy_file(node->cold->lazy);
+    free(node->cold);
+  }
+  free(node->index);
+  lock_fs_index();
+  release_name(node->name);
+  node->parent = free_inodes;
+  free_inodes = node;
+  unlock_fs_index();
 }
 
 // Deletes the given inode and its subtree
@@ -161,15 +796,21 @@ static void delete_inode_tree(inode* node) {
     delete_inode(node);
   } else {
     // For filesystem root, just make sure all children are gone.
+    lock_fs_index();
     node->child = 0;
+    node->num_children = 0;
+    free(node->index);
+    node->index = 0;
+    ++dentry_cache_generation;
+    unlock_fs_index();
   }
 }
 
 // Makes node the child of parent.
 static void link_inode(inode* node, inode* parent) {
+#ifdef ASMFS_DEBUG
   char parentName[PATH_MAX];
   inode_abspath(parent, parentName, PATH_MAX);
-#ifdef ASMFS_DEBUG
   EM_ASM(err('link_inode: node "' + UTF8ToString($0) + '" to parent "' + UTF8ToString($1) + '".'),
     node->name, parentName);
 #endif
@@ -183,6 +824,13 @@ static void link_inode(inode* node, inode* parent) {
   // that operation first.
   node->parent = parent;
 
+  // Index the node before publishing it in the sibling list, so that lookups never miss a node
+  // that can be found by listing the directory.
+  lock_fs_index();
+  dir_index_add(parent, node);
+  ++parent->num_children;
+  unlock_fs_index();
+
   // This node is to become the first child of the parent, and the old first child of the parent
   // should become the sibling of this node, i.e.
   //  1) node->sibling = parent->child;
@@ -221,6 +869,12 @@ static void unlink_inode(inode* node) {
     return;
   node->parent = 0;
 
+  lock_fs_index();
+  dir_index_remove(parent, node);
+  --parent->num_children;
+  ++dentry_cache_generation;
+  unlock_fs_index();
+
   if (parent->child == node) {
     parent->child = node->sibling;
   } else {
@@ -253,6 +907,34 @@ static const char* path_cmp(const char* s1, const char* s2, bool* is_directory)
   return 0;
 }
 
+// Finds the child of directory dir whose name matches the first component of path. On success,
+// returns the child, and like path_cmp() above, stores a pointer to the beginning of the next
+// component of path to child_path, and whether the matched component was followed by a slash to
+// is_directory.
+static inode* find_child(inode* dir, const char* path, const char** child_path, bool* is_directory) {
+  lock_fs_index();
+  if (dir->index) {
+    inode* node = dir->index->buckets[hash_inodename(path) & (dir->index->num_buckets - 1)];
+    while (node && !(*child_path = path_cmp(path, node->name, is_directory)))
+      node = node->hash_next;
+    unlock_fs_index();
+    return node;
+  }
+  unlock_fs_index();
+
+  inode* node = dir->child;
+  while (node) {
+#ifdef ASMFS_DEBUG
+    EM_ASM_INT({err('path_cmp ' + UTF8ToString($0) + ', ' + UTF8ToString($1) + ' .')}, path,
+      node->name);
+#endif
+    if ((*child_path = path_cmp(path, node->name, is_directory)))
+      return node;
+    node = node->sibling;
+  }
+  return 0;
+}
+
 #define NIBBLE_TO_CHAR(x) ("0123456789abcdef"[(x)])
 static void uriEncode(char* dst, int dstLengthBytes, const char* src) {
   char* end =
@@ -271,16 +953,6 @@ static void uriEncode(char* dst, int dstLengthBytes, const char* src) {
   *dst = '\0';
 }
 
-// Copies string 'path' to 'dst', but stops on the first forward slash '/' character.
-// Returns number of bytes written, excluding null terminator
-static int strcpy_inodename(char* dst, const char* path) {
-  char* d = dst;
-  while (*path && *path != '/')
-    *dst++ = *path++;
-  *dst = '\0';
-  return dst - d;
-}
-
 // Copies src to dst, writes at most maxBytesToWrite out. Always null terminates dst. Returns the
 // number of characters written, excluding null terminator.
 static int strcpy_safe(char* dst, const char* src, int maxBytesToWrite) {
@@ -304,6 +976,18 @@ static const char* basename_part(const char* path) {
   return s;
 }
 
+// Returns true if a component of the given path is longer than NAME_MAX bytes, in which case no
+// file can be created at it.
+static bool has_too_long_name(const char* path) {
+  int len = 0;
+  for (; *path; ++path) {
+    len = (*path == '/') ? 0 : len + 1;
+    if (len > NAME_MAX)
+      return true;
+  }
+  return false;
+}
+
 static inode* create_directory_hierarchy_for_file(
   inode* root, const char* path_to_file, unsigned int mode) {
   assert(root);
@@ -332,50 +1016,41 @@ static inode* create_directory_hierarchy_for_file(
   if (path_to_file[0] == '\0')
     return 0;
 
-  inode* node = root->child;
+  bool is_directory = false;
+  const char* child_path = 0;
+  inode* node = find_child(root, path_to_file, &child_path, &is_directory);
   while (node) {
-    bool is_directory = false;
-    const char* child_path = path_cmp(path_to_file, node->name, &is_directory);
-#ifdef ASMFS_DEBUG
-    EM_ASM_INT({err('path_cmp ' + UTF8ToString($0) + ', ' + UTF8ToString($1) + ', ' +
-                    UTF8ToString($2) + ' .')},
-      path_to_file, node->name, child_path);
-#endif
-    if (child_path) {
-      if (is_directory && node->type != INODE_DIR)
-        return 0; // "A component used as a directory in pathname is not, in fact, a directory"
-
-      // The directory name matches.
-      path_to_file = child_path;
-
-      // Traverse . and ..
-      while (path_to_file[0] == '.') {
-        if (path_to_file[1] == '/')
-          path_to_file += 2; // Skip over redundant "./././././" blocks
-        else if (path_to_file[1] == '\0')
-          path_to_file += 1;
-        else if (path_to_file[1] == '.' &&
-                 (path_to_file[2] == '/' ||
-                   path_to_file[2] == '\0')) // Go up to parent directories with ".."
-        {
-          node = node->parent;
-          if (!node)
-            return 0;
-          assert(node->type ==
-                 INODE_DIR); // Anything that is a parent should automatically be a directory.
-          path_to_file += (path_to_file[2] == '/') ? 3 : 2;
-        } else
-          break;
-      }
-      if (path_to_file[0] == '\0')
-        return node;
-      if (path_to_file[0] == '/' && path_to_file[1] == '\0' /* && node is a directory*/)
-        return node;
-      root = node;
-      node = node->child;
-    } else {
-      node = node->sibling;
+    if (is_directory && node->type != INODE_DIR)
+      return 0; // "A component used as a directory in pathname is not, in fact, a directory"
+
+    // The directory name matches.
+    path_to_file = child_path;
+
+    // Traverse . and ..
+    while (path_to_file[0] == '.') {
+      if (path_to_file[1] == '/')
+        path_to_file += 2; // Skip over redundant "./././././" blocks
+      else if (path_to_file[1] == '\0')
+        path_to_file += 1;
+      else if (path_to_file[1] == '.' &&
+               (path_to_file[2] == '/' ||
+                 path_to_file[2] == '\0')) // Go up to parent directories with ".."
+      {
+        node = node->parent;
+        if (!node)
+          return 0;
+        assert(node->type ==
+               INODE_DIR); // Anything that is a parent should automatically be a directory.
+        path_to_file += (path_to_file[2] == '/') ? 3 : 2;
+      } else
+        break;
     }
+    if (path_to_file[0] == '\0')
+      return node;
+    if (path_to_file[0] == '/' && path_to_file[1] == '\0' /* && node is a directory*/)
+      return node;
+    root = node;
+    node = find_child(node, path_to_file, &child_path, &is_directory);
   }
   const char* basename_pos = basename_part(path_to_file);
 #ifdef ASMFS_DEBUG
@@ -384,7 +1059,10 @@ static inode* create_directory_hierarchy_for_file(
 #endif
   while (*path_to_file && path_to_file < basename_pos) {
     node = create_inode(INODE_DIR, mode);
-    path_to_file += strcpy_inodename(node->name, path_to_file) + 1;
+    set_inode_name(node, path_to_file);
+    while (*path_to_file && *path_to_file != '/')
+      ++path_to_file;
+    ++path_to_file;
     link_inode(node, root);
 #ifdef ASMFS_DEBUG
     EM_ASM(out('create_directory_hierarchy_for_file: created directory ' + UTF8ToString($0) +
@@ -406,9 +1084,9 @@ static inode* create_directory_hierarchy_for_file(
 // file/directory, or 0 if the intermediate path doesn't exist. Note that the file/directory pointed
 // to by path does not need to exist, only its parent does.
 static inode* find_parent_inode(inode* root, const char* path, int* out_errno) {
+#ifdef ASMFS_DEBUG
   char rootName[PATH_MAX];
   inode_abspath(root, rootName, PATH_MAX);
-#ifdef ASMFS_DEBUG
   EM_ASM(err('find_parent_inode(root="' + UTF8ToString($0) + '", path="' + UTF8ToString($1) + '")'),
     rootName, path);
 #endif
@@ -453,48 +1131,44 @@ static inode* find_parent_inode(inode* root, const char* path, int* out_errno) {
   const char* basename = basename_part(path);
   if (path == basename)
     RETURN_NODE_AND_ERRNO(root, 0);
-  inode* node = root->child;
+  bool is_directory = false;
+  const char* child_path = 0;
+  inode* node = find_child(root, path, &child_path, &is_directory);
   while (node) {
-    bool is_directory = false;
-    const char* child_path = path_cmp(path, node->name, &is_directory);
-    if (child_path) {
-      if (is_directory && node->type != INODE_DIR)
-        RETURN_NODE_AND_ERRNO(
-          0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
-
-      // The directory name matches.
-      path = child_path;
-
-      // Traverse . and ..
-      while (path[0] == '.') {
-        if (path[1] == '/')
-          path += 2; // Skip over redundant "./././././" blocks
-        else if (path[1] == '\0')
-          path += 1;
-        else if (path[1] == '.' &&
-                 (path[2] == '/' || path[2] == '\0')) // Go up to parent directories with ".."
-        {
-          node = node->parent;
-          if (!node)
-            RETURN_NODE_AND_ERRNO(0, ENOENT);
-          assert(node->type ==
-                 INODE_DIR); // Anything that is a parent should automatically be a directory.
-          path += (path[2] == '/') ? 3 : 2;
-        } else
-          break;
-      }
-
-      if (path >= basename)
-        RETURN_NODE_AND_ERRNO(node, 0);
-      if (!*path)
-        RETURN_NODE_AND_ERRNO(0, ENOENT);
-      node = node->child;
-      if (node->type != INODE_DIR)
-        RETURN_NODE_AND_ERRNO(
-          0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
-    } else {
-      node = node->sibling;
+    if (is_directory && node->type != INODE_DIR)
+      RETURN_NODE_AND_ERRNO(
+        0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
+
+    // The directory name matches.
+    path = child_path;
+
+    // Traverse . and ..
+    while (path[0] == '.') {
+      if (path[1] == '/')
+        path += 2; // Skip over redundant "./././././" blocks
+      else if (path[1] == '\0')
+        path += 1;
+      else if (path[1] == '.' &&
+               (path[2] == '/' || path[2] == '\0')) // Go up to parent directories with ".."
+      {
+        node = node->parent;
+        if (!node)
+          RETURN_NODE_AND_ERRNO(0, ENOENT);
+        assert(node->type ==
+               INODE_DIR); // Anything that is a parent should automatically be a directory.
+        path += (path[2] == '/') ? 3 : 2;
+      } else
+        break;
     }
+
+    if (path >= basename)
+      RETURN_NODE_AND_ERRNO(node, 0);
+    if (!*path)
+      RETURN_NODE_AND_ERRNO(0, ENOENT);
+    if (node->type != INODE_DIR)
+      RETURN_NODE_AND_ERRNO(
+        0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
+    node = find_child(node, path, &child_path, &is_directory);
   }
   RETURN_NODE_AND_ERRNO(
     0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
@@ -504,10 +1178,10 @@ static inode* find_parent_inode(inode* root, const char* path, int* out_errno) {
 // "some/directory/dir_or_file", returns the inode that corresponds to "dir_or_file", or 0 if it
 // doesn't exist. If the parameter out_closest_parent is specified, the closest (grand)parent node
 // will be returned.
-static inode* find_inode(inode* root, const char* path, int* out_errno) {
+static inode* resolve_inode(inode* root, const char* path, int* out_errno) {
+#ifdef ASMFS_DEBUG
   char rootName[PATH_MAX];
   inode_abspath(root, rootName, PATH_MAX);
-#ifdef ASMFS_DEBUG
   EM_ASM(err('find_inode(root="' + UTF8ToString($0) + '", path="' + UTF8ToString($1) + '")'),
     rootName, path);
 #endif
@@ -549,53 +1223,65 @@ static inode* find_inode(inode* root, const char* path, int* out_errno) {
   if (path[0] == '\0')
     RETURN_NODE_AND_ERRNO(root, 0);
 
-  inode* node = root->child;
+  bool is_directory = false;
+  const char* child_path = 0;
+  inode* node = find_child(root, path, &child_path, &is_directory);
   while (node) {
-    bool is_directory = false;
-    const char* child_path = path_cmp(path, node->name, &is_directory);
-    if (child_path) {
-      if (is_directory && node->type != INODE_DIR)
-        RETURN_NODE_AND_ERRNO(
-          0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
-
-      // The directory name matches.
-      path = child_path;
-
-      // Traverse . and ..
-      while (path[0] == '.') {
-        if (path[1] == '/')
-          path += 2; // Skip over redundant "./././././" blocks
-        else if (path[1] == '\0')
-          path += 1;
-        else if (path[1] == '.' &&
-                 (path[2] == '/' || path[2] == '\0')) // Go up to parent directories with ".."
-        {
-          node = node->parent;
-          if (!node)
-            RETURN_NODE_AND_ERRNO(0, ENOENT);
-          assert(node->type ==
-                 INODE_DIR); // Anything that is a parent should automatically be a directory.
-          path += (path[2] == '/') ? 3 : 2;
-        } else
-          break;
-      }
-
-      // If we arrived to the end of the search, this is the node we were looking for.
-      if (path[0] == '\0')
-        RETURN_NODE_AND_ERRNO(node, 0);
-      if (path[0] == '/' && node->type != INODE_DIR)
-        RETURN_NODE_AND_ERRNO(
-          0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
-      if (path[0] == '/' && path[1] == '\0')
-        RETURN_NODE_AND_ERRNO(node, 0);
-      node = node->child;
-    } else {
-      node = node->sibling;
+    if (is_directory && node->type != INODE_DIR)
+      RETURN_NODE_AND_ERRNO(
+        0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
+
+    // The directory name matches.
+    path = child_path;
+
+    // Traverse . and ..
+    while (path[0] == '.') {
+      if (path[1] == '/')
+        path += 2; // Skip over redundant "./././././" blocks
+      else if (path[1] == '\0')
+        path += 1;
+      else if (path[1] == '.' &&
+               (path[2] == '/' || path[2] == '\0')) // Go up to parent directories with ".."
+      {
+        node = node->parent;
+        if (!node)
+          RETURN_NODE_AND_ERRNO(0, ENOENT);
+        assert(node->type ==
+               INODE_DIR); // Anything that is a parent should automatically be a directory.
+        path += (path[2] == '/') ? 3 : 2;
+      } else
+        break;
     }
+
+    // If we arrived to the end of the search, this is the node we were looking for.
+    if (path[0] == '\0')
+      RETURN_NODE_AND_ERRNO(node, 0);
+    if (path[0] == '/' && node->type != INODE_DIR)
+      RETURN_NODE_AND_ERRNO(
+        0, ENOTDIR); // "A component used as a directory in pathname is not, in fact, a directory"
+    if (path[0] == '/' && path[1] == '\0')
+      RETURN_NODE_AND_ERRNO(node, 0);
+    node = find_child(node, path, &child_path, &is_directory);
   }
   RETURN_NODE_AND_ERRNO(0, ENOENT);
 }
 
+// Same as resolve_inode(), but goes through the dentry cache.
+static inode* find_inode(inode* root, const char* path, int* out_errno) {
+  if (!root || !path || !*path)
+    return resolve_inode(root, path, out_errno);
+
+  inode* node = dentry_cache_lookup(root, path);
+  if (node)
+    RETURN_NODE_AND_ERRNO(node, 0);
+
+  uint32_t generation = __atomic_load_n(&dentry_cache_generation, __ATOMIC_SEQ_CST);
+  node = resolve_inode(root, path, out_errno);
+  if (node)
+    dentry_cache_insert(root, path, node, generation);
+  return node;
+}
+
 // Same as above, but the root node is deduced from 'path'. (either absolute if path starts with
 // "/", or relative)
 static inode* find_inode(const char* path, int* out_errno) {
@@ -612,8 +1298,9 @@ void emscripten_asmfs_set_remote_url(const char* filename, const char* remoteUrl
   inode* node = find_inode(filename, &err);
   if (!node)
     return;
-  free(node->remoteurl);
-  node->remoteurl = strdup(remoteUrl);
+  inode_cold* cold = get_inode_cold(node);
+  free(cold->remoteurl);
+  cold->remoteurl = strdup(remoteUrl);
 }
 
 void emscripten_asmfs_set_file_data(const char* filename, char* data, size_t size) {
@@ -623,9 +1310,11 @@ void emscripten_asmfs_set_file_data(const char* filename, char* data, size_t siz
     free(data);
     return;
   }
-  free(node->data);
-  node->data = (uint8_t*)data;
-  node->size = node->capacity = size;
+  free_file_chunks(node, false);
+  node->size = 0;
+  if (write_file_chunks(node, 0, (const uint8_t*)data, size))
+    node->size = size;
+  free(data);
 }
 
 char* find_last_occurrence(char* str, char ch) {
@@ -680,8 +1369,9 @@ void emscripten_asmfs_remote_url(const char* filename, char* outRemoteUrl, int m
   full_path[0] = full_path[PATH_MAX] = full_path_temp[0] = full_path_temp[PATH_MAX] = '\0';
 
   while (node) {
-    if (node->remoteurl && node->remoteurl[0] != '\0') {
-      int nWritten = strcpy_safe(outRemoteUrl, node->remoteurl, maxBytesToWrite);
+    const char* remoteurl = inode_remoteurl(node);
+    if (remoteurl && remoteurl[0] != '\0') {
+      int nWritten = strcpy_safe(outRemoteUrl, remoteurl, maxBytesToWrite);
       if (maxBytesToWrite - nWritten > 1 && outRemoteUrl[nWritten - 1] != '/' &&
           full_path[0] != '/') {
         outRemoteUrl[nWritten++] = '/';
@@ -731,7 +1421,7 @@ void emscripten_dump_fs_tree(inode* root, char* path) {
       (child->mode & S_IXGRP) ? 'x' : '-', (child->mode & S_IROTH) ? 'r' : '-',
       (child->mode & S_IWOTH) ? 'w' : '-', (child->mode & S_IXOTH) ? 'x' : '-',
       1, // number of links to this file
-      child->uid, child->gid,
+      child->cold ? child->cold->uid : 0, child->cold ? child->cold->gid : 0,
       child->size ? child->size : (child->fetch ? (int)child->fetch->numBytes : 0), child->name,
       child->type == INODE_DIR ? '/' : ' ');
     EM_ASM(out(UTF8ToString($0)), str);
@@ -866,8 +1556,8 @@ emscripten_asmfs_open_t emscripten_asmfs_get_file_open_behavior() {
 
 // Returns true if the given file can be synchronously read by the main browser thread.
 static bool emscripten_asmfs_file_is_synchronously_accessible(inode* node) {
-  return node->data // If file was created from memory without XHR, e.g. via fopen("foo.txt", "w"),
-                    // it will have node->data ptr backing.
+  return has_file_chunks(node) // If file was created from memory without XHR, e.g. via
+                               // fopen("foo.txt", "w"), it will have file chunks backing.
          ||
          (node->fetch && node->fetch->data); // If the file was downloaded, it will be backed here.
 }
@@ -939,6 +1629,8 @@ static long open(const char* pathname, int flags, int mode) {
     RETURN_ERRNO(ENAMETOOLONG, "pathname was too long");
   if (len == 0)
     RETURN_ERRNO(ENOENT, "pathname is empty");
+  if (has_too_long_name(pathname))
+    RETURN_ERRNO(ENAMETOOLONG, "A component of pathname was longer than NAME_MAX");
 
   // Find if this file exists already in the filesystem?
   inode* root = (pathname[0] == '/') ? filesystem_root() : get_cwd();
@@ -990,14 +1682,21 @@ static long open(const char* pathname, int flags, int mode) {
       if (node->fetch)
         emscripten_fetch_close(node->fetch);
       node->fetch = 0;
+      if (inode_lazy(node)) {
+        free_lazy_file(node->cold->lazy);
+        node->cold->lazy = 0;
+      }
+      if (has_file_chunks(node))
+        free_file_chunks(node, true);
       node->size = 0;
     } else if ((flags & O_CREAT)) {
       inode* directory = create_directory_hierarchy_for_file(root, relpath, mode);
       node = create_inode((flags & O_DIRECTORY) ? INODE_DIR : INODE_FILE, mode);
-      strcpy(node->name, basename_part(pathname));
+      set_inode_name(node, basename_part(pathname));
       link_inode(node, directory);
     }
-  } else if (!node || (node->type == INODE_FILE && !node->fetch && !node->data)) {
+  } else if (!node || (node->type == INODE_FILE && !node->fetch && !has_file_chunks(node) &&
+                           !inode_lazy(node))) {
     emscripten_fetch_t* fetch = 0;
     if (!(flags & O_DIRECTORY) && accessMode != O_WRONLY) // Opening a file for reading?
     {
@@ -1010,7 +1709,7 @@ static long open(const char* pathname, int flags, int mode) {
 
       // Report an error if there is an inode entry, but file data is not synchronously available
       // and it should have been.
-      if (node && !node->data &&
+      if (node && !has_file_chunks(node) &&
           __emscripten_asmfs_file_open_behavior_mode == EMSCRIPTEN_ASMFS_OPEN_MEMORY) {
         RETURN_ERRNO(
           ENOENT, "O_CREAT is not set, the named file exists, but file data is not synchronously available in memory (EMSCRIPTEN_ASMFS_OPEN_MEMORY specified)");
@@ -1062,7 +1761,7 @@ static long open(const char* pathname, int flags, int mode) {
       // ... add it as a new entry to the fs.
       inode* directory = create_directory_hierarchy_for_file(root, relpath, mode);
       node = create_inode((flags & O_DIRECTORY) ? INODE_DIR : INODE_FILE, mode);
-      strcpy(node->name, basename_part(pathname));
+      set_inode_name(node, basename_part(pathname));
       node->fetch = fetch;
       link_inode(node, directory);
     } else {
@@ -1161,6 +1860,13 @@ EMSCRIPTEN_RESULT emscripten_asmfs_preload_file(
     return EMSCRIPTEN_RESULT_INVALID_PARAM;
   }
 
+  if (has_too_long_name(pathname)) {
+#ifdef ASMFS_DEBUG
+    EM_ASM(err('emscripten_asmfs_preload_file: a component of pathname is longer than NAME_MAX!'));
+#endif
+    return EMSCRIPTEN_RESULT_INVALID_PARAM;
+  }
+
   // Find if this file exists already in the filesystem?
   inode* root = (pathname[0] == '/') ? filesystem_root() : get_cwd();
   const char* relpath = (pathname[0] == '/') ? pathname + 1 : pathname;
@@ -1217,7 +1923,7 @@ EMSCRIPTEN_RESULT emscripten_asmfs_preload_file(
   if (!node) {
     inode* directory = create_directory_hierarchy_for_file(root, relpath, mode);
     node = create_inode(INODE_FILE, mode);
-    strcpy(node->name, basename_part(pathname));
+    set_inode_name(node, basename_part(pathname));
     link_inode(node, directory);
   }
   node->fetch = fetch;
@@ -1225,6 +1931,118 @@ EMSCRIPTEN_RESULT emscripten_asmfs_preload_file(
   return EMSCRIPTEN_RESULT_SUCCESS;
 }
 
+void emscripten_asmfs_set_lazy_loading(
+  uint32_t blockSize, uint32_t readAheadBlocks, uint64_t maxResidentBytes) {
+  if (blockSize > 0)
+    lazy_block_size = blockSize;
+  lazy_read_ahead_blocks = readAheadBlocks;
+  lazy_max_resident_bytes = maxResidentBytes;
+}
+
+// Parses the total size of the file out of a "Content-Range: bytes 0-1023/146515" response header.
+static bool parse_content_range_size(emscripten_fetch_t* fetch, uint64_t* size) {
+  size_t len = emscripten_fetch_get_response_headers_length(fetch);
+  char* headers = (char*)malloc(len + 1);
+  if (!headers)
+    return false;
+  emscripten_fetch_get_response_headers(fetch, headers, len + 1);
+  bool found = false;
+  for (char* line = headers; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : 0) {
+    if (!strncasecmp(line, "content-range:", 14)) {
+      char* slash = strchr(line, '/');
+      char* eol = strchr(line, '\n');
+      if (slash && (!eol || slash < eol) && isdigit(slash[1])) {
+        *size = strtoull(slash + 1, 0, 10);
+        found = true;
+      }
+      break;
+    }
+  }
+  free(headers);
+  return found;
+}
+
+EMSCRIPTEN_RESULT emscripten_asmfs_add_lazy_file(const char* url, const char* pathname, int mode) {
+  if (!url || !pathname || has_too_long_name(pathname))
+    return EMSCRIPTEN_RESULT_INVALID_PARAM;
+  if (emscripten_is_main_browser_thread())
+    return EMSCRIPTEN_RESULT_NOT_SUPPORTED; // Can't wait for the first block to download.
+
+  inode* root = (pathname[0] == '/') ? filesystem_root() : get_cwd();
+  const char* relpath = (pathname[0] == '/') ? pathname + 1 : pathname;
+  int err;
+  inode* node = find_inode(root, relpath, &err);
+  if (err && err != ENOENT)
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+  if (node && (node->type != INODE_FILE || node->fetch || has_file_chunks(node) || inode_lazy(node)))
+    return EMSCRIPTEN_RESULT_INVALID_TARGET;
+
+  // Download the first block, which also tells the size of the whole file.
+  uint32_t blockSize = lazy_block_size;
+  emscripten_fetch_t* fetch = fetch_range(url, 0, blockSize);
+  if (!fetch)
+    return EMSCRIPTEN_RESULT_FAILED;
+
+  uint64_t size = fetch->numBytes;
+  if (fetch->status == 416) {
+    // The file is empty. The response should say so with "Content-Range: bytes */0".
+    size = 0;
+    if (parse_content_range_size(fetch, &size) && size != 0) {
+      emscripten_fetch_close(fetch);
+      return EMSCRIPTEN_RESULT_FAILED;
+    }
+  } else if (fetch->status == 206 && !parse_content_range_size(fetch, &size)) {
+    emscripten_fetch_close(fetch);
+    return EMSCRIPTEN_RESULT_FAILED;
+  }
+  // The size is kept in a size_t, and all of the file must be reachable with lseek().
+  if (size > ASMFS_MAX_FILE_OFFSET) {
+    emscripten_fetch_close(fetch);
+    return EMSCRIPTEN_RESULT_NOT_SUPPORTED;
+  }
+
+  if (!node) {
+    inode* directory = create_directory_hierarchy_for_file(root, relpath, mode);
+    node = create_inode(INODE_FILE, mode);
+    set_inode_name(node, basename_part(pathname));
+    link_inode(node, directory);
+  }
+  node->size = size;
+
+  // The server does not support Range requests, and sent the whole file. Keep it like a regular
+  // downloaded file.
+  if (fetch->status == 200) {
+    node->fetch = fetch;
+    return EMSCRIPTEN_RESULT_SUCCESS;
+  }
+  // A 416 response to the first request carries no data, which leaves an empty lazy file.
+
+  lazy_file* file = (lazy_file*)calloc(1, sizeof(lazy_file));
+  if (file) {
+    file->url = strdup(url);
+    file->block_size = blockSize;
+    file->num_blocks = (size + blockSize - 1) / blockSize;
+    file->blocks = (lazy_block**)calloc(file->num_blocks ? file->num_blocks : 1, sizeof(lazy_block*));
+  }
+  if (!file || !file->url || !file->blocks) {
+    if (file) {
+      free(file->url);
+      free(file);
+    }
+    emscripten_fetch_close(fetch);
+    return EMSCRIPTEN_RESULT_FAILED;
+  }
+  if (file->num_blocks > 0) {
+    lock_lazy_blocks();
+    add_lazy_block(file, 0, (const uint8_t*)fetch->data,
+      fetch->numBytes < blockSize ? fetch->numBytes : blockSize);
+    unlock_lazy_blocks();
+  }
+  emscripten_fetch_close(fetch);
+  get_inode_cold(node)->lazy = file;
+  return EMSCRIPTEN_RESULT_SUCCESS;
+}
+
 long __syscall6(int which, ...) // close
 {
   va_list vl;
@@ -1498,6 +2316,8 @@ long emscripten_asmfs_mkdir(const char* pathname, mode_t mode) {
     RETURN_ERRNO(ENAMETOOLONG, "pathname was too long");
   if (len == 0)
     RETURN_ERRNO(ENOENT, "pathname is empty");
+  if (has_too_long_name(pathname))
+    RETURN_ERRNO(ENAMETOOLONG, "A component of pathname was longer than NAME_MAX");
 
   inode* root = (pathname[0] == '/') ? filesystem_root() : get_cwd();
   const char* relpath = (pathname[0] == '/') ? pathname + 1 : pathname;
@@ -1538,7 +2358,7 @@ long emscripten_asmfs_mkdir(const char* pathname, mode_t mode) {
   // file on a read-only filesystem");
 
   inode* directory = create_inode(INODE_DIR, mode);
-  strcpy(directory->name, basename_part(pathname));
+  set_inode_name(directory, basename_part(pathname));
   link_inode(directory, parent_dir);
   return 0;
 }
@@ -1549,17 +2369,30 @@ void emscripten_asmfs_unload_data(const char* pathname) {
   if (!node)
     return;
 
-  free(node->data);
-  node->data = 0;
-  node->size = node->capacity = 0;
+  lazy_file* file = inode_lazy(node);
+  if (file) {
+    // Lazy files keep their size, their blocks are downloaded again if needed.
+    lock_lazy_blocks();
+    for (uint32_t i = 0; i < file->num_blocks; ++i)
+      if (file->blocks[i])
+        evict_lazy_block(file->blocks[i]);
+    unlock_lazy_blocks();
+    return;
+  }
+
+  free_file_chunks(node, false);
+  node->size = 0;
 }
 
 uint64_t emscripten_asmfs_compute_memory_usage_at_node(inode* node) {
   if (!node)
     return 0;
   uint64_t sz = sizeof(inode);
-  if (node->data)
-    sz += node->capacity > node->size ? node->capacity : node->size;
+  if (node->cold)
+    sz += sizeof(inode_cold);
+  sz += file_chunks_memory_usage(node);
+  if (inode_lazy(node))
+    sz += inode_lazy(node)->resident_bytes;
   if (node->fetch && node->fetch->data)
     sz += node->fetch->numBytes;
   return sz + emscripten_asmfs_compute_memory_usage_at_node(node->child) +
@@ -1755,15 +2588,38 @@ long __syscall140(int which, ...) // llseek
       newPos = (desc->node->fetch ? desc->node->fetch->numBytes : desc->node->size) + offset;
       break;
     case 3 /*SEEK_DATA*/:
-      RETURN_ERRNO(EINVAL, "whence is invalid (sparse files, whence=SEEK_DATA, is not supported");
-    case 4 /*SEEK_HOLE*/:
-      RETURN_ERRNO(EINVAL, "whence is invalid (sparse files, whence=SEEK_HOLE, is not supported");
+    case 4 /*SEEK_HOLE*/: {
+      inode* node = desc->node;
+      size_t size = has_file_chunks(node) ? node->size
+                                          : (node->fetch ? node->fetch->numBytes : node->size);
+      if (offset < 0 || (uint64_t)offset >= size)
+        RETURN_ERRNO(ENXIO, "offset is beyond the end of the file");
+      newPos = offset;
+      if (has_file_chunks(node)) {
+        // Chunks are either fully holes or fully data, and the end of the file counts as a hole.
+        bool wantData = (whence == 3);
+        while ((uint64_t)newPos < size) {
+          uint32_t i = newPos >> FILE_CHUNK_SHIFT;
+          bool isData = i < node->num_chunks && node->chunks[i];
+          if (isData == wantData)
+            break;
+          newPos = ((int64_t)i + 1) << FILE_CHUNK_SHIFT;
+        }
+        if ((uint64_t)newPos > size)
+          newPos = size;
+        if (wantData && (uint64_t)newPos >= size)
+          RETURN_ERRNO(ENXIO, "there is no data past offset");
+      } else if (whence == 4) {
+        newPos = size; // Fetched files have no holes.
+      }
+      break;
+    }
     default:
       RETURN_ERRNO(EINVAL, "whence is invalid");
   }
   if (newPos < 0)
     RETURN_ERRNO(EINVAL, "The resulting file offset would be negative");
-  if (newPos > 0x7FFFFFFFLL)
+  if (newPos > ASMFS_MAX_FILE_OFFSET)
     RETURN_ERRNO(EOVERFLOW, "The resulting file offset cannot be represented in an off_t");
 
   desc->file_pos = newPos;
@@ -1816,7 +2672,8 @@ long __syscall145(int which, ...) // readv
       emscripten_fetch_wait(node->fetch, INFINITY);
   }
 
-  if (node->size > 0 && !node->data && (!node->fetch || !node->fetch->data))
+  lazy_file* lazy = inode_lazy(node);
+  if (node->size > 0 && !has_file_chunks(node) && !lazy && (!node->fetch || !node->fetch->data))
     RETURN_ERRNO(-1, "ASMFS internal error: no file data available");
   if (iovcnt < 0)
     RETURN_ERRNO(EINVAL, "The vector count, iovcnt, is less than zero");
@@ -1833,14 +2690,24 @@ long __syscall145(int which, ...) // readv
   }
 
   size_t offset = desc->file_pos;
-  uint8_t* data = node->data ? node->data : (node->fetch ? (uint8_t*)node->fetch->data : 0);
-  size_t size = node->data ? node->size : (node->fetch ? node->fetch->numBytes : 0);
+  bool chunked = has_file_chunks(node);
+  uint8_t* data = node->fetch ? (uint8_t*)node->fetch->data : 0;
+  size_t size = (chunked || lazy) ? node->size : (node->fetch ? node->fetch->numBytes : 0);
   for (int i = 0; i < iovcnt; ++i) {
     ssize_t dataLeft = size - offset;
     if (dataLeft <= 0)
       break;
     size_t bytesToCopy = (size_t)dataLeft < iov[i].iov_len ? dataLeft : iov[i].iov_len;
-    memcpy(iov[i].iov_base, &data[offset], bytesToCopy);
+    if (chunked)
+      read_file_chunks(node, offset, (uint8_t*)iov[i].iov_base, bytesToCopy);
+    else if (lazy) {
+      int err = read_lazy_file(node, offset, (uint8_t*)iov[i].iov_base, bytesToCopy);
+      if (err == EAGAIN)
+        RETURN_ERRNO(EAGAIN, "Attempted to read a block of a lazily loaded file that is not in memory on the main browser thread. Could not block to wait!");
+      if (err)
+        RETURN_ERRNO(EIO, "Failed to download a block of a lazily loaded file");
+    } else
+      memcpy(iov[i].iov_base, &data[offset], bytesToCopy);
 #ifdef ASMFS_DEBUG
     EM_ASM(err('readv requested to read ' + $0 + ', read  ' + $1 + ' bytes from offset ' + $2 +
                ', new offset: ' + $3 + ' (file size: ' + $4 + ')'),
@@ -1896,33 +2763,25 @@ long __syscall146(int which, ...) // writev
     }
     return bytesWritten;
   } else {
-    // Enlarge the file in memory to fit space for the new data
-    size_t newSize = desc->file_pos + total_write_amount;
+    // Chunks for the new data are allocated as it is written, and any gap between the old end of
+    // the file and the write position is left as a hole.
     inode* node = desc->node;
-    if (node->capacity < newSize) {
-      size_t newCapacity =
-        (newSize > (size_t)(node->capacity * 1.25)
-            ? newSize
-            : (size_t)(
-                node->capacity * 1.25)); // Geometric increases in size for amortized O(1) behavior
-      uint8_t* newData = (uint8_t*)realloc(node->data, newCapacity);
-      if (!newData) {
-        newData = (uint8_t*)malloc(newCapacity);
-        memcpy(newData, node->data, node->size);
-        // TODO: init gaps with zeroes.
-        free(node->data);
-      }
-      node->data = newData;
-      node->size = newSize;
-      node->capacity = newCapacity;
-    }
-
+    if (inode_lazy(node))
+      RETURN_ERRNO(EBADF, "Lazily loaded files are read-only");
+    ssize_t bytesWritten = 0;
     for (int i = 0; i < iovcnt; ++i) {
-      memcpy((uint8_t*)node->data + desc->file_pos, iov[i].iov_base, iov[i].iov_len);
+      if (!write_file_chunks(node, desc->file_pos, (const uint8_t*)iov[i].iov_base, iov[i].iov_len)) {
+        if (bytesWritten == 0)
+          RETURN_ERRNO(ENOSPC, "out of memory to store the written data");
+        break; // Report the partial write.
+      }
       desc->file_pos += iov[i].iov_len;
+      bytesWritten += iov[i].iov_len;
+      if ((size_t)desc->file_pos > node->size)
+        node->size = desc->file_pos;
     }
+    return bytesWritten;
   }
-  return total_write_amount;
 }
 
 // WASI support: provide a shim between the wasi fd_write syscall and the
@@ -2006,8 +2865,8 @@ static long __stat64(inode* node, struct stat* buf) {
              */
   }
   buf->st_nlink = 1; // The number of hard links. TODO: Use this for real when links are supported.
-  buf->st_uid = node->uid;
-  buf->st_gid = node->gid;
+  buf->st_uid = node->cold ? node->cold->uid : 0;
+  buf->st_gid = node->cold ? node->cold->gid : 0;
   buf->st_rdev = 1; // Device ID (if special file) No meaning right now for Emscripten.
   buf->st_size = node->fetch ? node->fetch->totalBytes : 0;
   if (node->size > (size_t)buf->st_size)
@@ -2015,9 +2874,9 @@ static long __stat64(inode* node, struct stat* buf) {
   buf->st_blocks =
     (buf->st_size + 511) / 512; // The syscall docs state this is hardcoded to # of 512 byte blocks.
   buf->st_blksize = 1024 * 1024; // Specifies the preferred blocksize for efficient disk I/O.
-  buf->st_atim.tv_sec = node->atime;
+  buf->st_atim.tv_sec = node->cold ? node->cold->atime : node->mtime;
   buf->st_mtim.tv_sec = node->mtime;
-  buf->st_ctim.tv_sec = node->ctime;
+  buf->st_ctim.tv_sec = node->cold ? node->cold->ctime : node->mtime;
   return 0;
 }
 
@@ -44,6 +44,7 @@ __emscripten_fetch_queue* _emscripten_get_fetch_queue() {
 int32_t _emscripten_fetch_get_response_headers_length(int32_t fetchID);
 int32_t _emscripten_fetch_get_response_headers(int32_t fetchID, int32_t dst, int32_t dstSizeBytes);
 void _emscripten_fetch_free(unsigned int);
+void _emscripten_fetch_stream_resume(unsigned int);
 }
 
 void emscripten_proxy_fetch(emscripten_fetch_t* fetch) {
@@ -100,6 +101,14 @@ emscripten_fetch_t* emscripten_fetch(emscripten_fetch_attr_t* fetch_attr, const
   fetch->__attributes.withCredentials = fetch_attr->withCredentials;
   fetch->__attributes.requestData = fetch_attr->requestData;
   fetch->__attributes.requestDataSize = fetch_attr->requestDataSize;
+  if (fetch_attr->streamBuffer && fetch_attr->streamBufferSize) {
+    // The read and write positions wrap around at 2^32, so the size must divide that evenly.
+    size_t streamBufferSize = 1;
+    while (streamBufferSize <= fetch_attr->streamBufferSize / 2 && streamBufferSize < 0x80000000u)
+      streamBufferSize *= 2;
+    fetch->__attributes.streamBuffer = fetch_attr->streamBuffer;
+    fetch->__attributes.streamBufferSize = streamBufferSize;
+  }
   strcpy(fetch->__attributes.requestMethod, fetch_attr->requestMethod);
   fetch->__attributes.onerror = fetch_attr->onerror;
   fetch->__attributes.onsuccess = fetch_attr->onsuccess;
@@ -225,6 +234,65 @@ EMSCRIPTEN_RESULT emscripten_fetch_wait(emscripten_fetch_t* fetch, double timeou
 #endif
 }
 
+#if __EMSCRIPTEN_PTHREADS__
+#define FETCH_LOAD_U16(addr) emscripten_atomic_load_u16(addr)
+#define FETCH_LOAD_U32(addr) emscripten_atomic_load_u32(addr)
+#define FETCH_STORE_U32(addr, val) emscripten_atomic_store_u32(addr, val)
+#else
+#define FETCH_LOAD_U16(addr) (*(volatile uint16_t*)(addr))
+#define FETCH_LOAD_U32(addr) (*(volatile uint32_t*)(addr))
+#define FETCH_STORE_U32(addr, val) (*(volatile uint32_t*)(addr) = (val))
+#endif
+
+EMSCRIPTEN_RESULT emscripten_fetch_read(
+  emscripten_fetch_t* fetch, char* dst, size_t dstSizeBytes, size_t* numBytesRead, double timeoutMsecs) {
+  if (numBytesRead)
+    *numBytesRead = 0;
+  if (!fetch || !fetch->__attributes.streamBuffer || (!dst && dstSizeBytes))
+    return EMSCRIPTEN_RESULT_INVALID_PARAM;
+
+  const char* ring = fetch->__attributes.streamBuffer;
+  const uint32_t ringSize = (uint32_t)fetch->__attributes.streamBufferSize;
+#if __EMSCRIPTEN_PTHREADS__
+  double waitUntil = emscripten_get_now() + timeoutMsecs;
+#endif
+  for (;;) {
+    // Load the signal first, and the state and the write position after it: the fetch writes the last bytes before
+    // it marks itself done, and bumps the signal after both, so any change after this point wakes up the wait below.
+    uint32_t signal = FETCH_LOAD_U32(&fetch->__streamSignal);
+    unsigned short readyState = FETCH_LOAD_U16(&fetch->readyState);
+    uint32_t writePos = FETCH_LOAD_U32(&fetch->__streamWritePos);
+    uint32_t readPos = fetch->__streamReadPos; // Only written by the reader.
+    uint32_t available = writePos - readPos;
+    if (available) {
+      uint32_t n = available < dstSizeBytes ? available : (uint32_t)dstSizeBytes;
+      uint32_t offset = readPos & (ringSize - 1);
+      uint32_t first = n < ringSize - offset ? n : ringSize - offset;
+      memcpy(dst, ring + offset, first);
+      memcpy(dst + first, ring, n - first);
+      // Frees up the space for the fetch, which resumes the download if it was paused on a full buffer.
+      FETCH_STORE_U32(&fetch->__streamReadPos, readPos + n);
+      if (available == ringSize)
+        _emscripten_fetch_stream_resume(fetch->id);
+      if (numBytesRead)
+        *numBytesRead = n;
+      return EMSCRIPTEN_RESULT_SUCCESS;
+    }
+    if (readyState == 4 /*DONE*/)
+      return (fetch->status >= 200 && fetch->status < 300) ? EMSCRIPTEN_RESULT_NO_DATA
+                                                            : EMSCRIPTEN_RESULT_FAILED;
+#if __EMSCRIPTEN_PTHREADS__
+    double now = emscripten_get_now();
+    if (now >= waitUntil || emscripten_is_main_browser_thread())
+      return EMSCRIPTEN_RESULT_TIMED_OUT;
+    emscripten_futex_wait(&fetch->__streamSignal, signal, waitUntil - now);
+#else
+    (void)signal;
+    return EMSCRIPTEN_RESULT_TIMED_OUT; // Without threads, the bytes can only arrive after returning to the event loop.
+#endif
+  }
+}
+
 EMSCRIPTEN_RESULT emscripten_fetch_close(emscripten_fetch_t* fetch) {
   if (!fetch)
     return EMSCRIPTEN_RESULT_SUCCESS; // Closing null pointer is ok, same as with free().
@@ -5,6 +5,24 @@
 #define HIGHS (ONES * (UCHAR_MAX/2+1))
 #define HASZERO(x) ((x)-ONES & ~(x) & HIGHS)
 
+#ifdef __wasm_simd128__
+
+#include <stdint.h>
+#include "emscripten_string_simd.h"
+
+// The SIMD kernel is not instrumented, so check the bytes the result depends
+// on afterwards.
+void __asan_loadN(uintptr_t addr, size_t size);
+
+char *__strchrnul(const char *s, int c)
+{
+	char *r = em_simd_strchrnul(s, c);
+	__asan_loadN((uintptr_t)s, r - s + 1);
+	return r;
+}
+
+#else
+
 char *__strchrnul(const char *s, int c)
 {
 	for (;; ++s)
@@ -12,4 +30,6 @@ char *__strchrnul(const char *s, int c)
 			return (char *) s;
 }
 
+#endif
+
 extern __typeof(__strchrnul) strchrnul __attribute__((weak, alias("__strchrnul")));
@@ -0,0 +1,22 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#ifdef __wasm_simd128__
+
+#include <string.h>
+#include "emscripten_string_simd.h"
+
+void *memchr(const void *src, int c, size_t n)
+{
+  return em_simd_memchr(src, c, n);
+}
+
+#else
+
+#include "musl/src/string/memchr.c"
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#ifdef __wasm_simd128__
+
+#include <stdint.h>
+#include <string.h>
+#include "emscripten_string_simd.h"
+
+// Unlike the scanning kernels, memcmp only ever reads bytes inside both
+// buffers, so it needs no ASAN variant.
+int memcmp(const void *vl, const void *vr, size_t n)
+{
+  const unsigned char *l = vl, *r = vr;
+  if (n >= 16) {
+    for (;;) {
+      v128_t ne = wasm_i8x16_ne(wasm_v128_load(l), wasm_v128_load(r));
+      if (wasm_i8x16_any_true(ne)) {
+        size_t i = em_simd_first_lane(ne);
+        return l[i] - r[i];
+      }
+      n -= 16;
+      if (!n) return 0;
+      if (n < 16) {
+        // Compare the last 16 bytes, overlapping the block just compared.
+        l -= 16 - n;
+        r -= 16 - n;
+        n = 16;
+      }
+      l += 16;
+      r += 16;
+    }
+  }
+  for (; n && *l == *r; n--, l++, r++);
+  return n ? *l-*r : 0;
+}
+
+#else
+
+#include "musl/src/string/memcmp.c"
+
+#endif
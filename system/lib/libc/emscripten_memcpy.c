@@ -5,10 +5,24 @@
 #include <stdint.h>
 #include <string.h>
 
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
 // An external JS implementation that is efficient for very large copies, using
 // HEAPU8.set()
 extern void *emscripten_memcpy_big(void *restrict dest, const void *restrict src, size_t n);
 
+// Copies of at least this many bytes go to memory.copy when bulk memory is
+// available, or to emscripten_memcpy_big otherwise. The crossover points can be
+// measured with tests/benchmark_memcpy.cpp.
+#ifndef EMSCRIPTEN_MEMCPY_BULK_THRESHOLD
+#define EMSCRIPTEN_MEMCPY_BULK_THRESHOLD 512
+#endif
+#ifndef EMSCRIPTEN_MEMCPY_BIG_THRESHOLD
+#define EMSCRIPTEN_MEMCPY_BIG_THRESHOLD 8192
+#endif
+
 // XXX EMSCRIPTEN ASAN: build an uninstrumented version of memcpy
 #if defined(__EMSCRIPTEN__) && defined(__has_feature)
 #if __has_feature(address_sanitizer)
@@ -21,16 +35,80 @@ void *memcpy(void *restrict dest, const void *restrict src, size_t n)
   unsigned char *d = dest;
   const unsigned char *s = src;
 
-  unsigned char *aligned_d_end;
-  unsigned char *block_aligned_d_end;
-  unsigned char *d_end;
-
-  if (n >= 8192) {
+#ifdef __wasm_bulk_memory__
+  if (n >= EMSCRIPTEN_MEMCPY_BULK_THRESHOLD) {
+    // With bulk memory enabled this is lowered to a memory.copy instruction.
+    __builtin_memcpy(dest, src, n);
+    return dest;
+  }
+#else
+  if (n >= EMSCRIPTEN_MEMCPY_BIG_THRESHOLD) {
     emscripten_memcpy_big(dest, src, n);
     return dest;
   }
+#endif
+
+#ifdef __wasm_simd128__
+  if (n < 16) {
+    // Two possibly overlapping loads and stores of the largest size that fits.
+    if (n >= 8) {
+      uint64_t head, tail;
+      __builtin_memcpy(&head, s, 8);
+      __builtin_memcpy(&tail, s + n - 8, 8);
+      __builtin_memcpy(d, &head, 8);
+      __builtin_memcpy(d + n - 8, &tail, 8);
+    } else if (n >= 4) {
+      uint32_t head, tail;
+      __builtin_memcpy(&head, s, 4);
+      __builtin_memcpy(&tail, s + n - 4, 4);
+      __builtin_memcpy(d, &head, 4);
+      __builtin_memcpy(d + n - 4, &tail, 4);
+    } else if (n) {
+      // 1-3 bytes: the first, middle and last byte.
+      unsigned char first = s[0], middle = s[n >> 1], last = s[n - 1];
+      d[0] = first;
+      d[n >> 1] = middle;
+      d[n - 1] = last;
+    }
+    return dest;
+  }
+  // v128 loads do not need to be aligned, so source and destination may be
+  // misaligned relative to each other. The first and last 16 bytes are copied
+  // as unaligned vectors up front and at the end; in between, stores go to
+  // 16-byte aligned destination addresses, overlapping the head if need be.
+  {
+    v128_t head = wasm_v128_load(s);
+    v128_t tail = wasm_v128_load(s + n - 16);
+    size_t skip = 16 - (((uintptr_t)d) & 15);
+    unsigned char *d_end = d + n - 16;
+    wasm_v128_store(d, head);
+    d += skip;
+    s += skip;
+    while (d_end - d >= 64) {
+      v128_t v0 = wasm_v128_load(s);
+      v128_t v1 = wasm_v128_load(s + 16);
+      v128_t v2 = wasm_v128_load(s + 32);
+      v128_t v3 = wasm_v128_load(s + 48);
+      wasm_v128_store(d, v0);
+      wasm_v128_store(d + 16, v1);
+      wasm_v128_store(d + 32, v2);
+      wasm_v128_store(d + 48, v3);
+      d += 64;
+      s += 64;
+    }
+    while (d < d_end) {
+      wasm_v128_store(d, wasm_v128_load(s));
+      d += 16;
+      s += 16;
+    }
+    wasm_v128_store(d_end, tail);
+  }
+  return dest;
+#else
+  unsigned char *aligned_d_end;
+  unsigned char *block_aligned_d_end;
+  unsigned char *d_end = d + n;
 
-  d_end = d + n;
   if ((((uintptr_t)d) & 3) == (((uintptr_t)s) & 3)) {
     // The initial unaligned < 4-byte front.
     while ((((uintptr_t)d) & 3) && d < d_end) {
@@ -86,8 +164,5 @@ void *memcpy(void *restrict dest, const void *restrict src, size_t n)
     *d++ = *s++;
   }
   return dest;
-
-
-  for (; n; n--) *d++ = *s++;
-  return dest;
+#endif
 }
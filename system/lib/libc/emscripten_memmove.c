@@ -1,3 +1,40 @@
+#if defined(__wasm_simd128__) || defined(__wasm_bulk_memory__)
+
+#include <stdint.h>
+#include <string.h>
+
+// XXX EMSCRIPTEN ASAN: memmove copies non-overlapping ranges with the
+// uninstrumented memcpy, rather than the memcpy that ASAN intercepts.
+#if defined(__EMSCRIPTEN__) && defined(__has_feature)
+#if __has_feature(address_sanitizer)
+void *emscripten_builtin_memcpy(void *dest, const void *src, size_t n);
+#define emscripten_memmove_copy emscripten_builtin_memcpy
+#endif
+#endif
+
+#ifndef emscripten_memmove_copy
+#define emscripten_memmove_copy memcpy
+#endif
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#else
+// Without SIMD, moves below the bulk memory threshold use the musl
+// implementation. Like memmove itself it must not be instrumented by ASAN.
+static void *musl_memmove(void *dest, const void *src, size_t n) __attribute__((no_sanitize("address")));
+#define memmove musl_memmove
+#define memcpy emscripten_memmove_copy
+#include "musl/src/string/memmove.c"
+#undef memcpy
+#undef memmove
+#endif
+
+// Moves of at least this many bytes use memory.copy, which handles overlapping
+// ranges, when bulk memory is available.
+#ifndef EMSCRIPTEN_MEMMOVE_BULK_THRESHOLD
+#define EMSCRIPTEN_MEMMOVE_BULK_THRESHOLD 512
+#endif
+
 // XXX EMSCRIPTEN ASAN: build an uninstrumented version of memmove
 #if defined(__EMSCRIPTEN__) && defined(__has_feature)
 #if __has_feature(address_sanitizer)
@@ -5,4 +42,118 @@
 #endif
 #endif
 
+void *memmove(void *dest, const void *src, size_t n)
+{
+#ifdef __wasm_bulk_memory__
+  if (n >= EMSCRIPTEN_MEMMOVE_BULK_THRESHOLD) {
+    // With bulk memory enabled this is lowered to a memory.copy instruction.
+    __builtin_memmove(dest, src, n);
+    return dest;
+  }
+#endif
+
+#ifdef __wasm_simd128__
+  unsigned char *d = dest;
+  const unsigned char *s = src;
+
+  if (d == s) return dest;
+  if (s + n <= d || d + n <= s) return emscripten_memmove_copy(d, s, n);
+
+  // All loads of a step happen before its stores, so overlapping small moves
+  // are safe.
+  if (n < 16) {
+    if (n >= 8) {
+      uint64_t head, tail;
+      __builtin_memcpy(&head, s, 8);
+      __builtin_memcpy(&tail, s + n - 8, 8);
+      __builtin_memcpy(d, &head, 8);
+      __builtin_memcpy(d + n - 8, &tail, 8);
+    } else if (n >= 4) {
+      uint32_t head, tail;
+      __builtin_memcpy(&head, s, 4);
+      __builtin_memcpy(&tail, s + n - 4, 4);
+      __builtin_memcpy(d, &head, 4);
+      __builtin_memcpy(d + n - 4, &tail, 4);
+    } else {
+      unsigned char first = s[0], middle = s[n >> 1], last = s[n - 1];
+      d[0] = first;
+      d[n >> 1] = middle;
+      d[n - 1] = last;
+    }
+    return dest;
+  }
+
+  // The first and last 16 bytes of the source are loaded up front and stored
+  // last, since the loop below may overwrite them. The loop stores to 16-byte
+  // aligned destination addresses, walking away from the part of the source
+  // it has not read yet.
+  v128_t head = wasm_v128_load(s);
+  v128_t tail = wasm_v128_load(s + n - 16);
+  if (d < s) {
+    unsigned char *dd = d + 16 - (((uintptr_t)d) & 15);
+    const unsigned char *ss = s + (dd - d);
+    unsigned char *d_end = d + n - 16;
+    while (d_end - dd >= 64) {
+      v128_t v0 = wasm_v128_load(ss);
+      v128_t v1 = wasm_v128_load(ss + 16);
+      v128_t v2 = wasm_v128_load(ss + 32);
+      v128_t v3 = wasm_v128_load(ss + 48);
+      wasm_v128_store(dd, v0);
+      wasm_v128_store(dd + 16, v1);
+      wasm_v128_store(dd + 32, v2);
+      wasm_v128_store(dd + 48, v3);
+      dd += 64;
+      ss += 64;
+    }
+    while (dd < d_end) {
+      wasm_v128_store(dd, wasm_v128_load(ss));
+      dd += 16;
+      ss += 16;
+    }
+  } else {
+    unsigned char *dd = (unsigned char *)(((uintptr_t)(d + n)) & -16);
+    const unsigned char *ss = s + (dd - d);
+    unsigned char *d_start = d + 16;
+    while (dd - d_start >= 64) {
+      dd -= 64;
+      ss -= 64;
+      v128_t v0 = wasm_v128_load(ss);
+      v128_t v1 = wasm_v128_load(ss + 16);
+      v128_t v2 = wasm_v128_load(ss + 32);
+      v128_t v3 = wasm_v128_load(ss + 48);
+      wasm_v128_store(dd, v0);
+      wasm_v128_store(dd + 16, v1);
+      wasm_v128_store(dd + 32, v2);
+      wasm_v128_store(dd + 48, v3);
+    }
+    while (dd > d_start) {
+      dd -= 16;
+      ss -= 16;
+      wasm_v128_store(dd, wasm_v128_load(ss));
+    }
+  }
+  wasm_v128_store(d, head);
+  wasm_v128_store(d + n - 16, tail);
+  return dest;
+#else
+  return musl_memmove(dest, src, n);
+#endif
+}
+
+#else
+
+#include <string.h>
+
+// XXX EMSCRIPTEN ASAN: build an uninstrumented version of memmove, which
+// copies non-overlapping ranges with the uninstrumented memcpy
+#if defined(__EMSCRIPTEN__) && defined(__has_feature)
+#if __has_feature(address_sanitizer)
+void *emscripten_builtin_memcpy(void *dest, const void *src, size_t n);
+#define memmove __attribute__((no_sanitize("address"))) emscripten_builtin_memmove
+#define memcpy emscripten_builtin_memcpy
+#endif
+#endif
+
 #include "musl/src/string/memmove.c"
+
+#endif
@@ -1,3 +1,85 @@
+#if defined(__wasm_simd128__) || defined(__wasm_bulk_memory__)
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#else
+// Without SIMD, fills below the bulk memory threshold use the musl
+// implementation. Like memset itself it must not be instrumented by ASAN.
+static void *musl_memset(void *dest, int c, size_t n) __attribute__((no_sanitize("address")));
+#define memset musl_memset
+#include "musl/src/string/memset.c"
+#undef memset
+#endif
+
+// Fills of at least this many bytes use memory.fill when bulk memory is
+// available. The crossover point can be measured with
+// tests/benchmark_memset.cpp.
+#ifndef EMSCRIPTEN_MEMSET_BULK_THRESHOLD
+#define EMSCRIPTEN_MEMSET_BULK_THRESHOLD 512
+#endif
+
+// XXX EMSCRIPTEN ASAN: build an uninstrumented version of memset
+#if defined(__EMSCRIPTEN__) && defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define memset __attribute__((no_sanitize("address"))) emscripten_builtin_memset
+#endif
+#endif
+
+void *memset(void *dest, int c, size_t n)
+{
+#ifdef __wasm_bulk_memory__
+  if (n >= EMSCRIPTEN_MEMSET_BULK_THRESHOLD) {
+    // With bulk memory enabled this is lowered to a memory.fill instruction.
+    __builtin_memset(dest, c, n);
+    return dest;
+  }
+#endif
+
+#ifdef __wasm_simd128__
+  unsigned char *d = dest;
+  if (n < 16) {
+    // Two possibly overlapping stores of the largest size that fits.
+    uint64_t v = (uint8_t)c * 0x0101010101010101ull;
+    if (n >= 8) {
+      __builtin_memcpy(d, &v, 8);
+      __builtin_memcpy(d + n - 8, &v, 8);
+    } else if (n >= 4) {
+      __builtin_memcpy(d, &v, 4);
+      __builtin_memcpy(d + n - 4, &v, 4);
+    } else if (n) {
+      d[0] = d[n >> 1] = d[n - 1] = c;
+    }
+    return dest;
+  }
+  // The first and last 16 bytes are unaligned stores; in between, stores go to
+  // 16-byte aligned addresses, overlapping the head and tail if need be.
+  v128_t v = wasm_i8x16_splat(c);
+  unsigned char *d_end = d + n - 16;
+  wasm_v128_store(d, v);
+  wasm_v128_store(d_end, v);
+  d += 16 - (((uintptr_t)d) & 15);
+  while (d_end - d >= 64) {
+    wasm_v128_store(d, v);
+    wasm_v128_store(d + 16, v);
+    wasm_v128_store(d + 32, v);
+    wasm_v128_store(d + 48, v);
+    d += 64;
+  }
+  while (d < d_end) {
+    wasm_v128_store(d, v);
+    d += 16;
+  }
+  return dest;
+#else
+  return musl_memset(dest, c, n);
+#endif
+}
+
+#else
+
 // XXX EMSCRIPTEN ASAN: build an uninstrumented version of memset
 #if defined(__EMSCRIPTEN__) && defined(__has_feature)
 #if __has_feature(address_sanitizer)
@@ -6,3 +88,5 @@
 #endif
 
 #include "musl/src/string/memset.c"
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#ifdef __wasm_simd128__
+
+#include <string.h>
+#include "libc.h"
+#include "emscripten_string_simd.h"
+
+char *__strchrnul(const char *s, int c)
+{
+  return em_simd_strchrnul(s, c);
+}
+
+weak_alias(__strchrnul, strchrnul);
+
+#else
+
+#include "musl/src/string/strchrnul.c"
+
+#endif
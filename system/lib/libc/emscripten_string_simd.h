@@ -0,0 +1,96 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * wasm SIMD kernels for the string functions in this directory, shared with
+ * their ASAN variants in emscripten_asan_*.c.
+ *
+ * The kernels that search for a byte (strlen, memchr, strchrnul) read whole
+ * 16-byte aligned blocks, so they can read a few bytes past the end of the
+ * string or buffer. An aligned block never crosses the end of memory, so in
+ * wasm this cannot trap, but ASAN would report it. Those kernels are therefore
+ * built without instrumentation, and the ASAN variants check the bytes the
+ * result depends on afterwards.
+ */
+
+#ifndef EMSCRIPTEN_STRING_SIMD_H
+#define EMSCRIPTEN_STRING_SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <wasm_simd128.h>
+
+#define EM_SIMD_SCAN static inline __attribute__((no_sanitize("address")))
+
+// Index of the first set lane of a comparison result that has at least one
+// lane set.
+static inline size_t em_simd_first_lane(v128_t mask)
+{
+  uint64_t lo = wasm_i64x2_extract_lane(mask, 0);
+  if (lo) return __builtin_ctzll(lo) >> 3;
+  return 8 + (__builtin_ctzll(wasm_i64x2_extract_lane(mask, 1)) >> 3);
+}
+
+// A mask with the lanes at index n and above set.
+static inline v128_t em_simd_lanes_from(size_t n)
+{
+  v128_t iota = wasm_i8x16_make(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  return wasm_u8x16_ge(iota, wasm_i8x16_splat(n));
+}
+
+EM_SIMD_SCAN size_t em_simd_strlen(const char *s)
+{
+  size_t offset = (uintptr_t)s & 15;
+  const unsigned char *p = (const unsigned char *)s - offset;
+  v128_t zero = wasm_i8x16_splat(0);
+  v128_t m = wasm_v128_and(wasm_i8x16_eq(wasm_v128_load(p), zero), em_simd_lanes_from(offset));
+  while (!wasm_i8x16_any_true(m)) {
+    p += 16;
+    m = wasm_i8x16_eq(wasm_v128_load(p), zero);
+  }
+  return p + em_simd_first_lane(m) - (const unsigned char *)s;
+}
+
+EM_SIMD_SCAN void *em_simd_memchr(const void *src, int c, size_t n)
+{
+  if (!n) return 0;
+  size_t offset = (uintptr_t)src & 15;
+  const unsigned char *p = (const unsigned char *)src - offset;
+  v128_t vc = wasm_i8x16_splat(c);
+  v128_t m = wasm_v128_and(wasm_i8x16_eq(wasm_v128_load(p), vc), em_simd_lanes_from(offset));
+  // From here on n counts the bytes from p on.
+  n = n > SIZE_MAX - offset ? SIZE_MAX : n + offset;
+  for (;;) {
+    if (wasm_i8x16_any_true(m)) {
+      size_t i = em_simd_first_lane(m);
+      return i < n ? (void *)(p + i) : 0;
+    }
+    if (n <= 16) return 0;
+    n -= 16;
+    p += 16;
+    m = wasm_i8x16_eq(wasm_v128_load(p), vc);
+  }
+}
+
+EM_SIMD_SCAN char *em_simd_strchrnul(const char *s, int c)
+{
+  size_t offset = (uintptr_t)s & 15;
+  const unsigned char *p = (const unsigned char *)s - offset;
+  v128_t vc = wasm_i8x16_splat(c);
+  v128_t zero = wasm_i8x16_splat(0);
+  v128_t v = wasm_v128_load(p);
+  v128_t m = wasm_v128_or(wasm_i8x16_eq(v, vc), wasm_i8x16_eq(v, zero));
+  m = wasm_v128_and(m, em_simd_lanes_from(offset));
+  while (!wasm_i8x16_any_true(m)) {
+    p += 16;
+    v = wasm_v128_load(p);
+    m = wasm_v128_or(wasm_i8x16_eq(v, vc), wasm_i8x16_eq(v, zero));
+  }
+  return (char *)p + em_simd_first_lane(m);
+}
+
+#endif // EMSCRIPTEN_STRING_SIMD_H
@@ -0,0 +1,22 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#ifdef __wasm_simd128__
+
+#include <string.h>
+#include "emscripten_string_simd.h"
+
+size_t strlen(const char *s)
+{
+  return em_simd_strlen(s);
+}
+
+#else
+
+#include "musl/src/string/strlen.c"
+
+#endif
@@ -0,0 +1,272 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * UTF-8 validation and UTF-8 <-> UTF-16 conversion, the native counterparts of
+ * UTF8ToString() and stringToUTF8(). With -msimd128, runs of ASCII are handled
+ * 16 bytes at a time, and validation checks whole 16-byte blocks.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <emscripten/utf8.h>
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
+
+// Decodes the sequence at the start of s, which has len > 0 bytes. Returns the
+// number of bytes consumed and sets *cp to the code point, or to -1 if the
+// bytes are not valid UTF-8. In that case the return value is the length of the
+// maximal invalid subpart, which is replaced by a single U+FFFD when decoding,
+// as TextDecoder does.
+static size_t decode_one(const unsigned char *s, size_t len, int32_t *cp)
+{
+  unsigned c = s[0];
+  unsigned lo = 0x80, hi = 0xBF;
+  size_t need;
+  uint32_t v;
+
+  if (c < 0x80) {
+    *cp = c;
+    return 1;
+  }
+  if (c >= 0xC2 && c <= 0xDF) {
+    need = 1;
+    v = c & 0x1F;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    need = 2;
+    v = c & 0x0F;
+    if (c == 0xE0) lo = 0xA0; // overlong
+    else if (c == 0xED) hi = 0x9F; // surrogates
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    need = 3;
+    v = c & 0x07;
+    if (c == 0xF0) lo = 0x90; // overlong
+    else if (c == 0xF4) hi = 0x8F; // above U+10FFFF
+  } else {
+    *cp = -1;
+    return 1;
+  }
+  for (size_t i = 1; i <= need; ++i) {
+    if (i >= len || s[i] < lo || s[i] > hi) {
+      *cp = -1;
+      return i;
+    }
+    v = (v << 6) | (s[i] & 0x3F);
+    lo = 0x80;
+    hi = 0xBF;
+  }
+  *cp = v;
+  return need + 1;
+}
+
+static size_t validate_scalar(const unsigned char *s, size_t len)
+{
+  size_t i = 0;
+  while (i < len) {
+    int32_t cp;
+    size_t n = decode_one(s + i, len - i, &cp);
+    if (cp < 0) break;
+    i += n;
+  }
+  return i;
+}
+
+#ifdef __wasm_simd128__
+
+// Block validation classifies every byte together with the byte before it by
+// looking up the high nibble of the previous byte, its low nibble and the high
+// nibble of the byte itself in three 16-entry tables; the AND of the three is
+// nonzero exactly for invalid pairs. The one property that pairs cannot see,
+// whether a continuation byte is the second or third one after a 3- or 4-byte
+// lead, is checked separately against the bytes two and three back. This is
+// the lookup algorithm used by simdjson.
+#define TOO_SHORT      (1 << 0) // lead byte or ASCII after a lead byte
+#define TOO_LONG       (1 << 1) // continuation byte after ASCII
+#define OVERLONG_3     (1 << 2)
+#define TOO_LARGE      (1 << 3)
+#define SURROGATE      (1 << 4)
+#define OVERLONG_2     (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4     (1 << 6)
+#define TWO_CONTS      (1 << 7) // continuation after continuation
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static inline v128_t block_errors(v128_t input, v128_t prev_input)
+{
+  const v128_t byte_1_high_table = wasm_i8x16_make(
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const v128_t byte_1_low_table = wasm_i8x16_make(
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000);
+  const v128_t byte_2_high_table = wasm_i8x16_make(
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+  v128_t prev1 = wasm_v8x16_shuffle(prev_input, input,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30);
+  v128_t prev2 = wasm_v8x16_shuffle(prev_input, input,
+    14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29);
+  v128_t prev3 = wasm_v8x16_shuffle(prev_input, input,
+    13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28);
+  v128_t low_nibble = wasm_i8x16_splat(0x0F);
+
+  v128_t special = wasm_v128_and(
+    wasm_v128_and(wasm_v8x16_swizzle(byte_1_high_table, wasm_u8x16_shr(prev1, 4)),
+                  wasm_v8x16_swizzle(byte_1_low_table, wasm_v128_and(prev1, low_nibble))),
+    wasm_v8x16_swizzle(byte_2_high_table, wasm_u8x16_shr(input, 4)));
+
+  // Bit 7 is set where the byte must be a continuation because of a 3- or
+  // 4-byte lead two or three bytes back.
+  v128_t must_be_continuation = wasm_v128_or(
+    wasm_u8x16_sub_saturate(prev2, wasm_i8x16_splat(0xE0 - 0x80)),
+    wasm_u8x16_sub_saturate(prev3, wasm_i8x16_splat(0xF0 - 0x80)));
+  must_be_continuation = wasm_v128_and(must_be_continuation, wasm_i8x16_splat(0x80));
+  return wasm_v128_xor(must_be_continuation, special);
+}
+
+// Nonzero when the block ends inside a multibyte sequence.
+static inline v128_t block_incomplete(v128_t input)
+{
+  const v128_t max_value = wasm_i8x16_make(
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1);
+  return wasm_u8x16_sub_saturate(input, max_value);
+}
+
+#endif
+
+size_t emscripten_utf8_validate(const char *str, size_t len)
+{
+  const unsigned char *s = (const unsigned char *)str;
+  size_t i = 0;
+#ifdef __wasm_simd128__
+  v128_t high_bit = wasm_i8x16_splat(0x80);
+  v128_t prev = wasm_i8x16_splat(0);
+  v128_t prev_incomplete = prev;
+  for (; len - i >= 16; i += 16) {
+    v128_t input = wasm_v128_load(s + i);
+    if (!wasm_i8x16_any_true(wasm_v128_and(input, high_bit))) {
+      if (wasm_i8x16_any_true(prev_incomplete)) break;
+    } else {
+      if (wasm_i8x16_any_true(block_errors(input, prev))) break;
+      prev_incomplete = block_incomplete(input);
+    }
+    prev = input;
+  }
+  // Everything before i is valid, except that a sequence starting in the last
+  // three bytes may continue past it. Finish the tail, or find where exactly
+  // the block that failed goes wrong, from the start of that sequence.
+  for (size_t k = 1; k <= 3 && k <= i; ++k) {
+    if (s[i - k] >= 0xC0) {
+      i -= k;
+      break;
+    }
+  }
+#endif
+  return i + validate_scalar(s + i, len - i);
+}
+
+size_t emscripten_utf8_to_utf16(const char *str, size_t len, uint16_t *out)
+{
+  const unsigned char *s = (const unsigned char *)str;
+  const unsigned char *end = s + len;
+  uint16_t *o = out;
+  while (s < end) {
+#ifdef __wasm_simd128__
+    while (end - s >= 16 && *s < 0x80) {
+      v128_t v = wasm_v128_load(s);
+      if (wasm_i8x16_any_true(wasm_v128_and(v, wasm_i8x16_splat(0x80)))) break;
+      wasm_v128_store(o, wasm_i16x8_widen_low_u8x16(v));
+      wasm_v128_store(o + 8, wasm_i16x8_widen_high_u8x16(v));
+      s += 16;
+      o += 16;
+    }
+    if (s == end) break;
+#endif
+    int32_t cp;
+    s += decode_one(s, end - s, &cp);
+    if (cp < 0) cp = 0xFFFD;
+    if (cp >= 0x10000) {
+      cp -= 0x10000;
+      *o++ = 0xD800 | (cp >> 10);
+      *o++ = 0xDC00 | (cp & 0x3FF);
+    } else {
+      *o++ = cp;
+    }
+  }
+  return o - out;
+}
+
+size_t emscripten_utf16_to_utf8(const uint16_t *str, size_t len, char *out)
+{
+  const uint16_t *s = str;
+  const uint16_t *end = s + len;
+  unsigned char *o = (unsigned char *)out;
+  while (s < end) {
+#ifdef __wasm_simd128__
+    while (end - s >= 16 && *s < 0x80) {
+      v128_t a = wasm_v128_load(s);
+      v128_t b = wasm_v128_load(s + 8);
+      if (wasm_i8x16_any_true(wasm_v128_and(wasm_v128_or(a, b), wasm_i16x8_splat(0xFF80)))) break;
+      wasm_v128_store(o, wasm_u8x16_narrow_i16x8(a, b));
+      s += 16;
+      o += 16;
+    }
+    if (s == end) break;
+#endif
+    uint32_t c = *s++;
+    if (c >= 0xD800 && c <= 0xDFFF) {
+      // Unpaired surrogates are replaced, as TextEncoder does.
+      if (c <= 0xDBFF && s < end && *s >= 0xDC00 && *s <= 0xDFFF) {
+        c = 0x10000 + ((c - 0xD800) << 10) + (*s++ - 0xDC00);
+      } else {
+        c = 0xFFFD;
+      }
+    }
+    if (c < 0x80) {
+      *o++ = c;
+    } else if (c < 0x800) {
+      *o++ = 0xC0 | (c >> 6);
+      *o++ = 0x80 | (c & 0x3F);
+    } else if (c < 0x10000) {
+      *o++ = 0xE0 | (c >> 12);
+      *o++ = 0x80 | ((c >> 6) & 0x3F);
+      *o++ = 0x80 | (c & 0x3F);
+    } else {
+      *o++ = 0xF0 | (c >> 18);
+      *o++ = 0x80 | ((c >> 12) & 0x3F);
+      *o++ = 0x80 | ((c >> 6) & 0x3F);
+      *o++ = 0x80 | (c & 0x3F);
+    }
+  }
+  return o - (unsigned char *)out;
+}
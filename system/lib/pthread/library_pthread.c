@@ -166,9 +166,82 @@ int usleep(unsigned usec) {
   return 0;
 }
 
+// Pool of free em_queued_call objects, so that proxying a call does not need to malloc() and free()
+// (and take the allocator's lock for each) every time. Calls are usually freed by a different
+// thread than the one that allocated them (e.g. allocated by a worker, and freed by the main thread
+// after performing them), so rather than per-thread caches, which would only pile the objects up in
+// the consuming thread, this is a single pool shared by all threads. It is a lock-free stack, linked
+// through em_queued_call::next, whose head is tagged with a counter that is bumped by every push, to
+// make it immune to the ABA problem. That needs native 64-bit atomics, so the pool is only used with
+// the wasm backend.
+#ifdef __wasm__
+#define QUEUED_CALL_POOL
+#endif
+
+// The pool never holds more free objects than this, further ones are given back to malloc().
+#define QUEUED_CALL_POOL_MAX_SIZE 256
+
+#ifdef QUEUED_CALL_POOL
+static uint64_t queued_call_pool_head = 0; // Low 32 bits: the top of the stack, high: the tag.
+static uint32_t queued_call_pool_size = 0;
+#endif
+static uint32_t queued_call_pool_hits = 0;
+static uint32_t queued_call_pool_misses = 0;
+
+static em_queued_call* PopPooledCall() {
+#ifdef QUEUED_CALL_POOL
+  uint64_t head = emscripten_atomic_load_u64(&queued_call_pool_head);
+  while ((uint32_t)head) {
+    em_queued_call* call = (em_queued_call*)(uint32_t)head;
+    // If another thread pops this call first, this may read a stale value, but then the tag has
+    // changed as well, and the CAS fails.
+    uint64_t newHead = (head & 0xFFFFFFFF00000000ULL) | (uint32_t)call->next;
+    uint64_t prevHead = emscripten_atomic_cas_u64(&queued_call_pool_head, head, newHead);
+    if (prevHead == head) {
+      emscripten_atomic_sub_u32(&queued_call_pool_size, 1);
+      emscripten_atomic_add_u32(&queued_call_pool_hits, 1);
+      return call;
+    }
+    head = prevHead;
+  }
+#endif
+  emscripten_atomic_add_u32(&queued_call_pool_misses, 1);
+  return 0;
+}
+
+// Returns 0 if the pool is full, and the call should be freed instead.
+static int PushPooledCall(em_queued_call* call) {
+#ifdef QUEUED_CALL_POOL
+  if (emscripten_atomic_add_u32(&queued_call_pool_size, 1) >= QUEUED_CALL_POOL_MAX_SIZE) {
+    emscripten_atomic_sub_u32(&queued_call_pool_size, 1);
+    return 0;
+  }
+  uint64_t head = emscripten_atomic_load_u64(&queued_call_pool_head);
+  while (1) {
+    call->next = (em_queued_call*)(uint32_t)head;
+    uint64_t newHead = (head & 0xFFFFFFFF00000000ULL) + 0x100000000ULL + (uint32_t)call;
+    uint64_t prevHead = emscripten_atomic_cas_u64(&queued_call_pool_head, head, newHead);
+    if (prevHead == head)
+      return 1;
+    head = prevHead;
+  }
+#else
+  return 0;
+#endif
+}
+
+void emscripten_get_queued_call_pool_stats(uint32_t* hits, uint32_t* misses) {
+  if (hits)
+    *hits = emscripten_atomic_load_u32(&queued_call_pool_hits);
+  if (misses)
+    *misses = emscripten_atomic_load_u32(&queued_call_pool_misses);
+}
+
 // Allocator and deallocator for em_queued_call objects.
 static em_queued_call* em_queued_call_malloc() {
-  em_queued_call* call = (em_queued_call*)malloc(sizeof(em_queued_call));
+  em_queued_call* call = PopPooledCall();
+  if (!call)
+    call = (em_queued_call*)malloc(sizeof(em_queued_call));
   assert(call); // Not a programming error, but use assert() in debug builds to catch OOM scenarios.
   if (call) {
     call->operationDone = 0;
@@ -178,9 +251,11 @@ static em_queued_call* em_queued_call_malloc() {
   return call;
 }
 static void em_queued_call_free(em_queued_call* call) {
-  if (call)
-    free(call->satelliteData);
-  free(call);
+  if (!call)
+    return;
+  free(call->satelliteData);
+  if (!PushPooledCall(call))
+    free(call);
 }
 
 void emscripten_async_waitable_close(em_queued_call* call) { em_queued_call_free(call); }
@@ -361,54 +436,137 @@ static void _do_call(em_queued_call* q) {
   }
 }
 
-#define CALL_QUEUE_SIZE 128
+// Each thread has a queue of calls proxied to it. The queue is a lock-free stack (linked through
+// em_queued_call::next), which any thread may push to, and which the owning thread consumes by
+// atomically taking the whole stack at once and reversing it, so calls are still performed in the
+// order they were queued. Taking the whole stack (rather than popping items one by one) avoids the
+// ABA problem, and since it is a linked list, the queue can never fill up.
+//
+// The queues are not stored on the pthread_t, which is freed when the thread is cleaned up, but in
+// a table keyed by thread that is never freed, so a call can be queued to a thread that is exiting
+// or has exited without touching freed memory. A queue is opened when its thread is created, and
+// closed when the thread exits and when its pthread_t is freed; calls that were pending or that are
+// queued after that are cancelled. A new thread that gets the same pthread_t reuses the queue.
+
+#define CALL_QUEUE_CLOSED ((em_queued_call*)1)
+#define CALL_QUEUE_BUCKETS 64
 
 typedef struct CallQueue {
   void* target_thread;
-  em_queued_call** call_queue;
-  int call_queue_head; // Shared data synchronized by call_queue_lock.
-  int call_queue_tail;
-  struct CallQueue* next;
+  em_queued_call* volatile calls; // The stack of queued calls, or CALL_QUEUE_CLOSED.
+  struct CallQueue* next;         // Next queue in the same bucket.
 } CallQueue;
 
-// Currently global to the queue, but this can be improved to be per-queue specific. (TODO: with
-// lockfree list operations on callQueue_head, or removing the list by moving this data to
-// pthread_t)
-static pthread_mutex_t call_queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static CallQueue* callQueue_head = 0;
-
-static CallQueue* GetQueue(
-  void* target) // Not thread safe, call while having call_queue_lock obtained.
-{
-  assert(target);
-  CallQueue* q = callQueue_head;
+// Buckets of queues, which are only ever added to, at the head.
+static CallQueue* volatile call_queues[CALL_QUEUE_BUCKETS];
+
+static CallQueue* volatile* GetQueueBucket(void* target) {
+  // pthread_ts are malloc'd, so the low bits carry no information.
+  return &call_queues[((uint32_t)target >> 4) % CALL_QUEUE_BUCKETS];
+}
+
+static CallQueue* FindQueue(CallQueue* q, void* target) {
   while (q && q->target_thread != target)
     q = q->next;
   return q;
 }
 
-static CallQueue* GetOrAllocateQueue(
-  void* target) // Not thread safe, call while having call_queue_lock obtained.
-{
-  CallQueue* q = GetQueue(target);
+static CallQueue* GetQueue(void* target) {
+  return FindQueue(*GetQueueBucket(target), target);
+}
+
+static CallQueue* GetOrAllocateQueue(void* target) {
+  CallQueue* volatile* bucket = GetQueueBucket(target);
+  CallQueue* head = *bucket;
+  CallQueue* q = FindQueue(head, target);
   if (q)
     return q;
 
   q = (CallQueue*)malloc(sizeof(CallQueue));
   q->target_thread = target;
-  q->call_queue = 0;
-  q->call_queue_head = 0;
-  q->call_queue_tail = 0;
-  q->next = 0;
-  if (callQueue_head) {
-    CallQueue* last = callQueue_head;
-    while (last->next)
-      last = last->next;
-    last->next = q;
-  } else {
-    callQueue_head = q;
+  q->calls = CALL_QUEUE_CLOSED;
+  while (1) {
+    q->next = head;
+    CallQueue* prev = (CallQueue*)emscripten_atomic_cas_u32((void*)bucket, (uint32_t)head, (uint32_t)q);
+    if (prev == head)
+      return q;
+    // Another thread added queues to the bucket, possibly one for the same target.
+    CallQueue* found = FindQueue(prev, target);
+    if (found) {
+      free(q);
+      return found;
+    }
+    head = prev;
   }
-  return q;
+}
+
+// Releases calls that will never be performed: calls the callers have detached from are deleted,
+// and callers waiting on a call are woken up.
+static void CancelQueuedCalls(em_queued_call* calls) {
+  while (calls) {
+    em_queued_call* next = calls->next;
+    if (calls->calleeDelete) {
+      em_queued_call_free(calls);
+    } else {
+      calls->operationDone = 1;
+      emscripten_futex_wake(&calls->operationDone, INT_MAX);
+    }
+    calls = next;
+  }
+}
+
+// Called from pthread_create() for each new thread, and for the main browser thread.
+void EMSCRIPTEN_KEEPALIVE __emscripten_open_call_queue(pthread_t thread) {
+  CallQueue* q = GetOrAllocateQueue(thread);
+  emscripten_atomic_cas_u32((void*)&q->calls, (uint32_t)CALL_QUEUE_CLOSED, 0);
+}
+
+// Called when a thread exits, and before its pthread_t is freed.
+void EMSCRIPTEN_KEEPALIVE __emscripten_close_call_queue(pthread_t thread) {
+  CallQueue* q = GetQueue(thread);
+  if (!q)
+    return;
+  em_queued_call* calls =
+    (em_queued_call*)emscripten_atomic_exchange_u32((void*)&q->calls, (uint32_t)CALL_QUEUE_CLOSED);
+  if (calls != CALL_QUEUE_CLOSED)
+    CancelQueuedCalls(calls);
+}
+
+// Pushes a chain of calls, linked from the last call to be performed to the first one, to a
+// queue. The whole chain is pushed with a single CAS, so calls queued by other threads can't end
+// up in the middle of it. Returns 1 if the queue was empty before, in which case the target thread
+// needs to be woken up, 0 if it was not, and -1 if the queue is closed.
+static int PushQueuedCalls(CallQueue* q, em_queued_call* first, em_queued_call* last) {
+  while (1) {
+    em_queued_call* head = q->calls;
+    if (head == CALL_QUEUE_CLOSED)
+      return -1;
+    first->next = head;
+    if (emscripten_atomic_cas_u32((void*)&q->calls, (uint32_t)head, (uint32_t)last) ==
+        (uint32_t)head) {
+      return head == 0;
+    }
+  }
+}
+
+// Takes all the calls in a queue, leaving it open if it is. Returns them in the order they were
+// queued.
+static em_queued_call* TakeQueuedCalls(CallQueue* q) {
+  em_queued_call* calls;
+  do {
+    calls = q->calls;
+    if (!calls || calls == CALL_QUEUE_CLOSED)
+      return 0;
+  } while (emscripten_atomic_cas_u32((void*)&q->calls, (uint32_t)calls, 0) != (uint32_t)calls);
+
+  em_queued_call* ordered = 0;
+  while (calls) {
+    em_queued_call* next = calls->next;
+    calls->next = ordered;
+    ordered = calls;
+    calls = next;
+  }
+  return ordered;
 }
 
 EMSCRIPTEN_RESULT emscripten_wait_for_call_v(em_queued_call* call, double timeoutMSecs) {
@@ -445,15 +603,17 @@ static pthread_t main_browser_thread_id_ = 0;
 void EMSCRIPTEN_KEEPALIVE emscripten_register_main_browser_thread_id(
   pthread_t main_browser_thread_id) {
   main_browser_thread_id_ = main_browser_thread_id;
+  __emscripten_open_call_queue(main_browser_thread_id);
 }
 
 pthread_t EMSCRIPTEN_KEEPALIVE emscripten_main_browser_thread_id() {
   return main_browser_thread_id_;
 }
 
-static void EMSCRIPTEN_KEEPALIVE emscripten_async_queue_call_on_thread(
-  pthread_t target_thread, em_queued_call* call) {
-  assert(call);
+static void EMSCRIPTEN_KEEPALIVE emscripten_async_queue_calls_on_thread(
+  pthread_t target_thread, em_queued_call** calls, int numCalls) {
+  assert(calls);
+  assert(numCalls > 0);
 
   // #if PTHREADS_DEBUG // TODO: Create a debug version of pthreads library
   //	EM_ASM_INT({dump('thread ' + _pthread_self() + ' (ENVIRONMENT_IS_WORKER: ' +
@@ -470,84 +630,61 @@ static void EMSCRIPTEN_KEEPALIVE emscripten_async_queue_call_on_thread(
   // If we are the target recipient of this message, we can just call the operation directly.
   if (target_thread == EM_CALLBACK_THREAD_CONTEXT_CALLING_THREAD ||
       target_thread == pthread_self()) {
-    _do_call(call);
+    for (int i = 0; i < numCalls; ++i)
+      _do_call(calls[i]);
     return;
   }
 
-  // Add the operation to the call queue of the main runtime thread.
-  pthread_mutex_lock(&call_queue_lock);
-  CallQueue* q = GetOrAllocateQueue(target_thread);
-  if (!q->call_queue)
-    q->call_queue = malloc(
-      sizeof(em_queued_call*) * CALL_QUEUE_SIZE); // Shared data synchronized by call_queue_lock.
-
-  int head = emscripten_atomic_load_u32((void*)&q->call_queue_head);
-  int tail = emscripten_atomic_load_u32((void*)&q->call_queue_tail);
-  int new_tail = (tail + 1) % CALL_QUEUE_SIZE;
-
-  while (new_tail == head) { // Queue is full?
-    pthread_mutex_unlock(&call_queue_lock);
-
-    // If queue of the main browser thread is full, then we wait. (never drop messages for the main
-    // browser thread)
-    if (target_thread == emscripten_main_browser_thread_id()) {
-      emscripten_futex_wait((void*)&q->call_queue_head, head, INFINITY);
-      pthread_mutex_lock(&call_queue_lock);
-      head = emscripten_atomic_load_u32((void*)&q->call_queue_head);
-      tail = emscripten_atomic_load_u32((void*)&q->call_queue_tail);
-      new_tail = (tail + 1) % CALL_QUEUE_SIZE;
-    } else {
-      // For the queues of other threads, just drop the message.
-      // #if DEBUG TODO: a debug build of pthreads library?
-      //			EM_ASM(console.error('Pthread queue overflowed, dropping queued
-      //message to thread. ' + new Error().stack));
-      // #endif
-      em_queued_call_free(call);
-      return;
-    }
+  // Link the calls from last to first, the order in which the target thread's queue holds them.
+  for (int i = 1; i < numCalls; ++i)
+    calls[i]->next = calls[i - 1];
+
+  // Add the operations to the call queue of the target thread. If the call queue was empty, the
+  // target thread is likely idle in the browser event loop, so send a message to it to ensure that
+  // it wakes up to start processing the commands we have posted. If the thread is gone, or was
+  // never created, the calls are cancelled.
+  CallQueue* q = GetQueue(target_thread);
+  int wasEmpty = q ? PushQueuedCalls(q, calls[0], calls[numCalls - 1]) : -1;
+  if (wasEmpty < 0) {
+    calls[0]->next = 0;
+    CancelQueuedCalls(calls[numCalls - 1]);
+    return;
   }
+  if (!wasEmpty)
+    return;
 
-  q->call_queue[tail] = call;
-
-  // If the call queue was empty, the main runtime thread is likely idle in the browser event loop,
-  // so send a message to it to ensure that it wakes up to start processing the command we have
-  // posted.
-  if (head == tail) {
-    if (target_thread == emscripten_main_browser_thread_id()) {
-      EM_ASM(postMessage({cmd : 'processQueuedMainThreadWork'}));
-    } else {
-      int success = EM_ASM_INT(
-        {
-          if (!ENVIRONMENT_IS_PTHREAD) {
-            if (!PThread.pthreads[$0] || !PThread.pthreads[$0].worker) {
-              // #if DEBUG
-              //						Module.printErr('Cannot send message
-              //to thread with ID ' + $0 + ', unknown thread ID!');
-              // #endif
-              return 0;
-            }
-            PThread.pthreads[$0].worker.postMessage({cmd : 'processThreadQueue'});
-          } else {
-            postMessage({targetThread : $0, cmd : 'processThreadQueue'});
+  if (target_thread == emscripten_main_browser_thread_id()) {
+    EM_ASM(postMessage({cmd : 'processQueuedMainThreadWork'}));
+  } else {
+    int success = EM_ASM_INT(
+      {
+        if (!ENVIRONMENT_IS_PTHREAD) {
+          if (!PThread.pthreads[$0] || !PThread.pthreads[$0].worker) {
+            // #if DEBUG
+            //						Module.printErr('Cannot send message
+            //to thread with ID ' + $0 + ', unknown thread ID!');
+            // #endif
+            return 0;
           }
-          return 1;
-        },
-        target_thread);
-
-      // Failed to dispatch the thread, delete the crafted message.
-      if (!success) {
-        em_queued_call_free(call);
-        pthread_mutex_unlock(&call_queue_lock);
-        return;
-      }
-
-      // TODO: Need to postMessage() to a specific target Worker that is hosting target_thread....
-    }
+          PThread.pthreads[$0].worker.postMessage({cmd : 'processThreadQueue'});
+        } else {
+          postMessage({targetThread : $0, cmd : 'processThreadQueue'});
+        }
+        return 1;
+      },
+      target_thread);
+
+    // Failed to dispatch to the thread, so nothing will ever process its queue. Take back what was
+    // queued (which may now include calls other threads queued after us), and cancel it.
+    if (!success)
+      CancelQueuedCalls(TakeQueuedCalls(q));
   }
+}
 
-  emscripten_atomic_store_u32((void*)&q->call_queue_tail, new_tail);
-
-  pthread_mutex_unlock(&call_queue_lock);
+static void EMSCRIPTEN_KEEPALIVE emscripten_async_queue_call_on_thread(
+  pthread_t target_thread, em_queued_call* call) {
+  assert(call);
+  emscripten_async_queue_calls_on_thread(target_thread, &call, 1);
 }
 
 void EMSCRIPTEN_KEEPALIVE emscripten_async_run_in_main_thread(em_queued_call* call) {
@@ -561,6 +698,22 @@ void EMSCRIPTEN_KEEPALIVE emscripten_sync_run_in_main_thread(em_queued_call* cal
   emscripten_wait_for_call_v(call, INFINITY);
 }
 
+void EMSCRIPTEN_KEEPALIVE emscripten_async_run_batch_in_main_thread(
+  em_queued_call** calls, int numCalls) {
+  if (numCalls > 0)
+    emscripten_async_queue_calls_on_thread(emscripten_main_browser_thread_id(), calls, numCalls);
+}
+
+void EMSCRIPTEN_KEEPALIVE emscripten_sync_run_batch_in_main_thread(
+  em_queued_call** calls, int numCalls) {
+  if (numCalls <= 0)
+    return;
+  emscripten_async_run_batch_in_main_thread(calls, numCalls);
+
+  // The calls are performed in order, so once the last one is done, the whole batch is.
+  emscripten_wait_for_call_v(calls[numCalls - 1], INFINITY);
+}
+
 void* EMSCRIPTEN_KEEPALIVE emscripten_sync_run_in_main_thread_0(int function) {
   em_queued_call q = {function};
   q.returnValue.vp = 0;
@@ -692,37 +845,21 @@ void EMSCRIPTEN_KEEPALIVE emscripten_current_thread_process_queued_calls() {
     // would be processed again and again.
     if (bool_main_thread_inside_nested_process_queued_calls)
       return;
-    // This must be before pthread_mutex_lock(), since pthread_mutex_lock() can call back to this
-    // function.
     bool_main_thread_inside_nested_process_queued_calls = 1;
   }
 
-  pthread_mutex_lock(&call_queue_lock);
+  // Keep going until the queue is empty, as more calls may be queued while we perform the ones we
+  // took. Assume that the calls are heavy, and don't hold anything while they are being performed.
   CallQueue* q = GetQueue(pthread_self());
-  if (!q) {
-    pthread_mutex_unlock(&call_queue_lock);
-    if (emscripten_is_main_browser_thread())
-      bool_main_thread_inside_nested_process_queued_calls = 0;
-    return;
-  }
-
-  int head = emscripten_atomic_load_u32((void*)&q->call_queue_head);
-  int tail = emscripten_atomic_load_u32((void*)&q->call_queue_tail);
-  while (head != tail) {
-    // Assume that the call is heavy, so unlock access to the call queue while it is being
-    // performed.
-    pthread_mutex_unlock(&call_queue_lock);
-    _do_call(q->call_queue[head]);
-    pthread_mutex_lock(&call_queue_lock);
-
-    head = (head + 1) % CALL_QUEUE_SIZE;
-    emscripten_atomic_store_u32((void*)&q->call_queue_head, head);
-    tail = emscripten_atomic_load_u32((void*)&q->call_queue_tail);
+  em_queued_call* calls;
+  while (q && (calls = TakeQueuedCalls(q))) {
+    while (calls) {
+      // The call may be freed when it is done.
+      em_queued_call* next = calls->next;
+      _do_call(calls);
+      calls = next;
+    }
   }
-  pthread_mutex_unlock(&call_queue_lock);
-
-  // If the queue was full and we had waiters pending to get to put data to queue, wake them up.
-  emscripten_futex_wake((void*)&q->call_queue_head, 0x7FFFFFFF);
 
   if (emscripten_is_main_browser_thread())
     bool_main_thread_inside_nested_process_queued_calls = 0;
@@ -15,6 +15,8 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include <emscripten/heap.h>
+
 #ifdef __EMSCRIPTEN_TRACING__
 #include <emscripten/em_asm.h>
 #endif
@@ -44,6 +46,41 @@ extern size_t emscripten_get_heap_size(void);
   return (void*)-1;      \
 }
 
+// How many times, and by how many bytes in total, we have grown the heap.
+static size_t heap_growth_count;
+static size_t heap_growth_bytes;
+
+static uintptr_t get_heap_size() {
+#ifdef __wasm__
+  return __builtin_wasm_memory_size(0) * WASM_PAGE_SIZE;
+#else
+  return emscripten_get_heap_size();
+#endif
+}
+
+// Grows the heap from old_size to at least new_size bytes. How far beyond that
+// it grows is up to emscripten_resize_heap().
+static int grow_heap(uintptr_t old_size, uintptr_t new_size) {
+  if (!emscripten_resize_heap(new_size)) {
+#if __EMSCRIPTEN_PTHREADS__
+    // Another thread may have grown the heap in the meantime, in which case
+    // emscripten_resize_heap() fails, but there is enough memory now.
+    return get_heap_size() >= new_size;
+#else
+    return 0;
+#endif
+  }
+  size_t grown = get_heap_size() - old_size;
+#if __EMSCRIPTEN_PTHREADS__
+  __c11_atomic_fetch_add((_Atomic(size_t)*)&heap_growth_count, 1, __ATOMIC_SEQ_CST);
+  __c11_atomic_fetch_add((_Atomic(size_t)*)&heap_growth_bytes, grown, __ATOMIC_SEQ_CST);
+#else
+  heap_growth_count++;
+  heap_growth_bytes += grown;
+#endif
+  return 1;
+}
+
 void *sbrk(intptr_t increment) {
 #if __EMSCRIPTEN_PTHREADS__
   // Our default dlmalloc uses locks around each malloc/free, so no additional
@@ -70,15 +107,10 @@ void *sbrk(intptr_t increment) {
     if ((uint32_t)new_brk > (uint32_t)INT_MAX) {
       RETURN_ERROR();
     }
-#ifdef __wasm__
-    uintptr_t old_size = __builtin_wasm_memory_size(0) * WASM_PAGE_SIZE;
-#else
-    uintptr_t old_size = emscripten_get_heap_size();
-#endif
+    uintptr_t old_size = get_heap_size();
     if (new_brk > old_size) {
       // Try to grow memory.
-      intptr_t diff = new_brk - old_size;
-      if (!emscripten_resize_heap(new_brk)) {
+      if (!grow_heap(old_size, new_brk)) {
         RETURN_ERROR();
       }
     }
@@ -120,3 +152,26 @@ int brk(intptr_t ptr) {
   }
   return 0;
 }
+
+int emscripten_reserve_heap(size_t bytes) {
+  intptr_t* sbrk_ptr = emscripten_get_sbrk_ptr();
+#if __EMSCRIPTEN_PTHREADS__
+  uintptr_t brk = __c11_atomic_load((_Atomic(intptr_t)*)sbrk_ptr, __ATOMIC_SEQ_CST);
+#else
+  uintptr_t brk = *sbrk_ptr;
+#endif
+  // The same limit as in sbrk().
+  if (bytes > (uint32_t)INT_MAX - brk) {
+    return 0;
+  }
+  uintptr_t old_size = get_heap_size();
+  return brk + bytes <= old_size || grow_heap(old_size, brk + bytes);
+}
+
+size_t emscripten_get_heap_growth_count() {
+  return heap_growth_count;
+}
+
+size_t emscripten_get_heap_growth_bytes() {
+  return heap_growth_bytes;
+}
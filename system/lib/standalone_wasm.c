@@ -78,7 +78,18 @@ int emscripten_resize_heap(size_t size) {
   size_t old_size = __builtin_wasm_memory_size(0) * WASM_PAGE_SIZE;
   assert(old_size < size);
   ssize_t diff = (size - old_size + WASM_PAGE_SIZE - 1) / WASM_PAGE_SIZE;
-  size_t result = __builtin_wasm_memory_grow(0, diff);
+  // Like the JS version with the default MEMORY_GROWTH_GEOMETRIC_PERCENT,
+  // double the memory (up to 1GB) if that is enough, so that allocating
+  // incrementally does not grow it each time. If there is no room for that,
+  // grow just by what was asked for.
+  ssize_t double_diff = old_size / WASM_PAGE_SIZE;
+  size_t result = (size_t)-1;
+  if (old_size <= (1u << 29) && double_diff > diff) {
+    result = __builtin_wasm_memory_grow(0, double_diff);
+  }
+  if (result == (size_t)-1) {
+    result = __builtin_wasm_memory_grow(0, diff);
+  }
   if (result != (size_t)-1) {
 
    // Success, update JS (see https://github.com/WebAssembly/WASI/issues/82)
@@ -49,6 +49,8 @@ struct SocketCallResultHeader
   // uint8_t extraData[];
 };
 
+struct PosixSocketState;
+
 struct PosixSocketCallResult
 {
   PosixSocketCallResult *next;
@@ -59,22 +61,65 @@ struct PosixSocketCallResult
   // After the call has finished, this field reports back the number of bytes pointed to by data, >= the expected value.
   int bytes;
 
+  // If nonzero, this is the result of a send() that no thread is waiting for, and the result is accounted to this socket
+  // when it arrives.
+  PosixSocketState *unwaitedSend;
+  int unwaitedSendBytes;
+
   // Result data:
   SocketCallResultHeader *data;
 };
 
-// Shield multithreaded accesses to POSIX sockets functions in the program, namely the two variables 'bridgeSocket' and 'callResultHead' below.
+// Client side state of a socket that has been created via the bridge.
+struct PosixSocketState
+{
+  PosixSocketState *next;
+  int socket;
+  int nonBlocking; // Created with SOCK_NONBLOCK
+
+  // The error of a send() that failed after the call already returned, reported by the next send() on the socket.
+  int pendingError;
+
+  // The number of bytes that have been sent to the proxy but whose send() result has not yet been received. Used as a
+  // futex to wait for the results when too much data is in flight.
+  uint32_t unacknowledgedBytes;
+
+  // Serializes send() calls on the socket, and guards the write-behind buffer below.
+  pthread_mutex_t sendLock;
+
+  // Data of send() calls with MSG_MORE, that are collected and proxied together with the subsequent send().
+  uint8_t *writeBehind;
+  int writeBehindBytes;
+  int writeBehindFlags;
+};
+
+// Shield multithreaded accesses to POSIX sockets functions in the program, namely the variables 'bridgeSocket', 'callResults' and 'socketStates' below.
 static pthread_mutex_t bridgeLock = PTHREAD_MUTEX_INITIALIZER;
 
 // Socket handle for the connection from browser WebSocket to the sockets bridge proxy server.
 static EMSCRIPTEN_WEBSOCKET_T bridgeSocket = (EMSCRIPTEN_WEBSOCKET_T)0;
 
-// Stores a linked list of all currently pending sockets operations (ones that are waiting for a reply back from the sockets proxy server)
-static PosixSocketCallResult *callResultHead = 0;
+// Both must be powers of two.
+#define CALL_RESULT_TABLE_SIZE 256
+#define SOCKET_STATE_TABLE_SIZE 64
+
+// A hash table of all currently pending sockets operations (ones that are waiting for a reply back from the sockets
+// proxy server), keyed by call ID. Call IDs are allocated sequentially, so they spread evenly over the buckets.
+static PosixSocketCallResult *callResults[CALL_RESULT_TABLE_SIZE];
+
+// A hash table of the client side state of each socket, keyed by socket fd.
+static PosixSocketState *socketStates[SOCKET_STATE_TABLE_SIZE];
+
+// send() on a blocking socket does not wait for the proxy to perform the send, but returns as soon as the data has been
+// posted to the bridge. Once this much data is in flight on a socket, send() waits for earlier sends to finish.
+#define MAX_UNACKNOWLEDGED_SEND_BYTES (4*1024*1024)
+
+// send() calls with MSG_MORE are collected up to this many bytes before they are posted to the bridge.
+#define WRITE_BEHIND_BUFFER_SIZE (64*1024)
 
 static PosixSocketCallResult *allocate_call_result(int expectedBytes)
 {
-  pthread_mutex_lock(&bridgeLock); // Guard multithreaded access to 'callResultHead' and 'nextId' below
+  pthread_mutex_lock(&bridgeLock); // Guard multithreaded access to 'callResults' and 'nextId' below
   PosixSocketCallResult *b = (PosixSocketCallResult*)(malloc(sizeof(PosixSocketCallResult)));
   if (!b)
   {
@@ -92,16 +137,12 @@ static PosixSocketCallResult *allocate_call_result(int expectedBytes)
   b->bytes = expectedBytes;
   b->data = 0;
   b->operationCompleted = 0;
-  b->next = 0;
+  b->unwaitedSend = 0;
+  b->unwaitedSendBytes = 0;
 
-  if (!callResultHead)
-    callResultHead = b;
-  else
-  {
-    PosixSocketCallResult *t = callResultHead;
-    while(t->next) t = t->next;
-    t->next = b;
-  }
+  PosixSocketCallResult **bucket = &callResults[b->callId & (CALL_RESULT_TABLE_SIZE-1)];
+  b->next = *bucket;
+  *bucket = b;
   pthread_mutex_unlock(&bridgeLock);
   return b;
 }
@@ -119,28 +160,26 @@ static void free_call_result(PosixSocketCallResult *buffer)
 
 PosixSocketCallResult *pop_call_result(int callId)
 {
-  pthread_mutex_lock(&bridgeLock); // Guard multithreaded access to 'callResultHead'
-  PosixSocketCallResult *prev = 0;
-  PosixSocketCallResult *b = callResultHead;
-  while(b)
+  pthread_mutex_lock(&bridgeLock); // Guard multithreaded access to 'callResults'
+  PosixSocketCallResult **b = &callResults[callId & (CALL_RESULT_TABLE_SIZE-1)];
+  while(*b)
   {
-    if (b->callId == callId)
+    if ((*b)->callId == callId)
     {
-      if (prev) prev->next = b->next;
-      else callResultHead = b->next;
-      b->next = 0;
+      PosixSocketCallResult *result = *b;
+      *b = result->next;
+      result->next = 0;
 #ifdef POSIX_SOCKET_DEEP_DEBUG
-      emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "pop_call_result: Removed call ID %d from pending sockets call queue\n", callId);
+      emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "pop_call_result: Removed call ID %d from pending sockets call table\n", callId);
 #endif
       pthread_mutex_unlock(&bridgeLock);
-      return b;
+      return result;
     }
-    prev = b;
-    b = b->next;
+    b = &(*b)->next;
   }
   pthread_mutex_unlock(&bridgeLock);
 #ifdef POSIX_SOCKET_DEBUG
-  emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "pop_call_result: No such call ID %d in pending sockets call queue!\n", callId);
+  emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "pop_call_result: No such call ID %d in pending sockets call table!\n", callId);
 #endif
   return 0;
 }
@@ -157,6 +196,73 @@ void wait_for_call_result(PosixSocketCallResult *b)
 #endif
 }
 
+static PosixSocketState *find_socket_state(int socket)
+{
+  pthread_mutex_lock(&bridgeLock); // Guard multithreaded access to 'socketStates'
+  PosixSocketState *s = socketStates[socket & (SOCKET_STATE_TABLE_SIZE-1)];
+  while(s && s->socket != socket) s = s->next;
+  pthread_mutex_unlock(&bridgeLock);
+  return s;
+}
+
+static void free_socket_state(PosixSocketState *s)
+{
+  pthread_mutex_destroy(&s->sendLock);
+  free(s->writeBehind);
+  free(s);
+}
+
+static PosixSocketState *remove_socket_state(int socket)
+{
+  pthread_mutex_lock(&bridgeLock); // Guard multithreaded access to 'socketStates'
+  PosixSocketState **s = &socketStates[socket & (SOCKET_STATE_TABLE_SIZE-1)];
+  while(*s && (*s)->socket != socket) s = &(*s)->next;
+  PosixSocketState *removed = *s;
+  if (removed) *s = removed->next;
+  pthread_mutex_unlock(&bridgeLock);
+  return removed;
+}
+
+// Called when the proxy has handed out a new socket fd. If the fd was previously in use, the proxy has closed the old
+// socket, so any stale state of it is discarded.
+static void create_socket_state(int socket, int nonBlocking)
+{
+  PosixSocketState *stale = remove_socket_state(socket);
+  if (stale) free_socket_state(stale);
+
+  PosixSocketState *s = (PosixSocketState*)calloc(1, sizeof(PosixSocketState));
+  if (!s) return; // Without state, the socket is still usable, but send() will wait for each call to finish.
+  s->socket = socket;
+  s->nonBlocking = nonBlocking;
+  pthread_mutex_init(&s->sendLock, 0);
+
+  pthread_mutex_lock(&bridgeLock); // Guard multithreaded access to 'socketStates'
+  PosixSocketState **bucket = &socketStates[socket & (SOCKET_STATE_TABLE_SIZE-1)];
+  s->next = *bucket;
+  *bucket = s;
+  pthread_mutex_unlock(&bridgeLock);
+}
+
+static void flush_write_behind(int socket);
+
+// Runs on the main browser thread when the result of a send() that nobody waits for arrives.
+static void finish_unwaited_send(PosixSocketCallResult *b, const SocketCallResultHeader *header)
+{
+  PosixSocketState *s = b->unwaitedSend;
+  if (header->ret != b->unwaitedSendBytes)
+  {
+#ifdef POSIX_SOCKET_DEBUG
+    emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "send(socket=%d) of %d bytes finished with %d, errno=%d\n", s->socket, b->unwaitedSendBytes, header->ret, header->errno_);
+#endif
+    // A blocking send() only writes partially if the connection fails midway.
+    int error = (header->ret < 0 && header->errno_) ? header->errno_ : EIO;
+    emscripten_atomic_cas_u32(&s->pendingError, 0, error);
+  }
+  emscripten_atomic_sub_u32(&s->unacknowledgedBytes, b->unwaitedSendBytes);
+  emscripten_futex_wake(&s->unacknowledgedBytes, 0x7FFFFFFF);
+  free_call_result(b);
+}
+
 static EM_BOOL bridge_socket_on_message(int eventType, const EmscriptenWebSocketMessageEvent *websocketEvent, void *userData)
 {
   if (websocketEvent->numBytes < sizeof(SocketCallResultHeader))
@@ -179,6 +285,12 @@ static EM_BOOL bridge_socket_on_message(int eventType, const EmscriptenWebSocket
     return EM_TRUE;
   }
 
+  if (b->unwaitedSend)
+  {
+    finish_unwaited_send(b, header);
+    return EM_TRUE;
+  }
+
   if (websocketEvent->numBytes < b->bytes)
   {
     emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "Received corrupt WebSocket result message with size %d, expected at least %d bytes!\n", (int)websocketEvent->numBytes, b->bytes);
@@ -278,6 +390,7 @@ int socket(int domain, int type, int protocol)
   wait_for_call_result(b);
   int ret = b->data->ret;
   if (ret < 0) errno = b->data->errno_;
+  else create_socket_state(ret, type & SOCK_NONBLOCK);
   free_call_result(b);
   return ret;
 }
@@ -314,7 +427,9 @@ int socketpair(int domain, int type, int protocol, int socket_vector[2])
   {
     Result *r = (Result*)b->data;
     socket_vector[0] = r->sv[0];
-    socket_vector[1] = r->sv[1];    
+    socket_vector[1] = r->sv[1];
+    create_socket_state(r->sv[0], type & SOCK_NONBLOCK);
+    create_socket_state(r->sv[1], type & SOCK_NONBLOCK);
   }
   else
   {
@@ -336,6 +451,8 @@ int shutdown(int socket, int how)
     int how;
   } d;
 
+  flush_write_behind(socket);
+
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_SHUTDOWN;
@@ -347,6 +464,20 @@ int shutdown(int socket, int how)
   int ret = b->data->ret;
   if (ret != 0) errno = b->data->errno_;
   free_call_result(b);
+
+  // The proxy closes the socket only on a successful bidirectional shutdown, which is how the socket is closed over the
+  // bridge. After a one-way or a failed shutdown the socket stays in use, and so does its state. The proxy has
+  // answered all earlier sends on the socket before this call, and the results are processed in order, so no unwaited
+  // send still refers to the state.
+  if (ret == 0 && how == SHUT_RDWR)
+  {
+    PosixSocketState *s = remove_socket_state(socket);
+    if (s)
+    {
+      assert(emscripten_atomic_load_u32(&s->unacknowledgedBytes) == 0);
+      free_socket_state(s);
+    }
+  }
   return ret;
 }
 
@@ -481,6 +612,7 @@ int accept(int socket, struct sockaddr *address, socklen_t *address_len)
   {
     errno = b->data->errno_;
   }
+  if (ret >= 0) create_socket_state(ret, 0);
   free_call_result(b);
   return ret;
 }
@@ -571,12 +703,9 @@ int getpeername(int socket, struct sockaddr *address, socklen_t *address_len)
   return ret;
 }
 
-ssize_t send(int socket, const void *message, size_t length, int flags)
+// Sends the data and waits for the proxy to report how much of it was sent.
+static ssize_t send_and_wait(int socket, const void *message, size_t length, int flags)
 {
-#ifdef POSIX_SOCKET_DEBUG
-  emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "send(socket=%d,message=%p,length=%zd,flags=%d)\n", socket, message, length, flags);
-#endif
-
   struct MSG {
     SocketCallHeader header;
     int socket;
@@ -606,6 +735,104 @@ ssize_t send(int socket, const void *message, size_t length, int flags)
   return ret;
 }
 
+// Sends the write-behind data of the socket followed by the given data as a single send() call, without waiting for
+// its result. Must be called with s->sendLock held.
+static void post_send_locked(PosixSocketState *s, const void *message, size_t length, int flags)
+{
+  struct MSG {
+    SocketCallHeader header;
+    int socket;
+    uint32_t/*size_t*/ length;
+    int flags;
+    uint8_t message[];
+  };
+  int numBytes = s->writeBehindBytes + (int)length;
+
+  // Bound the amount of data that is queued up in the browser and in the proxy on behalf of this socket.
+  for(;;)
+  {
+    uint32_t inFlight = emscripten_atomic_load_u32(&s->unacknowledgedBytes);
+    if (inFlight == 0 || inFlight + numBytes <= MAX_UNACKNOWLEDGED_SEND_BYTES) break;
+    emscripten_futex_wait(&s->unacknowledgedBytes, inFlight, 1e9);
+  }
+
+  size_t sz = sizeof(MSG) + numBytes;
+  MSG *d = (MSG*)malloc(sz);
+
+  PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
+  b->unwaitedSendBytes = numBytes;
+  b->unwaitedSend = s;
+  emscripten_atomic_add_u32(&s->unacknowledgedBytes, numBytes);
+
+  d->header.callId = b->callId;
+  d->header.function = POSIX_SOCKET_MSG_SEND;
+  d->socket = s->socket;
+  d->length = numBytes;
+  d->flags = (s->writeBehindFlags | flags) & ~MSG_MORE;
+  memcpy(d->message, s->writeBehind, s->writeBehindBytes);
+  if (message) memcpy(d->message + s->writeBehindBytes, message, length);
+  else memset(d->message + s->writeBehindBytes, 0, length);
+  s->writeBehindBytes = 0;
+  s->writeBehindFlags = 0;
+  emscripten_websocket_send_binary(bridgeSocket, d, sz);
+  free(d);
+}
+
+// Posts any data that send() has collected for the socket, so that it reaches the proxy before the next call on it.
+static void flush_write_behind(int socket)
+{
+  PosixSocketState *s = find_socket_state(socket);
+  if (!s) return;
+  pthread_mutex_lock(&s->sendLock);
+  if (s->writeBehindBytes > 0) post_send_locked(s, 0, 0, 0);
+  pthread_mutex_unlock(&s->sendLock);
+}
+
+ssize_t send(int socket, const void *message, size_t length, int flags)
+{
+#ifdef POSIX_SOCKET_DEBUG
+  emscripten_log(EM_LOG_NO_PATHS | EM_LOG_CONSOLE | EM_LOG_ERROR | EM_LOG_JS_STACK, "send(socket=%d,message=%p,length=%zd,flags=%d)\n", socket, message, length, flags);
+#endif
+
+  // Non-blocking sends must report EAGAIN and partial writes back to the caller, so they wait for the proxy. Sends on
+  // blocking sockets always send all of the data unless the connection fails, so they are posted to the bridge
+  // without waiting, and a failure is reported by the next send() on the socket instead.
+  PosixSocketState *s = find_socket_state(socket);
+  if (!s || s->nonBlocking || (flags & MSG_DONTWAIT) || length > MAX_UNACKNOWLEDGED_SEND_BYTES)
+  {
+    flush_write_behind(socket);
+    return send_and_wait(socket, message, length, flags);
+  }
+
+  int error = emscripten_atomic_load_u32(&s->pendingError);
+  if (error)
+  {
+    emscripten_atomic_cas_u32(&s->pendingError, error, 0);
+    errno = error;
+    return -1;
+  }
+
+  pthread_mutex_lock(&s->sendLock);
+  if ((flags & MSG_MORE) && s->writeBehindBytes + length <= WRITE_BEHIND_BUFFER_SIZE)
+  {
+    if (!s->writeBehind) s->writeBehind = (uint8_t*)malloc(WRITE_BEHIND_BUFFER_SIZE);
+    if (s->writeBehind)
+    {
+      if (message) memcpy(s->writeBehind + s->writeBehindBytes, message, length);
+      else memset(s->writeBehind + s->writeBehindBytes, 0, length);
+      s->writeBehindBytes += length;
+      s->writeBehindFlags |= flags;
+      pthread_mutex_unlock(&s->sendLock);
+      return length;
+    }
+  }
+  if (s->writeBehindBytes + length > WRITE_BEHIND_BUFFER_SIZE && s->writeBehindBytes > 0)
+    post_send_locked(s, 0, 0, 0); // Don't let a large send() copy all of the collected data once more.
+  post_send_locked(s, message, length, flags);
+  pthread_mutex_unlock(&s->sendLock);
+  return length;
+}
+
 ssize_t recv(int socket, void *buffer, size_t length, int flags)
 {
 #ifdef POSIX_SOCKET_DEBUG
@@ -619,6 +846,8 @@ ssize_t recv(int socket, void *buffer, size_t length, int flags)
     int flags;
   } d;
 
+  flush_write_behind(socket);
+
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_RECV;
@@ -665,6 +894,8 @@ ssize_t sendto(int socket, const void *message, size_t length, int flags, const
   size_t sz = sizeof(MSG)+length;
   MSG *d = (MSG*)malloc(sz);
 
+  flush_write_behind(socket);
+
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
   d->header.callId = b->callId;
   d->header.function = POSIX_SOCKET_MSG_SENDTO;
@@ -701,6 +932,8 @@ ssize_t recvfrom(int socket, void *buffer, size_t length, int flags, struct sock
     uint32_t/*socklen_t*/ address_len;
   } d;
 
+  flush_write_behind(socket);
+
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_RECVFROM;
@@ -774,6 +1007,8 @@ int getsockopt(int socket, int level, int option_name, void *option_value, sockl
     uint8_t option_value[];
   };
 
+  flush_write_behind(socket);
+
   PosixSocketCallResult *b = allocate_call_result(sizeof(Result));
   d.header.callId = b->callId;
   d.header.function = POSIX_SOCKET_MSG_GETSOCKOPT;
@@ -817,6 +1052,8 @@ int setsockopt(int socket, int level, int option_name, const void *option_value,
   int messageSize = sizeof(MSG) + option_len;
   MSG *d = (MSG*)malloc(messageSize);
 
+  flush_write_behind(socket);
+
   PosixSocketCallResult *b = allocate_call_result(sizeof(SocketCallResultHeader));
   d->header.callId = b->callId;
   d->header.function = POSIX_SOCKET_MSG_SETSOCKOPT;
@@ -0,0 +1,82 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Enough files to make the directory indexed, and to grow its index a few times.
+#define NUM_FILES 1000
+
+int main()
+{
+  int ret = mkdir("big", 0777); assert(ret == 0);
+  char path[64];
+  for(int i = 0; i < NUM_FILES; ++i)
+  {
+    sprintf(path, "big/file%d.txt", i);
+    FILE *file = fopen(path, "wb");
+    assert(file);
+    fprintf(file, "%d", i);
+    fclose(file);
+  }
+
+  // Every file resolves to its own contents, both through a fresh lookup and through the cache.
+  for(int pass = 0; pass < 2; ++pass)
+    for(int i = 0; i < NUM_FILES; ++i)
+    {
+      sprintf(path, pass ? "./big/../big/file%d.txt" : "big/file%d.txt", i);
+      FILE *file = fopen(path, "rb");
+      assert(file);
+      int value = -1;
+      fscanf(file, "%d", &value);
+      fclose(file);
+      assert(value == i);
+    }
+
+  // Removed files must not be found anymore, even if they were just looked up.
+  for(int i = 0; i < NUM_FILES; i += 2)
+  {
+    sprintf(path, "big/file%d.txt", i);
+    ret = unlink(path); assert(ret == 0);
+    struct stat st;
+    ret = stat(path, &st); assert(ret == -1); assert(errno == ENOENT);
+  }
+  for(int i = 1; i < NUM_FILES; i += 2)
+  {
+    sprintf(path, "big/file%d.txt", i);
+    ret = access(path, F_OK); assert(ret == 0);
+  }
+
+  int numEntries = 0;
+  DIR *dir = opendir("big");
+  assert(dir);
+  while(readdir(dir))
+    ++numEntries;
+  closedir(dir);
+  assert(numEntries == NUM_FILES/2 + 2); // The remaining files, and "." and "..".
+
+  // Names longer than NAME_MAX are refused, rather than created under a truncated name.
+  char longName[NAME_MAX + 16] = "big/";
+  memset(longName + 4, 'x', NAME_MAX + 1);
+  longName[NAME_MAX + 5] = '\0';
+  FILE *file = fopen(longName, "wb");
+  assert(!file); assert(errno == ENAMETOOLONG);
+  ret = mkdir(longName, 0777); assert(ret == -1); assert(errno == ENAMETOOLONG);
+  longName[NAME_MAX + 4] = '\0'; // Exactly NAME_MAX bytes is fine.
+  file = fopen(longName, "wb");
+  assert(file);
+  fclose(file);
+  ret = access(longName, F_OK); assert(ret == 0);
+
+#ifdef REPORT_RESULT
+  REPORT_RESULT(0);
+#endif
+}
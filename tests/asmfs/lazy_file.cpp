@@ -0,0 +1,77 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <emscripten/fetch.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Matches the file generated by test_asmfs_lazy_file in tests/test_browser.py.
+#define FILE_SIZE (1000 * 1000)
+#define BLOCK_SIZE (64 * 1024)
+
+static void check_range(int fd, off_t offset, size_t len)
+{
+  static unsigned char buf[3 * BLOCK_SIZE];
+  assert(len <= sizeof(buf));
+  off_t pos = lseek(fd, offset, SEEK_SET);
+  assert(pos == offset);
+  ssize_t n = read(fd, buf, len);
+  size_t expected = offset + len > FILE_SIZE ? FILE_SIZE - offset : len;
+  assert(n == (ssize_t)expected);
+  for(size_t i = 0; i < expected; ++i)
+    assert(buf[i] == (unsigned char)((offset + i) % 251));
+}
+
+int main()
+{
+  // Keep only a few blocks in memory, so that the file gets evicted and downloaded again.
+  emscripten_asmfs_set_lazy_loading(BLOCK_SIZE, 2, 4 * BLOCK_SIZE);
+  EMSCRIPTEN_RESULT r = emscripten_asmfs_add_lazy_file("lazy.bin", "/lazy.bin", 0777);
+  assert(r == EMSCRIPTEN_RESULT_SUCCESS);
+
+  struct stat st;
+  int ret = stat("/lazy.bin", &st);
+  assert(ret == 0);
+  assert(st.st_size == FILE_SIZE);
+
+  int fd = open("/lazy.bin", O_RDONLY);
+  assert(fd >= 0);
+
+  // Sequential reads, which read ahead.
+  for(off_t offset = 0; offset < FILE_SIZE; offset += 10000)
+    check_range(fd, offset, 10000);
+
+  // Random access, including reads spanning blocks and the end of the file.
+  check_range(fd, 12345, 3 * BLOCK_SIZE);
+  check_range(fd, FILE_SIZE - 100, 1000);
+  check_range(fd, BLOCK_SIZE - 1, 2);
+  check_range(fd, 0, 1);
+
+  // Lazily loaded files can't be written to.
+  ret = write(fd, "x", 1);
+  assert(ret == -1);
+  close(fd);
+
+  assert(emscripten_asmfs_compute_memory_usage() < FILE_SIZE);
+
+  // An empty file, for which the first Range request can't be satisfied.
+  r = emscripten_asmfs_add_lazy_file("empty.bin", "/empty.bin", 0777);
+  assert(r == EMSCRIPTEN_RESULT_SUCCESS);
+  ret = stat("/empty.bin", &st);
+  assert(ret == 0);
+  assert(st.st_size == 0);
+  fd = open("/empty.bin", O_RDONLY);
+  assert(fd >= 0);
+  char c;
+  assert(read(fd, &c, 1) == 0);
+  close(fd);
+
+#ifdef REPORT_RESULT
+  REPORT_RESULT(0);
+#endif
+}
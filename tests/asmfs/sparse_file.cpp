@@ -0,0 +1,70 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HOLE_END (1024 * 1024 + 7)
+
+int main()
+{
+  // Appending in small pieces must keep all of the data intact as the file grows past several
+  // chunks.
+  FILE *file = fopen("log.txt", "wb");
+  assert(file);
+  for(int i = 0; i < 50000; ++i)
+  {
+    fprintf(file, "%08d", i);
+    fflush(file);
+  }
+  fclose(file);
+
+  file = fopen("log.txt", "rb");
+  assert(file);
+  char buf[9] = {};
+  for(int i = 0; i < 50000; ++i)
+  {
+    size_t n = fread(buf, 1, 8, file);
+    assert(n == 8);
+    assert(atoi(buf) == i);
+  }
+  fclose(file);
+
+  // Writing past the end of the file leaves a hole that reads back as zeros.
+  int fd = open("sparse.bin", O_CREAT | O_TRUNC | O_WRONLY, 0777);
+  assert(fd >= 0);
+  ssize_t n = write(fd, "head", 4);
+  assert(n == 4);
+  off_t pos = lseek(fd, HOLE_END, SEEK_SET);
+  assert(pos == HOLE_END);
+  n = write(fd, "tail", 4);
+  assert(n == 4);
+  close(fd);
+
+  struct stat st;
+  int ret = stat("sparse.bin", &st);
+  assert(ret == 0);
+  assert(st.st_size == HOLE_END + 4);
+
+  fd = open("sparse.bin", O_RDONLY);
+  assert(fd >= 0);
+  static char data[HOLE_END + 4];
+  n = read(fd, data, sizeof(data));
+  assert(n == HOLE_END + 4);
+  assert(!memcmp(data, "head", 4));
+  for(int i = 4; i < HOLE_END; ++i)
+    assert(data[i] == 0);
+  assert(!memcmp(data + HOLE_END, "tail", 4));
+  close(fd);
+
+#ifdef REPORT_RESULT
+  REPORT_RESULT(0);
+#endif
+}
@@ -26,26 +26,115 @@ char src[1024*1024*64+16] = {};
 
 uint8_t resultCheckSum = 0;
 
+// Misaligning the source and destination exercises the unaligned paths.
+#ifndef SRC_OFFSET
+#define SRC_OFFSET 0
+#endif
+
+#ifndef DST_OFFSET
+#define DST_OFFSET 0
+#endif
+
+typedef void *(*copy_func)(void *dest, const void *src, size_t n);
+
+template<copy_func copy>
 void __attribute__((noinline)) test_memcpy(int numTimes, int copySize)
 {
+	char *d = dst + DST_OFFSET;
+	const char *s = src + SRC_OFFSET;
 	for(int i = 0; i < numTimes - 8; i += 8)
 	{
-		memcpy(dst, src, copySize); resultCheckSum += dst[copySize >> 1];
-		memcpy(dst, src, copySize); resultCheckSum += dst[copySize >> 1];
-		memcpy(dst, src, copySize); resultCheckSum += dst[copySize >> 1];
-		memcpy(dst, src, copySize); resultCheckSum += dst[copySize >> 1];
-		memcpy(dst, src, copySize); resultCheckSum += dst[copySize >> 1];
-		memcpy(dst, src, copySize); resultCheckSum += dst[copySize >> 1];
-		memcpy(dst, src, copySize); resultCheckSum += dst[copySize >> 1];
-		memcpy(dst, src, copySize); resultCheckSum += dst[copySize >> 1];
+		copy(d, s, copySize); resultCheckSum += d[copySize >> 1];
+		copy(d, s, copySize); resultCheckSum += d[copySize >> 1];
+		copy(d, s, copySize); resultCheckSum += d[copySize >> 1];
+		copy(d, s, copySize); resultCheckSum += d[copySize >> 1];
+		copy(d, s, copySize); resultCheckSum += d[copySize >> 1];
+		copy(d, s, copySize); resultCheckSum += d[copySize >> 1];
+		copy(d, s, copySize); resultCheckSum += d[copySize >> 1];
+		copy(d, s, copySize); resultCheckSum += d[copySize >> 1];
 	}
 	numTimes &= 15;
 	for(int i = 0; i < numTimes; ++i)
 	{
-		memcpy(dst, src, copySize); resultCheckSum += dst[copySize >> 1];
+		copy(d, s, copySize); resultCheckSum += d[copySize >> 1];
 	}
 }
 
+#ifdef SWEEP
+// With -DSWEEP, every size is timed with the copy loop that memcpy uses for
+// small copies and with the path it takes for large copies, to find the size
+// from which the large copy path wins. That is the value to use for
+// EMSCRIPTEN_MEMCPY_BULK_THRESHOLD (when built with -mbulk-memory) or
+// EMSCRIPTEN_MEMCPY_BIG_THRESHOLD in system/lib/libc/emscripten_memcpy.c.
+
+#if defined(__EMSCRIPTEN__) && !defined(__wasm_bulk_memory__)
+extern "C" void *emscripten_memcpy_big(void *dest, const void *src, size_t n);
+#endif
+
+void *copy_large(void *dest, const void *src, size_t n)
+{
+#if defined(__wasm_bulk_memory__)
+	// memory.copy
+	__builtin_memcpy(dest, src, n);
+	return dest;
+#elif defined(__EMSCRIPTEN__)
+	return emscripten_memcpy_big(dest, src, n);
+#else
+	return memcpy(dest, src, n);
+#endif
+}
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+
+// The v128 copy loop of emscripten_memcpy.c, without the size dispatch in
+// front of it.
+void *copy_small(void *dest, const void *src, size_t n)
+{
+	if (n < 16) return memcpy(dest, src, n);
+	unsigned char *d = (unsigned char *)dest;
+	const unsigned char *s = (const unsigned char *)src;
+	v128_t head = wasm_v128_load(s);
+	v128_t tail = wasm_v128_load(s + n - 16);
+	size_t skip = 16 - (((uintptr_t)d) & 15);
+	unsigned char *d_end = d + n - 16;
+	wasm_v128_store(d, head);
+	d += skip;
+	s += skip;
+	while (d_end - d >= 64)
+	{
+		v128_t v0 = wasm_v128_load(s);
+		v128_t v1 = wasm_v128_load(s + 16);
+		v128_t v2 = wasm_v128_load(s + 32);
+		v128_t v3 = wasm_v128_load(s + 48);
+		wasm_v128_store(d, v0);
+		wasm_v128_store(d + 16, v1);
+		wasm_v128_store(d + 32, v2);
+		wasm_v128_store(d + 48, v3);
+		d += 64;
+		s += 64;
+	}
+	while (d < d_end)
+	{
+		wasm_v128_store(d, wasm_v128_load(s));
+		d += 16;
+		s += 16;
+	}
+	wasm_v128_store(d_end, tail);
+	return dest;
+}
+#else
+// Without SIMD the scalar copy loop is only reachable through memcpy itself,
+// so sizes above the current threshold compare the large path to itself.
+void *copy_small(void *dest, const void *src, size_t n)
+{
+	return memcpy(dest, src, n);
+}
+#endif
+
+std::vector<double> largeResults;
+#endif
+
 std::vector<int> copySizes;
 std::vector<double> results;
 
@@ -53,7 +142,8 @@ std::vector<int> testCases;
 
 double totalTimeSecs = 0.0;
 
-void test_case(int copySize)
+template<copy_func copy>
+double measure(int copySize)
 {
 	const int minimumCopyBytes = 1024*1024*64;
 
@@ -69,27 +159,33 @@ void test_case(int copySize)
 	for(int i = 0; i < NUM_TRIALS; ++i)
 	{
 		double t0 = tick();
-		test_memcpy(numTimes, copySize);
+		test_memcpy<copy>(numTimes, copySize);
 		double t1 = tick();
 		if (t1 - t0 < bestResult) bestResult = t1 - t0;
 		totalTimeSecs += (double)(t1 - t0) / ticks_per_sec();
 	}
 	unsigned long long totalBytesTransferred = numTimes * copySize;
 
-	copySizes.push_back(copySize);
-
 	tick_t ticksElapsed = bestResult;
 	if (ticksElapsed > 0)
 	{
 		double seconds = (double)ticksElapsed / ticks_per_sec();
 		double bytesPerSecond = totalBytesTransferred / seconds;
 		double mbytesPerSecond = bytesPerSecond / (1024.0*1024.0);
-		results.push_back(mbytesPerSecond);
-	}
-	else
-	{
-		results.push_back(0.0);
+		return mbytesPerSecond;
 	}
+	return 0.0;
+}
+
+void test_case(int copySize)
+{
+	copySizes.push_back(copySize);
+#ifdef SWEEP
+	results.push_back(measure<copy_small>(copySize));
+	largeResults.push_back(measure<copy_large>(copySize));
+#else
+	results.push_back(measure<memcpy>(copySize));
+#endif
 }
 
 void print_results()
@@ -114,6 +210,21 @@ void print_results()
 		if (i % 10 == 9) std::cout << std::endl;
 	}
 
+#ifdef SWEEP
+	// The crossover is the smallest size from which the large copy path is at
+	// least as fast as the copy loop for every larger size measured.
+	size_t crossover = copySizes.size();
+	while (crossover > 0 && largeResults[crossover-1] >= results[crossover-1])
+		--crossover;
+	std::cout << std::endl << "Size, copy loop MB/s, large copy MB/s:" << std::endl;
+	for(size_t i = 0; i < copySizes.size(); ++i)
+		std::cout << copySizes[i] << ", " << results[i] << ", " << largeResults[i] << std::endl;
+	if (crossover < copySizes.size())
+		std::cout << "Crossover: large copies win from " << copySizes[crossover] << " bytes" << std::endl;
+	else
+		std::cout << "Crossover: the copy loop wins at all sizes measured" << std::endl;
+#endif
+
 	std::cout << "Result checksum: " << (int)resultCheckSum << std::endl;
 	std::cout << "Total time: " << totalTimeSecs << std::endl;
 }
@@ -155,13 +266,21 @@ void main_loop()
 
 int main()
 {
+#ifdef SWEEP
+	// Four sizes per power of two, to locate the crossover more precisely.
+	for(int copySize = MIN_COPY; copySize < MAX_COPY; copySize <<= 1)
+		for(int quarter = 0; quarter < 4; ++quarter)
+			testCases.push_back(copySize + (copySize >> 2) * quarter);
+#else
 	for(int copySizeI = MIN_COPY; copySizeI < MAX_COPY; copySizeI <<= 1)
 		for(int copySizeJ = 1; copySizeJ <= copySizeI; copySizeJ <<= 1)
 		{
 			testCases.push_back(copySizeI | copySizeJ);
 		}
+#endif
 
 	std::sort(testCases.begin(), testCases.end());
+	testCases.erase(std::unique(testCases.begin(), testCases.end()), testCases.end());
 #if defined(__EMSCRIPTEN__) && !defined(BUILD_FOR_SHELL)
 	emscripten_set_main_loop(main_loop, 0, 0);
 #else
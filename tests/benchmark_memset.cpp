@@ -25,26 +25,92 @@ char dst[1024*1024*64+16] = {};
 
 uint8_t resultCheckSum = 0;
 
+// Misaligning the destination exercises the unaligned paths.
+#ifndef DST_OFFSET
+#define DST_OFFSET 0
+#endif
+
+typedef void *(*set_func)(void *dest, int c, size_t n);
+
+template<set_func set>
 void __attribute__((noinline)) test_memset(int numTimes, int copySize)
 {
+	char *d = dst + DST_OFFSET;
 	for(int i = 0; i < numTimes - 8; i += 8)
 	{
-		memset(dst, i ^ 0xAA, copySize); resultCheckSum += dst[copySize >> 1];
-		memset(dst, i ^ 0xAA, copySize); resultCheckSum += dst[copySize >> 1];
-		memset(dst, i ^ 0xAA, copySize); resultCheckSum += dst[copySize >> 1];
-		memset(dst, i ^ 0xAA, copySize); resultCheckSum += dst[copySize >> 1];
-		memset(dst, i ^ 0xAA, copySize); resultCheckSum += dst[copySize >> 1];
-		memset(dst, i ^ 0xAA, copySize); resultCheckSum += dst[copySize >> 1];
-		memset(dst, i ^ 0xAA, copySize); resultCheckSum += dst[copySize >> 1];
-		memset(dst, i ^ 0xAA, copySize); resultCheckSum += dst[copySize >> 1];
+		set(d, i ^ 0xAA, copySize); resultCheckSum += d[copySize >> 1];
+		set(d, i ^ 0xAA, copySize); resultCheckSum += d[copySize >> 1];
+		set(d, i ^ 0xAA, copySize); resultCheckSum += d[copySize >> 1];
+		set(d, i ^ 0xAA, copySize); resultCheckSum += d[copySize >> 1];
+		set(d, i ^ 0xAA, copySize); resultCheckSum += d[copySize >> 1];
+		set(d, i ^ 0xAA, copySize); resultCheckSum += d[copySize >> 1];
+		set(d, i ^ 0xAA, copySize); resultCheckSum += d[copySize >> 1];
+		set(d, i ^ 0xAA, copySize); resultCheckSum += d[copySize >> 1];
 	}
 	numTimes &= 15;
 	for(int i = 0; i < numTimes; ++i)
 	{
-		memset(dst, i ^ 0xAA, copySize); resultCheckSum += dst[copySize >> 1];
+		set(d, i ^ 0xAA, copySize); resultCheckSum += d[copySize >> 1];
 	}
 }
 
+#ifdef SWEEP
+// With -DSWEEP, every size is timed with the store loop that memset uses for
+// small fills and with memory.fill, to find the size from which memory.fill
+// wins. That is the value to use for EMSCRIPTEN_MEMSET_BULK_THRESHOLD in
+// system/lib/libc/emscripten_memset.c. Without -mbulk-memory there is no
+// large fill path, and both columns measure memset.
+
+void *set_large(void *dest, int c, size_t n)
+{
+#ifdef __wasm_bulk_memory__
+	// memory.fill
+	__builtin_memset(dest, c, n);
+	return dest;
+#else
+	return memset(dest, c, n);
+#endif
+}
+
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+
+// The v128 store loop of emscripten_memset.c, without the size dispatch in
+// front of it.
+void *set_small(void *dest, int c, size_t n)
+{
+	if (n < 16) return memset(dest, c, n);
+	unsigned char *d = (unsigned char *)dest;
+	v128_t v = wasm_i8x16_splat(c);
+	unsigned char *d_end = d + n - 16;
+	wasm_v128_store(d, v);
+	wasm_v128_store(d_end, v);
+	d += 16 - (((uintptr_t)d) & 15);
+	while (d_end - d >= 64)
+	{
+		wasm_v128_store(d, v);
+		wasm_v128_store(d + 16, v);
+		wasm_v128_store(d + 32, v);
+		wasm_v128_store(d + 48, v);
+		d += 64;
+	}
+	while (d < d_end)
+	{
+		wasm_v128_store(d, v);
+		d += 16;
+	}
+	return dest;
+}
+#else
+void *set_small(void *dest, int c, size_t n)
+{
+	return memset(dest, c, n);
+}
+#endif
+
+std::vector<double> largeResults;
+#endif
+
 std::vector<int> copySizes;
 std::vector<double> results;
 
@@ -52,7 +118,8 @@ std::vector<int> testCases;
 
 double totalTimeSecs = 0.0;
 
-void test_case(int copySize)
+template<set_func set>
+double measure(int copySize)
 {
 	const int minimumCopyBytes = 1024*1024*64;
 
@@ -68,27 +135,33 @@ void test_case(int copySize)
 	for(int i = 0; i < NUM_TRIALS; ++i)
 	{
 		double t0 = tick();
-		test_memset(numTimes, copySize);
+		test_memset<set>(numTimes, copySize);
 		double t1 = tick();
 		if (t1 - t0 < bestResult) bestResult = t1 - t0;
 		totalTimeSecs += (double)(t1 - t0) / ticks_per_sec();
 	}
 	unsigned long long totalBytesTransferred = numTimes * copySize;
 
-	copySizes.push_back(copySize);
-
 	tick_t ticksElapsed = bestResult;
 	if (ticksElapsed > 0)
 	{
 		double seconds = (double)ticksElapsed / ticks_per_sec();
 		double bytesPerSecond = totalBytesTransferred / seconds;
 		double mbytesPerSecond = bytesPerSecond / (1024.0*1024.0);
-		results.push_back(mbytesPerSecond);
-	}
-	else
-	{
-		results.push_back(0.0);
+		return mbytesPerSecond;
 	}
+	return 0.0;
+}
+
+void test_case(int copySize)
+{
+	copySizes.push_back(copySize);
+#ifdef SWEEP
+	results.push_back(measure<set_small>(copySize));
+	largeResults.push_back(measure<set_large>(copySize));
+#else
+	results.push_back(measure<memset>(copySize));
+#endif
 }
 
 void print_results()
@@ -113,6 +186,21 @@ void print_results()
 		if (i % 10 == 9) std::cout << std::endl;
 	}
 
+#ifdef SWEEP
+	// The crossover is the smallest size from which memory.fill is at least as
+	// fast as the store loop for every larger size measured.
+	size_t crossover = copySizes.size();
+	while (crossover > 0 && largeResults[crossover-1] >= results[crossover-1])
+		--crossover;
+	std::cout << std::endl << "Size, store loop MB/s, memory.fill MB/s:" << std::endl;
+	for(size_t i = 0; i < copySizes.size(); ++i)
+		std::cout << copySizes[i] << ", " << results[i] << ", " << largeResults[i] << std::endl;
+	if (crossover < copySizes.size())
+		std::cout << "Crossover: memory.fill wins from " << copySizes[crossover] << " bytes" << std::endl;
+	else
+		std::cout << "Crossover: the store loop wins at all sizes measured" << std::endl;
+#endif
+
 	std::cout << "Result checksum: " << (int)resultCheckSum << std::endl;
 	std::cout << "Total time: " << totalTimeSecs << std::endl;
 }
@@ -154,13 +242,21 @@ void main_loop()
 
 int main()
 {
+#ifdef SWEEP
+	// Four sizes per power of two, to locate the crossover more precisely.
+	for(int copySize = MIN_COPY; copySize < MAX_COPY; copySize <<= 1)
+		for(int quarter = 0; quarter < 4; ++quarter)
+			testCases.push_back(copySize + (copySize >> 2) * quarter);
+#else
 	for(int copySizeI = MIN_COPY; copySizeI < MAX_COPY; copySizeI <<= 1)
 		for(int copySizeJ = 1; copySizeJ <= copySizeI; copySizeJ <<= 1)
 		{
 			testCases.push_back(copySizeI | copySizeJ);
 		}
+#endif
 
 	std::sort(testCases.begin(), testCases.end());
+	testCases.erase(std::unique(testCases.begin(), testCases.end()), testCases.end());
 #if defined(__EMSCRIPTEN__) && !defined(BUILD_FOR_SHELL)
 	emscripten_set_main_loop(main_loop, 0, 0);
 #else
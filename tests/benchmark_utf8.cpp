@@ -9,6 +9,9 @@
 #include <iostream>
 #include <cassert>
 #include <emscripten.h>
+#include <emscripten/utf8.h>
+
+int jsLength = 0;
 
 double test(const char *str) {
   double res = EM_ASM_DOUBLE({
@@ -16,11 +19,27 @@ double test(const char *str) {
     var str = Module.UTF8ToString($0);
     var t1 = _emscripten_get_now();
 //    out('t: ' + (t1 - t0) + ', len(result): ' + str.length + ', result: ' + str.slice(0, 100));
+    HEAP32[$1>>2] = str.length;
     return (t1-t0);
-  }, str);
+  }, str, &jsLength);
   return res;
 }
 
+#define MAX_LENGTH 1024
+uint16_t utf16[MAX_LENGTH];
+
+// The same work done natively: validate the string and convert it to UTF-16.
+double test_native(const char *str) {
+  double t0 = emscripten_get_now();
+  size_t len = strlen(str);
+  size_t valid = emscripten_utf8_validate(str, len);
+  size_t n = emscripten_utf8_to_utf16(str, len, utf16);
+  double t1 = emscripten_get_now();
+  assert(valid == len);
+  assert(n == (size_t)jsLength);
+  return t1 - t0;
+}
+
 char *utf8_corpus = 0;
 long utf8_corpus_length = 0;
 
@@ -55,14 +74,17 @@ char *randomString(int len) {
 int main() {
   srand(time(NULL));
   double t = 0;
+  double tn = 0;
   double t2 = emscripten_get_now();
   for(int i = 0; i < 100000; ++i) {
     // FF Nightly: Already on small strings of 64 bytes in length, TextDecoder trumps in performance.
     char *str = randomString(8);
     t += test(str);
+    tn += test_native(str);
     delete [] str;
   }
   double t3 = emscripten_get_now();
+  printf("Native time: %f.\n", tn);
   printf("OK. Time: %f (%f).\n", t, t3-t2);
 
 #ifdef REPORT_RESULT
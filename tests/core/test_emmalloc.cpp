@@ -6,8 +6,10 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <emscripten.h>
+#include <emscripten/emmalloc.h>
 
 #ifndef RANDOM_ITERS
 #define RANDOM_ITERS 12345
@@ -289,6 +291,57 @@ void randoms() {
   assert(check_where_we_would_malloc(10) == start);
 }
 
+void trim() {
+  stage("trim");
+  emmalloc_blank_slate_from_orbit();
+  void* first = malloc(10);
+  void* big = malloc(1024 * 1024);
+  void* end = sbrk(0);
+  free(big);
+  // Nothing happens automatically by default.
+  assert(sbrk(0) == end);
+  assert(emmalloc_trim(0) == 1);
+  assert((char*)sbrk(0) < (char*)end - 1000000);
+  // The memory can be used again.
+  void* again = malloc(1024 * 1024);
+  assert(again == big);
+  free(again);
+  stage("trim_threshold");
+  emmalloc_set_trim_threshold(65536);
+  big = malloc(100000);
+  end = sbrk(0);
+  free(big);
+  assert(sbrk(0) < end);
+  // Small frees don't trim.
+  void* small = malloc(100);
+  end = sbrk(0);
+  free(small);
+  assert(sbrk(0) == end);
+  emmalloc_set_trim_threshold(0);
+  free(first);
+  stage("trim_zero");
+  emmalloc_blank_slate_from_orbit();
+  char* a = (char*)malloc(100000);
+  void* b = malloc(10);
+  memset(a, 1, 100000);
+  free(a);
+  // The last region is in use, but the large free region is zeroed.
+  end = sbrk(0);
+  assert(emmalloc_trim(0) == 1);
+  assert(sbrk(0) == end);
+  assert(a[50000] == 0);
+  // Nothing changed since, so there is nothing left to do.
+  assert(emmalloc_trim(0) == 0);
+  // Once the region was used again it is zeroed again.
+  char* c = (char*)malloc(100000);
+  assert(c == a);
+  memset(c, 1, 100000);
+  free(c);
+  assert(emmalloc_trim(0) == 1);
+  assert(a[50000] == 0);
+  free(b);
+}
+
 int main() {
   stage("beginning");
 
@@ -301,6 +354,7 @@ int main() {
   realloc();
   aligned();
   randoms();
+  trim();
 
   stage("the_end");
 }
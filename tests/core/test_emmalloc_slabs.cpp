@@ -0,0 +1,166 @@
+// Copyright 2020 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <emscripten.h>
+
+extern void emmalloc_blank_slate_from_orbit();
+
+// Test emmalloc's slabs for small allocations (EMMALLOC_SLABS), through the
+// external interface.
+
+void stage(const char* name) {
+  EM_ASM({
+    out('\n>> ' + UTF8ToString($0) + '\n');
+  }, name);
+}
+
+void no_metadata() {
+  stage("no_metadata");
+  emmalloc_blank_slate_from_orbit();
+  // Objects of the same size class are packed together, with no metadata
+  // in between them.
+  for (size_t size = 1; size <= 256; size++) {
+    size_t expected = (size + 7) & -8;
+    char* first = (char*)malloc(size);
+    char* second = (char*)malloc(size);
+    assert(second - first == expected);
+    assert(malloc_usable_size(first) == expected);
+    free(first);
+    free(second);
+  }
+  // Larger allocations are normal regions.
+  char* big = (char*)malloc(257);
+  char* big2 = (char*)malloc(257);
+  assert(big2 - big > 264);
+  free(big);
+  free(big2);
+}
+
+void reuse() {
+  stage("reuse");
+  emmalloc_blank_slate_from_orbit();
+  void* first = malloc(12);
+  void* second = malloc(20);
+  free(first);
+  // The freed object is reused, and different size classes don't mix.
+  assert(malloc(12) == first);
+  assert(malloc(20) != second);
+}
+
+void many() {
+  stage("many");
+  emmalloc_blank_slate_from_orbit();
+  // Fill several slabs, then free everything, and see that we get back to
+  // the same memory.
+  const int N = 10000;
+  static void* ptrs[N];
+  for (int i = 0; i < N; i++) {
+    ptrs[i] = malloc(16);
+    assert(ptrs[i]);
+    memset(ptrs[i], i & 255, 16);
+  }
+  for (int i = 0; i < N; i++) {
+    assert(((unsigned char*)ptrs[i])[15] == (i & 255));
+  }
+  struct mallinfo info = mallinfo();
+  assert(info.smblks < 1024);
+  for (int i = N - 1; i >= 0; i--) {
+    free(ptrs[i]);
+  }
+  // Empty slabs are released, except for the last one in each class.
+  info = mallinfo();
+  assert(info.fsmblks < 16384);
+  // The released memory can be used for other allocations.
+  void* big = malloc(100000);
+  assert(big < ptrs[N - 1]);
+  free(big);
+}
+
+void realloc_() {
+  stage("realloc");
+  emmalloc_blank_slate_from_orbit();
+  char* ptr = (char*)malloc(10);
+  strcpy(ptr, "emmalloc");
+  // Growing within the size class does not move.
+  assert(realloc(ptr, 16) == ptr);
+  // Growing past it moves to another class, then to a region.
+  char* larger = (char*)realloc(ptr, 100);
+  assert(larger != ptr);
+  assert(!strcmp(larger, "emmalloc"));
+  char* region = (char*)realloc(larger, 1000);
+  assert(!strcmp(region, "emmalloc"));
+  assert(malloc_usable_size(region) >= 1000);
+  free(region);
+}
+
+void aligned() {
+  stage("aligned");
+  emmalloc_blank_slate_from_orbit();
+  for (size_t align = 8; align <= 1024; align *= 2) {
+    void* small = memalign(align, 10);
+    void* other = malloc(10);
+    assert(small && size_t(small) % align == 0);
+    assert(other && size_t(other) % 8 == 0);
+    free(small);
+    free(other);
+  }
+}
+
+void randoms() {
+  stage("randoms");
+  emmalloc_blank_slate_from_orbit();
+  const int BINS = 128;
+  void* bins[BINS];
+  char values[BINS];
+  for (int i = 0; i < BINS; i++) {
+    bins[i] = NULL;
+  }
+  srandom(1337101);
+  for (int i = 0; i < 12345; i++) {
+    unsigned int r = random();
+    int alloc = r & 1;
+    r >>= 1;
+    int bin = r & 127;
+    r >>= 7;
+    // Mostly small sizes, with some larger ones.
+    unsigned int size = (r & 7) ? (r >> 3) & 511 : (r >> 3) & 8191;
+    if (alloc || !bins[bin]) {
+      if (bins[bin]) {
+        char value = values[bin];
+        bins[bin] = realloc(bins[bin], size + 1);
+        assert(*(char*)bins[bin] == value);
+      } else {
+        bins[bin] = malloc(size + 1);
+        values[bin] = random();
+        *(char*)bins[bin] = values[bin];
+      }
+    } else {
+      free(bins[bin]);
+      bins[bin] = NULL;
+    }
+  }
+  for (int i = 0; i < BINS; i++) {
+    free(bins[i]);
+  }
+}
+
+int main() {
+  stage("beginning");
+
+  no_metadata();
+  reuse();
+  many();
+  realloc_();
+  aligned();
+  randoms();
+
+  stage("the_end");
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <emscripten/utf8.h>
+
+// Checks emscripten_utf8_validate() and emscripten_utf8_to_utf16() against a
+// byte at a time reference that follows the WHATWG decoder: each maximal
+// invalid subpart becomes one U+FFFD. The inputs are placed after runs of
+// ASCII of every length up to 40, so that the problems land at every position
+// of the 16-byte blocks that the SIMD version works on.
+
+// Decodes one sequence like the WHATWG decoder. Returns the number of bytes
+// consumed, and sets *cp to the code point, or to -1 for an invalid subpart.
+static size_t ref_decode(const unsigned char *s, size_t len, long *cp) {
+  unsigned c = s[0];
+  size_t need;
+  unsigned lo = 0x80, hi = 0xBF;
+  long v;
+  if (c <= 0x7F) { *cp = c; return 1; }
+  if (c >= 0xC2 && c <= 0xDF) { need = 1; v = c & 0x1F; }
+  else if (c >= 0xE0 && c <= 0xEF) { need = 2; v = c & 0xF; if (c == 0xE0) lo = 0xA0; if (c == 0xED) hi = 0x9F; }
+  else if (c >= 0xF0 && c <= 0xF4) { need = 3; v = c & 0x7; if (c == 0xF0) lo = 0x90; if (c == 0xF4) hi = 0x8F; }
+  else { *cp = -1; return 1; }
+  for (size_t i = 1; i <= need; i++) {
+    if (i == len || s[i] < lo || s[i] > hi) { *cp = -1; return i; }
+    lo = 0x80;
+    hi = 0xBF;
+    v = (v << 6) | (s[i] & 0x3F);
+  }
+  *cp = v;
+  return need + 1;
+}
+
+static size_t ref_validate(const unsigned char *s, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    long cp;
+    size_t n = ref_decode(s + i, len - i, &cp);
+    if (cp < 0) return i;
+    i += n;
+  }
+  return len;
+}
+
+static size_t ref_to_utf16(const unsigned char *s, size_t len, unsigned short *out) {
+  size_t i = 0, o = 0;
+  while (i < len) {
+    long cp;
+    i += ref_decode(s + i, len - i, &cp);
+    if (cp < 0) cp = 0xFFFD;
+    if (cp >= 0x10000) {
+      out[o++] = 0xD800 + ((cp - 0x10000) >> 10);
+      out[o++] = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+    } else {
+      out[o++] = cp;
+    }
+  }
+  return o;
+}
+
+struct Case {
+  const char *name;
+  const char *bytes;
+  // The expected error position and U+FFFD count, in the input on its own.
+  size_t valid;
+  int replacements;
+};
+
+static const struct Case cases[] = {
+  { "ascii", "hello", 5, 0 },
+  { "two byte", "\xC3\xA9", 2, 0 },
+  { "three byte", "\xE2\x82\xAC", 3, 0 },
+  { "four byte", "\xF0\x9F\x98\x80", 4, 0 },
+  { "max", "\xF4\x8F\xBF\xBF", 4, 0 },
+  { "lone continuation", "a\x80z", 1, 1 },
+  { "continuations", "a\x80\xBF\x80z", 1, 3 },
+  { "overlong 2", "a\xC0\xAFz", 1, 2 },
+  { "overlong 2 high", "a\xC1\xBFz", 1, 2 },
+  { "overlong 3", "a\xE0\x80\xAFz", 1, 3 },
+  { "overlong 3 high", "a\xE0\x9F\xBFz", 1, 3 },
+  { "overlong 4", "a\xF0\x80\x80\xAFz", 1, 4 },
+  { "overlong 4 high", "a\xF0\x8F\xBF\xBFz", 1, 4 },
+  { "surrogate low", "a\xED\xA0\x80z", 1, 3 },
+  { "surrogate high", "a\xED\xBF\xBFz", 1, 3 },
+  { "before surrogates", "a\xED\x9F\xBFz", 5, 0 },
+  { "above max", "a\xF4\x90\x80\x80z", 1, 4 },
+  { "f5", "a\xF5\x80\x80\x80z", 1, 4 },
+  { "ff", "a\xFFz", 1, 1 },
+  { "truncated 2", "a\xC3", 1, 1 },
+  { "truncated 3", "a\xE2\x82", 1, 1 },
+  { "truncated 4", "a\xF0\x9F\x98", 1, 1 },
+  { "truncated 3 then ascii", "a\xE2\x82z", 1, 1 },
+  { "truncated 4 then ascii", "a\xF0\x9Fz", 1, 1 },
+  { "truncated then valid", "a\xE2\xC3\xA9", 1, 1 },
+  { "valid then invalid", "\xC3\xA9\xE2\x82\xAC\x80", 5, 1 },
+};
+
+static unsigned char buf[256];
+static unsigned short out[256], expected[256];
+
+static int check(const char *name, size_t prefix, size_t len) {
+  size_t valid = emscripten_utf8_validate((const char *)buf, len);
+  size_t ref_valid = ref_validate(buf, len);
+  if (valid != ref_valid) {
+    printf("%s after %zu bytes of ASCII: validate returned %zu, expected %zu\n", name, prefix, valid, ref_valid);
+    return 1;
+  }
+  size_t n = emscripten_utf8_to_utf16((const char *)buf, len, out);
+  size_t ref_n = ref_to_utf16(buf, len, expected);
+  if (n != ref_n || memcmp(out, expected, n * sizeof(out[0]))) {
+    printf("%s after %zu bytes of ASCII: UTF-16 conversion differs\n", name, prefix);
+    return 1;
+  }
+  return 0;
+}
+
+int main() {
+  int failures = 0;
+  for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+    const struct Case *t = &cases[c];
+    size_t len = strlen(t->bytes);
+    // The reference itself must agree with the expectations.
+    size_t n = ref_to_utf16((const unsigned char *)t->bytes, len, expected);
+    int replacements = 0;
+    for (size_t i = 0; i < n; i++) replacements += expected[i] == 0xFFFD;
+    if (ref_validate((const unsigned char *)t->bytes, len) != t->valid || replacements != t->replacements) {
+      printf("%s: bad reference result\n", t->name);
+      failures++;
+    }
+    for (size_t prefix = 0; prefix <= 40; prefix++) {
+      memset(buf, 'x', prefix);
+      memcpy(buf + prefix, t->bytes, len);
+      // Also with ASCII after it, so that the input goes on past the block.
+      memset(buf + prefix + len, 'y', 20);
+      failures += check(t->name, prefix, prefix + len);
+      failures += check(t->name, prefix, prefix + len + 20);
+      if (emscripten_utf8_validate((const char *)buf, prefix + len) != prefix + t->valid) {
+        printf("%s after %zu bytes of ASCII: wrong error position\n", t->name, prefix);
+        failures++;
+      }
+    }
+  }
+  // Random bytes that are mostly valid UTF-8.
+  static const char *pieces[] = { "a", "bcdefghijklmnop", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\x80", "\xE2\x82", "\xED\xA0\x80", "\xC0\x80", "\xF4\x90\x80\x80" };
+  srand(1);
+  for (int i = 0; i < 20000; i++) {
+    size_t len = 0;
+    while (len < 200) {
+      const char *piece = pieces[rand() % (i % 2 ? 5 : 10)];
+      memcpy(buf + len, piece, strlen(piece));
+      len += strlen(piece);
+    }
+    len -= rand() % 4;
+    failures += check("random", 0, len);
+  }
+  printf(failures ? "%d failures\n" : "OK.\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,55 @@
+/*
+ * Copyright 2019 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Checks memmove against a byte at a time reference, for overlapping moves in
+// both directions at all alignments, and for sizes around the thresholds where
+// the implementation changes strategy.
+
+#define BUF_SIZE 10240
+
+static unsigned char buf[BUF_SIZE], expected[BUF_SIZE];
+
+static void reference_memmove(unsigned char *d, const unsigned char *s, size_t n) {
+  if (d < s) {
+    for (size_t i = 0; i < n; i++) d[i] = s[i];
+  } else {
+    for (size_t i = n; i > 0; i--) d[i - 1] = s[i - 1];
+  }
+}
+
+static void test(size_t n, size_t src, size_t dst) {
+  for (int i = 0; i < BUF_SIZE; i++) buf[i] = expected[i] = (unsigned char)(i * 7 + (i >> 8));
+  reference_memmove(expected + dst, expected + src, n);
+  if (memmove(buf + dst, buf + src, n) != buf + dst || memcmp(buf, expected, BUF_SIZE)) {
+    printf("memmove(n=%zu, src=%zu, dst=%zu) failed!\n", n, src, dst);
+    exit(1);
+  }
+}
+
+int main() {
+  static const size_t sizes[] = { 0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 79, 80, 127,
+                                  128, 129, 255, 256, 257, 511, 512, 513, 1000, 1024, 1031, 4096, 4099 };
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    size_t n = sizes[i];
+    for (size_t a = 0; a < 17; a++) {
+      for (size_t shift = 0; shift < 40; shift += (shift < 17 ? 1 : 11)) {
+        // Overlapping, or adjacent, with the destination before and after the
+        // source.
+        test(n, 64 + a + shift, 64 + a);
+        test(n, 64 + a, 64 + a + shift);
+        // Not overlapping at all.
+        test(n, 64 + a, 64 + a + n + shift);
+      }
+    }
+  }
+  printf("OK.\n");
+  return 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2020 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <assert.h>
+#include <emscripten.h>
+
+#define MB (1024 * 1024)
+
+extern int emscripten_resize_heap(size_t requested_size);
+
+int get_TOTAL_MEMORY() {
+  return EM_ASM_INT({ return HEAP8.length });
+}
+
+int main() {
+  // Asking for one byte more than there is grows the heap by one geometric
+  // step, so the sizes show the step that MEMORY_GROWTH_GEOMETRIC_PERCENT and
+  // MEMORY_GROWTH_GEOMETRIC_CAP give.
+  for (int i = 0; i < 3; i++) {
+    int old_size = get_TOTAL_MEMORY();
+    assert(emscripten_resize_heap(old_size + 1));
+    printf("%d -> %d MB\n", old_size / MB, get_TOTAL_MEMORY() / MB);
+  }
+}
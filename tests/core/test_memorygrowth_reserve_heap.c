@@ -0,0 +1,42 @@
+/*
+ * Copyright 2020 The Emscripten Authors.  All rights reserved.
+ * Emscripten is available under two separate licenses, the MIT license and the
+ * University of Illinois/NCSA Open Source License.  Both these licenses can be
+ * found in the LICENSE file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <emscripten/heap.h>
+
+#define MB (1024 * 1024)
+
+int main() {
+  size_t count = emscripten_get_heap_growth_count();
+  size_t bytes = emscripten_get_heap_growth_bytes();
+
+  // Reserving grows the heap at most once.
+  assert(emscripten_reserve_heap(64 * MB));
+  assert(emscripten_get_heap_growth_count() <= count + 1);
+  assert(emscripten_get_heap_growth_bytes() >= bytes);
+  count = emscripten_get_heap_growth_count();
+  bytes = emscripten_get_heap_growth_bytes();
+
+  // Allocating within the reservation does not grow it again.
+  for (int i = 0; i < 60; i++) {
+    volatile void* sink = malloc(MB);
+    assert(sink);
+  }
+  assert(emscripten_get_heap_growth_count() == count);
+  printf("reserved ok.\n");
+
+  // Going beyond it does, and is counted.
+  for (int i = 0; i < 128; i++) {
+    volatile void* sink = malloc(MB);
+    assert(sink);
+  }
+  assert(emscripten_get_heap_growth_count() > count);
+  assert(emscripten_get_heap_growth_bytes() >= bytes + 60 * MB);
+  printf("grew memory ok.\n");
+}
@@ -2655,6 +2655,26 @@ module({
         test("enums", function() {
             assert.equal(cm.Enum.ONE, cm.val_as_enum(cm.Enum.ONE));
         });
+
+        test("numbers and strings", function() {
+            assert.equal(1, cm.val_as_double(true));
+            assert.equal(-0.25, cm.val_as_float(-0.25));
+            var e = assert.throws(TypeError, function() { cm.val_as_double("1"); });
+            assert.equal('Cannot convert "1" to double', e.message);
+            e = assert.throws(TypeError, function() { cm.val_as_float("1"); });
+            assert.equal('Cannot convert "1" to float', e.message);
+            assert.equal(10.5, cm.val_from_double(10.5));
+
+            assert.equal("", cm.val_as_string(""));
+            assert.equal("a\u0000b", cm.val_as_string("a\u0000b"));
+            assert.equal("abc", cm.val_as_string(new Uint8Array([97, 98, 99])));
+        });
+
+        test("many live handles", function() {
+            assert.equal(499500, cm.val_sum_of_n_handles(1000));
+            assert.equal(0, cm.count_emval_handles());
+            assert.equal(499500, cm.val_sum_of_n_handles(1000));
+        });
     });
 
     BaseFixture.extend("val::new_", function() {
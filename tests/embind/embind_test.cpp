@@ -2740,6 +2740,24 @@ T val_as(const val& v) {
     return v.as<T>();
 }
 
+val val_from_double(double d) {
+    return val(d);
+}
+
+// Holds n handles at once, so that the handle table has to grow, then reads
+// them back.
+double val_sum_of_n_handles(unsigned n) {
+    std::vector<val> vals;
+    for (unsigned i = 0; i < n; ++i) {
+        vals.push_back(val(double(i)));
+    }
+    double sum = 0;
+    for (const val& v : vals) {
+        sum += v.as<double>();
+    }
+    return sum;
+}
+
 EMSCRIPTEN_BINDINGS(val_as) {
     function("val_as_bool",   &val_as<bool>);
     function("val_as_char",   &val_as<char>);
@@ -2759,6 +2777,9 @@ EMSCRIPTEN_BINDINGS(val_as) {
 
     function("val_as_enum", &val_as<Enum>);
 
+    function("val_from_double", &val_from_double);
+    function("val_sum_of_n_handles", &val_sum_of_n_handles);
+
     // memory_view is always JS -> C++
     //function("val_as_memory_view", &val_as<memory_view>);
 }
@@ -0,0 +1,72 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+// Runs a sequence of fetches against the FETCH_DISK_CACHE backend in node.js, downloading from the XMLHttpRequest
+// stand-in in node_disk_cache_xhr.js, and prints what each of them got.
+
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+#include <emscripten.h>
+#include <emscripten/fetch.h>
+
+struct Step
+{
+  const char *name;
+  const char *url;
+  uint32_t attributes;
+  bool offline;
+};
+
+static const Step steps[] = {
+  // Nothing is cached yet.
+  { "miss", "data.txt", EMSCRIPTEN_FETCH_NO_DOWNLOAD, false },
+  // Downloads and caches the file.
+  { "download", "data.txt", 0, false },
+  // Served from the cache, without asking the server.
+  { "hit", "data.txt", EMSCRIPTEN_FETCH_NO_DOWNLOAD, false },
+  // The same destination path from another URL is a different entry.
+  { "other url", "other.txt", EMSCRIPTEN_FETCH_NO_DOWNLOAD, false },
+  // Revalidated with the ETag, and served from the cache after a 304 Not Modified.
+  { "revalidate", "data.txt", 0, false },
+  // The revalidation can not reach the server, so the cached response is used.
+  { "offline", "data.txt", 0, true },
+};
+
+static int step = 0;
+
+static void next();
+
+static void done(emscripten_fetch_t *fetch)
+{
+  printf("%s: status %d, %llu bytes \"%.*s\"\n", steps[step].name, fetch->status, fetch->numBytes, (int)fetch->numBytes, fetch->data ? fetch->data : "");
+  emscripten_fetch_close(fetch);
+  ++step;
+  next();
+}
+
+static void next()
+{
+  if (step == sizeof(steps) / sizeof(steps[0]))
+  {
+    printf("done\n");
+    return;
+  }
+  const Step &s = steps[step];
+  EM_ASM(Module['offline'] = $0, s.offline);
+  emscripten_fetch_attr_t attr;
+  emscripten_fetch_attr_init(&attr);
+  strcpy(attr.requestMethod, "GET");
+  attr.attributes = EMSCRIPTEN_FETCH_LOAD_TO_MEMORY | EMSCRIPTEN_FETCH_PERSIST_FILE | s.attributes;
+  attr.destinationPath = "data.txt";
+  attr.onsuccess = done;
+  attr.onerror = done;
+  emscripten_fetch(&attr, s.url);
+}
+
+int main()
+{
+  next();
+}
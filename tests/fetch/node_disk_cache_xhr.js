@@ -0,0 +1,41 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+// node.js has no XMLHttpRequest, so node_disk_cache.cpp downloads from this stand-in instead. It serves "hello" with
+// the ETag "v1" for every URL, answers requests that have a matching If-None-Match with 304 Not Modified, and fails
+// like an unreachable server does (status 0) while Module['offline'] is set.
+Module['fetchDiskCacheDir'] = 'fetch_cache';
+
+var XMLHttpRequest = function() {
+  this.readyState = 0;
+  this.status = 0;
+  this.requestHeaders = {};
+};
+
+XMLHttpRequest.prototype.open = function(method, url) { this.url = url; };
+XMLHttpRequest.prototype.setRequestHeader = function(key, value) { this.requestHeaders[key] = value; };
+XMLHttpRequest.prototype.overrideMimeType = function() {};
+XMLHttpRequest.prototype.getAllResponseHeaders = function() { return this.status === 200 ? 'ETag: "v1"\r\n' : ''; };
+XMLHttpRequest.prototype.getResponseHeader = function(key) { return key === 'ETag' && this.status === 200 ? '"v1"' : null; };
+
+XMLHttpRequest.prototype.send = function() {
+  var xhr = this;
+  var ifNoneMatch = this.requestHeaders['If-None-Match'];
+  console.log('xhr ' + this.url + (ifNoneMatch ? ' If-None-Match: ' + ifNoneMatch : ''));
+  setTimeout(function() {
+    xhr.readyState = 4;
+    if (Module['offline']) {
+      xhr.onerror({});
+    } else if (ifNoneMatch === '"v1"') {
+      xhr.status = 304;
+      xhr.response = null;
+      xhr.onload({});
+    } else {
+      xhr.status = 200;
+      xhr.response = new Uint8Array([104, 101, 108, 108, 111]).buffer;
+      xhr.onload({});
+    }
+  }, 0);
+};
@@ -0,0 +1,91 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+#include <emscripten/emscripten.h>
+#include <emscripten/fetch.h>
+
+// The 128MB file is streamed through a buffer of 1MB.
+char streamBuffer[1024*1024];
+char readBuffer[64*1024];
+
+// Compute rudimentary checksum of data
+uint32_t checksum = 0;
+uint64_t numBytesRead = 0;
+
+emscripten_fetch_t *fetch = 0;
+
+void finish(EMSCRIPTEN_RESULT ret)
+{
+  printf("Finished reading %llu bytes\n", numBytesRead);
+  printf("Data checksum: %08X\n", checksum);
+  assert(ret == EMSCRIPTEN_RESULT_NO_DATA);
+  assert(fetch->status == 200);
+  assert(fetch->totalBytes == 134217728);
+  assert(numBytesRead == 134217728);
+  assert(checksum == 0xA7F8E858U);
+  emscripten_fetch_close(fetch);
+
+#ifdef REPORT_RESULT
+  REPORT_RESULT(1);
+#endif
+}
+
+// Returns the result of the last read, which is EMSCRIPTEN_RESULT_TIMED_OUT if there are no more bytes yet.
+EMSCRIPTEN_RESULT read_bytes(double timeoutMSecs, size_t maxBytes)
+{
+  EMSCRIPTEN_RESULT ret;
+  size_t n;
+  size_t total = 0;
+  while((ret = emscripten_fetch_read(fetch, readBuffer, sizeof(readBuffer), &n, timeoutMSecs)) == EMSCRIPTEN_RESULT_SUCCESS)
+  {
+    assert(n > 0 && n <= sizeof(readBuffer));
+    for(size_t i = 0; i < n; ++i)
+      checksum = ((checksum << 8) | (checksum >> 24)) * (uint8_t)readBuffer[i] + (uint8_t)readBuffer[i];
+    numBytesRead += n;
+    total += n;
+    if (total >= maxBytes)
+      break;
+  }
+  return ret;
+}
+
+#ifndef WAITABLE
+// Reads at most 512KB at a time, less than what can arrive in between, so the buffer fills up and the download has
+// to wait for the reader.
+void read_some(void *)
+{
+  EMSCRIPTEN_RESULT ret = read_bytes(0, 512*1024);
+  if (ret == EMSCRIPTEN_RESULT_SUCCESS || ret == EMSCRIPTEN_RESULT_TIMED_OUT)
+    emscripten_async_call(read_some, 0, 0);
+  else
+    finish(ret);
+}
+#endif
+
+int main()
+{
+  emscripten_fetch_attr_t attr;
+  emscripten_fetch_attr_init(&attr);
+  strcpy(attr.requestMethod, "GET");
+  attr.attributes = EMSCRIPTEN_FETCH_STREAM_DATA;
+#ifdef WAITABLE
+  attr.attributes |= EMSCRIPTEN_FETCH_WAITABLE;
+#endif
+  attr.streamBuffer = streamBuffer;
+  attr.streamBufferSize = sizeof(streamBuffer);
+  fetch = emscripten_fetch(&attr, "largefile.txt");
+  assert(fetch);
+
+#ifdef WAITABLE
+  // The fetch runs in the fetch worker, so this thread can block until bytes arrive.
+  finish(read_bytes(INFINITY, (size_t)-1));
+#else
+  emscripten_async_call(read_some, 0, 0);
+#endif
+}
@@ -0,0 +1,65 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <pthread.h>
+#include <emscripten.h>
+#include <emscripten/threading.h>
+#include <assert.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Creates and joins threads that free small allocations before they exit,
+// which the allocator may keep in a cache of the thread, and checks that the
+// heap does not grow with the number of threads that have exited.
+
+#define NUM_ROUNDS 200
+#define WARMUP_ROUNDS 10
+#define N 64
+
+static void *thread_start(void *arg)
+{
+  void *mem[N];
+  for(int i = 0; i < N; ++i)
+    mem[i] = malloc(8 + 8 * (i % 16));
+  for(int i = 0; i < N; ++i)
+    free(mem[i]);
+  return 0;
+}
+
+static size_t heap_in_use()
+{
+  return mallinfo().uordblks;
+}
+
+int main()
+{
+  if (!emscripten_has_threading_support()) {
+#ifdef REPORT_RESULT
+    REPORT_RESULT(0);
+#endif
+    printf("Skipped: threading support is not available!\n");
+    return 0;
+  }
+
+  size_t start = 0;
+  for(int i = 0; i < NUM_ROUNDS; ++i) {
+    if (i == WARMUP_ROUNDS)
+      start = heap_in_use();
+    pthread_t thr;
+    int rc = pthread_create(&thr, NULL, thread_start, 0);
+    assert(rc == 0);
+    rc = pthread_join(thr, NULL);
+    assert(rc == 0);
+  }
+  size_t end = heap_in_use();
+  printf("In use after %d threads: %zu bytes, after %d threads: %zu bytes\n", WARMUP_ROUNDS, start, NUM_ROUNDS, end);
+  // Leaking the freed allocations of every thread would take over 800KB.
+  int result = end > start + 64 * 1024;
+#ifdef REPORT_RESULT
+  REPORT_RESULT(result);
+#endif
+  return result;
+}
@@ -0,0 +1,66 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <emscripten/threading.h>
+#include <stdio.h>
+#include <assert.h>
+
+#define NUM_CALLS 100
+
+volatile int func_called = 0;
+volatile int exit_now = 0;
+
+void vi(int value)
+{
+	emscripten_atomic_add_u32((void*)&func_called, 1);
+}
+
+// Exits without ever processing the calls queued to it.
+void *thread_main(void*)
+{
+	while(!emscripten_atomic_load_u32((void*)&exit_now))
+		;
+	pthread_exit(0);
+}
+
+void *process_calls(void*)
+{
+	emscripten_current_thread_process_queued_calls();
+	pthread_exit(0);
+}
+
+int main()
+{
+	if (emscripten_has_threading_support())
+	{
+		pthread_t thread;
+		int rc = pthread_create(&thread, 0, thread_main, 0);
+		assert(rc == 0);
+		// Calls still pending when the thread exits are cancelled.
+		for(int i = 0; i < NUM_CALLS; ++i)
+			emscripten_async_queue_on_thread(thread, EM_FUNC_SIG_VI, vi, 0, i);
+		emscripten_atomic_store_u32((void*)&exit_now, 1);
+		rc = pthread_join(thread, 0);
+		assert(rc == 0);
+
+		// Calls queued to a thread that has exited are cancelled right away, without touching its
+		// freed pthread_t.
+		for(int i = 0; i < NUM_CALLS; ++i)
+			emscripten_async_queue_on_thread(thread, EM_FUNC_SIG_VI, vi, 0, i);
+
+		// A new thread, which may well get the same pthread_t, starts with an empty queue.
+		rc = pthread_create(&thread, 0, process_calls, 0);
+		assert(rc == 0);
+		rc = pthread_join(thread, 0);
+		assert(rc == 0);
+
+		printf("%d calls performed\n", func_called);
+		assert(func_called == 0);
+	}
+
+#ifdef REPORT_RESULT
+	REPORT_RESULT(0);
+#endif
+}
@@ -0,0 +1,49 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <emscripten/threading.h>
+#include <stdio.h>
+#include <assert.h>
+
+// Many more calls than used to fit in a call queue, none of which may be dropped.
+#define NUM_CALLS 10000
+
+volatile int func_called = 0;
+volatile int last_value = -1;
+
+void vi(int value)
+{
+	// Calls must be performed in the order they were queued.
+	assert(value == last_value + 1);
+	last_value = value;
+	emscripten_atomic_add_u32((void*)&func_called, 1);
+}
+
+void *thread_main(void*)
+{
+	while(emscripten_atomic_load_u32((void*)&func_called) != NUM_CALLS)
+		emscripten_current_thread_process_queued_calls();
+	pthread_exit(0);
+}
+
+int main()
+{
+	if (emscripten_has_threading_support())
+	{
+		pthread_t thread;
+		int rc = pthread_create(&thread, 0, thread_main, 0);
+		assert(rc == 0);
+		for(int i = 0; i < NUM_CALLS; ++i)
+			emscripten_async_queue_on_thread(thread, EM_FUNC_SIG_VI, vi, 0, i);
+		rc = pthread_join(thread, 0);
+		assert(rc == 0);
+		printf("%d calls performed\n", func_called);
+		assert(func_called == NUM_CALLS);
+	}
+
+#ifdef REPORT_RESULT
+	REPORT_RESULT(0);
+#endif
+}
@@ -0,0 +1,80 @@
+// Copyright 2019 The Emscripten Authors.  All rights reserved.
+// Emscripten is available under two separate licenses, the MIT license and the
+// University of Illinois/NCSA Open Source License.  Both these licenses can be
+// found in the LICENSE file.
+
+#include <emscripten/threading.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#define NUM_CALLS 500
+
+volatile int last_value = -1;
+
+int ii(int value)
+{
+	assert(emscripten_is_main_runtime_thread());
+	// Calls in a batch must be performed in order.
+	assert(value == last_value + 1);
+	last_value = value;
+	return value * 2;
+}
+
+em_queued_call calls[NUM_CALLS];
+em_queued_call *batch[NUM_CALLS];
+
+void init_batch(int first)
+{
+	memset(calls, 0, sizeof(calls));
+	for(int i = 0; i < NUM_CALLS; ++i)
+	{
+		calls[i].functionEnum = EM_FUNC_SIG_II;
+		calls[i].functionPtr = (void*)ii;
+		calls[i].args[0].i = first + i;
+		batch[i] = &calls[i];
+	}
+}
+
+void check_batch(int first)
+{
+	for(int i = 0; i < NUM_CALLS; ++i)
+	{
+		assert(calls[i].operationDone);
+		assert(calls[i].returnValue.i == (first + i) * 2);
+	}
+}
+
+void *thread_main(void*)
+{
+	printf("Testing sync batch:\n");
+	init_batch(0);
+	emscripten_sync_run_batch_in_main_thread(batch, NUM_CALLS);
+	check_batch(0);
+
+	printf("Testing async batch:\n");
+	init_batch(NUM_CALLS);
+	emscripten_async_run_batch_in_main_thread(batch, NUM_CALLS);
+	EMSCRIPTEN_RESULT r = emscripten_wait_for_call_v(batch[NUM_CALLS-1], INFINITY);
+	assert(r == EMSCRIPTEN_RESULT_SUCCESS);
+	check_batch(NUM_CALLS);
+	pthread_exit(0);
+}
+
+int main()
+{
+	if (emscripten_has_threading_support())
+	{
+		pthread_t thread;
+		int rc = pthread_create(&thread, 0, thread_main, 0);
+		assert(rc == 0);
+		rc = pthread_join(thread, 0);
+		assert(rc == 0);
+		assert(last_value == 2*NUM_CALLS - 1);
+	}
+
+#ifdef REPORT_RESULT
+	REPORT_RESULT(0);
+#endif
+}
@@ -79,6 +79,15 @@ int main()
 		assert(rc == 0);
 		rc = pthread_join(thread, 0);
 		assert(rc == 0);
+
+		// Call objects freed after each waitable run above should have been reused for the
+		// next one, rather than allocated again.
+		uint32_t hits, misses;
+		emscripten_get_queued_call_pool_stats(&hits, &misses);
+		printf("Call pool hits: %u, misses: %u\n", hits, misses);
+#ifdef __wasm__
+		assert(hits > 0);
+#endif
 	}
 
 	test_async();
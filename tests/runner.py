@@ -20,6 +20,7 @@ http://kripken.github.io/emscripten-site/docs/getting_started/test-suite.html
 from __future__ import print_function
 from subprocess import PIPE, STDOUT
 from functools import wraps
+from io import BytesIO
 import argparse
 import atexit
 import contextlib
@@ -1252,6 +1253,28 @@ def harness_server_func(in_queue, out_queue, port):
         self.send_header('Expires', '-1')
         self.end_headers()
         return f
+      elif self.headers.get('Range'):
+        # Serve byte ranges of files, for tests of loading files lazily with HTTP Range requests.
+        path = self.translate_path(self.path)
+        m = re.match(r'bytes=(\d+)-(\d*)$', self.headers.get('Range'))
+        if not m or not os.path.isfile(path):
+          return SimpleHTTPRequestHandler.send_head(self)
+        with open(path, 'rb') as f:
+          data = f.read()
+        start = int(m.group(1))
+        end = min(int(m.group(2)), len(data) - 1) if m.group(2) else len(data) - 1
+        if start > end:
+          self.send_response(416)
+          self.send_header('Content-Length', '0')
+          self.send_header('Content-Range', 'bytes */%d' % len(data))
+          self.end_headers()
+          return BytesIO(b'')
+        self.send_response(206)
+        self.send_header('Content-type', 'application/octet-stream')
+        self.send_header('Content-Length', str(end - start + 1))
+        self.send_header('Content-Range', 'bytes %d-%d/%d' % (start, end, len(data)))
+        self.end_headers()
+        return BytesIO(data[start:end + 1])
       else:
         return SimpleHTTPRequestHandler.send_head(self)
 
@@ -3759,14 +3759,34 @@ window.close = function() {
     self.btest(path_from_root('tests', 'pthread', 'test_pthread_attr_getstack.cpp'), expected='0', args=['-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=2'])
 
   # Test that memory allocation is thread-safe.
+  @parameterized({
+    'dlmalloc': (['-s', 'MALLOC=dlmalloc'],),
+    'dlmalloc_mspaces': (['-s', 'MALLOC=dlmalloc', '-s', 'DLMALLOC_MSPACES=1'],),
+    'emmalloc': (['-s', 'MALLOC=emmalloc'],),
+  })
   @requires_threads
-  def test_pthread_malloc(self):
-    self.btest(path_from_root('tests', 'pthread', 'test_pthread_malloc.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8'])
+  def test_pthread_malloc(self, args):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_malloc.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8'] + args)
 
   # Stress test pthreads allocating memory that will call to sbrk(), and main thread has to free up the data.
+  @parameterized({
+    'dlmalloc': (['-s', 'MALLOC=dlmalloc'],),
+    'dlmalloc_mspaces': (['-s', 'MALLOC=dlmalloc', '-s', 'DLMALLOC_MSPACES=1'],),
+    'emmalloc': (['-s', 'MALLOC=emmalloc'],),
+  })
+  @requires_threads
+  def test_pthread_malloc_free(self, args):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_malloc_free.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8', '-s', 'TOTAL_MEMORY=256MB'] + args)
+
+  # Test that exited threads don't leave behind memory that the allocator can't use anymore.
+  @parameterized({
+    'dlmalloc': (['-s', 'MALLOC=dlmalloc'],),
+    'dlmalloc_mspaces': (['-s', 'MALLOC=dlmalloc', '-s', 'DLMALLOC_MSPACES=1'],),
+    'emmalloc': (['-s', 'MALLOC=emmalloc'],),
+  })
   @requires_threads
-  def test_pthread_malloc_free(self):
-    self.btest(path_from_root('tests', 'pthread', 'test_pthread_malloc_free.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=8', '-s', 'TOTAL_MEMORY=256MB'])
+  def test_pthread_malloc_thread_exit(self, args):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_malloc_thread_exit.cpp'), expected='0', args=['-s', 'TOTAL_MEMORY=64MB', '-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=2'] + args)
 
   # Test that the pthread_barrier API works ok.
   @requires_threads
@@ -3916,6 +3936,21 @@ window.close = function() {
   def test_pthread_run_on_main_thread_flood(self):
     self.btest(path_from_root('tests', 'pthread', 'test_pthread_run_on_main_thread_flood.cpp'), expected='0', args=['-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=1'])
 
+  # Test that calls queued to a pthread are never dropped, and are performed in order.
+  @requires_threads
+  def test_pthread_queue_on_thread_flood(self):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_queue_on_thread_flood.cpp'), expected='0', args=['-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=1'])
+
+  # Test that calls queued to a pthread that exits, or has exited, are cancelled.
+  @requires_threads
+  def test_pthread_queue_on_exited_thread(self):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_queue_on_exited_thread.cpp'), expected='0', args=['-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=2'])
+
+  # Test proxying batches of calls to the main thread.
+  @requires_threads
+  def test_pthread_run_on_main_thread_batch(self):
+    self.btest(path_from_root('tests', 'pthread', 'test_pthread_run_on_main_thread_batch.cpp'), expected='0', args=['-O3', '-s', 'USE_PTHREADS=1', '-s', 'PTHREAD_POOL_SIZE=1'])
+
   # Test that it is possible to synchronously call a JavaScript function on the main thread and get a return value back.
   @requires_threads
   def test_pthread_call_sync_on_main_thread(self):
@@ -4395,22 +4430,42 @@ window.close = function() {
     shutil.copyfile(path_from_root('tests', 'gears.png'), 'gears.png')
     self.btest('fetch/response_headers.cpp', expected='1', args=['--std=c++11', '-s', 'FETCH_DEBUG=1', '-s', 'FETCH=1', '-s', 'USE_PTHREADS=1', '-s', 'PROXY_TO_PTHREAD=1'], also_asmjs=True)
 
-  # Test emscripten_fetch() usage to stream a XHR in to memory without storing the full file in memory
-  def test_fetch_stream_file(self):
-    self.skipTest('moz-chunked-arraybuffer was firefox-only and has been removed')
-    # Strategy: create a large 128MB file, and compile with a small 16MB Emscripten heap, so that the tested file
-    # won't fully fit in the heap. This verifies that streaming works properly.
+  # Creates the 128MB largefile.txt that the emscripten_fetch() streaming tests download.
+  def _create_fetch_large_file(self):
     s = '12345678'
     for i in range(14):
       s = s[::-1] + s # length of str will be 2^17=128KB
     with open('largefile.txt', 'w') as f:
       for i in range(1024):
         f.write(s)
+
+  # Test emscripten_fetch() usage to stream a XHR in to memory without storing the full file in memory
+  def test_fetch_stream_file(self):
+    # Strategy: create a large 128MB file, and compile with a small 16MB Emscripten heap, so that the tested file
+    # won't fully fit in the heap. This verifies that streaming works properly.
+    self._create_fetch_large_file()
     self.btest('fetch/stream_file.cpp',
                expected='1',
                args=['--std=c++11', '-s', 'FETCH_DEBUG=1', '-s', 'FETCH=1', '-s', 'TOTAL_MEMORY=536870912'],
                also_asmjs=True)
 
+  # Tests streaming a 128MB file through a 1MB buffer given to emscripten_fetch(), and reading it out with
+  # emscripten_fetch_read() as it arrives.
+  def test_fetch_stream_to_buffer(self):
+    self._create_fetch_large_file()
+    self.btest('fetch/stream_to_buffer.cpp',
+               expected='1',
+               args=['--std=c++11', '-s', 'FETCH_DEBUG=1', '-s', 'FETCH=1'],
+               also_asmjs=True)
+
+  # Tests the same on a pthread that blocks in emscripten_fetch_read() while the fetch worker downloads the file.
+  @requires_threads
+  def test_fetch_stream_to_buffer_waitable(self):
+    self._create_fetch_large_file()
+    self.btest('fetch/stream_to_buffer.cpp',
+               expected='1',
+               args=['--std=c++11', '-s', 'FETCH_DEBUG=1', '-s', 'FETCH=1', '-s', 'WASM=0', '-s', 'USE_PTHREADS=1', '-s', 'PROXY_TO_PTHREAD=1', '-DWAITABLE'])
+
   # Tests emscripten_fetch() usage in synchronous mode when used from the main
   # thread proxied to a Worker with -s PROXY_TO_PTHREAD=1 option.
   @requires_threads
@@ -4516,6 +4571,25 @@ window.close = function() {
   def test_asmfs_relative_paths(self):
     self.btest('asmfs/relative_paths.cpp', expected='0', args=['-s', 'ASMFS=1', '-s', 'WASM=0', '-s', 'USE_PTHREADS=1', '-s', 'FETCH_DEBUG=1'])
 
+  @requires_asmfs
+  @requires_threads
+  def test_asmfs_large_directory(self):
+    self.btest('asmfs/large_directory.cpp', expected='0', args=['-s', 'ASMFS=1', '-s', 'WASM=0', '-s', 'USE_PTHREADS=1'])
+
+  @requires_asmfs
+  @requires_threads
+  def test_asmfs_sparse_file(self):
+    self.btest('asmfs/sparse_file.cpp', expected='0', args=['-s', 'ASMFS=1', '-s', 'WASM=0', '-s', 'USE_PTHREADS=1'])
+
+  # Test loading a file in blocks with HTTP Range requests, which the test server supports.
+  @requires_asmfs
+  @requires_threads
+  def test_asmfs_lazy_file(self):
+    with open('lazy.bin', 'wb') as f:
+      f.write(bytearray(i % 251 for i in range(1000 * 1000)))
+    open('empty.bin', 'wb').close()
+    self.btest('asmfs/lazy_file.cpp', expected='0', args=['-s', 'ASMFS=1', '-s', 'WASM=0', '-s', 'USE_PTHREADS=1', '-s', 'PROXY_TO_PTHREAD=1'])
+
   @requires_threads
   def test_pthread_locale(self):
     for args in [
@@ -166,6 +166,31 @@ def also_with_impure_standalone_wasm(func):
   return decorated
 
 
+# Runs a test of system library functions again with wasm SIMD and with bulk
+# memory enabled, which select different implementations of e.g. memcpy,
+# memmove, memset and the UTF-8 functions.
+def also_with_wasm_memory_features(func):
+  def decorated(self):
+    func(self)
+    if not self.is_wasm_backend() or not self.get_setting('WASM') or self.is_emterpreter():
+      return
+    emcc_args = self.emcc_args[:]
+    try:
+      if V8_ENGINE and V8_ENGINE in JS_ENGINES:
+        print('simd128')
+        self.emcc_args = emcc_args + ['-msimd128']
+        func(self, js_engines=[V8_ENGINE + ['--experimental-wasm-simd']])
+      self.emcc_args = emcc_args
+      print('bulk memory')
+      self.set_setting('BULK_MEMORY', 1)
+      func(self, js_engines=[NODE_JS + ['--experimental-wasm-bulk-memory']])
+    finally:
+      self.emcc_args = emcc_args
+      self.clear_setting('BULK_MEMORY')
+
+  return decorated
+
+
 def node_pthreads(f):
   def decorated(self):
     self.set_setting('USE_PTHREADS', 1)
@@ -914,6 +939,20 @@ base align: 0, 0, 0, 0'''])
                 open(path_from_root('tests', 'core', 'test_emmalloc.cpp')).read(),
                 open(path_from_root('tests', 'core', 'test_emmalloc.txt')).read())
 
+  @no_asan('ASan does not support custom memory allocators')
+  @parameterized({
+    'normal': [],
+    'debug': ['-DEMMALLOC_DEBUG'],
+  })
+  def test_emmalloc_slabs(self, *args):
+    self.set_setting('MALLOC', 'none')
+    self.emcc_args += ['-fno-builtin', '-DEMMALLOC_SLABS'] + list(args)
+
+    self.do_run(open(path_from_root('system', 'lib', 'emmalloc.cpp')).read() +
+                open(path_from_root('system', 'lib', 'sbrk.c')).read() +
+                open(path_from_root('tests', 'core', 'test_emmalloc_slabs.cpp')).read(),
+                open(path_from_root('tests', 'core', 'test_emmalloc_slabs.txt')).read())
+
   def test_newstruct(self):
     self.do_run(self.gen_struct_src.replace('{{gen_struct}}', 'new S').replace('{{del_struct}}', 'delete'), '*51,62*')
 
@@ -2044,6 +2083,29 @@ int main(int argc, char **argv) {
     self.emcc_args += ['-s', 'ALLOW_MEMORY_GROWTH=1', '-s', 'TOTAL_STACK=1Mb', '-s', 'TOTAL_MEMORY=64Mb', '-s', 'WASM_MEM_MAX=130Mb', '-s', 'MEMORY_GROWTH_STEP=1Mb']
     self.do_run_in_out_file_test('tests', 'core', 'test_memorygrowth_memory_growth_step')
 
+  @no_asan('ASan alters the memory size')
+  def test_memorygrowth_reserve_heap(self):
+    if self.has_changed_setting('ALLOW_MEMORY_GROWTH'):
+      self.skipTest('test needs to modify memory growth')
+
+    self.emcc_args += ['-s', 'ALLOW_MEMORY_GROWTH=1']
+    self.do_run_in_out_file_test('tests', 'core', 'test_memorygrowth_reserve_heap')
+
+  def test_memorygrowth_geometric(self):
+    if self.has_changed_setting('ALLOW_MEMORY_GROWTH'):
+      self.skipTest('test needs to modify memory growth')
+    if not self.is_wasm():
+      self.skipTest('wasm memory specific test')
+
+    src = open(path_from_root('tests', 'core', 'test_memorygrowth_geometric.c')).read()
+    self.emcc_args += ['-s', 'ALLOW_MEMORY_GROWTH=1', '-s', 'TOTAL_MEMORY=16Mb']
+    # Grow by half of the current size each time...
+    self.set_setting('MEMORY_GROWTH_GEOMETRIC_PERCENT', 50)
+    self.do_run(src, '16 -> 24 MB\n24 -> 36 MB\n36 -> 54 MB\n')
+    # ...but by at most 4MB at a time.
+    self.set_setting('MEMORY_GROWTH_GEOMETRIC_CAP', 4 * 1024 * 1024)
+    self.do_run(src, '16 -> 20 MB\n20 -> 24 MB\n24 -> 28 MB\n')
+
   def test_memorygrowth_3_force_fail_reallocBuffer(self):
     if self.has_changed_setting('ALLOW_MEMORY_GROWTH'):
       self.skipTest('test needs to modify memory growth')
@@ -2424,21 +2486,26 @@ The current type of b is: 9
 
     self.do_run_in_out_file_test('tests', 'core', 'test_memcpy_memcmp', output_nicerizer=check)
 
-  def test_memcpy2(self):
-    self.do_run_in_out_file_test('tests', 'core', 'test_memcpy2', assert_returncode=None)
+  @also_with_wasm_memory_features
+  def test_memcpy2(self, js_engines=None):
+    self.do_run_in_out_file_test('tests', 'core', 'test_memcpy2', assert_returncode=None, js_engines=js_engines)
 
-  def test_memcpy3(self):
-    self.do_run_in_out_file_test('tests', 'core', 'test_memcpy3', assert_returncode=None)
+  @also_with_wasm_memory_features
+  def test_memcpy3(self, js_engines=None):
+    self.do_run_in_out_file_test('tests', 'core', 'test_memcpy3', assert_returncode=None, js_engines=js_engines)
 
   @also_with_standalone_wasm
-  def test_memcpy_alignment(self):
-    self.do_run(open(path_from_root('tests', 'test_memcpy_alignment.cpp')).read(), 'OK.')
+  @also_with_wasm_memory_features
+  def test_memcpy_alignment(self, js_engines=None):
+    self.do_run(open(path_from_root('tests', 'test_memcpy_alignment.cpp')).read(), 'OK.', js_engines=js_engines)
 
-  def test_memset_alignment(self):
-    self.do_run(open(path_from_root('tests', 'test_memset_alignment.cpp')).read(), 'OK.')
+  @also_with_wasm_memory_features
+  def test_memset_alignment(self, js_engines=None):
+    self.do_run(open(path_from_root('tests', 'test_memset_alignment.cpp')).read(), 'OK.', js_engines=js_engines)
 
-  def test_memset(self):
-    self.do_run_in_out_file_test('tests', 'core', 'test_memset', assert_returncode=None)
+  @also_with_wasm_memory_features
+  def test_memset(self, js_engines=None):
+    self.do_run_in_out_file_test('tests', 'core', 'test_memset', assert_returncode=None, js_engines=js_engines)
 
   def test_getopt(self):
     self.do_run_in_out_file_test('tests', 'core', 'test_getopt', args=['-t', '12', '-n', 'foobar'])
@@ -2446,14 +2513,25 @@ The current type of b is: 9
   def test_getopt_long(self):
     self.do_run_in_out_file_test('tests', 'core', 'test_getopt_long', args=['--file', 'foobar', '-b'])
 
-  def test_memmove(self):
-    self.do_run_in_out_file_test('tests', 'core', 'test_memmove')
+  @also_with_wasm_memory_features
+  def test_memmove(self, js_engines=None):
+    self.do_run_in_out_file_test('tests', 'core', 'test_memmove', js_engines=js_engines)
+
+  @also_with_wasm_memory_features
+  def test_memmove2(self, js_engines=None):
+    self.do_run_in_out_file_test('tests', 'core', 'test_memmove2', assert_returncode=None, js_engines=js_engines)
+
+  @also_with_wasm_memory_features
+  def test_memmove3(self, js_engines=None):
+    self.do_run_in_out_file_test('tests', 'core', 'test_memmove3', js_engines=js_engines)
 
-  def test_memmove2(self):
-    self.do_run_in_out_file_test('tests', 'core', 'test_memmove2', assert_returncode=None)
+  @also_with_wasm_memory_features
+  def test_memmove_overlap(self, js_engines=None):
+    self.do_run_in_out_file_test('tests', 'core', 'test_memmove_overlap', js_engines=js_engines)
 
-  def test_memmove3(self):
-    self.do_run_in_out_file_test('tests', 'core', 'test_memmove3')
+  @also_with_wasm_memory_features
+  def test_emscripten_utf8(self, js_engines=None):
+    self.do_run_in_out_file_test('tests', 'core', 'test_emscripten_utf8', js_engines=js_engines)
 
   def test_flexarray_struct(self):
     self.do_run_in_out_file_test('tests', 'core', 'test_flexarray_struct')
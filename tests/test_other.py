@@ -2269,6 +2269,17 @@ int f() {
         output = run_process([tools.js_optimizer.get_native_optimizer(), input] + passes, stdin=PIPE, stdout=PIPE).stdout
         check_js(output, expected)
 
+        print('  native (multithreaded)')
+        output = run_process([tools.js_optimizer.get_native_optimizer(), input] + passes + ['threads=4'], stdin=PIPE, stdout=PIPE).stdout
+        check_js(output, expected)
+
+        if '// EXTRA_INFO:' in original:
+          print('  native (extra info file)')
+          create_test_file(input_temp, original[:original.find('// EXTRA_INFO:')])
+          create_test_file('extra_info.json', original[original.find('// EXTRA_INFO:') + len('// EXTRA_INFO:'):])
+          output = run_process([tools.js_optimizer.get_native_optimizer(), input_temp] + passes + ['extraInfo=extra_info.json'], stdin=PIPE, stdout=PIPE).stdout
+          check_js(output, expected)
+
   def test_m_mm(self):
     create_test_file('foo.c', '''#include <emscripten.h>''')
     for opt in ['M', 'MM']:
@@ -8777,6 +8788,24 @@ end
     err = self.expect_fail(base + ['--embed-files', 'somefile'])
     assert expected in err
 
+  def test_fetch_node_disk_cache(self):
+    run_process([PYTHON, EMCC, path_from_root('tests', 'fetch', 'node_disk_cache.cpp'), '--std=c++11',
+                 '-s', 'FETCH=1', '-s', 'FETCH_DISK_CACHE=1',
+                 '--pre-js', path_from_root('tests', 'fetch', 'node_disk_cache_xhr.js')])
+    expected = '''miss: status 404, 0 bytes ""
+xhr data.txt
+download: status 200, 5 bytes "hello"
+hit: status 200, 5 bytes "hello"
+other url: status 404, 0 bytes ""
+xhr data.txt If-None-Match: "v1"
+revalidate: status 200, 5 bytes "hello"
+xhr data.txt If-None-Match: "v1"
+offline: status 200, 5 bytes "hello"
+done
+'''
+    self.assertContained(expected, run_js('a.out.js'))
+    self.assertTrue(os.path.isdir(os.path.join('fetch_cache', 'entries')))
+
   def test_node_code_caching(self):
     run_process([PYTHON, EMCC, path_from_root('tests', 'hello_world.c'),
                  '-s', 'NODE_CODE_CACHING',
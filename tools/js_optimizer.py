@@ -166,7 +166,7 @@ def get_native_optimizer():
                               shared.path_from_root('tools', 'optimizer', 'optimizer.cpp'),
                               shared.path_from_root('tools', 'optimizer', 'optimizer-shared.cpp'),
                               shared.path_from_root('tools', 'optimizer', 'optimizer-main.cpp'),
-                              '-O3', '-std=c++11', '-fno-exceptions', '-fno-rtti', '-o', output] + args,
+                              '-O3', '-std=c++11', '-fno-exceptions', '-fno-rtti', '-pthread', '-o', output] + args,
                              stdout=log_output, stderr=log_output)
         except Exception as e:
           logging.debug(str(e))
@@ -282,13 +282,14 @@ def run_on_chunk(command):
       shutil.copyfile(filename, os.path.join(shared.get_emscripten_temp_dir(), saved))
     if shared.EM_BUILD_VERBOSE >= 3:
       print('run_on_chunk: ' + str(command), file=sys.stderr)
-    proc = shared.run_process(command, stdout=subprocess.PIPE)
-    output = proc.stdout
-    assert proc.returncode == 0, 'Error in optimizer (return code ' + str(proc.returncode) + '): ' + output
-    assert len(output) and not output.startswith('Assertion failed'), 'Error in optimizer: ' + output
+    # the optimizer output can be as big as the input, so let it go straight to the file instead of through memory
     filename = temp_files.get(os.path.basename(filename) + '.jo.js').name
     with open(filename, 'w') as f:
-      f.write(output)
+      proc = shared.run_process(command, stdout=f)
+    with open(filename) as f:
+      output_start = f.read(1024)
+    assert proc.returncode == 0, 'Error in optimizer (return code ' + str(proc.returncode) + '): ' + output_start
+    assert len(output_start) and not output_start.startswith('Assertion failed'), 'Error in optimizer: ' + output_start
     if DEBUG and not shared.WINDOWS:
       print('.', file=sys.stderr) # Skip debug progress indicator on Windows, since it doesn't buffer well with multiple threads printing to console.
     return filename
@@ -413,7 +414,11 @@ EMSCRIPTEN_FUNCS();
     # top of the file, so avoid breaking the JS into chunks
     cores = 1 if source_map else shared.Building.get_num_cores()
 
-    if not just_split:
+    if not just_split and use_native(passes, source_map):
+      # the native optimizer runs each pass over the functions on multiple threads by itself, so give it all of them
+      # at once, rather than having each process parse the shell and intern the same strings again
+      chunks = [''.join([f[1] for f in funcs])]
+    elif not just_split:
       intended_num_chunks = int(round(cores * NUM_CHUNKS_PER_CORE))
       chunk_size = min(MAX_CHUNK_SIZE, max(MIN_CHUNK_SIZE, total_size / intended_num_chunks))
       chunks = shared.chunkify(funcs, chunk_size)
@@ -429,9 +434,17 @@ EMSCRIPTEN_FUNCS();
     if len(chunks):
       serialized_extra_info = suffix_marker + '\n'
       if minify_globals:
-        serialized_extra_info += '// EXTRA_INFO:' + json.dumps(minify_info)
-      elif extra_info:
-        serialized_extra_info += '// EXTRA_INFO:' + json.dumps(extra_info)
+        extra_info = minify_info
+      native_extra_info = None
+      if extra_info:
+        if not just_split and use_native(passes, source_map):
+          # the native optimizer reads the extra info from a file of its own, so it does not need to be
+          # appended to (and searched for in) the code
+          native_extra_info = temp_files.get('.jsinfo.json').name
+          with open(native_extra_info, 'w') as f:
+            json.dump(extra_info, f)
+        else:
+          serialized_extra_info += '// EXTRA_INFO:' + json.dumps(extra_info)
       with ToolchainProfiler.profile_block('js_optimizer.write_chunks'):
         def write_chunk(chunk, i):
           temp_file = temp_files.get('.jsfunc_%d.js' % i).name
@@ -452,7 +465,8 @@ EMSCRIPTEN_FUNCS();
         # use the native optimizer
         shared.logging.debug('js optimizer using native')
         assert not source_map # XXX need to use js optimizer
-        commands = [[get_native_optimizer(), f] + passes for f in filenames]
+        commands = [[get_native_optimizer(), f] + passes + ['threads=%d' % cores] +
+                    (['extraInfo=' + native_extra_info] if native_extra_info else []) for f in filenames]
       # print [' '.join(command) for command in commands]
 
       cores = min(cores, len(filenames))
@@ -551,7 +565,8 @@ EMSCRIPTEN_FUNCS();
     else:
       # just concat the outputs
       for out_file in filenames:
-        f.write(open(out_file).read())
+        with open(out_file) as out:
+          shutil.copyfileobj(out, f)
 
   with ToolchainProfiler.profile_block('write_post'):
     f.write('\n')
@@ -6,6 +6,8 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <set>
+#include <mutex>
+#include <atomic>
 
 #include <string.h>
 #include <stdint.h>
@@ -15,31 +17,123 @@
 
 namespace cashew {
 
-struct IString {
-  const char *str;
+// The table of all interned strings. It is split into shards by hash, each with its own open addressing table. Looking
+// up a string that is already interned, which is by far the most common case, does not take any locks: the slots of a
+// table are only ever filled in once, and a table is never freed when it is replaced by a larger one, so readers can
+// probe it concurrently with an insertion. Inserting a new string locks its shard, and copies the string into an
+// arena owned by the shard if needed.
+class IStringTable {
+  enum {
+    NUM_SHARDS = 64,
+    INITIAL_SHARD_SIZE = 1024, // slots, a power of two
+    ARENA_BLOCK_SIZE = 64*1024
+  };
+
+  struct Slot {
+    size_t hash; // written before str is published
+    std::atomic<const char*> str;
+  };
+
+  struct Table {
+    size_t mask; // number of slots - 1
+    Slot slots[1];
 
-  static size_t hash_c(const char *str) { // see http://www.cse.yorku.ca/~oz/hash.html
-    unsigned int hash = 5381;
-    int c;
-    while ((c = *str++)) {
-      hash = ((hash << 5) + hash) ^ c;
+    static Table* create(size_t size) {
+      Table* table = (Table*)calloc(1, sizeof(Table) + (size - 1) * sizeof(Slot));
+      assert(table);
+      table->mask = size - 1;
+      return table;
     }
-    return (size_t)hash;
-  }
 
-  class CStringHash : public std::hash<const char *> {
-  public:
-    size_t operator()(const char *str) const {
-      return IString::hash_c(str);
+    // Returns the slot that holds the string, or the empty slot where it should be inserted.
+    Slot& find(const char* s, size_t hash) {
+      for (size_t i = (hash / NUM_SHARDS) & mask;; i = (i + 1) & mask) {
+        Slot& slot = slots[i];
+        const char* str = slot.str.load(std::memory_order_acquire);
+        if (!str || (slot.hash == hash && (str == s || strcmp(str, s) == 0))) return slot;
+      }
     }
   };
-  class CStringEqual : public std::equal_to<const char *> {
-  public:
-    bool operator()(const char *x, const char *y) const {
-      return strcmp(x, y) == 0;
+
+  struct Shard {
+    std::mutex mutex; // guards insertions
+    std::atomic<Table*> table;
+    size_t count;
+    char* arena; // the rest of the current arena block, for copies of strings
+    size_t arenaLeft;
+
+    Shard() : table(Table::create(INITIAL_SHARD_SIZE)), count(0), arena(nullptr), arenaLeft(0) {}
+
+    const char* copy(const char* s) {
+      size_t size = strlen(s) + 1;
+      if (size > ARENA_BLOCK_SIZE / 4) {
+        return strcpy((char*)malloc(size), s); // a large string gets a block of its own, rather than waste the rest of one
+      }
+      if (size > arenaLeft) {
+        arena = (char*)malloc(ARENA_BLOCK_SIZE);
+        arenaLeft = ARENA_BLOCK_SIZE;
+      }
+      char* ret = strcpy(arena, s);
+      arena += size;
+      arenaLeft -= size;
+      return ret;
+    }
+
+    void grow() { // called with the mutex held
+      Table* old = table.load(std::memory_order_relaxed);
+      Table* grown = Table::create((old->mask + 1) * 2);
+      for (size_t i = 0; i <= old->mask; i++) {
+        const char* str = old->slots[i].str.load(std::memory_order_relaxed);
+        if (str) {
+          Slot& slot = grown->find(str, old->slots[i].hash);
+          slot.hash = old->slots[i].hash;
+          slot.str.store(str, std::memory_order_relaxed);
+        }
+      }
+      table.store(grown, std::memory_order_release); // the old table stays valid for concurrent readers, and is leaked
     }
   };
 
+  Shard shards[NUM_SHARDS];
+
+public:
+  static size_t hash(const char* str) { // FNV-1a
+    size_t hash = sizeof(size_t) == 8 ? (size_t)14695981039346656037ULL : (size_t)2166136261U;
+    const size_t prime = sizeof(size_t) == 8 ? (size_t)1099511628211ULL : (size_t)16777619U;
+    while (*str) {
+      hash = (hash ^ (unsigned char)*str++) * prime;
+    }
+    return hash;
+  }
+
+  // Returns the interned copy of s. If s is not interned yet, it is interned as it is if reuse is set, in which case
+  // it must stay alive, and otherwise as a copy.
+  const char* intern(const char* s, bool reuse) {
+    size_t h = hash(s);
+    Shard& shard = shards[h % NUM_SHARDS];
+    const char* existing = shard.table.load(std::memory_order_acquire)->find(s, h).str.load(std::memory_order_acquire);
+    if (existing) return existing;
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    Table* table = shard.table.load(std::memory_order_relaxed);
+    Slot* slot = &table->find(s, h);
+    existing = slot->str.load(std::memory_order_relaxed);
+    if (existing) return existing; // inserted by another thread in the meantime
+    if ((shard.count + 1) * 2 > table->mask + 1) { // keep the load factor at most 1/2
+      shard.grow();
+      slot = &shard.table.load(std::memory_order_relaxed)->find(s, h);
+    }
+    const char* str = reuse ? s : shard.copy(s);
+    slot->hash = h;
+    slot->str.store(str, std::memory_order_release);
+    shard.count++;
+    return str;
+  }
+};
+
+struct IString {
+  const char *str;
+
   IString() : str(nullptr) {}
   IString(const char *s, bool reuse=true) { // if reuse=true, then input is assumed to remain alive; not copied
     assert(s);
@@ -47,24 +141,8 @@ struct IString {
   }
 
   void set(const char *s, bool reuse=true) {
-    typedef std::unordered_set<const char *, CStringHash, CStringEqual> StringSet;
-    static StringSet* strings = new StringSet();
-
-    if (reuse) {
-      auto result = strings->insert(s); // if already present, does nothing
-      str = *(result.first);
-    } else {
-      auto existing = strings->find(s);
-      if (existing == strings->end()) {
-        char *copy = (char*)malloc(strlen(s)+1); // XXX leaked
-        strcpy(copy, s);
-        s = copy;
-      } else {
-        s = *existing;
-      }
-      strings->insert(s);
-      str = s;
-    }
+    static IStringTable* strings = new IStringTable();
+    str = strings->intern(s, reuse);
   }
 
   void set(const IString &s) {
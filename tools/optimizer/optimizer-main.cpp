@@ -20,7 +20,26 @@
 
 using namespace cashew;
 
+char *readFile(const char *name) {
+  FILE *f = fopen(name, "r");
+  assert(f);
+  fseek(f, 0, SEEK_END);
+  int size = ftell(f);
+  char *input = new char[size+1];
+  rewind(f);
+  int num = fread(input, 1, size, f);
+  // On Windows, ftell() gives the byte position (\r\n counts as two bytes), but when
+  // reading, fread() returns the number of characters read (\r\n is read as one char \n, and counted as one),
+  // so return value of fread can be less than size reported by ftell, and that is normal.
+  assert((num > 0 || size == 0) && num <= size);
+  fclose(f);
+  input[num] = 0;
+  return input;
+}
+
 int main(int argc, char **argv) {
+  const char *extraInfoFile = nullptr;
+
   // Read directives
   for (int i = 2; i < argc; i++) {
     std::string str(argv[i]);
@@ -30,6 +49,8 @@ int main(int argc, char **argv) {
     else if (str == "emitJSON") emitJSON = true;
     else if (str == "minifyWhitespace") minifyWhitespace = true;
     else if (str == "last") last = true;
+    else if (str.compare(0, 8, "threads=") == 0) numThreads = std::max(atoi(str.c_str() + 8), 1);
+    else if (str.compare(0, 10, "extraInfo=") == 0) extraInfoFile = argv[i] + 10;
   }
 
 #ifdef PROFILING
@@ -39,21 +60,14 @@ int main(int argc, char **argv) {
 #endif
 
   // Read input file
-  FILE *f = fopen(argv[1], "r");
-  assert(f);
-  fseek(f, 0, SEEK_END);
-  int size = ftell(f);
-  char *input = new char[size+1];
-  rewind(f);
-  int num = fread(input, 1, size, f);
-  // On Windows, ftell() gives the byte position (\r\n counts as two bytes), but when
-  // reading, fread() returns the number of characters read (\r\n is read as one char \n, and counted as one),
-  // so return value of fread can be less than size reported by ftell, and that is normal.
-  assert((num > 0 || size == 0) && num <= size);
-  fclose(f);
-  input[num] = 0;
+  char *input = readFile(argv[1]);
 
-  char *extraInfoStart = strstr(input, "// EXTRA_INFO:");
+  // The extra info is either given in a file of its own, or appended to the input after a marker comment
+  if (extraInfoFile) {
+    extraInfo = arena.alloc();
+    extraInfo->parse(readFile(extraInfoFile));
+  }
+  char *extraInfoStart = extraInfoFile ? nullptr : strstr(input, "// EXTRA_INFO:");
   if (extraInfoStart) {
     extraInfo = arena.alloc();
     extraInfo->parse(extraInfoStart + 14);
@@ -100,6 +114,8 @@ int main(int argc, char **argv) {
     else if (str == "asmLastOpts") asmLastOpts(doc);
     else if (str == "last") { worked = false; }
     else if (str == "noop") { worked = false; }
+    else if (str.compare(0, 8, "threads=") == 0) { worked = false; }
+    else if (str.compare(0, 10, "extraInfo=") == 0) { worked = false; }
     else {
       fprintf(stderr, "unrecognized argument: %s\n", str.c_str());
       abort();
@@ -121,9 +137,9 @@ int main(int argc, char **argv) {
     doc->stringify(std::cout);
     std::cout << "\n";
   } else {
-    JSPrinter jser(!minifyWhitespace, last, doc);
+    JSPrinter jser(!minifyWhitespace, last, doc, stdout); // written out as it is printed
     jser.printAst();
-    std::cout << jser.buffer << "\n";
+    fputs("\n", stdout);
   }
   return 0;
 }
@@ -9,6 +9,8 @@
 #include <string>
 #include <algorithm>
 #include <map>
+#include <atomic>
+#include <thread>
 
 #include "simple_ast.h"
 #include "optimizer.h"
@@ -60,6 +62,33 @@ Ref deStat(Ref node) {
   return node;
 }
 
+// Like traverseFunctions, but visits the functions on numThreads threads. A visit must only modify its own function.
+void traverseFunctionsInParallel(Ref ast, std::function<void (Ref)> visit) {
+  std::vector<Ref> funcs;
+  traverseFunctions(ast, [&funcs](Ref func) {
+    funcs.push_back(func);
+  });
+#ifdef PROFILING
+  int threads = 1; // the passes accumulate their timings without synchronization
+#else
+  int threads = std::min(numThreads, (int)funcs.size());
+#endif
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    for (size_t i = next++; i < funcs.size(); i = next++) {
+      visit(funcs[i]);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (int i = 1; i < threads; i++) {
+    workers.emplace_back(work);
+  }
+  work();
+  for (auto& worker : workers) {
+    worker.join();
+  }
+}
+
 Ref getStatements(Ref node) {
   if (node[0] == DEFUN) {
     return node[3];
@@ -589,6 +618,8 @@ bool preciseF32 = false,
      minifyWhitespace = false,
      last = false;
 
+int numThreads = 1;
+
 //=====================
 // Optimization passes
 //=====================
@@ -766,7 +797,7 @@ void eliminate(Ref ast, bool memSafe) {
 #endif
 
   // Find variables that have a single use, and if they can be eliminated, do so
-  traverseFunctions(ast, [&](Ref func) {
+  traverseFunctionsInParallel(ast, [&](Ref func) {
 
 #ifdef PROFILING
     clock_t start = clock();
@@ -1918,7 +1949,7 @@ void simplifyExpressions(Ref ast) {
     });
   };
 
-  traverseFunctions(ast, [&](Ref func) {
+  traverseFunctionsInParallel(ast, [&](Ref func) {
     simplifyIntegerConversions(func);
     simplifyOps(func);
     traversePre(func, [](Ref node) {
@@ -1933,7 +1964,7 @@ void simplifyExpressions(Ref ast) {
 }
 
 void simplifyIfs(Ref ast) {
-  traverseFunctions(ast, [](Ref func) {
+  traverseFunctionsInParallel(ast, [](Ref func) {
     bool simplifiedAnElse = false;
 
     traversePre(func, [&simplifiedAnElse](Ref node) {
@@ -2148,7 +2179,7 @@ IString getRegName(AsmType type, int num) {
 }
 
 void registerize(Ref ast) {
-  traverseFunctions(ast, [](Ref fun) {
+  traverseFunctionsInParallel(ast, [](Ref fun) {
     AsmData asmData(fun);
     // Add parameters as a first (fake) var (with assignment), so they get taken into consideration
     // note: params are special, they can never share a register between them (see later)
@@ -2410,7 +2441,7 @@ void registerizeHarder(Ref ast) {
   clock_t treconstruct = 0;
 #endif
 
-  traverseFunctions(ast, [&](Ref fun) {
+  traverseFunctionsInParallel(ast, [&](Ref fun) {
 
 #ifdef PROFILING
     clock_t start = clock();
@@ -3727,8 +3758,8 @@ void minifyLocals(Ref ast) {
 }
 
 void asmLastOpts(Ref ast) {
-  std::vector<Ref> statsStack;
-  traverseFunctions(ast, [&](Ref fun) {
+  traverseFunctionsInParallel(ast, [&](Ref fun) {
+    std::vector<Ref> statsStack;
     traversePrePost(fun, [&](Ref node) {
       Ref type = node[0];
       Ref stats = getStatements(node);
@@ -3877,7 +3908,7 @@ void eliminateDeadFuncs(Ref ast) {
   for (size_t i = 0; i < extraInfo[DEAD_FUNCTIONS]->size(); i++) {
     deadFunctions.insert(extraInfo[DEAD_FUNCTIONS][i]->getIString());
   }
-  traverseFunctions(ast, [&](Ref fun) {
+  traverseFunctionsInParallel(ast, [&](Ref fun) {
     if (!deadFunctions.has(fun[1].get()->getIString())) {
       return;
     }
@@ -10,6 +10,8 @@ extern bool preciseF32,
             minifyWhitespace,
             last;
 
+extern int numThreads; // passes that handle each function separately run on this many threads
+
 extern cashew::Ref extraInfo;
 
 void eliminateDeadFuncs(cashew::Ref ast);
@@ -45,20 +45,74 @@ bool Ref::operator!() {
 
 Arena arena;
 
+// There is a single arena, so the current chunk of each thread can be kept in thread-local statics.
+
 Ref Arena::alloc() {
-  if (chunks.size() == 0 || index == CHUNK_SIZE) {
-    chunks.push_back(new Value[CHUNK_SIZE]);
+  thread_local Value* chunk = nullptr;
+  thread_local int index = CHUNK_SIZE; // in chunk
+  if (index == CHUNK_SIZE) {
+    chunk = new Value[CHUNK_SIZE];
     index = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    chunks.push_back(chunk);
   }
-  return &chunks.back()[index++];
+  return &chunk[index++];
 }
 
 ArrayStorage* Arena::allocArray() {
-  if (arr_chunks.size() == 0 || arr_index == CHUNK_SIZE) {
-    arr_chunks.push_back(new ArrayStorage[CHUNK_SIZE]);
-    arr_index = 0;
+  thread_local ArrayStorage* chunk = nullptr;
+  thread_local int index = CHUNK_SIZE; // in chunk
+  if (index == CHUNK_SIZE) {
+    chunk = new ArrayStorage[CHUNK_SIZE];
+    index = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    arr_chunks.push_back(chunk);
+  }
+  return &chunk[index++];
+}
+
+// ArrayStorage
+
+// Spans are carved from blocks of this many Refs. Larger spans are allocated separately.
+#define SPAN_BLOCK_SIZE 65536
+
+static thread_local Ref* spanBlock = nullptr;
+static thread_local unsigned spanBlockLeft = 0;
+static thread_local Ref* freeSpans[32]; // by log2 of capacity, linked through their first element
+
+static unsigned spanClass(unsigned capacity) {
+  unsigned ret = 0;
+  while ((1u << ret) < capacity) ret++;
+  return ret;
+}
+
+Ref* ArrayStorage::allocSpan(unsigned capacity) {
+  Ref*& freeList = freeSpans[spanClass(capacity)];
+  if (freeList) {
+    Ref* ret = freeList;
+    freeList = (Ref*)ret[0].inst;
+    return ret;
+  }
+  if (capacity > SPAN_BLOCK_SIZE / 4) {
+    Ref* ret = (Ref*)malloc(capacity * sizeof(Ref));
+    assert(ret);
+    return ret;
   }
-  return &arr_chunks.back()[arr_index++];
+  if (capacity > spanBlockLeft) {
+    spanBlock = (Ref*)malloc(SPAN_BLOCK_SIZE * sizeof(Ref)); // the rest of the old block is wasted, at most a quarter
+    assert(spanBlock);
+    spanBlockLeft = SPAN_BLOCK_SIZE;
+  }
+  Ref* ret = spanBlock;
+  spanBlock += capacity;
+  spanBlockLeft -= capacity;
+  return ret;
+}
+
+void ArrayStorage::freeSpan(Ref* span, unsigned capacity) {
+  Ref*& freeList = freeSpans[spanClass(capacity)];
+  span[0].inst = (Value*)freeList;
+  freeList = span;
 }
 
 // dump
@@ -14,6 +14,7 @@
 #include <iomanip>
 #include <functional>
 #include <algorithm>
+#include <mutex>
 #include <set>
 #include <unordered_set>
 #include <unordered_map>
@@ -56,19 +57,106 @@ struct Ref {
   bool operator!(); // check if null, in effect
 };
 
-// Arena allocation, free it all on process exit
+// The elements of an array value. Rather than being a separate heap allocation for every node, as a std::vector
+// would be, they live in a span carved out of large per-thread blocks. Span capacities are powers of two, and when an
+// array outgrows its span, the span is kept for reuse by the next array of that capacity on the same thread. Like
+// the rest of the AST, the blocks are freed on process exit.
 
-typedef std::vector<Ref> ArrayStorage;
+class ArrayStorage {
+  Ref* elements;
+  unsigned used, capacity;
+
+  static Ref* allocSpan(unsigned capacity);
+  static void freeSpan(Ref* span, unsigned capacity);
+
+  void grow(unsigned minCapacity) {
+    unsigned newCapacity = 2;
+    while (newCapacity < minCapacity) newCapacity *= 2;
+    Ref* newElements = allocSpan(newCapacity);
+    if (used) memcpy(newElements, elements, used * sizeof(Ref));
+    if (elements) freeSpan(elements, capacity);
+    elements = newElements;
+    capacity = newCapacity;
+  }
+
+public:
+  ArrayStorage() : elements(nullptr), used(0), capacity(0) {}
+  ArrayStorage(const ArrayStorage& other) : elements(nullptr), used(0), capacity(0) {
+    *this = other;
+  }
+
+  ArrayStorage& operator=(const ArrayStorage& other) {
+    if (this == &other) return *this;
+    if (capacity < other.used) grow(other.used);
+    if (other.used) memcpy(elements, other.elements, other.used * sizeof(Ref));
+    used = other.used;
+    return *this;
+  }
+
+  unsigned size() const { return used; }
+  Ref* data() { return elements; }
+  Ref* begin() { return elements; }
+  Ref* end() { return elements + used; }
+
+  Ref& operator[](unsigned x) { return elements[x]; }
+  Ref& at(unsigned x) {
+    assert(x < used);
+    return elements[x];
+  }
+  Ref& back() {
+    assert(used > 0);
+    return elements[used - 1];
+  }
+
+  void reserve(unsigned n) {
+    if (n > capacity) grow(n);
+  }
+  void resize(unsigned n) {
+    reserve(n);
+    for (unsigned i = used; i < n; i++) elements[i] = Ref();
+    used = n;
+  }
+  void clear() { used = 0; }
+  void shrink_to_fit() { // only gives the span back when empty, which is how Value uses it
+    if (used == 0 && elements) {
+      freeSpan(elements, capacity);
+      elements = nullptr;
+      capacity = 0;
+    }
+  }
+
+  void push_back(Ref r) {
+    if (used == capacity) grow(used + 1);
+    elements[used++] = r;
+  }
+  void pop_back() {
+    assert(used > 0);
+    used--;
+  }
+
+  void insert(Ref* pos, unsigned num, Ref value) {
+    unsigned index = pos - elements;
+    assert(index <= used);
+    if (used + num > capacity) grow(used + num);
+    memmove(elements + index + num, elements + index, (used - index) * sizeof(Ref));
+    for (unsigned i = 0; i < num; i++) elements[index + i] = value;
+    used += num;
+  }
+  void erase(Ref* first, Ref* last) {
+    assert(elements <= first && first <= last && last <= elements + used);
+    memmove(first, last, (elements + used - last) * sizeof(Ref));
+    used -= last - first;
+  }
+};
+
+// Arena allocation, free it all on process exit. Each thread allocates from a chunk of its own, so that optimization
+// passes can run on several functions in parallel.
 
 struct Arena {
   #define CHUNK_SIZE 1000
+  std::mutex mutex; // guards the chunk lists, which are shared by all threads
   std::vector<Value*> chunks;
-  int index; // in last chunk
-
   std::vector<ArrayStorage*> arr_chunks;
-  int arr_index;
-
-  Arena() : index(0), arr_index(0) {}
 
   Ref alloc();
   ArrayStorage* allocArray();
@@ -566,13 +654,30 @@ struct JSPrinter {
 
   Ref ast;
 
-  JSPrinter(bool pretty_, bool finalize_, Ref ast_) : pretty(pretty_), finalize(finalize_), buffer(0), size(0), used(0), indent(0), possibleSpace(false), ast(ast_) {}
+  // If set, the output is written here as it is printed, one top-level statement (typically a whole function) at a
+  // time, so that the buffer only ever holds about the largest function rather than the whole program.
+  FILE *out;
+
+  JSPrinter(bool pretty_, bool finalize_, Ref ast_, FILE *out_=nullptr) : pretty(pretty_), finalize(finalize_), buffer(0), size(0), used(0), indent(0), possibleSpace(false), ast(ast_), out(out_) {}
 
   void printAst() {
     print(ast);
+    if (out) {
+      fwrite(buffer, 1, used, out);
+      used = 0;
+    }
     buffer[used] = 0;
   }
 
+  // Writes out what has been printed so far, if it is enough to be worth a write. The last character stays in the
+  // buffer, since printing looks back at it.
+  void flushOutput() {
+    if (!out || used < 65536) return;
+    fwrite(buffer, 1, used - 1, out);
+    buffer[0] = buffer[used - 1];
+    used = 1;
+  }
+
   // Utils
 
   void ensure(int safety=100) {
@@ -747,8 +852,16 @@ struct JSPrinter {
   }
 
   void printToplevel(Ref node) {
-    if (node[1]->size() > 0) {
-      printStats(node[1]);
+    Ref stats = node[1];
+    bool first = true;
+    for (size_t i = 0; i < stats->size(); i++) {
+      Ref curr = stats[i];
+      if (!isNothing(curr)) {
+        if (first) first = false;
+        else newline();
+        print(curr);
+        flushOutput();
+      }
     }
   }
 
@@ -2920,6 +2920,8 @@ class Building(object):
       ret += ['--enable-threads']
     if Settings.SIMD:
       ret += ['--enable-simd']
+    if Settings.BULK_MEMORY:
+      ret += ['--enable-bulk-memory']
     ret += Settings.BINARYEN_FEATURES
     return ret
 
@@ -602,6 +602,64 @@ class AsanInstrumentedLibrary(Library):
     return super(AsanInstrumentedLibrary, cls).get_default_variation(is_asan=shared.Settings.USE_ASAN, **kwargs)
 
 
+class SIMDLibrary(Library):
+  def __init__(self, **kwargs):
+    self.is_simd = kwargs.pop('is_simd', False)
+    super(SIMDLibrary, self).__init__(**kwargs)
+
+  def get_cflags(self):
+    cflags = super(SIMDLibrary, self).get_cflags()
+    if self.is_simd:
+      cflags += ['-msimd128']
+    return cflags
+
+  def get_base_name(self):
+    name = super(SIMDLibrary, self).get_base_name()
+    if self.is_simd:
+      name += '-simd'
+    return name
+
+  @classmethod
+  def vary_on(cls):
+    vary_on = super(SIMDLibrary, cls).vary_on()
+    if shared.Settings.WASM_BACKEND:
+      vary_on += ['is_simd']
+    return vary_on
+
+  @classmethod
+  def get_default_variation(cls, **kwargs):
+    return super(SIMDLibrary, cls).get_default_variation(is_simd=shared.Settings.SIMD, **kwargs)
+
+
+class BulkMemoryLibrary(Library):
+  def __init__(self, **kwargs):
+    self.is_bulk_memory = kwargs.pop('is_bulk_memory', False)
+    super(BulkMemoryLibrary, self).__init__(**kwargs)
+
+  def get_cflags(self):
+    cflags = super(BulkMemoryLibrary, self).get_cflags()
+    if self.is_bulk_memory:
+      cflags += ['-mbulk-memory']
+    return cflags
+
+  def get_base_name(self):
+    name = super(BulkMemoryLibrary, self).get_base_name()
+    if self.is_bulk_memory:
+      name += '-bulkmem'
+    return name
+
+  @classmethod
+  def vary_on(cls):
+    vary_on = super(BulkMemoryLibrary, cls).vary_on()
+    if shared.Settings.WASM_BACKEND:
+      vary_on += ['is_bulk_memory']
+    return vary_on
+
+  @classmethod
+  def get_default_variation(cls, **kwargs):
+    return super(BulkMemoryLibrary, cls).get_default_variation(is_bulk_memory=shared.Settings.BULK_MEMORY, **kwargs)
+
+
 class CXXLibrary(Library):
   emcc = shared.EMXX
 
@@ -637,7 +695,7 @@ class libcompiler_rt(Library):
     src_files.append(shared.path_from_root('system', 'lib', 'compiler-rt', 'extras.c'))
 
 
-class libc(AsanInstrumentedLibrary, MuslInternalLibrary, MTLibrary):
+class libc(AsanInstrumentedLibrary, SIMDLibrary, MuslInternalLibrary, MTLibrary):
   name = 'libc'
   depends = ['libcompiler_rt']
 
@@ -707,6 +765,18 @@ class libc(AsanInstrumentedLibrary, MuslInternalLibrary, MTLibrary):
         shared.path_from_root('system', 'lib', 'libc', 'emscripten_asan_strlen.c'),
         shared.path_from_root('system', 'lib', 'libc', 'emscripten_asan_fcntl.c'),
       ]
+    else:
+      # These use wasm SIMD when building with -msimd128, and musl otherwise.
+      blacklist += ['memchr.c', 'strchrnul.c', 'strlen.c']
+      libc_files += files_in_path(
+        path_components=['system', 'lib', 'libc'],
+        filenames=['emscripten_memchr.c', 'emscripten_strchrnul.c',
+                   'emscripten_strlen.c'])
+
+    blacklist += ['memcmp.c']
+    libc_files += files_in_path(
+      path_components=['system', 'lib', 'libc'],
+      filenames=['emscripten_memcmp.c', 'emscripten_utf8.c'])
 
     if shared.Settings.WASM_BACKEND:
       # With the wasm backend these are included in wasm_libc_rt instead
@@ -919,12 +989,16 @@ class libmalloc(MTLibrary, NoBCLibrary):
     self.is_debug = kwargs.pop('is_debug')
     self.use_errno = kwargs.pop('use_errno')
     self.is_tracing = kwargs.pop('is_tracing')
+    self.use_slabs = kwargs.pop('use_slabs')
+    self.use_mspaces = kwargs.pop('use_mspaces')
 
     super(libmalloc, self).__init__(**kwargs)
 
-    if self.malloc != 'dlmalloc':
-      assert not self.is_mt
+    if self.malloc == 'emmalloc':
       assert not self.is_tracing
+      assert not self.use_mspaces
+    else:
+      assert not self.use_slabs
 
   def get_files(self):
     malloc = shared.path_from_root('system', 'lib', {
@@ -944,6 +1018,10 @@ class libmalloc(MTLibrary, NoBCLibrary):
       cflags += ['-DMALLOC_FAILURE_ACTION=', '-DEMSCRIPTEN_NO_ERRNO']
     if self.is_tracing:
       cflags += ['--tracing']
+    if self.use_slabs:
+      cflags += ['-DEMMALLOC_SLABS']
+    if self.use_mspaces:
+      cflags += ['-DDLMALLOC_MSPACES']
     return cflags
 
   def get_base_name_prefix(self):
@@ -958,6 +1036,10 @@ class libmalloc(MTLibrary, NoBCLibrary):
       name += '-noerrno'
     if self.is_tracing:
       name += '-tracing'
+    if self.use_slabs:
+      name += '-slabs'
+    if self.use_mspaces:
+      name += '-mspaces'
     return name
 
   def can_use(self):
@@ -965,7 +1047,7 @@ class libmalloc(MTLibrary, NoBCLibrary):
 
   @classmethod
   def vary_on(cls):
-    return super(libmalloc, cls).vary_on() + ['is_debug', 'use_errno', 'is_tracing']
+    return super(libmalloc, cls).vary_on() + ['is_debug', 'use_errno', 'is_tracing', 'use_slabs', 'use_mspaces']
 
   @classmethod
   def get_default_variation(cls, **kwargs):
@@ -974,15 +1056,18 @@ class libmalloc(MTLibrary, NoBCLibrary):
       is_debug=shared.Settings.DEBUG_LEVEL >= 3,
       use_errno=shared.Settings.SUPPORT_ERRNO,
       is_tracing=shared.Settings.EMSCRIPTEN_TRACING,
+      use_slabs=shared.Settings.MALLOC == 'emmalloc' and shared.Settings.EMMALLOC_SLABS,
+      use_mspaces=shared.Settings.MALLOC == 'dlmalloc' and shared.Settings.DLMALLOC_MSPACES and shared.Settings.USE_PTHREADS,
       **kwargs
     )
 
   @classmethod
   def variations(cls):
     combos = super(libmalloc, cls).variations()
-    return ([dict(malloc='dlmalloc', **combo) for combo in combos] +
+    return ([dict(malloc='dlmalloc', **combo) for combo in combos
+             if not combo['use_slabs'] and (combo['is_mt'] or not combo['use_mspaces'])] +
             [dict(malloc='emmalloc', **combo) for combo in combos
-             if not combo['is_mt'] and not combo['is_tracing']])
+             if not combo['is_tracing'] and not combo['use_mspaces']])
 
 
 class libal(Library):
@@ -1178,7 +1263,7 @@ class CompilerRTWasmLibrary(NoBCLibrary):
     return shared.Settings.WASM_BACKEND
 
 
-class libc_rt_wasm(AsanInstrumentedLibrary, CompilerRTWasmLibrary, MuslInternalLibrary):
+class libc_rt_wasm(AsanInstrumentedLibrary, SIMDLibrary, BulkMemoryLibrary, CompilerRTWasmLibrary, MuslInternalLibrary):
   name = 'libc_rt_wasm'
 
   def get_files(self):
@@ -0,0 +1,75 @@
+// Compares the WebSocket payload unmasking implementations supported by the current CPU, on payloads from 64 bytes
+// to 16 MB. Usage: unmask_benchmark [minimum milliseconds to run each measurement]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+
+#include "../src/websocket_unmask.h"
+
+static double Now()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int main(int argc, char *argv[])
+{
+  double minSeconds = (argc >= 2) ? atof(argv[1]) / 1000.0 : 0.2;
+
+  WebSocketUnmaskFunc funcs[8];
+  const char *names[8];
+  int numFuncs = GetWebSocketUnmaskImplementations(funcs, names, 8);
+
+  const uint32_t maskingKey = 0x5A3C96E1;
+  const size_t maxSize = 16*1024*1024;
+  std::vector<uint8_t> original(maxSize + 3), expected(maxSize + 3), data(maxSize + 3);
+  for(size_t i = 0; i < original.size(); ++i)
+    original[i] = (uint8_t)(i * 2654435761u >> 13);
+
+  // Verify all implementations against the scalar one, including odd sizes and misaligned payloads.
+  for(size_t size = 0; size < 300; ++size)
+    for(int offset = 0; offset < 3; ++offset)
+    {
+      memcpy(&expected[0], &original[0], size + offset);
+      funcs[0](&expected[offset], size, maskingKey);
+      for(int f = 1; f < numFuncs; ++f)
+      {
+        memcpy(&data[0], &original[0], size + offset);
+        funcs[f](&data[offset], size, maskingKey);
+        if (memcmp(&data[0], &expected[0], size + offset))
+        {
+          fprintf(stderr, "%s implementation produced wrong results for a %d byte payload at offset %d!\n", names[f], (int)size, offset);
+          return 1;
+        }
+      }
+    }
+
+  printf("%10s", "size");
+  for(int f = 0; f < numFuncs; ++f)
+    printf("%12s", names[f]);
+  printf("   (GB/s)\n");
+
+  for(size_t size = 64; size <= maxSize; size *= 4)
+  {
+    printf("%10d", (int)size);
+    for(int f = 0; f < numFuncs; ++f)
+    {
+      // Masking twice restores the data, so the same buffer can be reused for any number of rounds.
+      memcpy(&data[0], &original[0], size);
+      uint64_t rounds = 0;
+      double start = Now(), elapsed;
+      do
+      {
+        for(int i = 0; i < 16; ++i)
+          funcs[f](&data[0], size, maskingKey);
+        rounds += 16;
+        elapsed = Now() - start;
+      } while(elapsed < minSeconds);
+      printf("%12.2f", rounds * size / elapsed / 1e9);
+    }
+    printf("\n");
+  }
+  return 0;
+}
@@ -1,16 +1,31 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include <memory.h>
 #include <sys/types.h>
 #include "posix_sockets.h"
 #include "threads.h"
 #include <assert.h>
 #include <vector>
+#include <string>
 
 #include "sha1.h"
 #include "websocket_to_posix_proxy.h"
+#include "websocket_receive_buffer.h"
+#include "websocket_unmask.h"
 #include "socket_registry.h"
 
+#ifdef PROXY_USE_EPOLL
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include "worker_pool.h"
+#endif
+
 // #define PROXY_DEBUG
 
 // #define PROXY_DEEP_DEBUG
@@ -32,7 +47,10 @@ static void base64_encode(void *dst, const void *src, size_t len) // thread-safe
   for (size_t i = 0; i < (3 - (len % 3)) % 3; i++) ((char *)d)[-1-i] = '=';
 }
 
-#define BUFFER_SIZE 1024
+#define MAX_HANDSHAKE_SIZE 16384
+
+// Larger WebSocket messages from a client are rejected, to not let a corrupt length field exhaust memory.
+#define MAX_WEBSOCKET_MESSAGE_SIZE (1024*1024*1024)
 #define on_error(...) { fprintf(stderr, __VA_ARGS__); fflush(stderr); exit(1); }
 
 // Given a multiline string of HTTP headers, returns a pointer to the beginning of the value of given header inside the string that was passed in.
@@ -48,8 +66,8 @@ static int GetHttpHeader(const char *headers, const char *header, char *out) //
   return (int)(end-pos);
 }
 
-// Sends WebSocket handshake back to the given WebSocket connection.
-void SendHandshake(int fd, const char *request)
+// Sends WebSocket handshake back to the given WebSocket connection. Returns false if the connection failed.
+bool SendHandshake(int fd, const char *request)
 {
   char key[128];
   GetHttpHeader(request, "Sec-WebSocket-Key: ", key);
@@ -70,8 +88,13 @@ void SendHandshake(int fd, const char *request)
   base64_encode(strstr(handshakeMsg, "Sec-WebSocket-Accept: ") + strlen("Sec-WebSocket-Accept: "), sha1, 20);
 
   int err = send(fd, handshakeMsg, (int)strlen(handshakeMsg), 0);
-  if (err < 0) on_error("Client write failed\n");
+  if (err < 0)
+  {
+    fprintf(stderr, "Client write failed\n");
+    return false;
+  }
   printf("Sent handshake:\n%s\n", handshakeMsg);
+  return true;
 }
 
 // Validates if the given, possibly partially received WebSocket message has enough bytes to contain a full WebSocket header.
@@ -83,8 +106,8 @@ static bool WebSocketHasFullHeader(uint8_t *data, uint64_t obtainedNumBytes)
   if (header->mask) expectedNumBytes += 4;
   switch(header->payloadLength)
   {
-    case 127: return expectedNumBytes += 8; break;
-    case 126: return expectedNumBytes += 2; break;
+    case 127: expectedNumBytes += 8; break;
+    case 126: expectedNumBytes += 2; break;
     default: break;
   }
   return obtainedNumBytes >= expectedNumBytes;
@@ -94,6 +117,7 @@ static bool WebSocketHasFullHeader(uint8_t *data, uint64_t obtainedNumBytes)
 uint64_t WebSocketFullMessageSize(uint8_t *data, uint64_t obtainedNumBytes)
 {
   assert(WebSocketHasFullHeader(data, obtainedNumBytes));
+  (void)obtainedNumBytes; // Only used by the assert.
 
   uint64_t expectedNumBytes = 2;
   WebSocketMessageHeader *header = (WebSocketMessageHeader *)data;
@@ -114,7 +138,7 @@ bool WebSocketValidateMessageSize(uint8_t *data, uint64_t obtainedNumBytes)
 
   if (expectedNumBytes != obtainedNumBytes)
   {
-    printf("Corrupt WebSocket message size! (got %llu bytes, expected %llu bytes)\n", obtainedNumBytes, expectedNumBytes);
+    printf("Corrupt WebSocket message size! (got %llu bytes, expected %llu bytes)\n", (unsigned long long)obtainedNumBytes, (unsigned long long)expectedNumBytes);
     printf("Received data:");
     for(size_t i = 0; i < obtainedNumBytes; ++i)
       printf(" %02X", data[i]);
@@ -163,6 +187,7 @@ void CloseWebSocket(int client_fd)
 {
   printf("Closing WebSocket connection %d\n", client_fd);
   CloseAllSocketsByConnection(client_fd);
+  DestroyWebSocketSendQueue(client_fd);
   shutdown(client_fd, SHUTDOWN_BIDIRECTIONAL);
   CLOSE_SOCKET(client_fd);
 }
@@ -185,7 +210,7 @@ void DumpWebSocketMessage(uint8_t *data, uint64_t numBytes)
   uint8_t *payload = WebSocketMessageData(data, numBytes);
 
   printf("Received: FIN: %d, opcode: %s, mask: 0x%08X, payload length: %llu bytes, unmasked payload:", header->fin, WebSocketOpcodeToString(header->opcode),
-    WebSocketMessageMaskingKey(data, numBytes), payloadLength);
+    WebSocketMessageMaskingKey(data, numBytes), (unsigned long long)payloadLength);
   for(uint64_t i = 0; i < payloadLength; ++i)
   {
     if (i%16 == 0) printf("\n");
@@ -193,142 +218,595 @@ void DumpWebSocketMessage(uint8_t *data, uint64_t numBytes)
     printf(" %02X", payload[i]);
     if (i >= 63 && payloadLength > 64)
     {
-      printf("\n   ... (%llu more bytes)", payloadLength-i);
+      printf("\n   ... (%llu more bytes)", (unsigned long long)(payloadLength-i));
       break;
     }
   }
   printf("\n");
 }
 
-// connection thread manages a single active proxy connection.
-THREAD_RETURN_T connection_thread(void *arg)
+// Looks for a complete WebSocket upgrade request at the front of the received data, and answers it. Returns 1 if the
+// handshake was completed, 0 if more data is needed, and -1 if the connection should be closed.
+static int ProcessHandshake(int client_fd, WebSocketReceiveBuffer &buffer)
 {
-  int client_fd = (int)(uintptr_t)arg;
-  printf("Established new proxy connection handler thread for incoming connection, at fd=%d\n", client_fd); // TODO: print out getpeername()+getsockname() for more info
+  std::string request(buffer.Size(), '\0');
+  if (!request.empty()) buffer.Peek(&request[0], 0, request.size());
+  size_t endOfHeaders = request.find("\r\n\r\n");
+  if (endOfHeaders == std::string::npos)
+  {
+    if (request.size() <= MAX_HANDSHAKE_SIZE)
+      return 0;
+    fprintf(stderr, "Too large WebSocket handshake received from fd=%d\n", client_fd);
+    return -1;
+  }
+  request.resize(endOfHeaders + 4);
+  buffer.Consume(request.size());
+#ifdef PROXY_DEEP_DEBUG
+  printf("Received handshake:\n%s\n", request.c_str());
+#endif
+  return SendHandshake(client_fd, request.c_str()) ? 1 : -1;
+}
+
+// Processes all complete WebSocket messages at the front of the received data, and passes the payloads of binary
+// messages to handleMessage(). Payloads are unmasked in place in the receive buffer. Returns false if the connection
+// should be closed.
+static bool ProcessWebSocketFrames(WebSocketReceiveBuffer &buffer, void (*handleMessage)(void *userData, uint8_t *payload, uint64_t numBytes), void *userData)
+{
+  // Process received fragments until there is not enough data for a full message
+  for(;;)
+  {
+    uint8_t headerData[sizeof(WebSocketMessageHeader) + 8/*extended length*/ + 4/*masking key*/];
+    size_t headerBytes = buffer.Size() < sizeof(headerData) ? buffer.Size() : sizeof(headerData);
+    buffer.Peek(headerData, 0, headerBytes);
+    if (!WebSocketHasFullHeader(headerData, headerBytes))
+    {
+#ifdef PROXY_DEEP_DEBUG
+      printf("(not enough for a full WebSocket header)\n");
+#endif
+      return true;
+    }
+    uint64_t neededBytes = WebSocketFullMessageSize(headerData, headerBytes);
+    if (neededBytes > MAX_WEBSOCKET_MESSAGE_SIZE)
+    {
+      fprintf(stderr, "Too large WebSocket message received (%llu bytes)!\n", (unsigned long long)neededBytes);
+      return false;
+    }
+    if (buffer.Size() < neededBytes)
+    {
+#ifdef PROXY_DEEP_DEBUG
+      printf("(not enough for a full WebSocket message, needed %d bytes)\n", (int)neededBytes);
+#endif
+      buffer.Reserve((size_t)neededBytes);
+      return true;
+    }
+
+    WebSocketMessageHeader *header = (WebSocketMessageHeader *)headerData;
+    uint64_t payloadLength = WebSocketMessagePayloadLength(headerData, neededBytes);
+    size_t payloadOffset = (size_t)(WebSocketMessageData(headerData, neededBytes) - headerData);
+    uint8_t *payload = buffer.Contiguous(payloadOffset, (size_t)payloadLength);
+
+    // Unmask payload
+    if (header->mask)
+      WebSocketMessageUnmaskPayload(payload, payloadLength, WebSocketMessageMaskingKey(headerData, neededBytes));
+
+#ifdef PROXY_DEEP_DEBUG
+    printf("Received: FIN: %d, opcode: %s, payload length: %llu bytes\n", header->fin, WebSocketOpcodeToString(header->opcode), payloadLength);
+#endif
+
+    bool connectionAlive = true;
+    switch(header->opcode)
+    {
+    case 0x02: /*binary message*/ handleMessage(userData, payload, payloadLength); break;
+    case 0x08: connectionAlive = false; break;
+    default:
+      fprintf(stderr, "Unknown WebSocket opcode received %x!\n", header->opcode);
+      connectionAlive = false; // Kill connection
+      break;
+    }
+
+    buffer.Consume((size_t)neededBytes);
+#ifdef PROXY_DEEP_DEBUG
+    printf("Consumed used bytes, got %d left in receive buffer.\n", (int)buffer.Size());
+#endif
+    if (!connectionAlive)
+      return false;
+  }
+}
+
+#ifdef PROXY_USE_EPOLL
+
+// The epoll event loop: a single thread waits on the listening socket, on all WebSocket client connections, and on
+// proxied sockets that have a recv()/accept()/connect() waiting for them. Client connections are read with
+// edge-triggered notifications, and the received messages are handed to the worker pool for processing, one
+// connection's messages at a time and in order.
+
+// Identifies the kind of the fd in the upper 32 bits of epoll_event.data.u64.
+#define EPOLL_LISTEN_SOCKET 1
+#define EPOLL_CONNECTION 2
+#define EPOLL_PROXIED_SOCKET 3
+#define EPOLL_DATA(type, fd) (((uint64_t)(type) << 32) | (uint32_t)(fd))
+
+struct QueuedMessage
+{
+  uint8_t *payload;
+  uint64_t numBytes;
+};
+
+struct Connection
+{
+  int fd;
+  int refCount; // The event loop holds one reference until the connection closes, and each in-flight call holds one.
 
-  // Waiting for connection upgrade handshake
-  char buf[BUFFER_SIZE];
-  int read = recv(client_fd, buf, BUFFER_SIZE, 0);
+  // Only accessed by the event loop thread.
+  bool handshakeDone;
+  WebSocketReceiveBuffer receivedData;
 
-  if (!read)
+  // Guarded by messageQueueLock.
+  MUTEX_T messageQueueLock;
+  std::deque<QueuedMessage> messageQueue;
+  bool processingMessages;
+  bool closed;
+
+  // Guarded by socketWaitersLock. A socket is listed once for each call waiting on it.
+  std::vector<SOCKET_T> waitingSockets;
+};
+
+struct SocketWaiter
+{
+  Connection *connection;
+  SOCKET_T socket;
+  bool waitForWrite;
+  bool running; // The socket became ready and the callback was queued to run. Guarded by socketWaitersLock.
+  void (*callback)(void *arg);
+  void *arg;
+};
+
+static int epoll_fd = -1;
+
+// Guards the connections and socketWaiters maps, and Connection::waitingSockets. The connections map is only
+// modified by the event loop thread.
+static MUTEX_T socketWaitersLock;
+static std::map<int, Connection*> connections;
+// The calls waiting on each proxied socket, in the order they were made. Only the first one is armed in the epoll
+// set, the next one is armed after it has run.
+static std::map<SOCKET_T, std::deque<SocketWaiter*> > socketWaiters;
+
+static void AddConnectionRef(Connection *conn)
+{
+  __sync_add_and_fetch(&conn->refCount, 1);
+}
+
+static void ReleaseConnection(Connection *conn)
+{
+  if (__sync_sub_and_fetch(&conn->refCount, 1) > 0)
+    return;
+
+  // The fd is only closed after all in-flight calls have finished, so that a new connection can not reuse the fd
+  // and receive replies meant for this one.
+  DestroyWebSocketSendQueue(conn->fd);
+  CLOSE_SOCKET(conn->fd);
+  for(size_t i = 0; i < conn->messageQueue.size(); ++i)
+    free(conn->messageQueue[i].payload);
+  delete conn;
+}
+
+// Processes queued messages of a connection in a worker thread.
+static void ProcessConnectionMessages(void *arg)
+{
+  Connection *conn = (Connection*)arg;
+  for(;;)
   {
-    CloseWebSocket(client_fd);
-    EXIT_THREAD(0);
+    LOCK_MUTEX(&conn->messageQueueLock);
+    if (conn->messageQueue.empty() || conn->closed)
+    {
+      conn->processingMessages = false;
+      UNLOCK_MUTEX(&conn->messageQueueLock);
+      break;
+    }
+    QueuedMessage msg = conn->messageQueue.front();
+    conn->messageQueue.pop_front();
+    UNLOCK_MUTEX(&conn->messageQueueLock);
+
+    ProcessWebSocketMessage(conn->fd, msg.payload, msg.numBytes);
+    free(msg.payload);
   }
+  ReleaseConnection(conn);
+}
 
-  if (read < 0)
+// The payload points into the connection's receive ring, which the event loop keeps reading into while a worker
+// processes the message, so it is copied out here. This is the one copy a received message takes on its way to
+// ProcessWebSocketMessage(); the ring itself is filled with readv() and unmasked in place.
+static void QueueMessageOnConnection(void *userData, uint8_t *payload, uint64_t numBytes)
+{
+  Connection *conn = (Connection*)userData;
+  QueuedMessage msg;
+  msg.payload = (uint8_t*)malloc((size_t)numBytes);
+  memcpy(msg.payload, payload, (size_t)numBytes);
+  msg.numBytes = numBytes;
+
+  LOCK_MUTEX(&conn->messageQueueLock);
+  conn->messageQueue.push_back(msg);
+  bool startProcessing = !conn->processingMessages;
+  conn->processingMessages = true;
+  UNLOCK_MUTEX(&conn->messageQueueLock);
+
+  if (startProcessing)
   {
-    fprintf(stderr, "Client read failed\n");
-    CloseWebSocket(client_fd);
-    EXIT_THREAD(0);
+    AddConnectionRef(conn);
+    QueueWork(ProcessConnectionMessages, conn);
   }
+}
 
-#ifdef PROXY_DEEP_DEBUG
-  printf("Received:");
-  for(int i = 0; i < read; ++i)
+// Watches the socket of the given waiter in the epoll set. Must be called with socketWaitersLock held.
+static bool ArmSocketWaiter(SocketWaiter *waiter)
+{
+  // A socket that has been waited on before stays registered (but disarmed) in the epoll set until it is closed.
+  epoll_event ev;
+  ev.events = (waiter->waitForWrite ? EPOLLOUT : EPOLLIN) | EPOLLRDHUP | EPOLLONESHOT;
+  ev.data.u64 = EPOLL_DATA(EPOLL_PROXIED_SOCKET, waiter->socket);
+  return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, waiter->socket, &ev) == 0
+    || (errno == ENOENT && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, waiter->socket, &ev) == 0);
+}
+
+// Removes the given waiter from the waiters of its socket. Must be called with socketWaitersLock held.
+static void RemoveSocketWaiter(SocketWaiter *waiter)
+{
+  std::map<SOCKET_T, std::deque<SocketWaiter*> >::iterator iter = socketWaiters.find(waiter->socket);
+  std::deque<SocketWaiter*> &waiters = iter->second;
+  waiters.erase(std::find(waiters.begin(), waiters.end(), waiter));
+  if (waiters.empty())
+    socketWaiters.erase(iter);
+  std::vector<SOCKET_T> &sockets = waiter->connection->waitingSockets;
+  sockets.erase(std::find(sockets.begin(), sockets.end(), waiter->socket));
+}
+
+static void RunSocketWaiter(void *arg)
+{
+  SocketWaiter *waiter = (SocketWaiter*)arg;
+  waiter->callback(waiter->arg);
+
+  // Hand the socket over to the next call waiting on it. If it can't be watched, the call runs (and blocks if it
+  // has to) in a worker as it would have without waiting.
+  SocketWaiter *next = 0;
+  LOCK_MUTEX(&socketWaitersLock);
+  RemoveSocketWaiter(waiter);
+  std::map<SOCKET_T, std::deque<SocketWaiter*> >::iterator iter = socketWaiters.find(waiter->socket);
+  if (iter != socketWaiters.end() && !iter->second.front()->running && !ArmSocketWaiter(iter->second.front()))
   {
-    printf(" %02X", buf[i]);
+    next = iter->second.front();
+    next->running = true;
   }
-  printf("\n");
-//  printf("In text:\n%s\n", buf);
-#endif
-  SendHandshake(client_fd, buf);
+  UNLOCK_MUTEX(&socketWaitersLock);
 
-#ifdef PROXY_DEEP_DEBUG
-  printf("Handshake received, entering message loop:\n");
-#endif
+  ReleaseConnection(waiter->connection);
+  delete waiter;
+  if (next)
+    QueueWork(RunSocketWaiter, next);
+}
 
-  std::vector<uint8_t> fragmentData;
+// Marks the first waiter of the given socket as running and returns it, or returns 0 if there is none, or it is
+// already running. Must be called with socketWaitersLock held.
+static SocketWaiter *TakeSocketWaiter(SOCKET_T socket)
+{
+  std::map<SOCKET_T, std::deque<SocketWaiter*> >::iterator iter = socketWaiters.find(socket);
+  if (iter == socketWaiters.end() || iter->second.front()->running)
+    return 0;
+  iter->second.front()->running = true;
+  return iter->second.front();
+}
 
-  bool connectionAlive = true;
-  while (connectionAlive)
+// Removes the waiters of the given socket that are not running yet, and appends them to the given vector. Must be
+// called with socketWaitersLock held.
+static void TakeIdleSocketWaiters(SOCKET_T socket, std::vector<SocketWaiter*> &taken)
+{
+  std::map<SOCKET_T, std::deque<SocketWaiter*> >::iterator iter = socketWaiters.find(socket);
+  if (iter == socketWaiters.end())
+    return;
+  std::deque<SocketWaiter*> waiters = iter->second;
+  for(size_t i = 0; i < waiters.size(); ++i)
+    if (!waiters[i]->running)
+    {
+      RemoveSocketWaiter(waiters[i]);
+      taken.push_back(waiters[i]);
+    }
+}
+
+bool RunWhenSocketReady(int client_fd, SOCKET_T socket, bool waitForWrite, void (*callback)(void *arg), void *arg)
+{
+  LOCK_MUTEX(&socketWaitersLock);
+  std::map<int, Connection*>::iterator iter = connections.find(client_fd);
+  if (iter == connections.end())
   {
-    int read = recv(client_fd, buf, BUFFER_SIZE, 0);
+    UNLOCK_MUTEX(&socketWaitersLock);
+    return false;
+  }
 
-    if (!read) break; // done reading
+  SocketWaiter *waiter = new SocketWaiter;
+  waiter->connection = iter->second;
+  waiter->socket = socket;
+  waiter->waitForWrite = waitForWrite;
+  waiter->running = false;
+  waiter->callback = callback;
+  waiter->arg = arg;
+
+  // If other calls are already waiting on the socket, this one waits for its turn after them.
+  std::deque<SocketWaiter*> &waiters = socketWaiters[socket];
+  if (waiters.empty() && !ArmSocketWaiter(waiter))
+  {
+    socketWaiters.erase(socket);
+    UNLOCK_MUTEX(&socketWaitersLock);
+    delete waiter;
+    return false;
+  }
+  AddConnectionRef(waiter->connection);
+  waiters.push_back(waiter);
+  waiter->connection->waitingSockets.push_back(socket);
+  UNLOCK_MUTEX(&socketWaitersLock);
+  return true;
+}
+
+void WakeSocketWaiters(SOCKET_T socket)
+{
+  std::vector<SocketWaiter*> waiters;
+  LOCK_MUTEX(&socketWaitersLock);
+  TakeIdleSocketWaiters(socket, waiters);
+  UNLOCK_MUTEX(&socketWaitersLock);
+  if (waiters.empty())
+    return;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket, 0);
+  for(size_t i = 0; i < waiters.size(); ++i)
+  {
+    waiters[i]->callback(waiters[i]->arg);
+    ReleaseConnection(waiters[i]->connection);
+    delete waiters[i];
+  }
+}
+
+static void CloseConnection(Connection *conn)
+{
+  printf("Proxy connection closed\n");
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, 0);
+
+  LOCK_MUTEX(&conn->messageQueueLock);
+  conn->closed = true;
+  UNLOCK_MUTEX(&conn->messageQueueLock);
+
+  // Drop the calls that are still waiting for their sockets, nobody is left to reply to.
+  std::vector<SocketWaiter*> waiters;
+  LOCK_MUTEX(&socketWaitersLock);
+  connections.erase(conn->fd);
+  std::vector<SOCKET_T> sockets = conn->waitingSockets;
+  for(size_t i = 0; i < sockets.size(); ++i)
+    TakeIdleSocketWaiters(sockets[i], waiters);
+  UNLOCK_MUTEX(&socketWaitersLock);
+  for(size_t i = 0; i < waiters.size(); ++i)
+  {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, waiters[i]->socket, 0);
+    free(waiters[i]->arg);
+    ReleaseConnection(waiters[i]->connection);
+    delete waiters[i];
+  }
+
+  printf("Closing WebSocket connection %d\n", conn->fd);
+  CloseAllSocketsByConnection(conn->fd);
+  shutdown(conn->fd, SHUTDOWN_BIDIRECTIONAL);
+  // The connection is no longer watched for EPOLLOUT, so release workers waiting for its send queue to drain.
+  AbortWebSocketSendQueue(conn->fd);
+  ReleaseConnection(conn);
+}
+
+static void SetNonBlocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static void AcceptConnections(int server_fd)
+{
+  for(;;)
+  {
+    int client_fd = accept(server_fd, 0, 0);
+    if (client_fd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        fprintf(stderr, "Could not establish new incoming proxy connection\n"); // Do not quit here, but keep serving any existing proxy connections.
+      return;
+    }
+    printf("Established new proxy connection for incoming connection, at fd=%d\n", client_fd); // TODO: print out getpeername()+getsockname() for more info
+    SetNonBlocking(client_fd);
+
+    Connection *conn = new Connection;
+    conn->fd = client_fd;
+    conn->refCount = 1;
+    conn->handshakeDone = false;
+    CREATE_MUTEX(&conn->messageQueueLock);
+    conn->processingMessages = false;
+    conn->closed = false;
+    CreateWebSocketSendQueue(client_fd);
+
+    LOCK_MUTEX(&socketWaitersLock);
+    connections[client_fd] = conn;
+    UNLOCK_MUTEX(&socketWaitersLock);
+
+    epoll_event ev;
+    // Edge-triggered EPOLLOUT fires whenever the socket becomes writable again after replies have filled it up.
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.u64 = EPOLL_DATA(EPOLL_CONNECTION, client_fd);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client_fd, &ev) != 0)
+    {
+      fprintf(stderr, "Failed to watch incoming proxy connection fd=%d!\n", client_fd);
+      CloseConnection(conn);
+    }
+  }
+}
+
+static void ReadFromConnection(Connection *conn)
+{
+  // With edge-triggered notifications, all available data must be read before waiting again.
+  for(;;)
+  {
+    if (conn->receivedData.Full())
+      conn->receivedData.Reserve(conn->receivedData.Capacity() * 2);
+
+    int read = conn->receivedData.Receive(conn->fd);
     if (read < 0)
     {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
       fprintf(stderr, "Client read failed\n");
-      EXIT_THREAD(0);
+      CloseConnection(conn);
+      return;
     }
-
-#ifdef PROXY_DEEP_DEBUG
-    printf("Received:");
-    for(int i = 0; i < read; ++i)
+    if (read == 0) // done reading
     {
-      printf(" %02X", ((unsigned char*)buf)[i]);
+      CloseConnection(conn);
+      return;
     }
-    printf("\n");
-//    printf("In text:\n%s\n", buf);
-#endif
-
 #ifdef PROXY_DEEP_DEBUG
-    printf("Have %d+%d==%d bytes now in queue\n", (int)fragmentData.size(), (int)read, (int)(fragmentData.size()+read));
+    printf("Have %d bytes now in receive buffer\n", (int)conn->receivedData.Size());
 #endif
-    fragmentData.insert(fragmentData.end(), buf, buf+read);
 
-    // Process received fragments until there is not enough data for a full message
-    while(!fragmentData.empty())
+    if (!conn->handshakeDone)
     {
-      bool hasFullHeader = WebSocketHasFullHeader(&fragmentData[0], fragmentData.size());
-      if (!hasFullHeader)
+      // Waiting for connection upgrade handshake
+      int handshake = ProcessHandshake(conn->fd, conn->receivedData);
+      if (handshake < 0)
       {
+        CloseConnection(conn);
+        return;
+      }
+      if (handshake == 0)
+        continue;
+      conn->handshakeDone = true;
 #ifdef PROXY_DEEP_DEBUG
-        printf("(not enough for a full WebSocket header)\n");
+      printf("Handshake received, entering message loop:\n");
 #endif
+    }
+
+    if (!ProcessWebSocketFrames(conn->receivedData, QueueMessageOnConnection, conn))
+    {
+      CloseConnection(conn);
+      return;
+    }
+  }
+}
+
+static void RunEventLoop(SOCKET_T server_fd)
+{
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) on_error("Could not create epoll instance\n");
+
+  SetNonBlocking(server_fd);
+  epoll_event ev;
+  ev.events = EPOLLIN | EPOLLET;
+  ev.data.u64 = EPOLL_DATA(EPOLL_LISTEN_SOCKET, server_fd);
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) != 0) on_error("Could not watch listen socket\n");
+
+  const int MAX_EVENTS = 256;
+  epoll_event events[MAX_EVENTS];
+  while (1)
+  {
+    int numEvents = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+    if (numEvents < 0)
+    {
+      if (errno == EINTR) continue;
+      on_error("epoll_wait failed\n");
+    }
+    for(int i = 0; i < numEvents; ++i)
+    {
+      int fd = (int)(uint32_t)events[i].data.u64;
+      switch(events[i].data.u64 >> 32)
+      {
+      case EPOLL_LISTEN_SOCKET:
+        AcceptConnections(fd);
+        break;
+      case EPOLL_CONNECTION:
+      {
+        // The connection may have been closed by an earlier event in this same batch.
+        std::map<int, Connection*>::iterator iter = connections.find(fd);
+        if (iter == connections.end())
+          break;
+        if (events[i].events & EPOLLOUT)
+          FlushWebSocketSendQueue(fd);
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+          ReadFromConnection(iter->second);
         break;
       }
-      uint64_t neededBytes = WebSocketFullMessageSize(&fragmentData[0], fragmentData.size());
-      if (fragmentData.size() < neededBytes)
+      case EPOLL_PROXIED_SOCKET:
       {
-#ifdef PROXY_DEEP_DEBUG
-        printf("(not enough for a full WebSocket message, needed %d bytes)\n", (int)neededBytes);
-#endif
+        LOCK_MUTEX(&socketWaitersLock);
+        SocketWaiter *waiter = TakeSocketWaiter(fd);
+        UNLOCK_MUTEX(&socketWaitersLock);
+        if (waiter)
+          QueueWork(RunSocketWaiter, waiter);
         break;
       }
+      }
+    }
+  }
+}
+
+#else
+
+static void ProcessMessageInCurrentThread(void *userData, uint8_t *payload, uint64_t numBytes)
+{
+  ProcessWebSocketMessage((int)(uintptr_t)userData, payload, numBytes);
+}
 
-      WebSocketMessageHeader *header = (WebSocketMessageHeader *)&fragmentData[0];
-      uint64_t payloadLength = WebSocketMessagePayloadLength(&fragmentData[0], neededBytes);
-      uint8_t *payload = WebSocketMessageData(&fragmentData[0], neededBytes);
+// connection thread manages a single active proxy connection.
+THREAD_RETURN_T connection_thread(void *arg)
+{
+  int client_fd = (int)(uintptr_t)arg;
+  printf("Established new proxy connection handler thread for incoming connection, at fd=%d\n", client_fd); // TODO: print out getpeername()+getsockname() for more info
+  CreateWebSocketSendQueue(client_fd);
 
-      // Unmask payload
-      if (header->mask)
-        WebSocketMessageUnmaskPayload(payload, payloadLength, WebSocketMessageMaskingKey(&fragmentData[0], neededBytes));
+  WebSocketReceiveBuffer receivedData;
+  bool handshakeDone = false;
+
+  bool connectionAlive = true;
+  while (connectionAlive)
+  {
+    if (receivedData.Full())
+      receivedData.Reserve(receivedData.Capacity() * 2);
+
+    int read = receivedData.Receive(client_fd);
+
+    if (!read) break; // done reading
+    if (read < 0)
+    {
+      fprintf(stderr, "Client read failed\n");
+      break;
+    }
 
 #ifdef PROXY_DEEP_DEBUG
-        DumpWebSocketMessage(&fragmentData[0], neededBytes);
+    printf("Have %d bytes now in receive buffer\n", (int)receivedData.Size());
 #endif
 
-      switch(header->opcode)
-      {
-      case 0x02: /*binary message*/ ProcessWebSocketMessage(client_fd, payload, payloadLength); break;
-      case 0x08: connectionAlive = false; break;
-      default:
-        fprintf(stderr, "Unknown WebSocket opcode received %x!\n", header->opcode);
-        connectionAlive = false; // Kill connection
-        break;
-      }
-
-      fragmentData.erase(fragmentData.begin(), fragmentData.begin() + (ptrdiff_t)neededBytes);
+    if (!handshakeDone)
+    {
+      // Waiting for connection upgrade handshake
+      int handshake = ProcessHandshake(client_fd, receivedData);
+      if (handshake < 0) break;
+      if (handshake == 0) continue;
+      handshakeDone = true;
 #ifdef PROXY_DEEP_DEBUG
-      printf("Cleared used bytes, got %d left in fragment queue.\n", (int)fragmentData.size());
+      printf("Handshake received, entering message loop:\n");
 #endif
     }
+
+    connectionAlive = ProcessWebSocketFrames(receivedData, ProcessMessageInCurrentThread, (void*)(uintptr_t)client_fd);
   }
   printf("Proxy connection closed\n");
   CloseWebSocket(client_fd);
   EXIT_THREAD(0);
 }
 
-// Technically only would need one lock per connection, but this is now one lock per all connections, which would be
-// slightly inefficient if we were handling multiple proxied connections at the same time. (currently that is a rare
-// use case, expected to only be proxying one connection at a time - if this proxy bridge is expected to be used
-// for hundreds of connections simultaneously, this mutex should be refactored to be per-connection)
-MUTEX_T webSocketSendLock;
+#endif
 
 int main(int argc, char *argv[])
 {
-  if (argc < 2) on_error("websocket_to_posix_proxy creates a bridge that allows WebSocket connections on a web page to proxy out to perform TCP/UDP connections.\nUsage: %s [port]\n", argv[0]);
+  if (argc < 2) on_error("websocket_to_posix_proxy creates a bridge that allows WebSocket connections on a web page to proxy out to perform TCP/UDP connections.\nUsage: %s port [numWorkerThreads]\n", argv[0]);
 
 #ifdef _WIN32
   WSADATA wsaData;
@@ -362,8 +840,19 @@ int main(int argc, char *argv[])
 
   printf("websocket_to_posix_proxy server is now listening for WebSocket connections to ws://localhost:%d/\n", port);
 
-  CREATE_MUTEX(&webSocketSendLock);
+#ifdef PROXY_USE_EPOLL
+  int numWorkerThreads = (argc >= 3) ? atoi(argv[2]) : 0;
+  if (numWorkerThreads <= 0)
+  {
+    long numCores = sysconf(_SC_NPROCESSORS_ONLN);
+    numWorkerThreads = (int)(numCores > 4 ? numCores : 4);
+  }
+  printf("Processing proxied socket calls on %d worker threads\n", numWorkerThreads);
+  StartWorkerPool(numWorkerThreads);
+  CREATE_MUTEX(&socketWaitersLock);
 
+  RunEventLoop(server_fd);
+#else
   while (1)
   {
     SOCKET_T client_fd = accept(server_fd, 0, 0);
@@ -381,6 +870,7 @@ int main(int argc, char *argv[])
       continue; // Do not quit here, but keep program alive to manage other existing proxy connections.
     }
   }
+#endif
 
 #ifdef _WIN32
   WSACleanup();
@@ -20,6 +20,7 @@ int CHECKED_TRUNCATE_TO_POSITIVE_INT32(const T &val)
 #include <unistd.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
+#include <sys/uio.h>
 
 #define SOCKET_T int
 #define SHUTDOWN_READ SHUT_RD
@@ -30,6 +31,12 @@ int CHECKED_TRUNCATE_TO_POSITIVE_INT32(const T &val)
 #define SEND_FORMATTING_SPECIFIER "%ld"
 #define CLOSE_SOCKET(x) close(x)
 
+// Scatter/gather I/O buffer descriptors
+#define IOVEC_T struct iovec
+#define SET_IOVEC(iov, ptr, numBytes) ((iov).iov_base = (void*)(ptr), (iov).iov_len = (numBytes))
+#define SEND_VECTORED(socket, iov, iovCount) writev((socket), (iov), (iovCount))
+#define RECV_VECTORED(socket, iov, iovCount) readv((socket), (iov), (iovCount))
+
 #define GET_SOCKET_ERROR() (errno)
 
 #define PRINT_SOCKET_ERROR(errorCode) do { \
@@ -50,6 +57,22 @@ int CHECKED_TRUNCATE_TO_POSITIVE_INT32(const T &val)
 #define SEND_FORMATTING_SPECIFIER "%d"
 #define CLOSE_SOCKET(x) closesocket(x)
 
+// Scatter/gather I/O buffer descriptors
+#define IOVEC_T WSABUF
+#define SET_IOVEC(iov, ptr, numBytes) ((iov).buf = (char*)(ptr), (iov).len = (ULONG)(numBytes))
+
+static inline int SEND_VECTORED(SOCKET_T socket, WSABUF *iov, int iovCount)
+{
+	DWORD numBytesSent = 0;
+	return WSASend(socket, iov, iovCount, &numBytesSent, 0, 0, 0) == 0 ? (int)numBytesSent : -1;
+}
+
+static inline int RECV_VECTORED(SOCKET_T socket, WSABUF *iov, int iovCount)
+{
+	DWORD numBytesReceived = 0, flags = 0;
+	return WSARecv(socket, iov, iovCount, &numBytesReceived, &flags, 0, 0) == 0 ? (int)numBytesReceived : -1;
+}
+
 #define GET_SOCKET_ERROR() (WSAGetLastError())
 
 static inline void PRINT_SOCKET_ERROR(int errorCode)
@@ -1,4 +1,5 @@
 #include "socket_registry.h"
+#include "threads.h"
 
 #include <map>
 #include <vector>
@@ -7,28 +8,53 @@
 namespace
 {
 	std::map<int, std::vector<SOCKET_T> > socketsPerProxyConnection;
+
+	// Calls from different proxy connections are processed in parallel worker threads, so guard the registry.
+	struct RegistryLock
+	{
+		MUTEX_T mutex;
+		RegistryLock() { CREATE_MUTEX(&mutex); }
+	} registryLock;
+
+	bool IsSocketPartOfConnectionUnlocked(int proxyConnection, SOCKET_T usedSocket)
+	{
+		if (usedSocket == 0) return true; // Allow all proxy connections to access "socket 0" when/if they need to refer to socket that does not exist.
+		std::map<int, std::vector<SOCKET_T> >::iterator iter = socketsPerProxyConnection.find(proxyConnection);
+		if (iter == socketsPerProxyConnection.end())
+			return false;
+
+		std::vector<SOCKET_T> &sockets = iter->second;
+		return std::find(sockets.begin(), sockets.end(), usedSocket) != sockets.end();
+	}
 }
 
 void TrackSocketUsedByConnection(int proxyConnection, SOCKET_T usedSocket)
 {
 	if (usedSocket == 0) return;
-	if (IsSocketPartOfConnection(proxyConnection, usedSocket))
-		return;
-	socketsPerProxyConnection[proxyConnection].push_back(usedSocket);
+	LOCK_MUTEX(&registryLock.mutex);
+	if (!IsSocketPartOfConnectionUnlocked(proxyConnection, usedSocket))
+		socketsPerProxyConnection[proxyConnection].push_back(usedSocket);
+	UNLOCK_MUTEX(&registryLock.mutex);
 }
 
 void CloseSocketByConnection(int proxyConnection, SOCKET_T usedSocket)
 {
-	if (!IsSocketPartOfConnection(proxyConnection, usedSocket))
+	LOCK_MUTEX(&registryLock.mutex);
+	if (!IsSocketPartOfConnectionUnlocked(proxyConnection, usedSocket))
+	{
+		UNLOCK_MUTEX(&registryLock.mutex);
 		return;
+	}
 	printf("Closing socket fd %d used by proxy connection %d\n", (int)usedSocket, proxyConnection);
 	CLOSE_SOCKET(usedSocket);
 	std::vector<SOCKET_T> &sockets = socketsPerProxyConnection[proxyConnection];
 	sockets.erase(std::remove(sockets.begin(), sockets.end(), usedSocket), sockets.end());
+	UNLOCK_MUTEX(&registryLock.mutex);
 }
 
 void CloseAllSocketsByConnection(int proxyConnection)
 {
+	LOCK_MUTEX(&registryLock.mutex);
 	std::vector<SOCKET_T> &sockets = socketsPerProxyConnection[proxyConnection];
 	for(size_t i = 0; i < sockets.size(); ++i)
 	{
@@ -37,14 +63,13 @@ void CloseAllSocketsByConnection(int proxyConnection)
 		CLOSE_SOCKET(sockets[i]);
 	}
 	socketsPerProxyConnection.erase(proxyConnection);
+	UNLOCK_MUTEX(&registryLock.mutex);
 }
 
 bool IsSocketPartOfConnection(int proxyConnection, SOCKET_T usedSocket)
 {
-	if (usedSocket == 0) return true; // Allow all proxy connections to access "socket 0" when/if they need to refer to socket that does not exist.
-	if (socketsPerProxyConnection.find(proxyConnection) == socketsPerProxyConnection.end())
-		return false;
-
-	std::vector<SOCKET_T> &sockets = socketsPerProxyConnection[proxyConnection];
-	return std::find(sockets.begin(), sockets.end(), usedSocket) != sockets.end();
+	LOCK_MUTEX(&registryLock.mutex);
+	bool isPart = IsSocketPartOfConnectionUnlocked(proxyConnection, usedSocket);
+	UNLOCK_MUTEX(&registryLock.mutex);
+	return isPart;
 }
@@ -19,6 +19,14 @@ inline void CREATE_MUTEX(MUTEX_T *m)
 }
 #define LOCK_MUTEX(m) pthread_mutex_lock(m)
 #define UNLOCK_MUTEX(m) pthread_mutex_unlock(m)
+#define CONDITION_T pthread_cond_t
+inline void CREATE_CONDITION(CONDITION_T *c)
+{
+	pthread_cond_init(c, 0);
+}
+#define WAIT_CONDITION(c, m) pthread_cond_wait(c, m)
+#define SIGNAL_CONDITION(c) pthread_cond_signal(c)
+#define BROADCAST_CONDITION(c) pthread_cond_broadcast(c)
 #endif
 
 #if defined(_WIN32)
@@ -39,4 +47,12 @@ inline void CREATE_MUTEX(MUTEX_T *m)
 }
 #define LOCK_MUTEX(m) EnterCriticalSection(m)
 #define UNLOCK_MUTEX(m) LeaveCriticalSection(m)
+#define CONDITION_T CONDITION_VARIABLE
+inline void CREATE_CONDITION(CONDITION_T *c)
+{
+	InitializeConditionVariable(c);
+}
+#define WAIT_CONDITION(c, m) SleepConditionVariableCS(c, m, INFINITE)
+#define SIGNAL_CONDITION(c) WakeConditionVariable(c)
+#define BROADCAST_CONDITION(c) WakeAllConditionVariable(c)
 #endif
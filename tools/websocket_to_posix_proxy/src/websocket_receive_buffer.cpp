@@ -0,0 +1,97 @@
+#include "websocket_receive_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define INITIAL_CAPACITY 16384
+
+WebSocketReceiveBuffer::WebSocketReceiveBuffer()
+:capacity(INITIAL_CAPACITY), head(0), tail(0)
+{
+  data = (uint8_t*)malloc(capacity);
+}
+
+WebSocketReceiveBuffer::~WebSocketReceiveBuffer()
+{
+  free(data);
+}
+
+int WebSocketReceiveBuffer::Receive(SOCKET_T socket)
+{
+  assert(!Full());
+  size_t start = (size_t)tail & (capacity - 1);
+  size_t end = (size_t)head & (capacity - 1);
+
+  // The free space is [start, end) if it does not wrap around, and [start, capacity) + [0, end) otherwise.
+  IOVEC_T iov[2];
+  int iovCount = 1;
+  if (start < end)
+    SET_IOVEC(iov[0], data + start, end - start);
+  else
+  {
+    SET_IOVEC(iov[0], data + start, capacity - start);
+    if (end > 0)
+    {
+      SET_IOVEC(iov[1], data, end);
+      iovCount = 2;
+    }
+  }
+
+  int numBytesReceived = (int)RECV_VECTORED(socket, iov, iovCount);
+  if (numBytesReceived > 0)
+    tail += numBytesReceived;
+  return numBytesReceived;
+}
+
+void WebSocketReceiveBuffer::Reserve(size_t numBytes)
+{
+  if (numBytes <= capacity)
+    return;
+  size_t newCapacity = capacity;
+  while(newCapacity < numBytes)
+    newCapacity *= 2;
+
+  uint8_t *newData = (uint8_t*)malloc(newCapacity);
+  size_t size = Size();
+  Peek(newData, 0, size);
+  free(data);
+  data = newData;
+  capacity = newCapacity;
+  head = 0;
+  tail = size;
+}
+
+void WebSocketReceiveBuffer::Peek(void *dst, size_t offset, size_t numBytes) const
+{
+  assert(offset + numBytes <= Size());
+  size_t start = (size_t)(head + offset) & (capacity - 1);
+  size_t firstPart = capacity - start;
+  if (numBytes <= firstPart)
+    memcpy(dst, data + start, numBytes);
+  else
+  {
+    memcpy(dst, data + start, firstPart);
+    memcpy((uint8_t*)dst + firstPart, data, numBytes - firstPart);
+  }
+}
+
+uint8_t *WebSocketReceiveBuffer::Contiguous(size_t offset, size_t numBytes)
+{
+  assert(offset + numBytes <= Size());
+  size_t start = (size_t)(head + offset) & (capacity - 1);
+  if (start + numBytes <= capacity)
+    return data + start;
+
+  scratch.resize(numBytes);
+  Peek(&scratch[0], offset, numBytes);
+  return &scratch[0];
+}
+
+void WebSocketReceiveBuffer::Consume(size_t numBytes)
+{
+  assert(numBytes <= Size());
+  head += numBytes;
+  if (head == tail) // Restart from the beginning when empty, so that subsequent data is less likely to wrap around.
+    head = tail = 0;
+}
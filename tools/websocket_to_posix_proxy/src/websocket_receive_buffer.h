@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "posix_sockets.h"
+
+// A ring buffer for the data received from a WebSocket client connection. Data is received directly into the free
+// space of the ring, and consumed from the front without shifting the remaining data around. The ring only grows if
+// a single WebSocket message does not fit in it.
+class WebSocketReceiveBuffer
+{
+public:
+  WebSocketReceiveBuffer();
+  ~WebSocketReceiveBuffer();
+
+  // Receives as much data from the given socket as there is free space in the buffer. Returns the number of bytes
+  // received, 0 if the connection was closed, or -1 on error (or when a non-blocking socket has no data available).
+  int Receive(SOCKET_T socket);
+
+  size_t Size() const { return (size_t)(tail - head); }
+  size_t Capacity() const { return capacity; }
+  bool Full() const { return Size() == capacity; }
+
+  // Grows the buffer to hold at least the given number of bytes.
+  void Reserve(size_t numBytes);
+
+  // Copies numBytes of data starting at the given offset from the front of the buffer to dst.
+  void Peek(void *dst, size_t offset, size_t numBytes) const;
+
+  // Returns a pointer to numBytes of contiguous data starting at the given offset from the front of the buffer. If
+  // the data wraps around the end of the ring, it is copied to a scratch area, which is valid until the next call.
+  uint8_t *Contiguous(size_t offset, size_t numBytes);
+
+  // Discards numBytes of data from the front of the buffer.
+  void Consume(size_t numBytes);
+
+private:
+  WebSocketReceiveBuffer(const WebSocketReceiveBuffer &); // not copyable
+  void operator=(const WebSocketReceiveBuffer &);
+
+  uint8_t *data;
+  size_t capacity; // Always a power of two
+  uint64_t head; // Read position, wraps modulo capacity when indexing
+  uint64_t tail; // Write position, wraps modulo capacity when indexing
+  std::vector<uint8_t> scratch;
+};
@@ -6,10 +6,18 @@
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
+#include <map>
+#include <deque>
 
 #include "websocket_to_posix_proxy.h"
 #include "socket_registry.h"
 
+#ifdef PROXY_USE_EPOLL
+#include <fcntl.h>
+#include <poll.h>
+#include "worker_pool.h"
+#endif
+
 // Uncomment to enable debug printing
 // #define POSIX_SOCKET_DEBUG
 
@@ -53,6 +61,7 @@ struct SocketCallHeader
   int function;
 };
 
+#ifdef POSIX_SOCKET_DEBUG
 static char buf_temp_str[2048] = {};
 
 static char *BufferToString(const void *buf, size_t len) // not thread-safe, but only used for debug prints, so expected not to cause trouble
@@ -71,33 +80,184 @@ static char *BufferToString(const void *buf, size_t len) // not thread-safe, but
   sprintf(buf_temp_str + len*3, " (%d bytes)", (int)len);
   return buf_temp_str;
 }
+#endif
+
+#define MAX_SEND_IOVECS 64
 
-void WebSocketMessageUnmaskPayload(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey) // thread-safe, re-entrant
+// How many bytes may be queued for a client that does not keep up, before the sending thread waits for it.
+#define MAX_QUEUED_SEND_BYTES (16*1024*1024)
+
+struct OutgoingData
 {
-  uint8_t maskingKey8[4];
-  memcpy(maskingKey8, &maskingKey, 4);
-  uint32_t *data_u32 = (uint32_t *)payload;
-  uint32_t *end_u32 = (uint32_t *)((uintptr_t)(payload + (payloadLength & ~3u)));
+  uint8_t *data;
+  size_t numBytes;
+};
 
-  while(data_u32 < end_u32)
-    *data_u32++ ^= maskingKey;
+// Messages that could not be written to a WebSocket client connection right away, because its socket send buffer
+// was full. Each connection has its own queue and lock, so sending to one connection never waits for another.
+struct WebSocketSendQueue
+{
+  MUTEX_T lock; // Guards the fields below
+  std::deque<OutgoingData> pending;
+  size_t numBytesSentOfFirst;
+  uint64_t numPendingBytes;
+  bool failed;
+  CONDITION_T drained; // Signaled when numPendingBytes drops to MAX_QUEUED_SEND_BYTES or below, or sending fails.
+
+  int refCount; // Guarded by sendQueuesLock
+};
 
-  uint8_t *end = payload + payloadLength;
-  uint8_t *data = (uint8_t *)data_u32;
-  while(data < end)
+namespace
+{
+  struct SendQueuesLock
   {
-    *data ^= maskingKey8[(data-payload) % 4];
-    ++data;
+    MUTEX_T mutex;
+    SendQueuesLock() { CREATE_MUTEX(&mutex); }
+  } sendQueuesLock;
+
+  std::map<int, WebSocketSendQueue*> sendQueues;
+}
+
+void CreateWebSocketSendQueue(int client_fd)
+{
+  WebSocketSendQueue *q = new WebSocketSendQueue;
+  CREATE_MUTEX(&q->lock);
+  CREATE_CONDITION(&q->drained);
+  q->numBytesSentOfFirst = 0;
+  q->numPendingBytes = 0;
+  q->failed = false;
+  q->refCount = 1;
+  LOCK_MUTEX(&sendQueuesLock.mutex);
+  sendQueues[client_fd] = q;
+  UNLOCK_MUTEX(&sendQueuesLock.mutex);
+}
+
+static WebSocketSendQueue *AcquireSendQueue(int client_fd)
+{
+  LOCK_MUTEX(&sendQueuesLock.mutex);
+  std::map<int, WebSocketSendQueue*>::iterator iter = sendQueues.find(client_fd);
+  WebSocketSendQueue *q = (iter != sendQueues.end()) ? iter->second : 0;
+  if (q) ++q->refCount;
+  UNLOCK_MUTEX(&sendQueuesLock.mutex);
+  return q;
+}
+
+static void ReleaseSendQueue(WebSocketSendQueue *q)
+{
+  LOCK_MUTEX(&sendQueuesLock.mutex);
+  bool lastRef = (--q->refCount == 0);
+  UNLOCK_MUTEX(&sendQueuesLock.mutex);
+  if (!lastRef)
+    return;
+  for(size_t i = 0; i < q->pending.size(); ++i)
+    free(q->pending[i].data);
+  delete q;
+}
+
+void DestroyWebSocketSendQueue(int client_fd)
+{
+  LOCK_MUTEX(&sendQueuesLock.mutex);
+  std::map<int, WebSocketSendQueue*>::iterator iter = sendQueues.find(client_fd);
+  WebSocketSendQueue *q = (iter != sendQueues.end()) ? iter->second : 0;
+  if (q) sendQueues.erase(iter);
+  UNLOCK_MUTEX(&sendQueuesLock.mutex);
+  if (q) ReleaseSendQueue(q);
+}
+
+static bool SendWouldBlock(int errorCode)
+{
+#ifdef _MSC_VER
+  return errorCode == WSAEWOULDBLOCK;
+#else
+  return errorCode == EAGAIN || errorCode == EWOULDBLOCK;
+#endif
+}
+
+static void DropPendingLocked(WebSocketSendQueue *q)
+{
+  for(size_t i = 0; i < q->pending.size(); ++i)
+    free(q->pending[i].data);
+  q->pending.clear();
+  q->numBytesSentOfFirst = 0;
+  q->numPendingBytes = 0;
+}
+
+static void WriteSendQueueLocked(WebSocketSendQueue *q, int client_fd)
+{
+  while(!q->pending.empty() && !q->failed)
+  {
+    IOVEC_T iov[MAX_SEND_IOVECS];
+    int iovCount = 0;
+    for(std::deque<OutgoingData>::iterator iter = q->pending.begin(); iter != q->pending.end() && iovCount < MAX_SEND_IOVECS; ++iter)
+    {
+      size_t skip = (iovCount == 0) ? q->numBytesSentOfFirst : 0;
+      SET_IOVEC(iov[iovCount], iter->data + skip, iter->numBytes - skip);
+      ++iovCount;
+    }
+
+    SEND_RET_TYPE sent = SEND_VECTORED(client_fd, iov, iovCount);
+    if (sent < 0)
+    {
+      int errorCode = GET_SOCKET_ERROR();
+      if (errorCode == EINTR) continue;
+      if (!SendWouldBlock(errorCode)) q->failed = true; // The client has disconnected, nothing to do.
+      return;
+    }
+
+    q->numPendingBytes -= sent;
+    size_t numBytes = (size_t)sent;
+    while(numBytes > 0)
+    {
+      OutgoingData &first = q->pending.front();
+      size_t remaining = first.numBytes - q->numBytesSentOfFirst;
+      if (numBytes < remaining)
+      {
+        q->numBytesSentOfFirst += numBytes;
+        break;
+      }
+      numBytes -= remaining;
+      free(first.data);
+      q->pending.pop_front();
+      q->numBytesSentOfFirst = 0;
+    }
   }
 }
 
-extern MUTEX_T webSocketSendLock;
+// Writes out as much of the queued data as the client socket accepts, and wakes up senders waiting for the queue to
+// drain. Must be called with q->lock held.
+static void FlushSendQueueLocked(WebSocketSendQueue *q, int client_fd)
+{
+  WriteSendQueueLocked(q, client_fd);
+  if (q->failed)
+    DropPendingLocked(q);
+  if (q->numPendingBytes <= MAX_QUEUED_SEND_BYTES)
+    BROADCAST_CONDITION(&q->drained);
+}
+
+void FlushWebSocketSendQueue(int client_fd)
+{
+  WebSocketSendQueue *q = AcquireSendQueue(client_fd);
+  if (!q) return;
+  LOCK_MUTEX(&q->lock);
+  FlushSendQueueLocked(q, client_fd);
+  UNLOCK_MUTEX(&q->lock);
+  ReleaseSendQueue(q);
+}
+
+void AbortWebSocketSendQueue(int client_fd)
+{
+  WebSocketSendQueue *q = AcquireSendQueue(client_fd);
+  if (!q) return;
+  LOCK_MUTEX(&q->lock);
+  q->failed = true;
+  DropPendingLocked(q);
+  BROADCAST_CONDITION(&q->drained);
+  UNLOCK_MUTEX(&q->lock);
+  ReleaseSendQueue(q);
+}
 
 void SendWebSocketMessage(int client_fd, void *buf, uint64_t numBytes)
 {
-  // Guard send() calls to the client_fd socket so that two threads won't ever race to send to the 
-  // same socket. (This could be per-socket, currently global for simplicity)
-  LOCK_MUTEX(&webSocketSendLock);
   uint8_t headerData[sizeof(WebSocketMessageHeader) + 8/*possible extended length*/] = {};
   WebSocketMessageHeader *header = (WebSocketMessageHeader *)headerData;
   header->opcode = 0x02;
@@ -132,9 +292,66 @@ void SendWebSocketMessage(int client_fd, void *buf, uint64_t numBytes)
   printf("\n");
 #endif
 
-  send(client_fd, (const char*)headerData, headerBytes, 0); // header
-  send(client_fd, (const char*)buf, (int)numBytes, 0); // payload
-  UNLOCK_MUTEX(&webSocketSendLock);
+  WebSocketSendQueue *q = AcquireSendQueue(client_fd);
+  if (!q) return; // The connection has already been closed.
+
+  LOCK_MUTEX(&q->lock);
+  uint64_t totalBytes = headerBytes + numBytes;
+  uint64_t sent = 0;
+  if (q->pending.empty())
+  {
+    // Nothing is queued ahead of this message, so write the header and the payload straight from their buffers.
+    while(sent < totalBytes && !q->failed)
+    {
+      IOVEC_T iov[2];
+      int iovCount = 0;
+      if (sent < (uint64_t)headerBytes)
+      {
+        SET_IOVEC(iov[iovCount], headerData + sent, headerBytes - (size_t)sent);
+        ++iovCount;
+      }
+      uint64_t payloadSent = (sent < (uint64_t)headerBytes) ? 0 : sent - headerBytes;
+      SET_IOVEC(iov[iovCount], (uint8_t*)buf + payloadSent, (size_t)MIN(numBytes - payloadSent, 0x7FFFFFFF));
+      ++iovCount;
+
+      SEND_RET_TYPE ret = SEND_VECTORED(client_fd, iov, iovCount);
+      if (ret < 0)
+      {
+        int errorCode = GET_SOCKET_ERROR();
+        if (errorCode == EINTR) continue;
+        if (!SendWouldBlock(errorCode)) q->failed = true; // The client has disconnected, nothing to do.
+        break;
+      }
+      sent += ret;
+    }
+  }
+
+  if (sent < totalBytes && !q->failed)
+  {
+    // The client socket is full: queue the rest of the message to be written when the socket becomes writable.
+    OutgoingData out;
+    out.numBytes = (size_t)(totalBytes - sent);
+    out.data = (uint8_t*)malloc(out.numBytes);
+    if (sent < (uint64_t)headerBytes)
+    {
+      memcpy(out.data, headerData + sent, headerBytes - (size_t)sent);
+      memcpy(out.data + headerBytes - (size_t)sent, buf, (size_t)numBytes);
+    }
+    else
+      memcpy(out.data, (uint8_t*)buf + (sent - headerBytes), out.numBytes);
+    q->pending.push_back(out);
+    q->numPendingBytes += out.numBytes;
+
+#ifdef PROXY_USE_EPOLL
+    // Do not let a client that is not reading its replies pile up unbounded amounts of memory. The event loop
+    // flushes the queue when the socket becomes writable, and wakes us up once it has drained enough. Waiting
+    // releases q->lock, so the event loop is never held up by a slow client.
+    while(q->numPendingBytes > MAX_QUEUED_SEND_BYTES && !q->failed)
+      WAIT_CONDITION(&q->drained, &q->lock);
+#endif
+  }
+  UNLOCK_MUTEX(&q->lock);
+  ReleaseSendQueue(q);
 }
 
 #define MUSL_PF_UNSPEC       0
@@ -849,6 +1066,11 @@ void Shutdown(int client_fd, uint8_t *data, uint64_t numBytes) // int shutdown(i
     {
       // Proxy client performed bidirectional close, mark this socket as being disconnected, and disallow it
       // from accessing this socket again - this close()s the socket.
+#ifdef PROXY_USE_EPOLL
+      // Any recv()s or accept()s still waiting on the socket now complete immediately, so finish them before the fd
+      // is closed and possibly reused.
+      WakeSocketWaiters(d->socket);
+#endif
       CloseSocketByConnection(client_fd, d->socket);
     }
   }
@@ -907,6 +1129,46 @@ void Bind(int client_fd, uint8_t *data, uint64_t numBytes) // int bind(int socke
   SendWebSocketMessage(client_fd, &r, sizeof(r));
 }
 
+static void SendConnectResult(int client_fd, int callId, int ret, int errorCode)
+{
+  struct {
+    int callId;
+    int ret;
+    int errno_;
+  } r;
+  r.callId = callId;
+  r.ret = ret;
+  r.errno_ = errorCode;
+  SendWebSocketMessage(client_fd, &r, sizeof(r));
+}
+
+#ifdef PROXY_USE_EPOLL
+struct PendingConnect
+{
+  int client_fd;
+  int callId;
+  SOCKET_T socket;
+};
+
+// Completes a blocking connect() that was started as a non-blocking one in Connect(), once the socket is writable.
+static void FinishConnect(void *arg)
+{
+  PendingConnect *c = (PendingConnect*)arg;
+  int errorCode = 0;
+  socklen_t errorCodeLen = sizeof(errorCode);
+  if (getsockopt(c->socket, SOL_SOCKET, SO_ERROR, &errorCode, &errorCodeLen) != 0)
+    errorCode = GET_SOCKET_ERROR();
+  int flags = fcntl(c->socket, F_GETFL);
+  if (flags >= 0) fcntl(c->socket, F_SETFL, flags & ~O_NONBLOCK);
+#ifdef POSIX_SOCKET_DEBUG
+  printf("connect(socket=%d) completed asynchronously->%d\n", c->socket, errorCode ? -1 : 0);
+  if (errorCode) PRINT_SOCKET_ERROR(errorCode);
+#endif
+  SendConnectResult(c->client_fd, c->callId, errorCode ? -1 : 0, errorCode);
+  free(c);
+}
+#endif
+
 void Connect(int client_fd, uint8_t *data, uint64_t numBytes) // int connect(int socket, const struct sockaddr *address, socklen_t address_len);
 {
   struct MSG {
@@ -923,11 +1185,40 @@ void Connect(int client_fd, uint8_t *data, uint64_t numBytes) // int connect(int
 
   if (IsSocketPartOfConnection(client_fd, d->socket))
   {
+#ifdef PROXY_USE_EPOLL
+    // Issue a blocking connect() as a non-blocking one, and reply once the connection completes, so that connecting
+    // to a slow host does not hold up a worker thread.
+    int flags = (d->socket != 0) ? fcntl(d->socket, F_GETFL) : -1;
+    bool blockingSocket = flags >= 0 && !(flags & O_NONBLOCK);
+    if (blockingSocket) fcntl(d->socket, F_SETFL, flags | O_NONBLOCK);
+#endif
     ret = connect(d->socket, (sockaddr*)d->address, actualAddressLen);
     errorCode = (ret != 0) ? GET_SOCKET_ERROR() : 0;
 #ifdef POSIX_SOCKET_DEBUG
     printf("connect(socket=%d,address=%p,address_len=%d, address=\"%s\")->%d\n", d->socket, d->address, d->address_len, BufferToString(d->address, actualAddressLen), ret);
     if (errorCode) PRINT_SOCKET_ERROR(errorCode);
+#endif
+#ifdef PROXY_USE_EPOLL
+    if (blockingSocket)
+    {
+      if (errorCode == EINPROGRESS)
+      {
+        PendingConnect *c = (PendingConnect*)malloc(sizeof(PendingConnect));
+        c->client_fd = client_fd;
+        c->callId = d->header.callId;
+        c->socket = d->socket;
+        if (!RunWhenSocketReady(client_fd, d->socket, true, FinishConnect, c))
+        {
+          // Could not wait asynchronously, so wait for the connection in this thread instead.
+          pollfd pfd = { d->socket, POLLOUT, 0 };
+          poll(&pfd, 1, -1);
+          FinishConnect(c);
+        }
+        return;
+      }
+      fcntl(d->socket, F_SETFL, flags);
+      errno = errorCode;
+    }
 #endif
   }
   else
@@ -936,15 +1227,7 @@ void Connect(int client_fd, uint8_t *data, uint64_t numBytes) // int connect(int
     ret = errorCode = -1;
   }
 
-  struct {
-    int callId;
-    int ret;
-    int errno_;
-  } r;
-  r.callId = d->header.callId;
-  r.ret = ret;
-  r.errno_ = (ret != 0) ? errno : 0;
-  SendWebSocketMessage(client_fd, &r, sizeof(r));
+  SendConnectResult(client_fd, d->header.callId, ret, (ret != 0) ? errno : 0);
 }
 
 void Listen(int client_fd, uint8_t *data, uint64_t numBytes) // int listen(int socket, int backlog);
@@ -1547,7 +1830,7 @@ void Getaddrinfo(int client_fd, uint8_t *data, uint64_t numBytes) // int getaddr
   r->callId = d->header.callId;
   r->ret = ret;
   r->errno_ = errorCode;
-  strncpy(r->ai_canonname, ai_canonname, MAX_NODE_LEN-1);
+  memcpy(r->ai_canonname, ai_canonname, MAX_NODE_LEN); // Null-terminated, since at most MAX_NODE_LEN-1 bytes were copied in.
   r->addrCount = addrCount;
 
   addrinfo *ai = res;
@@ -1576,21 +1859,22 @@ void Getnameinfo(int client_fd, uint8_t *data, uint64_t numBytes) // int getname
   fprintf(stderr, "TODO getnameinfo() unimplemented!\n");
 }
 
-static void *memdup(const void *ptr, size_t sz)
-{
-  if (!ptr) return 0;
-  void *dup = malloc(sz);
-  if (dup) memcpy(dup, ptr, sz);
-  return dup;
-}
-
 struct MessageArg
 {
   int client_fd;
-  uint8_t *payload;
   uint64_t numBytes;
+  uint8_t payload[];
 };
 
+static MessageArg *CreateMessageArg(int client_fd, uint8_t *payload, uint64_t numBytes)
+{
+  MessageArg *arg = (MessageArg*)malloc(sizeof(MessageArg) + (size_t)numBytes);
+  arg->client_fd = client_fd;
+  arg->numBytes = numBytes;
+  memcpy(arg->payload, payload, (size_t)numBytes);
+  return arg;
+}
+
 void ProcessWebSocketMessageSynchronouslyInCurrentThread(int client_fd, uint8_t *payload, uint64_t numBytes);
 
 THREAD_RETURN_T message_processing_thread(void *arg)
@@ -1599,22 +1883,55 @@ THREAD_RETURN_T message_processing_thread(void *arg)
   assert(msg);
   assert(msg->client_fd);
   ProcessWebSocketMessageSynchronouslyInCurrentThread(msg->client_fd, msg->payload, msg->numBytes);
-  free(msg->payload);
   free(msg);
   EXIT_THREAD(0);
 }
 
+#ifdef PROXY_USE_EPOLL
+static void RunQueuedMessage(void *arg)
+{
+  MessageArg *msg = (MessageArg*)arg;
+  ProcessWebSocketMessageSynchronouslyInCurrentThread(msg->client_fd, msg->payload, msg->numBytes);
+  free(msg);
+}
+
+// Returns true if the given recv()/recvfrom()/accept() call would block waiting for the proxied socket to become readable.
+static bool SocketCallWouldBlock(int client_fd, uint8_t *payload, uint64_t numBytes, SOCKET_T *socket)
+{
+  struct MSG {
+    SocketCallHeader header;
+    int socket;
+    uint32_t length_or_address_len;
+    int flags;
+  };
+  MSG *d = (MSG*)payload;
+
+  if (numBytes < sizeof(SocketCallHeader) + sizeof(int)) return false;
+  *socket = d->socket;
+  if (d->socket == 0 || !IsSocketPartOfConnection(client_fd, d->socket)) return false; // Fails immediately
+
+  if (d->header.function != POSIX_SOCKET_MSG_ACCEPT)
+  {
+    if (numBytes < sizeof(MSG) || (d->flags & MSG_DONTWAIT)) return false;
+  }
+  int flags = fcntl(d->socket, F_GETFL);
+  if (flags < 0 || (flags & O_NONBLOCK)) return false;
+
+  pollfd pfd = { d->socket, POLLIN, 0 };
+  return poll(&pfd, 1, 0) == 0;
+}
+#endif
+
 // Offloads the processing of the given message to a background thread.
 void ProcessWebSocketMessageAsynchronouslyInBackgroundThread(int client_fd, uint8_t *payload, uint64_t numBytes)
 {
-  MessageArg *arg = (MessageArg*)malloc(sizeof(MessageArg));
-  arg->client_fd = client_fd;
-  arg->payload = (uint8_t*)memdup(payload, (size_t)numBytes);
-  arg->numBytes = numBytes;
+  MessageArg *arg = CreateMessageArg(client_fd, payload, numBytes);
+#ifdef PROXY_USE_EPOLL
+  QueueWork(RunQueuedMessage, arg);
+#else
   THREAD_T thread;
-  // TODO: Instead of unconditionally always creating a thread here, create a thread pool and push messages to it.
-  // (leaving this as a future optimization because not sure if it matters here much at all for performance)
 	CREATE_THREAD(thread, message_processing_thread, arg);
+#endif
 }
 
 void ProcessWebSocketMessageSynchronouslyInCurrentThread(int client_fd, uint8_t *payload, uint64_t numBytes)
@@ -1656,6 +1973,23 @@ void ProcessWebSocketMessage(int client_fd, uint8_t *payload, uint64_t numBytes)
     return;
   }
   SocketCallHeader *header = (SocketCallHeader*)payload;
+#ifdef PROXY_USE_EPOLL
+  // Messages of a single proxy connection are processed in order in a worker thread. Calls that would block waiting
+  // for incoming data or connections are deferred until the proxied socket becomes readable, so that they neither
+  // stall the following messages nor tie up a worker thread. (connect() is made non-blocking in Connect() itself)
+  SOCKET_T socket;
+  if ((header->function == POSIX_SOCKET_MSG_RECV || header->function == POSIX_SOCKET_MSG_RECVFROM || header->function == POSIX_SOCKET_MSG_ACCEPT)
+    && SocketCallWouldBlock(client_fd, payload, numBytes, &socket))
+  {
+    MessageArg *arg = CreateMessageArg(client_fd, payload, numBytes);
+    if (!RunWhenSocketReady(client_fd, socket, false, RunQueuedMessage, arg))
+      QueueWork(RunQueuedMessage, arg); // The socket can't be waited on, so just block in a worker.
+  }
+  else
+  {
+    ProcessWebSocketMessageSynchronouslyInCurrentThread(client_fd, payload, numBytes);
+  }
+#else
   if (header->function == POSIX_SOCKET_MSG_RECV || header->function == POSIX_SOCKET_MSG_RECVFROM || header->function == POSIX_SOCKET_MSG_RECVMSG || header->function == POSIX_SOCKET_MSG_CONNECT || header->function == POSIX_SOCKET_MSG_LISTEN)
   {
     // Synchonous/blocking recv()s can halt indefinitely until a message is actually received. An application might
@@ -1668,4 +2002,5 @@ void ProcessWebSocketMessage(int client_fd, uint8_t *payload, uint64_t numBytes)
   {
     ProcessWebSocketMessageSynchronouslyInCurrentThread(client_fd, payload, numBytes);
   }
+#endif
 }
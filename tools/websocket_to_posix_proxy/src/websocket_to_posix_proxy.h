@@ -1,13 +1,43 @@
 #pragma once
 
 #include <stdint.h>
+#include "posix_sockets.h"
+
+// On Linux, client connections are served from a single epoll event loop, and proxied socket calls run on a fixed
+// pool of worker threads. Other platforms use one thread per client connection.
+#if defined(__linux__)
+#define PROXY_USE_EPOLL
+#endif
 
 uint64_t ntoh64(uint64_t x);
 #define hton64 ntoh64
 
-void WebSocketMessageUnmaskPayload(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey);
 void ProcessWebSocketMessage(int client_fd, uint8_t *payload, uint64_t numBytes);
 
+// Each WebSocket client connection has its own queue for outgoing messages that the client socket could not accept
+// right away. The queue must be created when the connection opens, and destroyed before its fd is closed.
+void CreateWebSocketSendQueue(int client_fd);
+void DestroyWebSocketSendQueue(int client_fd);
+
+// Writes out queued outgoing messages once the client socket has become writable again.
+void FlushWebSocketSendQueue(int client_fd);
+
+// Drops the queued outgoing messages of a connection that is being closed, and releases the threads waiting for the
+// queue to drain. Nothing is sent to the connection after this.
+void AbortWebSocketSendQueue(int client_fd);
+
+#ifdef PROXY_USE_EPOLL
+// Calls callback(arg) on a worker thread once the given proxied socket becomes readable (or writable, if waitForWrite
+// is true), so that calls that would block do not hold up a thread while they wait. Calls waiting on the same socket
+// run one at a time, in the order they were made, each once the socket is ready again. If the proxy connection closes
+// first, the callback is never called, and arg is free()d instead. Returns false if the socket could not be waited on,
+// in which case the caller retains ownership of arg.
+bool RunWhenSocketReady(int client_fd, SOCKET_T socket, bool waitForWrite, void (*callback)(void *arg), void *arg);
+
+// Immediately runs all calls waiting on the given proxied socket, e.g. because the socket is about to be closed.
+void WakeSocketWaiters(SOCKET_T socket);
+#endif
+
 #ifdef _MSC_VER
 #pragma pack(push,1)
 #endif
@@ -0,0 +1,156 @@
+#include "websocket_unmask.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define UNMASK_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only allow using the intrinsics of instruction sets that are enabled for the function they are used in.
+#if defined(UNMASK_X86) && defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+// Unmasks eight bytes at a time, and the remaining tail one byte at a time. The SIMD versions below finish off with
+// this, which keeps the key in phase since they always consume a multiple of four bytes first.
+static void UnmaskScalar(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey) // thread-safe, re-entrant
+{
+  uint64_t maskingKey64 = ((uint64_t)maskingKey << 32) | maskingKey;
+  uint8_t *data = payload;
+  uint8_t *end = payload + payloadLength;
+
+  while(end - data >= 8)
+  {
+    uint64_t v;
+    memcpy(&v, data, 8); // memcpy compiles to a single unaligned load
+    v ^= maskingKey64;
+    memcpy(data, &v, 8);
+    data += 8;
+  }
+
+  uint8_t maskingKey8[4];
+  memcpy(maskingKey8, &maskingKey, 4);
+  for(int i = 0; data < end; ++i)
+    *data++ ^= maskingKey8[i & 3];
+}
+
+#ifdef UNMASK_X86
+TARGET_SSE2 static void UnmaskSSE2(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey) // thread-safe, re-entrant
+{
+  __m128i key = _mm_set1_epi32((int)maskingKey);
+  uint8_t *data = payload;
+  uint8_t *end = payload + payloadLength;
+
+  while(end - data >= 64)
+  {
+    __m128i a = _mm_loadu_si128((__m128i*)data);
+    __m128i b = _mm_loadu_si128((__m128i*)(data + 16));
+    __m128i c = _mm_loadu_si128((__m128i*)(data + 32));
+    __m128i d = _mm_loadu_si128((__m128i*)(data + 48));
+    _mm_storeu_si128((__m128i*)data, _mm_xor_si128(a, key));
+    _mm_storeu_si128((__m128i*)(data + 16), _mm_xor_si128(b, key));
+    _mm_storeu_si128((__m128i*)(data + 32), _mm_xor_si128(c, key));
+    _mm_storeu_si128((__m128i*)(data + 48), _mm_xor_si128(d, key));
+    data += 64;
+  }
+  while(end - data >= 16)
+  {
+    _mm_storeu_si128((__m128i*)data, _mm_xor_si128(_mm_loadu_si128((__m128i*)data), key));
+    data += 16;
+  }
+  UnmaskScalar(data, (uint64_t)(end - data), maskingKey);
+}
+
+TARGET_AVX2 static void UnmaskAVX2(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey) // thread-safe, re-entrant
+{
+  __m256i key = _mm256_set1_epi32((int)maskingKey);
+  uint8_t *data = payload;
+  uint8_t *end = payload + payloadLength;
+
+  while(end - data >= 128)
+  {
+    __m256i a = _mm256_loadu_si256((__m256i*)data);
+    __m256i b = _mm256_loadu_si256((__m256i*)(data + 32));
+    __m256i c = _mm256_loadu_si256((__m256i*)(data + 64));
+    __m256i d = _mm256_loadu_si256((__m256i*)(data + 96));
+    _mm256_storeu_si256((__m256i*)data, _mm256_xor_si256(a, key));
+    _mm256_storeu_si256((__m256i*)(data + 32), _mm256_xor_si256(b, key));
+    _mm256_storeu_si256((__m256i*)(data + 64), _mm256_xor_si256(c, key));
+    _mm256_storeu_si256((__m256i*)(data + 96), _mm256_xor_si256(d, key));
+    data += 128;
+  }
+  while(end - data >= 32)
+  {
+    _mm256_storeu_si256((__m256i*)data, _mm256_xor_si256(_mm256_loadu_si256((__m256i*)data), key));
+    data += 32;
+  }
+  // Avoid the AVX-SSE transition penalty in the caller.
+  _mm256_zeroupper();
+  UnmaskScalar(data, (uint64_t)(end - data), maskingKey);
+}
+
+static bool CpuSupportsSSE2()
+{
+#if defined(_M_X64) || defined(__x86_64__)
+  return true; // Part of the x86-64 baseline
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+#else
+  __builtin_cpu_init(); // May run from a static initializer, before the CPU model has been initialized
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+
+static bool CpuSupportsAVX2()
+{
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6; // OSXSAVE, and XMM+YMM state enabled
+  __cpuidex(info, 7, 0);
+  return osSavesYmm && (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+int GetWebSocketUnmaskImplementations(WebSocketUnmaskFunc *funcs, const char **names, int maxCount)
+{
+  int count = 0;
+  if (count < maxCount) { funcs[count] = UnmaskScalar; names[count] = "scalar"; ++count; }
+#ifdef UNMASK_X86
+  if (count < maxCount && CpuSupportsSSE2()) { funcs[count] = UnmaskSSE2; names[count] = "SSE2"; ++count; }
+  if (count < maxCount && CpuSupportsAVX2()) { funcs[count] = UnmaskAVX2; names[count] = "AVX2"; ++count; }
+#endif
+  return count;
+}
+
+static WebSocketUnmaskFunc SelectUnmaskImplementation()
+{
+  WebSocketUnmaskFunc funcs[8];
+  const char *names[8];
+  int count = GetWebSocketUnmaskImplementations(funcs, names, 8);
+  return funcs[count-1];
+}
+
+// Chosen once at startup, before any threads are launched.
+static WebSocketUnmaskFunc unmaskPayload = SelectUnmaskImplementation();
+
+void WebSocketMessageUnmaskPayload(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey) // thread-safe, re-entrant
+{
+  unmaskPayload(payload, payloadLength, maskingKey);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdint.h>
+
+// WebSocket clients XOR every payload byte with a 4-byte masking key. Unmasking is applied to all data that is
+// proxied from the client, so besides the portable implementation there are SIMD versions of it, one of which
+// is picked at startup based on what the CPU supports.
+
+typedef void (*WebSocketUnmaskFunc)(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey);
+
+// Unmasks the payload in place, using the fastest implementation supported by the CPU. (thread-safe, re-entrant)
+void WebSocketMessageUnmaskPayload(uint8_t *payload, uint64_t payloadLength, uint32_t maskingKey);
+
+// The individual implementations, for testing and benchmarking. Returns the number of implementations supported by
+// the current CPU, and fills the given arrays with their functions and names, fastest last.
+int GetWebSocketUnmaskImplementations(WebSocketUnmaskFunc *funcs, const char **names, int maxCount);
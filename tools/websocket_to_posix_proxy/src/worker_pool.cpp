@@ -0,0 +1,57 @@
+#include "worker_pool.h"
+#include "threads.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+
+namespace
+{
+	struct WorkItem
+	{
+		void (*func)(void *arg);
+		void *arg;
+	};
+
+	MUTEX_T workQueueLock;
+	CONDITION_T workAvailable;
+	std::deque<WorkItem> workQueue;
+}
+
+static THREAD_RETURN_T worker_thread(void *)
+{
+	for(;;)
+	{
+		LOCK_MUTEX(&workQueueLock);
+		while(workQueue.empty())
+			WAIT_CONDITION(&workAvailable, &workQueueLock);
+		WorkItem work = workQueue.front();
+		workQueue.pop_front();
+		UNLOCK_MUTEX(&workQueueLock);
+
+		work.func(work.arg);
+	}
+	EXIT_THREAD(0);
+}
+
+void StartWorkerPool(int numThreads)
+{
+	CREATE_MUTEX(&workQueueLock);
+	CREATE_CONDITION(&workAvailable);
+	for(int i = 0; i < numThreads; ++i)
+	{
+		THREAD_T thread;
+		CREATE_THREAD_RETURN_T ret = CREATE_THREAD(thread, worker_thread, 0);
+		if (!CREATE_THREAD_SUCCEEDED(ret))
+			fprintf(stderr, "Failed to create worker thread %d/%d!\n", i+1, numThreads);
+	}
+}
+
+void QueueWork(void (*func)(void *arg), void *arg)
+{
+	WorkItem work = { func, arg };
+	LOCK_MUTEX(&workQueueLock);
+	workQueue.push_back(work);
+	UNLOCK_MUTEX(&workQueueLock);
+	SIGNAL_CONDITION(&workAvailable);
+}
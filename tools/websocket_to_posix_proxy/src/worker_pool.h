@@ -0,0 +1,11 @@
+#pragma once
+
+// Worker Pool runs queued work items on a fixed set of long-lived threads, so that processing proxied socket calls
+// does not need to create a new OS thread for each call.
+
+// Launches the given number of worker threads. Must be called once before any work is queued.
+void StartWorkerPool(int numThreads);
+
+// Queues func(arg) to be run on one of the worker threads. Work items are started in the order they are queued, but
+// since several workers run concurrently, they may finish in any order.
+void QueueWork(void (*func)(void *arg), void *arg);